@@ -0,0 +1,223 @@
+#include "address_dict.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*!
+ * @brief hash_address computes the FNV-1a hash of an address
+ * @param address the address (not necessarily null terminated)
+ * @param length the length of the address
+ * @return the hash
+ */
+static uint32_t hash_address(const char *address, size_t length) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; ++i){
+        hash ^= (uint8_t)address[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*!
+ * @brief address_dict_init initializes an empty dictionary (memory is allocated at the first insertion)
+ * @param dict the dictionary to initialize
+ */
+void address_dict_init(address_dict_t *dict) {
+    if(dict == NULL) return;
+    memset(dict, 0, sizeof(address_dict_t));
+}
+
+/*!
+ * @brief address_dict_free frees all the memory of a dictionary, leaving it empty
+ * @param dict the dictionary to free
+ */
+void address_dict_free(address_dict_t *dict) {
+    if(dict == NULL) return;
+    free(dict->offsets);
+    free(dict->hashes);
+    free(dict->slots);
+    free(dict->strings);
+    address_dict_init(dict);
+}
+
+/*!
+ * @brief grow_slots doubles the hash table of a dictionary and inserts all IDs again
+ * @param dict the dictionary
+ * @return true on success, false if allocation failed (the dictionary is left unchanged)
+ */
+static bool grow_slots(address_dict_t *dict) {
+    uint32_t slots_count = (dict->slots_count == 0) ? 2 * ADDRESS_DICT_INITIAL_CAPACITY : 2 * dict->slots_count;
+    uint32_t *slots = calloc(slots_count, sizeof(uint32_t));
+    if(slots == NULL) return false;
+    for(uint32_t id = 0; id < dict->count; ++id){
+        uint32_t slot = dict->hashes[id] & (slots_count - 1);
+        while(slots[slot] != 0) slot = (slot + 1) & (slots_count - 1);
+        slots[slot] = id + 1;
+    }
+    free(dict->slots);
+    dict->slots = slots;
+    dict->slots_count = slots_count;
+    return true;
+}
+
+/*!
+ * @brief reserve_address makes room in a dictionary for a new address
+ * @param dict the dictionary
+ * @param length the length of the new address
+ * @return true on success, false if allocation failed
+ */
+static bool reserve_address(address_dict_t *dict, size_t length) {
+    if(dict->count == dict->capacity){
+        uint32_t capacity = (dict->capacity == 0) ? ADDRESS_DICT_INITIAL_CAPACITY : 2 * dict->capacity;
+        uint32_t *offsets = realloc(dict->offsets, capacity * sizeof(uint32_t));
+        if(offsets == NULL) return false;
+        dict->offsets = offsets;
+        uint32_t *hashes = realloc(dict->hashes, capacity * sizeof(uint32_t));
+        if(hashes == NULL) return false;
+        dict->hashes = hashes;
+        dict->capacity = capacity;
+    }
+    if(dict->strings_size + length + 1 > dict->strings_capacity){
+        size_t strings_capacity = (dict->strings_capacity == 0) ? 32 * ADDRESS_DICT_INITIAL_CAPACITY
+                                                                : 2 * dict->strings_capacity;
+        while(dict->strings_size + length + 1 > strings_capacity) strings_capacity *= 2;
+        char *strings = realloc(dict->strings, strings_capacity);
+        if(strings == NULL) return false;
+        dict->strings = strings;
+        dict->strings_capacity = strings_capacity;
+    }
+    // Keep the table at most half full
+    if(2 * (dict->count + 1) > dict->slots_count) return grow_slots(dict);
+    return true;
+}
+
+/*!
+ * @brief find_address looks for an address in the hash table of a dictionary
+ * @param dict the dictionary
+ * @param address the address (not necessarily null terminated)
+ * @param length the length of the address
+ * @param hash the hash of the address
+ * @return the ID of the address, ADDRESS_DICT_INVALID_ID if it is not in the dictionary
+ */
+static uint32_t find_address(address_dict_t *dict, const char *address, size_t length, uint32_t hash) {
+    if(dict->slots_count == 0) return ADDRESS_DICT_INVALID_ID;
+    uint32_t slot = hash & (dict->slots_count - 1);
+    while(dict->slots[slot] != 0){
+        uint32_t id = dict->slots[slot] - 1;
+        const char *known = dict->strings + dict->offsets[id];
+        if(dict->hashes[id] == hash && strncmp(known, address, length) == 0 && known[length] == '\0') return id;
+        slot = (slot + 1) & (dict->slots_count - 1);
+    }
+    return ADDRESS_DICT_INVALID_ID;
+}
+
+/*!
+ * @brief address_dict_find returns the ID of an address, without adding it to the dictionary
+ * @param dict the dictionary
+ * @param address the address (not necessarily null terminated)
+ * @param length the length of the address
+ * @return the ID of the address, ADDRESS_DICT_INVALID_ID if it is not in the dictionary
+ */
+uint32_t address_dict_find(address_dict_t *dict, const char *address, size_t length) {
+    if(dict == NULL || address == NULL) return ADDRESS_DICT_INVALID_ID;
+    return find_address(dict, address, length, hash_address(address, length));
+}
+
+/*!
+ * @brief address_dict_intern returns the ID of an address, adding the address to the dictionary if it is not known yet
+ * @param dict the dictionary
+ * @param address the address (not necessarily null terminated)
+ * @param length the length of the address
+ * @param is_new if not NULL, set to true if the address was added, false if it was already known
+ * @return the ID of the address, ADDRESS_DICT_INVALID_ID if it could not be added
+ */
+uint32_t address_dict_intern(address_dict_t *dict, const char *address, size_t length, bool *is_new) {
+    if(is_new != NULL) *is_new = false;
+    if(dict == NULL || address == NULL) return ADDRESS_DICT_INVALID_ID;
+    uint32_t hash = hash_address(address, length);
+    uint32_t known_id = find_address(dict, address, length, hash);
+    if(known_id != ADDRESS_DICT_INVALID_ID) return known_id;
+
+    if(!reserve_address(dict, length)) return ADDRESS_DICT_INVALID_ID;
+    uint32_t id = dict->count++;
+    dict->offsets[id] = dict->strings_size;
+    dict->hashes[id] = hash;
+    memcpy(dict->strings + dict->strings_size, address, length);
+    dict->strings[dict->strings_size + length] = '\0';
+    dict->strings_size += length + 1;
+    uint32_t slot = hash & (dict->slots_count - 1);
+    while(dict->slots[slot] != 0) slot = (slot + 1) & (dict->slots_count - 1);
+    dict->slots[slot] = id + 1;
+    if(is_new != NULL) *is_new = true;
+    return id;
+}
+
+/*!
+ * @brief address_dict_get returns the address of an ID. The pointer is only valid until the next insertion.
+ * @param dict the dictionary
+ * @param id the ID of the address
+ * @return the null terminated address, NULL if the ID is unknown
+ */
+const char *address_dict_get(address_dict_t *dict, uint32_t id) {
+    if(dict == NULL || id >= dict->count) return NULL;
+    return dict->strings + dict->offsets[id];
+}
+
+/*!
+ * @brief address_dict_load adds the addresses of a dictionary file (one address per line, the line number being the
+ * ID the address had when the file was written) to a dictionary. A missing file is an empty dictionary.
+ * @param dict the dictionary to add the addresses to
+ * @param path the path to the dictionary file
+ * @param ids if not NULL, set to a malloc'd array giving the ID in dict of each line of the file (to be freed)
+ * @param ids_count if not NULL, set to the number of lines of the file
+ * @return true on success, false on error
+ */
+bool address_dict_load(address_dict_t *dict, char *path, uint32_t **ids, uint32_t *ids_count) {
+    if(ids != NULL) *ids = NULL;
+    if(ids_count != NULL) *ids_count = 0;
+    if(dict == NULL || path == NULL) return false;
+    FILE *dict_file = fopen(path, "r");
+    if(dict_file == NULL){
+        if(errno == ENOENT) return true;
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", path, strerror(errno));
+        return false;
+    }
+
+    uint32_t count = 0, capacity = 0;
+    uint32_t *lines_ids = NULL;
+    bool success = true;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t line_length;
+    while((line_length = getline(&line, &line_size, dict_file)) != -1){
+        if(line_length > 0 && line[line_length - 1] == '\n') --line_length;
+        uint32_t id = address_dict_intern(dict, line, line_length, NULL);
+        if(id == ADDRESS_DICT_INVALID_ID){
+            success = false;
+            break;
+        }
+        if(ids == NULL){
+            ++count;
+            continue;
+        }
+        if(count == capacity){
+            capacity = (capacity == 0) ? ADDRESS_DICT_INITIAL_CAPACITY : 2 * capacity;
+            uint32_t *new_ids = realloc(lines_ids, capacity * sizeof(uint32_t));
+            if(new_ids == NULL){
+                success = false;
+                break;
+            }
+            lines_ids = new_ids;
+        }
+        lines_ids[count++] = id;
+    }
+    if(!success) fprintf(stderr, "[ERROR] Could not load %s : out of memory\n", path);
+    free(line);
+    fclose(dict_file);
+
+    if(ids != NULL) *ids = lines_ids;
+    if(ids_count != NULL) *ids_count = count;
+    return success;
+}
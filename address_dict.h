@@ -0,0 +1,32 @@
+#ifndef A2022_ADDRESS_DICT_H
+#define A2022_ADDRESS_DICT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADDRESS_DICT_INITIAL_CAPACITY 1024
+// Returned by address_dict_intern when the address could not be added
+#define ADDRESS_DICT_INVALID_ID UINT32_MAX
+
+// Maps each distinct e-mail address to a dense ID (0, 1, 2... in order of insertion) and back
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;      // Capacity of offsets and hashes (in addresses)
+    uint32_t *offsets;      // Offset of each address in strings, by ID
+    uint32_t *hashes;       // Hash of each address, by ID (kept for rehashing)
+    uint32_t *slots;        // Open addressing table of ID + 1 (0 is an empty slot)
+    uint32_t slots_count;   // Always a power of 2, at least twice count
+    char *strings;          // Null terminated addresses, one after the other
+    size_t strings_size;
+    size_t strings_capacity;
+} address_dict_t;
+
+void address_dict_init(address_dict_t *dict);
+void address_dict_free(address_dict_t *dict);
+uint32_t address_dict_intern(address_dict_t *dict, const char *address, size_t length, bool *is_new);
+uint32_t address_dict_find(address_dict_t *dict, const char *address, size_t length);
+const char *address_dict_get(address_dict_t *dict, uint32_t id);
+bool address_dict_load(address_dict_t *dict, char *path, uint32_t **ids, uint32_t *ids_count);
+
+#endif //A2022_ADDRESS_DICT_H
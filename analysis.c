@@ -12,250 +12,795 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <stdlib.h>
-#include <sys/file.h>
 #include <errno.h>
+#include <malloc.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "utility.h"
+#include "mail_scanner.h"
+#include "arena.h"
+#include "address_dict.h"
+#include "mail_reader.h"
+#include "dir_walker.h"
+#include "step2_combiner.h"
+#include "approx_summary.h"
 
 /*!
- * @brief parse_dir parses a directory to find all files in it and its subdirs (recursive analysis of root directory)
+ * @brief parse_dir parses a directory to find all files in it and its subdirs (iterative analysis of root directory)
  * All files must be output with their full path into the output file.
  * @param path the path to the object directory
  * @param output_file a pointer to an already opened file
+ * Uses walk_directory: large trees are split between several threads.
  */
 void parse_dir(char *path, FILE *output_file){
     // 1. Check parameters
-    if (output_file == NULL || !directory_exists(path)) return;
+    if (output_file == NULL || path == NULL) return;
 
-    // 2. Go through all entries: if file, write it to the output file; if a dir, call parse dir on it
-    DIR *dir = opendir(path);
-    if(dir == NULL){
-        fprintf(stderr, "Could not open the directory %s : %s", path, strerror(errno));
-        return;
+    // 2. Go through all entries: files are written to the output file, subdirectories are queued
+    if(!walk_directory(path, output_file)){
+        fprintf(stderr, "[ERROR] Could not list all the files of %s\n", path);
     }
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL){
-        if (entry->d_type == DT_DIR && (strcmp(entry->d_name, ".") != 0) && (strcmp(entry->d_name, "..") != 0)){
-            char next_dir_name[STR_MAX_LEN] = "";
-            concat_path(path, entry->d_name, next_dir_name);
-            parse_dir(next_dir_name, output_file);
-        }
-        else if (entry->d_type != DT_DIR){
-            char file_path[STR_MAX_LEN] = "";
-            concat_path(path, entry->d_name, file_path);
-            fprintf(output_file, "%s\n", file_path);
-        }
+// Arena holding the recipients (spans and IDs) of the e-mail being parsed, reset after each e-mail (one per worker)
+static arena_t parse_arena = {NULL, NULL};
+
+#define HEADER_READ_SIZE 4096
+
+// Reusable header buffer, kept for the whole life of the worker process
+static char *header_buffer = NULL;
+static size_t header_buffer_size = 0;
+
+/*!
+ * @brief find_headers_end looks for the blank line ending the headers of an e-mail
+ * @param buffer the buffer holding the beginning of the e-mail
+ * @param from the offset from which to look for the blank line (previous bytes were already checked)
+ * @param length the number of valid bytes in buffer
+ * @return the length of the headers (blank line excluded), 0 if the blank line was not found yet
+ */
+size_t find_headers_end(char *buffer, size_t from, size_t length) {
+    char *cur = buffer + from;
+    char *end = buffer + length;
+    while((cur = memchr(cur, '\n', end - cur)) != NULL){
+        ++cur;
+        if(cur < end && *cur == '\n') return cur - buffer;
+        if(cur + 1 < end && cur[0] == '\r' && cur[1] == '\n') return cur - buffer;
     }
-    // 3. Clear all allocated resources
-    closedir(dir);
+    return 0;
 }
 
 /*!
- * @brief clear_recipient_list clears all recipients in a recipients list
- * @param list the list to be cleared
+ * @brief read_mail_headers reads the headers of an e-mail into a reusable buffer, with bounded preads. The buffer is
+ * only grown if the blank line ending the headers was not found in what was already read.
+ * @param fd the file descriptor of the opened e-mail
+ * @param buffer a pointer to the reusable buffer (may be reallocated)
+ * @param buffer_size a pointer to the size of the reusable buffer (updated if the buffer is grown)
+ * @return the length of the headers in the buffer, -1 on error
  */
-void clear_recipient_list(simple_recipient_t *list){
-    if(list == NULL) return;
-    simple_recipient_t *next;
-    while (list != NULL){
-        next = list->next;
-        free(list);
-        list = next;
+ssize_t read_mail_headers(int fd, char **buffer, size_t *buffer_size) {
+    if(buffer == NULL || buffer_size == NULL) return -1;
+    size_t length = 0;
+    size_t headers_length = 0;
+    while(headers_length == 0){
+        if(*buffer == NULL || length == *buffer_size){
+            size_t new_size = (*buffer_size == 0) ? HEADER_READ_SIZE : 2 * (*buffer_size);
+            char *new_buffer = realloc(*buffer, new_size);
+            if(new_buffer == NULL) return -1;
+            *buffer = new_buffer;
+            *buffer_size = new_size;
+        }
+        ssize_t read_bytes = pread(fd, *buffer + length, *buffer_size - length, length);
+        if(read_bytes < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        // Whole file read without a blank line: it is made of headers only
+        if(read_bytes == 0) return length;
+        // Go back 2 bytes so that a terminator split between two reads is found
+        size_t from = (length > 2) ? length - 2 : 0;
+        length += read_bytes;
+        headers_length = find_headers_end(*buffer, from, length);
     }
+    return headers_length;
 }
 
+// Header fields looked for in the e-mails
+typedef enum { FIELD_OTHER, FIELD_FROM, FIELD_TO, FIELD_CC, FIELD_BCC, FIELDS_COUNT } header_field_t;
+
+/*
+ * Header names are recognized case insensitively by a state machine reading one character at a time. Each state is a
+ * prefix of "From", "To", "Cc" or "Bcc": any character that does not extend the prefix leads to NAME_OTHER.
+ */
+typedef enum {
+    NAME_OTHER, NAME_START, NAME_F, NAME_FR, NAME_FRO, NAME_FROM, NAME_T, NAME_TO, NAME_C, NAME_CC, NAME_B, NAME_BC,
+    NAME_BCC, NAME_STATES_COUNT
+} name_state_t;
+typedef enum {
+    NAME_CHAR_OTHER, NAME_CHAR_F, NAME_CHAR_R, NAME_CHAR_O, NAME_CHAR_M, NAME_CHAR_T, NAME_CHAR_C, NAME_CHAR_B,
+    NAME_CHAR_COLON, NAME_CHARS_COUNT
+} name_char_t;
+
+static const uint8_t name_chars[256] = {
+    ['F'] = NAME_CHAR_F, ['f'] = NAME_CHAR_F, ['R'] = NAME_CHAR_R, ['r'] = NAME_CHAR_R,
+    ['O'] = NAME_CHAR_O, ['o'] = NAME_CHAR_O, ['M'] = NAME_CHAR_M, ['m'] = NAME_CHAR_M,
+    ['T'] = NAME_CHAR_T, ['t'] = NAME_CHAR_T, ['C'] = NAME_CHAR_C, ['c'] = NAME_CHAR_C,
+    ['B'] = NAME_CHAR_B, ['b'] = NAME_CHAR_B, [':'] = NAME_CHAR_COLON,
+};
+
+static const uint8_t name_transitions[NAME_STATES_COUNT][NAME_CHARS_COUNT] = {
+    [NAME_START] = {[NAME_CHAR_F] = NAME_F, [NAME_CHAR_T] = NAME_T, [NAME_CHAR_C] = NAME_C, [NAME_CHAR_B] = NAME_B},
+    [NAME_F] = {[NAME_CHAR_R] = NAME_FR},
+    [NAME_FR] = {[NAME_CHAR_O] = NAME_FRO},
+    [NAME_FRO] = {[NAME_CHAR_M] = NAME_FROM},
+    [NAME_T] = {[NAME_CHAR_O] = NAME_TO},
+    [NAME_C] = {[NAME_CHAR_C] = NAME_CC},
+    [NAME_B] = {[NAME_CHAR_C] = NAME_BC},
+    [NAME_BC] = {[NAME_CHAR_C] = NAME_BCC},
+};
+
+// The field named by each state, when the name is followed by ':'
+static const uint8_t name_fields[NAME_STATES_COUNT] = {
+    [NAME_FROM] = FIELD_FROM, [NAME_TO] = FIELD_TO, [NAME_CC] = FIELD_CC, [NAME_BCC] = FIELD_BCC,
+};
+
 /*!
- * @brief add_recipient_to_list adds a recipient to a recipients list (as a pointer to a recipient)
- * @param recipient_email the string containing the e-mail to add
- * @param list the list to add the e-mail to
- * @return a pointer to the new recipient (to update the list with)
+ * @brief read_field_name recognizes the name of the header field starting at the current offset
+ * @param headers the headers buffer
+ * @param headers_length the length of the headers
+ * @param cur a pointer to the current offset, moved after the ':' ending the name (or to the first character that is
+ * not part of a known name)
+ * @return the field, FIELD_OTHER if it is not one of From, To, Cc and Bcc
  */
-simple_recipient_t *add_recipient_to_list(char *recipient_email, simple_recipient_t *list){
-    if(recipient_email == NULL) return list;   
-    simple_recipient_t *new_recipient = malloc(sizeof(simple_recipient_t));
-    if(new_recipient == NULL) return list;
-    strcpy(new_recipient->email, recipient_email);
-    new_recipient->next = list;
-    return new_recipient;
+header_field_t read_field_name(char *headers, size_t headers_length, size_t *cur) {
+    uint8_t state = NAME_START;
+    while(*cur < headers_length){
+        uint8_t name_char = name_chars[(uint8_t)headers[*cur]];
+        if(name_char == NAME_CHAR_COLON){
+            ++(*cur);
+            return name_fields[state];
+        }
+        state = name_transitions[state][name_char];
+        if(state == NAME_OTHER) return FIELD_OTHER;
+        ++(*cur);
+    }
+    return FIELD_OTHER;
 }
 
-bool is_mail(char *mail){
-    bool is_mail = false;
-    uint32_t cur = 0;
-    uint32_t mail_len = strlen(mail);
-    for(; mail[cur] != '@' && cur < mail_len; ++cur)   if(mail[cur] == '\0') return false;
-    for(; mail[cur] != '\0' && cur < mail_len; ++cur)  if(mail[cur] == '.') is_mail = true;
-    return is_mail;
+/*!
+ * @brief skip_header_field moves to the end of the current header field, continuation lines (starting with a space or
+ * a tab) included
+ * @param headers the headers buffer
+ * @param headers_length the length of the headers
+ * @param cur the current offset, in the field
+ * @return the offset of the beginning of the next field
+ */
+size_t skip_header_field(char *headers, size_t headers_length, size_t cur) {
+    char *line_end;
+    while((line_end = memchr(headers + cur, '\n', headers_length - cur)) != NULL){
+        cur = line_end - headers + 1;
+        if(cur >= headers_length || (headers[cur] != ' ' && headers[cur] != '\t')) return cur;
+    }
+    return headers_length;
 }
 
 /*!
- * @brief extract_emails extracts all the e-mails from a buffer and put the e-mails into a recipients list
- * @param buffer the buffer containing one or more e-mails
- * @param list the resulting list
- * @return the updated list
+ * @brief parse_mail_headers finds the sender and the recipients of an e-mail in a single pass over its headers. Field
+ * names are recognized by a state machine, then the values of the first From, To, Cc and Bcc fields are scanned for
+ * e-mail addresses up to the end of the field (folded lines and CRLF/LF line breaks included). Other fields are
+ * skipped, and parsing stops once the four fields are found.
+ * @param headers the headers buffer
+ * @param headers_length the length of the headers
+ * @param sender a pointer to the span of the sender (the first address of the From field), of length 0 if none
+ * @param recipients the array receiving the spans of the recipients (To, Cc and Bcc addresses)
+ * @param max_recipients the capacity of recipients, extra addresses are ignored
+ * @return the count of recipients found
  */
-simple_recipient_t *extract_emails(char *buffer, simple_recipient_t *list){
-    // 1. Check parameters
-    if(buffer == NULL)return list;
-    // 2. Go through buffer and extract e-mails
-    uint16_t cur = 0;
-
-    uint32_t buffer_len = strlen(buffer);
-    if(buffer[cur] != '\t') for(; buffer[cur] != ' ' && cur < buffer_len; ++cur);
-    ++cur;
-
-    //Initialize the variables for loop
-    char mail[STR_MAX_LEN] = "";
-    uint16_t mail_index = 0;
-
-    for (; cur < buffer_len ; ++cur){
-        // 3. Add each e-mail to list
-        if (buffer[cur] == ','){
-            //terminate the mail with '\0'
-            mail[mail_index + 1] = '\0';
-            if(is_mail(mail))   list = add_recipient_to_list(mail, list);
-
-            //Empty the string
-            memset(mail, 0, STR_MAX_LEN);
-            mail_index = 0;
-            ++cur;
+size_t parse_mail_headers(char *headers, size_t headers_length, mail_span_t *sender, mail_span_t *recipients,
+                          size_t max_recipients) {
+    bool field_found[FIELDS_COUNT] = {false};
+    size_t fields_to_find = FIELDS_COUNT - 1;
+    size_t recipients_count = 0;
+    size_t cur = 0;
+    sender->length = 0;
+    while(cur < headers_length && fields_to_find > 0){
+        header_field_t field = read_field_name(headers, headers_length, &cur);
+        if(field == FIELD_OTHER || field_found[field]){
+            cur = skip_header_field(headers, headers_length, cur);
+            continue;
         }
-        else if (buffer[cur + 1] == '\0')
-        {
-            mail[mail_index] = buffer[cur];
-            mail[mail_index + 1] = '\0';
-
-            if(is_mail(mail))   list = add_recipient_to_list(mail, list);
+        field_found[field] = true;
+        --fields_to_find;
 
-            memset(mail, 0, STR_MAX_LEN);
-            mail_index = 0;
-            ++cur;
-        }
-        else{
-            mail[mail_index] = buffer[cur];
-            ++mail_index;
+        size_t field_length;
+        if(field == FIELD_FROM){
+            if(scan_mail_field(headers + cur, headers_length - cur, sender, 1, &field_length) == 1){
+                sender->offset += cur;
+            }
+        }else{
+            size_t count = scan_mail_field(headers + cur, headers_length - cur, recipients + recipients_count,
+                                           max_recipients - recipients_count, &field_length);
+            for(size_t i = 0; i < count; ++i) recipients[recipients_count + i].offset += cur;
+            recipients_count += count;
         }
+        cur += field_length;
     }
-    // 4. Return list
-    return list;
+    return recipients_count;
 }
 
+// Directories of the run, opened by the parent process before creating the workers (NULL if not set)
+static run_context_t *run_context = NULL;
+
+// Reader of the e-mails of the worker process, created at the first range of files
+static mail_reader_t mail_reader;
+static bool mail_reader_ready = false;
+
+// Files of the worker for one partition of the records, named <prefix><worker_id>.<partition>
+typedef struct {
+    FILE *shard;                // step2_output
+    address_dict_t addresses;   // Addresses met in the records of the partition
+    FILE *dict;                 // step2_dict: the addresses, written as they get an ID
+    FILE *keys;                 // step2_keys: keys of the e-mails parsed
+    FILE *hits;                 // step2_hits: entries of the mail cache of the partition found (e-mails not parsed)
+    step2_combiner_t combiner;  // Records not written yet, when the worker combines them
+} step2_partition_t;
+
+// Output shards of the worker process, kept open for the whole files phase
+static uint16_t worker_id = 0;
+static step2_partition_t step2_partitions[STEP2_PARTITIONS_COUNT];
+static char *step2_shards_buffer = NULL;
+static step2_format_t step2_format = STEP2_FORMAT_BINARY;
+// Commits of the tasks done by the worker (step2_commit.<worker_id>), opened after the shards
+static FILE *step2_commits = NULL;
+// Caches of the previous run (one per partition), mapped by the parent process (NULL if all the e-mails are parsed)
+static mail_cache_t *mail_caches = NULL;
+// When records are combined, the tasks done are committed once their records are written (@see commit_step2_task)
+static bool is_step2_combined = false;
+static uint32_t *pending_tasks = NULL;
+static uint32_t pending_tasks_count = 0;
+static uint32_t pending_tasks_capacity = 0;
+// A full combiner was written during the pending tasks: they are committed at the end of the current task
+static bool is_combiner_flushed = false;
+// In approximate mode, the pairs are added to the worker's summary, written to approx_summary.<worker_id> when the
+// worker ends its files step (no shard is written, and no task committed)
+static bool is_approximate_mode = false;
+static approx_summary_t approx_summary;
+static bool is_summary_ready = false;
+static char approx_summary_path[STR_MAX_LEN] = "";
+
 /*!
- * @brief extract_e_mail extracts an e-mail from a buffer
- * @param buffer the buffer containing the e-mail
- * @param destination the buffer into which the e-mail is copied
+ * @brief set_run_context sets the directories of the run: e-mails and temporary files are then opened relative to
+ * them, without checking the directories again for each e-mail
+ * @param context the context of the run, which must stay valid while files are processed
  */
-void extract_e_mail(char buffer[], char destination[]) {
-    uint32_t offset = 0;
-    while(buffer[offset] != ' ' && buffer[offset] != '\0') ++offset;
-    ++offset;
-    if(is_mail(buffer+offset))  strcpy(destination, buffer+offset);
+void set_run_context(run_context_t *context) {
+    run_context = context;
 }
 
-// char* get_line(char* file, off_t file_len, off_t* cur, char* line){
-//     for(off_t offset = 0; file[*cur] != '\n' && file[*cur-1] != '\r' && file[*cur] != 0 && *cur <= file_len; ++offset, ++(*cur)){
-//         line[offset] = file[*cur];
-//     }
-//     return line;
+/*!
+ * @brief set_mail_caches sets the caches of the previous run: the e-mails found in them are not parsed again
+ * @param caches the caches of the STEP2_PARTITIONS_COUNT partitions, which must stay mapped while files are processed
+ */
+void set_mail_caches(mail_cache_t *caches) {
+    mail_caches = caches;
+}
 
-//     // for(off_t offset = 0; cur <= file_len; ++offset, ++cur){
-//     //     if(file[cur] == '\n' || file[cur-1] == '\r' || file[cur] == 0)
-//     // }
-// }
+/*!
+ * @brief set_worker_id sets the number of the worker running in the current process, used to name its output shards
+ * @param id the worker number (between 0 and the number of processes - 1)
+ */
+void set_worker_id(uint16_t id) {
+    worker_id = id;
+}
 
-// Used to track status in e-mail (for multi lines To, Cc, and Bcc fields)
-typedef enum { IN_DEST_FIELD, OUT_OF_DEST_FIELD } read_status_t;
+/*!
+ * @brief set_step2_format sets the format of the shards written by the workers (to be called before they are created)
+ * @param format STEP2_FORMAT_BINARY, or STEP2_FORMAT_TEXT for debugging
+ */
+void set_step2_format(step2_format_t format) {
+    step2_format = format;
+}
 
 /*!
- * @brief parse_file parses mail file at filepath location and writes the result to
- * file whose location is on path output
- * @param filepath name of the e-mail file to analyze
- * @param output path to output file
- * Uses previous utility functions: extract_email, extract_emails, add_recipient_to_list,
- * and clear_recipient_list
+ * @brief set_step2_combiner sets whether the workers combine their records (@see step2_combiner.h) or write a record
+ * per e-mail (to be called before the shards are created). Combined records can not be cached: the mail cache must
+ * not be used.
+ * @param is_combined true to combine the records
  */
-void parse_file(char *filepath, char *output){
-    // 1. Check parameters
-    if (!(path_to_file_exists(filepath) && directory_exists(output))) return;
+void set_step2_combiner(bool is_combined) {
+    is_step2_combined = is_combined;
+}
 
-    FILE *email = fopen(filepath, "r");
-    if(email == NULL){
-        fprintf(stderr, "[ERROR]Could not open %s : %s\n", filepath, strerror(errno));
-        return ;
+/*!
+ * @brief set_approximate_mode sets whether the workers add the pairs of their e-mails to a summary instead of writing
+ * shards (to be called before they are created). Summaries can not be cached nor resumed: the mail cache must not be
+ * used.
+ * @param is_approximate true for the approximate mode
+ */
+void set_approximate_mode(bool is_approximate) {
+    is_approximate_mode = is_approximate;
+}
+
+/*!
+ * @brief worker_file_path gives the path of a file of the worker
+ * @param temp_files the temporary files directory
+ * @param name_format the format of the file name, with the worker number (and the partition, if it is partitioned)
+ * @param partition the partition of the file
+ * @param file_path the path to fill
+ */
+static void worker_file_path(char *temp_files, char *name_format, uint32_t partition, char *file_path) {
+    char file_name[STR_MAX_LEN] = "";
+    snprintf(file_name, STR_MAX_LEN, name_format, worker_id, partition);
+    concat_path(temp_files, file_name, file_path);
+}
+
+/*!
+ * @brief open_worker_file opens (in append mode) a file of the worker named after its number
+ * @param temp_files the temporary files directory, where the file is created
+ * @param name_format the format of the file name, with the worker number (and the partition, if it is partitioned)
+ * @param partition the partition of the file
+ * @return the file stream, NULL if it could not be opened
+ */
+static FILE *open_worker_file(char *temp_files, char *name_format, uint32_t partition) {
+    char file_path[STR_MAX_LEN] = "";
+    worker_file_path(temp_files, name_format, partition, file_path);
+    FILE *worker_file = fopen(file_path, "a");
+    if(worker_file == NULL) fprintf(stderr, "[ERROR] Could not open %s : %s\n", file_path, strerror(errno));
+    return worker_file;
+}
+
+/*!
+ * @brief close_step2_files closes the files of the worker that are opened
+ */
+static void close_step2_files() {
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        step2_partition_t *partition = &step2_partitions[p];
+        FILE **step2_files[] = {&partition->dict, &partition->shard, &partition->keys, &partition->hits};
+        for(size_t i = 0; i < sizeof(step2_files) / sizeof(step2_files[0]); ++i){
+            if(*step2_files[i] != NULL) fclose(*step2_files[i]);
+            *step2_files[i] = NULL;
+        }
+        address_dict_free(&partition->addresses);
+        step2_combiner_free(&partition->combiner);
     }
+    free(pending_tasks);
+    pending_tasks = NULL;
+    pending_tasks_count = 0;
+    pending_tasks_capacity = 0;
+    is_combiner_flushed = false;
+    if(step2_commits != NULL) fclose(step2_commits);
+    step2_commits = NULL;
+    free(step2_shards_buffer);
+    step2_shards_buffer = NULL;
+}
 
-    char email_line[STR_MAX_LEN] = "";
-    char sender[STR_MAX_LEN] = "";
-    bool state = OUT_OF_DEST_FIELD;
-    bool from_extracted = false;
-    bool to_extracted = false;
-    bool cc_extracted = false;
-    bool bcc_extracted = false;
-    simple_recipient_t *recipients_list = NULL;
-    while(fgets(email_line, STR_MAX_LEN, email) != NULL){
-        //Get rid of the new line char at the end
-        email_line[strlen(email_line) - 2] = '\0';
-        // 2. Go through e-mail and extract From: address into a buffer
-        if(!from_extracted && strncmp(email_line, "From:", 5) == 0){
-            from_extracted = true;
-            extract_e_mail(email_line ,sender);
+/*!
+ * @brief open_step2_partition opens the files of the worker for a partition (in append mode)
+ * @param temp_files the temporary files directory, where the files are created
+ * @param p the partition
+ * @return true on success, false if a file could not be opened
+ */
+static bool open_step2_partition(char *temp_files, uint32_t p) {
+    step2_partition_t *partition = &step2_partitions[p];
+    char dict_path[STR_MAX_LEN] = "";
+    worker_file_path(temp_files, STEP2_DICT_FORMAT, p, dict_path);
+    // A previous process with the same worker number may have written IDs already: they are kept
+    address_dict_init(&partition->addresses);
+    step2_combiner_init(&partition->combiner);
+    if(!address_dict_load(&partition->addresses, dict_path, NULL, NULL)) return false;
+    // The keys follow the records of the shard, and are kept with the hits for the mail cache of the next run
+    if((partition->dict = open_worker_file(temp_files, STEP2_DICT_FORMAT, p)) == NULL ||
+       (partition->shard = open_worker_file(temp_files, STEP2_SHARD_FORMAT, p)) == NULL ||
+       (partition->keys = open_worker_file(temp_files, STEP2_KEYS_FORMAT, p)) == NULL ||
+       (partition->hits = open_worker_file(temp_files, STEP2_HITS_FORMAT, p)) == NULL){
+        return false;
+    }
+    // Records are only written by large blocks
+    size_t buffer_size = STEP2_SHARD_BUFFER_SIZE / STEP2_PARTITIONS_COUNT;
+    if(step2_shards_buffer != NULL){
+        setvbuf(partition->shard, step2_shards_buffer + p * buffer_size, _IOFBF, buffer_size);
+    }
+    // The header is written by the first process using the shard
+    struct stat shard_stat;
+    if(step2_format == STEP2_FORMAT_BINARY && fstat(fileno(partition->shard), &shard_stat) == 0 &&
+       shard_stat.st_size == 0){
+        write_step2_header(partition->shard, is_step2_combined);
+    }
+    return true;
+}
+
+/*!
+ * @brief open_step2_shards opens the output shards of the worker, one per partition, with their files (at first use)
+ * @param temp_files the temporary files directory, where the shards are created
+ * @return true on success, false if they could not be opened
+ */
+bool open_step2_shards(char *temp_files) {
+    if(step2_commits != NULL) return true;
+    step2_shards_buffer = malloc(STEP2_SHARD_BUFFER_SIZE);
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        if(!open_step2_partition(temp_files, p)){
+            close_step2_files();
+            return false;
+        }
+    }
+    if((step2_commits = open_worker_file(temp_files, STEP2_COMMIT_FORMAT, 0)) == NULL){
+        close_step2_files();
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief flush_step2_shards writes the buffered records of the worker's shards (and those of its combiners), if they
+ * are opened
+ * @return true on success, false if a file could not be written
+ */
+bool flush_step2_shards() {
+    if(step2_commits == NULL) return true;
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        step2_partition_t *partition = &step2_partitions[p];
+        if(!step2_combiner_flush(&partition->combiner, partition->shard, step2_format)){
+            fprintf(stderr, "[ERROR] Could not write step2 shard %u.%u : %s\n", worker_id, p, strerror(errno));
+            return false;
         }
-        else if(!to_extracted && strncmp(email_line, "To:", 3) == 0){
-            state = IN_DEST_FIELD;
-            to_extracted = true;
+        // The dictionary goes first, so that the shard never holds an ID missing from it
+        if(fflush(partition->dict) != 0){
+            fprintf(stderr, "[ERROR] Could not write step2 dictionary %u.%u : %s\n", worker_id, p, strerror(errno));
+            return false;
         }
-        else if(!cc_extracted && strncmp(email_line, "Cc:", 3) == 0){
-            state = IN_DEST_FIELD;
-            cc_extracted = true;
+        if(fflush(partition->shard) != 0){
+            fprintf(stderr, "[ERROR] Could not write step2 shard %u.%u : %s\n", worker_id, p, strerror(errno));
+            return false;
         }
-        else if(!bcc_extracted && strncmp(email_line, "Bcc:", 4) == 0){
-            state = IN_DEST_FIELD;
-            bcc_extracted = true;
+        if(fflush(partition->keys) != 0 || fflush(partition->hits) != 0){
+            fprintf(stderr, "[ERROR] Could not write step2 keys %u.%u : %s\n", worker_id, p, strerror(errno));
+            return false;
         }
-        else if(email_line[0] != '\t' && state == IN_DEST_FIELD){
-            state = OUT_OF_DEST_FIELD;
+    }
+    return true;
+}
+
+/*!
+ * @brief commit_step2_tasks writes the results of the worker, then commits tasks with the sizes of its files
+ * @param task_ids the IDs of the tasks in the tasks log
+ * @param count the count of tasks
+ */
+static void commit_step2_tasks(uint32_t *task_ids, uint32_t count) {
+    if(!flush_step2_shards()) return;
+    uint64_t sizes[STEP2_FILES_COUNT];
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        step2_partition_t *partition = &step2_partitions[p];
+        FILE *step2_files[STEP2_PARTITION_FILES_COUNT] = {partition->dict, partition->shard, partition->keys,
+                                                          partition->hits};
+        for(size_t i = 0; i < STEP2_PARTITION_FILES_COUNT; ++i){
+            struct stat file_stat;
+            if(fstat(fileno(step2_files[i]), &file_stat) != 0) return;
+            sizes[p * STEP2_PARTITION_FILES_COUNT + i] = file_stat.st_size;
         }
-        if(state == IN_DEST_FIELD){
-            recipients_list = extract_emails(email_line, recipients_list);
+    }
+    for(uint32_t i = 0; i < count; ++i){
+        if(!write_commit_record(step2_commits, task_ids[i], sizes)){
+            fprintf(stderr, "[ERROR] Could not commit task %u of worker %u : %s\n", task_ids[i], worker_id,
+                    strerror(errno));
+            return;
         }
-        if(to_extracted && from_extracted && cc_extracted && bcc_extracted) break;
     }
-    fclose(email);
-    char output_file_path[STR_MAX_LEN] = "";
-    concat_path(output, "step2_output", output_file_path);
+}
+
+/*!
+ * @brief commit_pending_tasks writes the records left in the combiners, then commits the tasks they belong to
+ */
+static void commit_pending_tasks() {
+    if(pending_tasks_count > 0) commit_step2_tasks(pending_tasks, pending_tasks_count);
+    pending_tasks_count = 0;
+    is_combiner_flushed = false;
+}
 
-    FILE *step2_output = fopen(output_file_path, "a");
-    if(step2_output == NULL){
-        fprintf(stderr, "[ERROR] Could not open %s : %s\n", output_file_path, strerror(errno));
-        clear_recipient_list(recipients_list);
+/*!
+ * @brief add_pending_task adds a task to those whose records are still in the combiners
+ * @param task_id the ID of the task
+ * @return true on success, false if allocation failed
+ */
+static bool add_pending_task(uint32_t task_id) {
+    if(pending_tasks_count == pending_tasks_capacity){
+        uint32_t capacity = (pending_tasks_capacity == 0) ? 64 : 2 * pending_tasks_capacity;
+        uint32_t *tasks = realloc(pending_tasks, capacity * sizeof(uint32_t));
+        if(tasks == NULL) return false;
+        pending_tasks = tasks;
+        pending_tasks_capacity = capacity;
+    }
+    pending_tasks[pending_tasks_count++] = task_id;
+    return true;
+}
+
+/*!
+ * @brief add_approx_pairs adds the (sender, recipient) pairs of an e-mail to the worker's summary, created with the
+ * first e-mail
+ * @param headers the headers of the e-mail
+ * @param sender the sender in the headers
+ * @param recipients the recipients in the headers
+ * @param recipients_count the count of recipients
+ * @param output path to the temporary files directory, where the summary is written
+ */
+static void add_approx_pairs(char *headers, mail_span_t *sender, mail_span_t *recipients, size_t recipients_count,
+                             char *output) {
+    if(!is_summary_ready){
+        if(!approx_summary_init(&approx_summary)){
+            fprintf(stderr, "[ERROR] Could not allocate the summary of worker %u\n", worker_id);
+            return;
+        }
+        worker_file_path(output, APPROX_SUMMARY_FORMAT, 0, approx_summary_path);
+        is_summary_ready = true;
+    }
+    for(size_t i = 0; i < recipients_count; ++i){
+        approx_summary_add(&approx_summary, headers + sender->offset, sender->length, headers + recipients[i].offset,
+                           recipients[i].length);
+    }
+}
+
+/*!
+ * @brief write_approx_summary appends the worker's summary to its approx_summary file, then frees it
+ */
+static void write_approx_summary() {
+    if(!is_summary_ready) return;
+    FILE *summary_file = fopen(approx_summary_path, "a");
+    if(summary_file == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", approx_summary_path, strerror(errno));
+    }else{
+        bool is_written = approx_summary_write(&approx_summary, summary_file);
+        if(fclose(summary_file) != 0) is_written = false;
+        if(!is_written) fprintf(stderr, "[ERROR] Could not write %s\n", approx_summary_path);
+    }
+    approx_summary_free(&approx_summary);
+    is_summary_ready = false;
+}
+
+/*!
+ * @brief commit_step2_task writes the results of a task, then commits them with the sizes of the worker's files, so
+ * that they are kept if the run is interrupted and resumed (@see checkpoint.h)
+ * When records are combined, those of the task may still be in the combiners: the task is only committed, with the
+ * tasks before it, once all their records are written, that is at the end of a task during which a combiner was full,
+ * or at the end of the files step (@see process_files_end). Until then, resuming the run does them again.
+ * @param task_id the ID of the task in the tasks log
+ * @param temp_files the temporary files directory
+ */
+void commit_step2_task(uint32_t task_id, char *temp_files) {
+    // Summaries are only written at the end of the files step
+    if(is_approximate_mode || !open_step2_shards(temp_files)) return;
+    if(!is_step2_combined){
+        commit_step2_tasks(&task_id, 1);
+        return;
+    }
+    bool is_pending = add_pending_task(task_id);
+    if(is_pending && !is_combiner_flushed) return;
+    commit_pending_tasks();
+    if(!is_pending) commit_step2_tasks(&task_id, 1);
+}
+
+/*!
+ * @brief close_step2_shards flushes and closes the worker's shards (and releases its mail reader), to be called at the
+ * end of the files step or before the worker exits. The tasks whose records were still in the combiners are committed,
+ * and the summary of the approximate mode is written.
+ */
+void close_step2_shards() {
+    if(mail_reader_ready){
+        mail_reader_close(&mail_reader);
+        mail_reader_ready = false;
+    }
+    write_approx_summary();
+    if(step2_commits == NULL) return;
+    commit_pending_tasks();
+    close_step2_files();
+}
+
+/*!
+ * @brief remove_step2_shards removes the step2_output shards, their dictionaries and their keys, the cache hits and
+ * the summaries of the approximate mode left by a previous run (workers append to them)
+ * @param temp_files the temporary files directory
+ */
+void remove_step2_shards(char *temp_files) {
+    remove_files_with_prefix(temp_files, STEP2_SHARD_PREFIX);
+    remove_files_with_prefix(temp_files, STEP2_DICT_PREFIX);
+    remove_files_with_prefix(temp_files, STEP2_KEYS_PREFIX);
+    remove_files_with_prefix(temp_files, STEP2_HITS_PREFIX);
+    remove_files_with_prefix(temp_files, APPROX_SUMMARY_PREFIX);
+}
+
+/*!
+ * @brief skip_cached_mail looks for an e-mail in the caches of the previous run. A cached e-mail is not parsed again:
+ * its cache entry is written to the worker's hits of the partition instead, its record being already counted in the
+ * cache.
+ * @param directory_fd the directory the path is relative to (AT_FDCWD for the current directory)
+ * @param path the path to the e-mail
+ * @param output path to the temporary files directory
+ * @return true if the e-mail is cached (it must be skipped), false if it must be parsed
+ */
+bool skip_cached_mail(int directory_fd, char *path, char *output) {
+    if(mail_caches == NULL) return false;
+    bool has_entries = false;
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT && !has_entries; ++p) has_entries = mail_caches[p].entries_count > 0;
+    if(!has_entries) return false;
+    struct stat mail_stat;
+    if(fstatat(directory_fd, path, &mail_stat, 0) != 0) return false;
+    mail_key_t key;
+    mail_key_from_stat(&mail_stat, &key);
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        uint32_t index = mail_cache_find(&mail_caches[p], &key);
+        if(index == MAIL_CACHE_MISS) continue;
+        if(!open_step2_shards(output)) return false;
+        return fwrite(&index, sizeof(uint32_t), 1, step2_partitions[p].hits) == 1;
+    }
+    return false;
+}
+
+/*!
+ * @brief write_mail_key writes the key of a parsed e-mail to the worker's keys, after its record if it has one
+ * @param partition the files of the partition of the e-mail
+ * @param key the key of the e-mail, NULL if it could not be read
+ * @param has_record true if a record of the e-mail was written to the shard
+ */
+static void write_mail_key(step2_partition_t *partition, mail_key_t *key, bool has_record) {
+    // An e-mail without key nor record leaves no trace
+    if(key == NULL && !has_record) return;
+    step2_key_t mail_key;
+    memset(&mail_key, 0, sizeof(step2_key_t));
+    if(key != NULL){
+        mail_key.key = *key;
+        mail_key.flags |= STEP2_KEY_IS_VALID;
+    }
+    if(has_record) mail_key.flags |= STEP2_KEY_HAS_RECORD;
+    fwrite(&mail_key, sizeof(step2_key_t), 1, partition->keys);
+}
+
+/*!
+ * @brief intern_address returns the worker's ID of an address in a partition, writing the address to the dictionary
+ * file of the partition when it is met for the first time
+ * @param partition the files of the partition
+ * @param address the address (not necessarily null terminated)
+ * @param length the length of the address
+ * @return the ID of the address, ADDRESS_DICT_INVALID_ID on error
+ */
+static uint32_t intern_address(step2_partition_t *partition, char *address, size_t length) {
+    bool is_new;
+    uint32_t id = address_dict_intern(&partition->addresses, address, length, &is_new);
+    if(is_new){
+        fwrite(address, 1, length, partition->dict);
+        fputc('\n', partition->dict);
+    }
+    return id;
+}
+
+/*!
+ * @brief parse_mail parses the headers of an e-mail and writes the result (as address IDs) to the worker's shard of
+ * step2_output for the partition of its sender, in the directory on path output
+ * @param headers the headers of the e-mail
+ * @param headers_length the length of the headers
+ * @param output path to the temporary files directory
+ * @param key the key of the e-mail for the mail cache, written after its record (NULL if it could not be read)
+ * When the worker combines its records, the record is added to the combiner of the partition instead, which is written
+ * to the shard once full.
+ * Uses parse_mail_headers: addresses are not copied, they are interned directly from the headers buffer. The arrays of
+ * the e-mail are allocated from the worker's arena, which is reset before returning.
+ * In approximate mode, the pairs of the e-mail are added to the worker's summary instead (@see add_approx_pairs).
+ */
+void parse_mail(char *headers, size_t headers_length, char *output, mail_key_t *key){
+    // 2. Find the sender and recipients (the shortest address, like "@.", is 2 characters long plus a separator)
+    mail_span_t sender;
+    size_t max_recipients = headers_length / 3 + 1;
+    mail_span_t *recipients = arena_alloc(&parse_arena, max_recipients * sizeof(mail_span_t));
+    uint32_t *recipients_ids = arena_alloc(&parse_arena, max_recipients * sizeof(uint32_t));
+    if(recipients == NULL || recipients_ids == NULL){
+        arena_reset(&parse_arena);
         return;
     }
-    int fd = fileno(step2_output);
-    // 4. Lock output file
-    while(flock(fd, LOCK_EX) < 0);
-
-    // 5. Write to output file according to project instructions
-    simple_recipient_t *list_start = recipients_list;
-    fwrite(sender, 1, strlen(sender), step2_output);
-    while(recipients_list != NULL){
-        fwrite(" ", 1, 1, step2_output);
-        fwrite(recipients_list->email,1, strlen(recipients_list->email), step2_output);
-        recipients_list = recipients_list->next;
-    }
-    fputs("\n", step2_output);
-    
-    // 6. Unlock file
-    if(flock(fd, LOCK_UN) < 0){
-        fclose(step2_output);
-        clear_recipient_list(list_start);
-        fprintf(stderr, "[ERROR] Could not unlock %s : %s\n", output_file_path, strerror(errno));
+    size_t recipients_count = parse_mail_headers(headers, headers_length, &sender, recipients, max_recipients);
+    if(is_approximate_mode){
+        if(sender.length > 0) add_approx_pairs(headers, &sender, recipients, recipients_count, output);
+        arena_reset(&parse_arena);
         return;
     }
-    // 7. Close file
-    fclose(step2_output);
-    // 8. Clear all allocated resources
-    clear_recipient_list(list_start);
+
+    // 3. Without a sender, the recipients can not be counted for anyone (only the key of the e-mail is written, to
+    // partition 0)
+    if((sender.length == 0 && key == NULL) || !open_step2_shards(output)){
+        arena_reset(&parse_arena);
+        return;
+    }
+    step2_partition_t *partition = &step2_partitions[0];
+    if(sender.length > 0) partition = &step2_partitions[step2_partition(headers + sender.offset, sender.length)];
+
+    // 4. Write the IDs of the sender and recipients to the worker's shard (no lock: the shard is not shared)
+    uint32_t sender_id = (sender.length == 0) ? ADDRESS_DICT_INVALID_ID
+                                              : intern_address(partition, headers + sender.offset, sender.length);
+    if(sender_id != ADDRESS_DICT_INVALID_ID){
+        uint32_t ids_count = 0;
+        for(size_t i = 0; i < recipients_count; ++i){
+            uint32_t recipient_id = intern_address(partition, headers + recipients[i].offset, recipients[i].length);
+            if(recipient_id != ADDRESS_DICT_INVALID_ID) recipients_ids[ids_count++] = recipient_id;
+        }
+        if(!is_step2_combined){
+            write_step2_record(partition->shard, step2_format, sender_id, recipients_ids, ids_count);
+        }else if(!step2_combiner_add(&partition->combiner, sender_id, recipients_ids, ids_count)){
+            write_step2_combined_record(partition->shard, step2_format, sender_id, 1, recipients_ids, NULL, ids_count);
+        }else if(step2_combiner_is_full(&partition->combiner)){
+            if(!step2_combiner_flush(&partition->combiner, partition->shard, step2_format)){
+                fprintf(stderr, "[ERROR] Could not write step2 shard %u.%u : %s\n", worker_id,
+                        (uint32_t)(partition - step2_partitions), strerror(errno));
+            }
+            is_combiner_flushed = true;
+        }
+    }
+    // Combined records are not cached: they have no key
+    if(!is_step2_combined) write_mail_key(partition, key, sender_id != ADDRESS_DICT_INVALID_ID);
+
+    // 5. Clear all allocated resources
+    arena_reset(&parse_arena);
+}
+
+/*!
+ * @brief parse_file parses mail file at filepath location and writes the result (as address IDs) to the worker's
+ * shard of step2_output, in the directory on path output
+ * @param filepath name of the e-mail file to analyze
+ * @param output path to the temporary files directory
+ * Uses parse_mail on the headers of the e-mail. With a run context, the directories are not checked again and the
+ * e-mail is opened relative to the data source directory.
+ */
+void parse_file(char *filepath, char *output){
+    // 1. Check parameters
+    if(filepath == NULL || output == NULL) return;
+    if (run_context == NULL && !(path_to_file_exists(filepath) && directory_exists(output))) return;
+
+    char *relative_path;
+    int directory_fd = resolve_data_path(run_context, filepath, &relative_path);
+    int email = openat(directory_fd, relative_path, O_RDONLY);
+    if(email < 0){
+        fprintf(stderr, "[ERROR]Could not open %s : %s\n", filepath, strerror(errno));
+        return ;
+    }
+    // Only the headers are read: parsing stops at the blank line ending them
+    ssize_t headers_length = read_mail_headers(email, &header_buffer, &header_buffer_size);
+    struct stat mail_stat;
+    mail_key_t key;
+    bool has_key = fstat(email, &mail_stat) == 0;
+    close(email);
+    if(headers_length < 0){
+        fprintf(stderr, "[ERROR] Could not read %s : %s\n", filepath, strerror(errno));
+        return;
+    }
+    if(has_key) mail_key_from_stat(&mail_stat, &key);
+    parse_mail(header_buffer, headers_length, output, has_key ? &key : NULL);
+}
+
+/*!
+ * @brief parse_read_mail parses an e-mail read by the worker's mail reader (@see mail_callback_t). The headers are
+ * usually in the bytes already read; longer headers are read again from the beginning of the e-mail.
+ * @param filepath path to the e-mail (relative to the data source with a run context)
+ * @param fd the opened e-mail
+ * @param data the beginning of the e-mail
+ * @param length the length of data
+ * @param output path to the temporary files directory
+ */
+void parse_read_mail(char *filepath, int fd, char *data, size_t length, void *output){
+    char *headers = data;
+    size_t headers_length = find_headers_end(data, 0, length);
+    if(headers_length == 0 && length < MAIL_READ_SIZE){
+        // Whole file read without a blank line: it is made of headers only
+        headers_length = length;
+    }else if(headers_length == 0){
+        ssize_t read_length = read_mail_headers(fd, &header_buffer, &header_buffer_size);
+        if(read_length < 0){
+            fprintf(stderr, "[ERROR] Could not read %s : %s\n", filepath, strerror(errno));
+            return;
+        }
+        headers = header_buffer;
+        headers_length = read_length;
+    }
+    // The key is read from the opened e-mail: it matches the content parsed
+    struct stat mail_stat;
+    mail_key_t key;
+    bool has_key = fstat(fd, &mail_stat) == 0;
+    if(has_key) mail_key_from_stat(&mail_stat, &key);
+    parse_mail(headers, headers_length, output, has_key ? &key : NULL);
 }
 
 /*!
@@ -301,4 +846,151 @@ void process_file(task_t *task){
     file_task_t *file_task = (file_task_t*)task;
     // 3. Call parse_file
     parse_file(file_task->object_file, file_task->temporary_directory);
+    flush_step2_shards();
+}
+
+/*!
+ * @brief process_file_range processes all the e-mail files of a range of step1_output
+ * @param task a file_range_task_t as a pointer to a task
+ * The files are read by batches with the worker's mail reader (io_uring, or a prefetch thread), and parsed as their
+ * reads complete. Uses parse_file on each file of the range if the mail reader can not be created.
+ * With a run context, step1_output and the files are opened relative to the directories of the run. The e-mails of
+ * the mail cache are skipped.
+ */
+void process_file_range(task_t *task){
+    // 1. Check parameters
+    if(task == NULL) return;
+    file_range_task_t *range_task = (file_range_task_t*)task;
+    if(range_task->end_offset <= range_task->start_offset) return;
+
+    // 2. Open the files list at the beginning of the range
+    char files_list_path[STR_MAX_LEN] = "";
+    concat_path(range_task->temporary_directory, "step1_output", files_list_path);
+    int files_list_fd = (run_context != NULL) ? open_temp_file(run_context, "step1_output", O_RDONLY)
+                                              : open(files_list_path, O_RDONLY);
+    FILE *files_list = (files_list_fd < 0) ? NULL : fdopen(files_list_fd, "r");
+    if(files_list == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", files_list_path, strerror(errno));
+        if(files_list_fd >= 0) close(files_list_fd);
+        return;
+    }
+    if(fseeko(files_list, range_task->start_offset, SEEK_SET) != 0){
+        fprintf(stderr, "[ERROR] Could not seek in %s : %s\n", files_list_path, strerror(errno));
+        fclose(files_list);
+        return;
+    }
+
+    // 3. Parse each file of the range, by batches
+    if(!mail_reader_ready) mail_reader_ready = mail_reader_init(&mail_reader);
+    char batch_paths[MAIL_BATCH_SIZE][STR_MAX_LEN];
+    char *batch[MAIL_BATCH_SIZE];
+    size_t batch_count = 0;
+    int batch_fd = AT_FDCWD;
+    bool end_of_range = false;
+    while(!end_of_range){
+        char *file_path = batch_paths[batch_count];
+        end_of_range = (uint64_t)ftello(files_list) >= range_task->end_offset ||
+                       fgets(file_path, STR_MAX_LEN, files_list) == NULL;
+        char *relative_path = file_path;
+        int directory_fd = batch_fd;
+        if(!end_of_range){
+            size_t length = strlen(file_path);
+            if(length > 0 && file_path[length - 1] == '\n') file_path[length - 1] = '\0';
+            if(file_path[0] == '\0') continue;
+            directory_fd = resolve_data_path(run_context, file_path, &relative_path);
+            if(skip_cached_mail(directory_fd, relative_path, range_task->temporary_directory)) continue;
+            if(!mail_reader_ready){
+                parse_file(file_path, range_task->temporary_directory);
+                continue;
+            }
+        }
+        // The paths of a batch are relative to the same directory: a file out of the data source ends the batch
+        if(batch_count > 0 && (end_of_range || directory_fd != batch_fd)){
+            mail_reader_read(&mail_reader, batch_fd, batch, batch_count, parse_read_mail,
+                             range_task->temporary_directory);
+            batch_count = 0;
+            if(!end_of_range){
+                size_t relative_offset = relative_path - file_path;
+                memmove(batch_paths[0], file_path, strlen(file_path) + 1);
+                relative_path = batch_paths[0] + relative_offset;
+            }
+        }
+        if(end_of_range) break;
+        batch_fd = directory_fd;
+        batch[batch_count++] = relative_path;
+        if(batch_count == MAIL_BATCH_SIZE){
+            mail_reader_read(&mail_reader, batch_fd, batch, batch_count, parse_read_mail,
+                             range_task->temporary_directory);
+            batch_count = 0;
+        }
+    }
+
+    // 4. Clear all allocated resources (the results of the range are written to the shard and committed at once)
+    fclose(files_list);
+    commit_step2_task(range_task->task_id, range_task->temporary_directory);
+}
+
+/*!
+ * @brief process_file_batch processes the e-mail files of a batch streamed from the directories walk
+ * @param task a file_batch_task_t as a pointer to a task
+ * The files are read by batches with the worker's mail reader, relative to the data source directory of the run
+ * context. Uses parse_file on each file of the batch if the mail reader can not be created. The e-mails of the mail
+ * cache are skipped.
+ */
+void process_file_batch(task_t *task){
+    // 1. Check parameters
+    if(task == NULL) return;
+    file_batch_task_t *batch_task = (file_batch_task_t*)task;
+    if(run_context == NULL){
+        fprintf(stderr, "[ERROR] Could not process a batch of files without a run context\n");
+        return;
+    }
+
+    // 2. Parse the files of the batch, MAIL_BATCH_SIZE files at a time
+    if(!mail_reader_ready) mail_reader_ready = mail_reader_init(&mail_reader);
+    char *batch[MAIL_BATCH_SIZE];
+    size_t batch_count = 0;
+    char *cur = batch_task->paths;
+    char *end = batch_task->paths + FILE_BATCH_PATHS_SIZE;
+    for(uint16_t i = 0; i < batch_task->files_count && cur < end; ++i){
+        char *file_path = cur;
+        cur += strnlen(cur, end - cur) + 1;
+        if(skip_cached_mail(run_context->data_fd, file_path, run_context->temp_path)) continue;
+        if(!mail_reader_ready){
+            char full_path[STR_MAX_LEN] = "";
+            concat_path(run_context->data_path, file_path, full_path);
+            parse_file(full_path, run_context->temp_path);
+            continue;
+        }
+        batch[batch_count++] = file_path;
+        if(batch_count == MAIL_BATCH_SIZE){
+            mail_reader_read(&mail_reader, run_context->data_fd, batch, batch_count, parse_read_mail,
+                             run_context->temp_path);
+            batch_count = 0;
+        }
+    }
+    if(batch_count > 0){
+        mail_reader_read(&mail_reader, run_context->data_fd, batch, batch_count, parse_read_mail,
+                         run_context->temp_path);
+    }
+
+    // 3. Write the results of the batch to the shard and commit them at once
+    commit_step2_task(batch_task->task_id, run_context->temp_path);
+}
+
+/*!
+ * @brief process_files_end ends the files step in a worker, before the partitions are reduced: the records left in its
+ * combiners are written, and the tasks they belong to committed (in approximate mode, its summary is written)
+ * The memory of the files step is then given back: the dictionaries of the shards hold every address the worker met,
+ * and would otherwise stay in the worker while it reduces partitions, beside the results of the partition.
+ * @param task the task (it has no parameter)
+ */
+void process_files_end(task_t *task){
+    if(task == NULL) return;
+    close_step2_shards();
+    arena_free(&parse_arena);
+    free(header_buffer);
+    header_buffer = NULL;
+    header_buffer_size = 0;
+    malloc_trim(0);
 }
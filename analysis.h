@@ -6,12 +6,38 @@
 #define A2022_ANALYSIS_H
 
 #include "global_defs.h"
+#include "step2_format.h"
+#include "run_context.h"
+#include "mail_cache.h"
+#include "checkpoint.h"
 #include <stdio.h>
 
-typedef struct _simple_recipient {
-    char email[STR_MAX_LEN];
-    struct _simple_recipient *next;
-} simple_recipient_t;
+// Each worker writes its results into its own shards of step2_output, one per partition of the senders (@see
+// step2_format.h), named after the worker number and the partition
+#define STEP2_SHARD_PREFIX "step2_output."
+#define STEP2_SHARD_FORMAT STEP2_SHARD_PREFIX "%u.%u"
+#define STEP2_SHARD_BUFFER_SIZE (1024 * 1024)
+// Shards hold address IDs: each worker also writes the dictionary of its IDs (line n is the address with ID n)
+#define STEP2_DICT_PREFIX "step2_dict."
+#define STEP2_DICT_FORMAT STEP2_DICT_PREFIX "%u.%u"
+// Keys of the e-mails parsed by each worker (step2_key_t), in the order of the records of its shard
+#define STEP2_KEYS_PREFIX "step2_keys."
+#define STEP2_KEYS_FORMAT STEP2_KEYS_PREFIX "%u.%u"
+// Entries of the mail cache of the partition found by each worker (uint32_t indexes): their e-mails were not parsed again
+#define STEP2_HITS_PREFIX "step2_hits."
+#define STEP2_HITS_FORMAT STEP2_HITS_PREFIX "%u.%u"
+// In approximate mode, each worker writes the summaries of its pairs instead of shards (@see approx_summary.h)
+#define APPROX_SUMMARY_PREFIX "approx_summary."
+#define APPROX_SUMMARY_FORMAT APPROX_SUMMARY_PREFIX "%u"
+
+#define STEP2_KEY_HAS_RECORD 0x1    // The e-mail has a record in the shard (it has a sender)
+#define STEP2_KEY_IS_VALID 0x2      // The key could be read (else the e-mail can not be cached)
+
+typedef struct {
+    mail_key_t key;
+    uint32_t flags;
+    uint32_t reserved;
+} step2_key_t;
 
 typedef struct {
     void (* task_callback)(task_t *);
@@ -25,10 +51,47 @@ typedef struct {
     char temporary_directory[STR_MAX_LEN];
 } file_task_t;
 
+// A range of lines of step1_output (from start_offset included to end_offset excluded), processed by one worker
+typedef struct {
+    void (* task_callback)(task_t *);
+    char temporary_directory[STR_MAX_LEN];
+    uint64_t start_offset;
+    uint64_t end_offset;
+    uint32_t task_id;           // ID in the tasks log (@see checkpoint.h)
+} file_range_task_t;
+
+// Files paths packed in a task (relative to the data source, '\0' terminated), when files are streamed from step 1
+#define FILE_BATCH_PATHS_SIZE (2 * STR_MAX_LEN - 8)
+
+typedef struct {
+    void (* task_callback)(task_t *);
+    uint32_t task_id;           // ID in the tasks log (@see checkpoint.h)
+    uint16_t files_count;
+    char paths[FILE_BATCH_PATHS_SIZE];
+} file_batch_task_t;
+
+_Static_assert(sizeof(file_batch_task_t) <= sizeof(task_t), "file_batch_task_t must fit in a task_t");
+
 void parse_dir(char *path, FILE *output_file);
 void parse_file(char *filepath, char *output);
 
+void set_run_context(run_context_t *context);
+void set_mail_caches(mail_cache_t *caches);
+void set_worker_id(uint16_t id);
+void set_step2_format(step2_format_t format);
+void set_step2_combiner(bool is_combined);
+void set_approximate_mode(bool is_approximate);
+bool open_step2_shards(char *temp_files);
+bool flush_step2_shards();
+void commit_step2_task(uint32_t task_id, char *temp_files);
+void close_step2_shards();
+void remove_step2_shards(char *temp_files);
+bool skip_cached_mail(int directory_fd, char *path, char *output);
+
 void process_directory(task_t *task);
 void process_file(task_t *task);
+void process_file_range(task_t *task);
+void process_file_batch(task_t *task);
+void process_files_end(task_t *task);
 
 #endif //A2022_ANALYSIS_H
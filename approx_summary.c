@@ -0,0 +1,504 @@
+#include "approx_summary.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief hash_pair computes the hash of a (sender, recipient) pair (64 bits FNV-1a of both addresses, then mixed so
+ * that both halves of the hash can index the sketch)
+ * @param sender the sender
+ * @param sender_length the length of the sender
+ * @param recipient the recipient
+ * @param recipient_length the length of the recipient
+ * @return the hash
+ */
+static uint64_t hash_pair(const char *sender, size_t sender_length, const char *recipient, size_t recipient_length) {
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < sender_length; ++i) hash = (hash ^ (uint8_t)sender[i]) * 1099511628211ull;
+    hash *= 1099511628211ull;
+    for(size_t i = 0; i < recipient_length; ++i) hash = (hash ^ (uint8_t)recipient[i]) * 1099511628211ull;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/*!
+ * @brief sketch_counter gives the counter of a pair in a row of the sketch (double hashing of the pair)
+ * @param summary the summary
+ * @param hash the hash of the pair
+ * @param row the row
+ * @return a pointer to the counter
+ */
+static uint64_t *sketch_counter(approx_summary_t *summary, uint64_t hash, uint32_t row) {
+    uint32_t first = (uint32_t)hash;
+    uint32_t step = (uint32_t)(hash >> 32) | 1;
+    return &summary->counters[(size_t)row * APPROX_SKETCH_WIDTH + ((first + row * step) & (APPROX_SKETCH_WIDTH - 1))];
+}
+
+/*!
+ * @brief approx_summary_init initializes an empty summary, allocating all its memory
+ * @param summary the summary to initialize
+ * @return true on success, false if allocation failed (the summary is then empty)
+ */
+bool approx_summary_init(approx_summary_t *summary) {
+    memset(summary, 0, sizeof(approx_summary_t));
+    summary->counters = calloc((size_t)APPROX_SKETCH_DEPTH * APPROX_SKETCH_WIDTH, sizeof(uint64_t));
+    summary->entries = malloc(APPROX_HEAVY_HITTERS * sizeof(approx_entry_t));
+    summary->buckets = malloc(APPROX_BUCKETS * sizeof(uint32_t));
+    summary->heap = malloc(APPROX_HEAVY_HITTERS * sizeof(uint32_t));
+    if(summary->counters == NULL || summary->entries == NULL || summary->buckets == NULL || summary->heap == NULL){
+        approx_summary_free(summary);
+        return false;
+    }
+    for(uint32_t b = 0; b < APPROX_BUCKETS; ++b) summary->buckets[b] = APPROX_NO_ENTRY;
+    return true;
+}
+
+/*!
+ * @brief approx_summary_free frees all the memory of a summary, leaving it empty
+ * @param summary the summary to free
+ */
+void approx_summary_free(approx_summary_t *summary) {
+    if(summary == NULL) return;
+    for(uint32_t i = 0; summary->entries != NULL && i < summary->entries_count; ++i) free(summary->entries[i].pair);
+    free(summary->counters);
+    free(summary->entries);
+    free(summary->buckets);
+    free(summary->heap);
+    memset(summary, 0, sizeof(approx_summary_t));
+}
+
+/*!
+ * @brief find_entry looks for the entry of a pair
+ * @param summary the summary
+ * @param hash the hash of the pair
+ * @param sender the sender
+ * @param sender_length the length of the sender
+ * @param recipient the recipient
+ * @param recipient_length the length of the recipient
+ * @return the index of the entry, APPROX_NO_ENTRY if the pair is not a heavy hitter
+ */
+static uint32_t find_entry(approx_summary_t *summary, uint64_t hash, const char *sender, size_t sender_length,
+                           const char *recipient, size_t recipient_length) {
+    for(uint32_t index = summary->buckets[hash & (APPROX_BUCKETS - 1)]; index != APPROX_NO_ENTRY;
+        index = summary->entries[index].next){
+        approx_entry_t *entry = &summary->entries[index];
+        if(entry->hash == hash && entry->sender_length == sender_length &&
+           entry->recipient_length == recipient_length && memcmp(entry->pair, sender, sender_length) == 0 &&
+           memcmp(entry->pair + sender_length + 1, recipient, recipient_length) == 0){
+            return index;
+        }
+    }
+    return APPROX_NO_ENTRY;
+}
+
+/*!
+ * @brief link_entry adds an entry to the bucket of its hash
+ * @param summary the summary
+ * @param index the index of the entry
+ */
+static void link_entry(approx_summary_t *summary, uint32_t index) {
+    uint32_t *bucket = &summary->buckets[summary->entries[index].hash & (APPROX_BUCKETS - 1)];
+    summary->entries[index].next = *bucket;
+    *bucket = index;
+}
+
+/*!
+ * @brief unlink_entry removes an entry from the bucket of its hash
+ * @param summary the summary
+ * @param index the index of the entry
+ */
+static void unlink_entry(approx_summary_t *summary, uint32_t index) {
+    uint32_t *link = &summary->buckets[summary->entries[index].hash & (APPROX_BUCKETS - 1)];
+    while(*link != index) link = &summary->entries[*link].next;
+    *link = summary->entries[index].next;
+}
+
+/*!
+ * @brief swap_heap swaps two positions of the heap
+ * @param summary the summary
+ * @param first a position
+ * @param second another position
+ */
+static void swap_heap(approx_summary_t *summary, uint32_t first, uint32_t second) {
+    uint32_t index = summary->heap[first];
+    summary->heap[first] = summary->heap[second];
+    summary->heap[second] = index;
+    summary->entries[summary->heap[first]].heap_index = first;
+    summary->entries[summary->heap[second]].heap_index = second;
+}
+
+/*!
+ * @brief sift_down moves an entry down the heap, once its count increased
+ * @param summary the summary
+ * @param position the position of the entry in the heap
+ */
+static void sift_down(approx_summary_t *summary, uint32_t position) {
+    while(true){
+        uint32_t lightest = position;
+        for(uint32_t child = 2 * position + 1; child <= 2 * position + 2 && child < summary->entries_count; ++child){
+            if(summary->entries[summary->heap[child]].count < summary->entries[summary->heap[lightest]].count){
+                lightest = child;
+            }
+        }
+        if(lightest == position) return;
+        swap_heap(summary, position, lightest);
+        position = lightest;
+    }
+}
+
+/*!
+ * @brief sift_up moves a new entry up the heap
+ * @param summary the summary
+ * @param position the position of the entry in the heap
+ */
+static void sift_up(approx_summary_t *summary, uint32_t position) {
+    while(position > 0 &&
+          summary->entries[summary->heap[position]].count < summary->entries[summary->heap[(position - 1) / 2]].count){
+        swap_heap(summary, position, (position - 1) / 2);
+        position = (position - 1) / 2;
+    }
+}
+
+/*!
+ * @brief set_pair sets the pair of an entry, reusing its memory
+ * @param entry the entry
+ * @param hash the hash of the pair
+ * @param sender the sender
+ * @param sender_length the length of the sender
+ * @param recipient the recipient
+ * @param recipient_length the length of the recipient
+ * @return true on success, false if allocation failed (the entry is then unchanged)
+ */
+static bool set_pair(approx_entry_t *entry, uint64_t hash, const char *sender, size_t sender_length,
+                     const char *recipient, size_t recipient_length) {
+    char *pair = realloc(entry->pair, sender_length + recipient_length + 2);
+    if(pair == NULL) return false;
+    memcpy(pair, sender, sender_length);
+    pair[sender_length] = '\0';
+    memcpy(pair + sender_length + 1, recipient, recipient_length);
+    pair[sender_length + recipient_length + 1] = '\0';
+    entry->pair = pair;
+    entry->hash = hash;
+    entry->sender_length = sender_length;
+    entry->recipient_length = recipient_length;
+    return true;
+}
+
+/*!
+ * @brief approx_summary_add counts an occurrence of a (sender, recipient) pair
+ * @param summary the summary
+ * @param sender the sender (not necessarily null terminated)
+ * @param sender_length the length of the sender
+ * @param recipient the recipient (not necessarily null terminated)
+ * @param recipient_length the length of the recipient
+ * @return true on success, false if allocation failed (the pair is then only counted by the sketch)
+ */
+bool approx_summary_add(approx_summary_t *summary, const char *sender, size_t sender_length, const char *recipient,
+                        size_t recipient_length) {
+    uint64_t hash = hash_pair(sender, sender_length, recipient, recipient_length);
+    ++summary->total;
+    for(uint32_t row = 0; row < APPROX_SKETCH_DEPTH; ++row) ++*sketch_counter(summary, hash, row);
+
+    uint32_t index = find_entry(summary, hash, sender, sender_length, recipient, recipient_length);
+    if(index != APPROX_NO_ENTRY){
+        ++summary->entries[index].count;
+        sift_down(summary, summary->entries[index].heap_index);
+        return true;
+    }
+    if(summary->entries_count < APPROX_HEAVY_HITTERS){
+        index = summary->entries_count;
+        approx_entry_t *entry = &summary->entries[index];
+        entry->pair = NULL;
+        if(!set_pair(entry, hash, sender, sender_length, recipient, recipient_length)) return false;
+        entry->count = 1;
+        entry->error = 0;
+        entry->heap_index = index;
+        summary->heap[index] = index;
+        ++summary->entries_count;
+        link_entry(summary, index);
+        sift_up(summary, index);
+        return true;
+    }
+    // The lightest pair is replaced: the new one may have had as many occurrences before
+    index = summary->heap[0];
+    approx_entry_t *entry = &summary->entries[index];
+    unlink_entry(summary, index);
+    bool is_set = set_pair(entry, hash, sender, sender_length, recipient, recipient_length);
+    link_entry(summary, index);
+    if(!is_set) return false;
+    entry->error = entry->count;
+    ++entry->count;
+    sift_down(summary, 0);
+    return true;
+}
+
+/*!
+ * @brief approx_summary_estimate gives the estimate of the count-min sketch for the pair of an entry
+ * @param summary the summary
+ * @param entry the entry
+ * @return the smallest counter of the pair, never below its actual count
+ */
+uint64_t approx_summary_estimate(approx_summary_t *summary, approx_entry_t *entry) {
+    uint64_t estimate = UINT64_MAX;
+    for(uint32_t row = 0; row < APPROX_SKETCH_DEPTH; ++row){
+        uint64_t counter = *sketch_counter(summary, entry->hash, row);
+        if(counter < estimate) estimate = counter;
+    }
+    return estimate;
+}
+
+/*!
+ * @brief write_counters writes the counters of the sketch of a summary, only those above 0 if it takes less space
+ * (the sketch of a worker that parsed few e-mails is mostly empty)
+ * @param summary the summary
+ * @param file the file, opened for writing
+ * @param header the header of the summary, to update
+ * @return true on success, false on error
+ */
+static bool write_counters(approx_summary_t *summary, FILE *file, approx_summary_header_t *header) {
+    size_t counters_count = (size_t)APPROX_SKETCH_DEPTH * APPROX_SKETCH_WIDTH;
+    uint32_t used_count = 0;
+    for(size_t c = 0; c < counters_count; ++c) used_count += summary->counters[c] > 0;
+    header->is_sparse = used_count * (sizeof(uint32_t) + sizeof(uint64_t)) < counters_count * sizeof(uint64_t);
+    header->counters_count = header->is_sparse ? used_count : counters_count;
+    if(fwrite(header, sizeof(approx_summary_header_t), 1, file) != 1) return false;
+    if(!header->is_sparse) return fwrite(summary->counters, sizeof(uint64_t), counters_count, file) == counters_count;
+    for(uint32_t c = 0; c < counters_count; ++c){
+        if(summary->counters[c] == 0) continue;
+        if(fwrite(&c, sizeof(uint32_t), 1, file) != 1 ||
+           fwrite(&summary->counters[c], sizeof(uint64_t), 1, file) != 1){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief approx_summary_write appends a summary to a file (@see approx_summary_header_t)
+ * @param summary the summary
+ * @param file the file, opened for writing
+ * @return true on success, false on error
+ */
+bool approx_summary_write(approx_summary_t *summary, FILE *file) {
+    approx_summary_header_t header;
+    memset(&header, 0, sizeof(approx_summary_header_t));
+    memcpy(header.magic, APPROX_SUMMARY_MAGIC, APPROX_SUMMARY_MAGIC_SIZE);
+    header.version = APPROX_SUMMARY_VERSION;
+    header.depth = APPROX_SKETCH_DEPTH;
+    header.width = APPROX_SKETCH_WIDTH;
+    header.capacity = APPROX_HEAVY_HITTERS;
+    header.entries_count = summary->entries_count;
+    header.total = summary->total;
+    if(!write_counters(summary, file, &header)) return false;
+    for(uint32_t i = 0; i < summary->entries_count; ++i){
+        approx_entry_t *entry = &summary->entries[i];
+        approx_entry_header_t entry_header = {entry->count, entry->error, entry->sender_length,
+                                              entry->recipient_length};
+        if(fwrite(&entry_header, sizeof(approx_entry_header_t), 1, file) != 1 ||
+           fwrite(entry->pair, 1, entry->sender_length, file) != entry->sender_length ||
+           fwrite(entry->pair + entry->sender_length + 1, 1, entry->recipient_length, file) !=
+           entry->recipient_length){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief compare_entries orders entries by descending count, then by sender and recipient
+ * @param a a pointer to an approx_entry_t
+ * @param b a pointer to an approx_entry_t
+ * @return a negative value if a comes first, a positive value if b comes first
+ */
+static int compare_entries(const void *a, const void *b) {
+    const approx_entry_t *first = a;
+    const approx_entry_t *second = b;
+    if(first->count != second->count) return (first->count > second->count) ? -1 : 1;
+    int comparison = strcmp(first->pair, second->pair);
+    if(comparison != 0) return comparison;
+    return strcmp(first->pair + first->sender_length + 1, second->pair + second->sender_length + 1);
+}
+
+/*!
+ * @brief merge_entries merges the heavy hitters of another summary into a summary. A pair missing from a full summary
+ * may have had up to the count of its lightest pair there: it is added to its count and error. The heaviest pairs of
+ * the union are kept.
+ * @param summary the summary
+ * @param others the entries of the other summary (their pairs are then owned by the summary, or freed)
+ * @param others_count the count of entries of the other summary
+ * @param others_min the count of the lightest pair of the other summary if it is full, 0 otherwise
+ * @return true on success, false if allocation failed (the pairs of the other summary are then freed)
+ */
+static bool merge_entries(approx_summary_t *summary, approx_entry_t *others, uint32_t others_count,
+                          uint64_t others_min) {
+    uint64_t own_min = (summary->entries_count == APPROX_HEAVY_HITTERS) ? summary->entries[summary->heap[0]].count : 0;
+    bool *is_matched = calloc((size_t)summary->entries_count + 1, sizeof(bool));
+    approx_entry_t *merged = malloc(((size_t)summary->entries_count + others_count + 1) * sizeof(approx_entry_t));
+    if(is_matched == NULL || merged == NULL){
+        for(uint32_t i = 0; i < others_count; ++i) free(others[i].pair);
+        free(is_matched);
+        free(merged);
+        return false;
+    }
+    uint32_t merged_count = 0;
+    for(uint32_t i = 0; i < others_count; ++i){
+        approx_entry_t *other = &others[i];
+        uint32_t index = find_entry(summary, other->hash, other->pair, other->sender_length,
+                                    other->pair + other->sender_length + 1, other->recipient_length);
+        if(index != APPROX_NO_ENTRY){
+            summary->entries[index].count += other->count;
+            summary->entries[index].error += other->error;
+            is_matched[index] = true;
+            free(other->pair);
+        }else{
+            other->count += own_min;
+            other->error += own_min;
+            merged[merged_count++] = *other;
+        }
+    }
+    for(uint32_t i = 0; i < summary->entries_count; ++i){
+        if(!is_matched[i]){
+            summary->entries[i].count += others_min;
+            summary->entries[i].error += others_min;
+        }
+        merged[merged_count++] = summary->entries[i];
+    }
+    qsort(merged, merged_count, sizeof(approx_entry_t), compare_entries);
+    uint32_t kept_count = (merged_count < APPROX_HEAVY_HITTERS) ? merged_count : APPROX_HEAVY_HITTERS;
+    for(uint32_t i = kept_count; i < merged_count; ++i) free(merged[i].pair);
+
+    // The kept entries are indexed again: by increasing count, the heap is sorted
+    memcpy(summary->entries, merged, kept_count * sizeof(approx_entry_t));
+    summary->entries_count = kept_count;
+    for(uint32_t b = 0; b < APPROX_BUCKETS; ++b) summary->buckets[b] = APPROX_NO_ENTRY;
+    for(uint32_t i = 0; i < kept_count; ++i){
+        link_entry(summary, i);
+        summary->heap[i] = kept_count - 1 - i;
+        summary->entries[kept_count - 1 - i].heap_index = i;
+    }
+    free(merged);
+    free(is_matched);
+    return true;
+}
+
+/*!
+ * @brief read_entries reads the entries of a summary from a file
+ * @param file the file, positioned on the entries
+ * @param entries the entries to fill (their pairs are malloc'ed)
+ * @param count the count of entries
+ * @return true on success, false on error (no pair is then allocated)
+ */
+static bool read_entries(FILE *file, approx_entry_t *entries, uint32_t count) {
+    for(uint32_t i = 0; i < count; ++i){
+        approx_entry_header_t header;
+        bool is_read = fread(&header, sizeof(approx_entry_header_t), 1, file) == 1 &&
+                       header.sender_length < (1u << 30) && header.recipient_length < (1u << 30);
+        entries[i].pair = is_read ? malloc((size_t)header.sender_length + header.recipient_length + 2) : NULL;
+        is_read = entries[i].pair != NULL &&
+                  fread(entries[i].pair, 1, header.sender_length, file) == header.sender_length &&
+                  fread(entries[i].pair + header.sender_length + 1, 1, header.recipient_length, file) ==
+                  header.recipient_length;
+        if(!is_read){
+            for(uint32_t j = 0; j <= i; ++j) free(entries[j].pair);
+            return false;
+        }
+        char *pair = entries[i].pair;
+        pair[header.sender_length] = '\0';
+        pair[header.sender_length + header.recipient_length + 1] = '\0';
+        entries[i].count = header.count;
+        entries[i].error = header.error;
+        entries[i].sender_length = header.sender_length;
+        entries[i].recipient_length = header.recipient_length;
+        entries[i].hash = hash_pair(pair, header.sender_length, pair + header.sender_length + 1,
+                                    header.recipient_length);
+    }
+    return true;
+}
+
+/*!
+ * @brief merge_counters reads the counters of the sketch of a summary from a file, adding them to those of a summary
+ * @param summary the summary
+ * @param file the file, positioned on the counters
+ * @param header the header of the summary read
+ * @return true on success, false on error
+ */
+static bool merge_counters(approx_summary_t *summary, FILE *file, approx_summary_header_t *header) {
+    size_t counters_count = (size_t)APPROX_SKETCH_DEPTH * APPROX_SKETCH_WIDTH;
+    if(header->is_sparse){
+        for(uint32_t i = 0; i < header->counters_count; ++i){
+            uint32_t index;
+            uint64_t counter;
+            if(fread(&index, sizeof(uint32_t), 1, file) != 1 || fread(&counter, sizeof(uint64_t), 1, file) != 1 ||
+               index >= counters_count){
+                return false;
+            }
+            summary->counters[index] += counter;
+        }
+        return true;
+    }
+    if(header->counters_count != counters_count) return false;
+    uint64_t *row = malloc(APPROX_SKETCH_WIDTH * sizeof(uint64_t));
+    bool is_merged = row != NULL;
+    for(uint32_t r = 0; is_merged && r < APPROX_SKETCH_DEPTH; ++r){
+        is_merged = fread(row, sizeof(uint64_t), APPROX_SKETCH_WIDTH, file) == APPROX_SKETCH_WIDTH;
+        uint64_t *counters = summary->counters + (size_t)r * APPROX_SKETCH_WIDTH;
+        for(uint32_t c = 0; is_merged && c < APPROX_SKETCH_WIDTH; ++c) counters[c] += row[c];
+    }
+    free(row);
+    return is_merged;
+}
+
+/*!
+ * @brief merge_summary reads a summary from a file and merges it into a summary
+ * @param summary the summary
+ * @param file the file, positioned after the header of the summary
+ * @param header the header of the summary
+ * @return true on success, false on error
+ */
+static bool merge_summary(approx_summary_t *summary, FILE *file, approx_summary_header_t *header) {
+    approx_entry_t *others = malloc(((size_t)header->entries_count + 1) * sizeof(approx_entry_t));
+    bool is_merged = others != NULL && merge_counters(summary, file, header) &&
+                     read_entries(file, others, header->entries_count);
+    if(is_merged){
+        uint64_t others_min = 0;
+        if(header->entries_count > 0 && header->entries_count == header->capacity){
+            others_min = UINT64_MAX;
+            for(uint32_t i = 0; i < header->entries_count; ++i){
+                if(others[i].count < others_min) others_min = others[i].count;
+            }
+        }
+        summary->total += header->total;
+        is_merged = merge_entries(summary, others, header->entries_count, others_min);
+    }
+    free(others);
+    return is_merged;
+}
+
+/*!
+ * @brief approx_summary_merge_file merges all the summaries of a file into a summary
+ * @param summary the summary
+ * @param path the path to the file
+ * @return true on success, false on error (the summaries read before the error are merged)
+ */
+bool approx_summary_merge_file(approx_summary_t *summary, char *path) {
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", path, strerror(errno));
+        return false;
+    }
+    bool is_merged = true;
+    approx_summary_header_t header;
+    while(is_merged && fread(&header, sizeof(approx_summary_header_t), 1, file) == 1){
+        is_merged = memcmp(header.magic, APPROX_SUMMARY_MAGIC, APPROX_SUMMARY_MAGIC_SIZE) == 0 &&
+                    header.version == APPROX_SUMMARY_VERSION && header.depth == APPROX_SKETCH_DEPTH &&
+                    header.width == APPROX_SKETCH_WIDTH && header.entries_count <= header.capacity &&
+                    header.capacity <= APPROX_HEAVY_HITTERS && merge_summary(summary, file, &header);
+    }
+    if(!is_merged || ferror(file)) fprintf(stderr, "[ERROR] Could not merge the summaries of %s\n", path);
+    is_merged = is_merged && !ferror(file);
+    fclose(file);
+    return is_merged;
+}
@@ -0,0 +1,82 @@
+#ifndef A2022_APPROX_SUMMARY_H
+#define A2022_APPROX_SUMMARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Summary of the (sender, recipient) pairs of the e-mails in fixed memory, for the approximate mode (-A):
+ * - a count-min sketch of APPROX_SKETCH_DEPTH rows of APPROX_SKETCH_WIDTH counters: each pair adds 1 to one counter of
+ * each row, chosen by a hash of the pair for the row. The estimate of a pair, its smallest counter, is never below its
+ * count, and exceeds it by at most e / APPROX_SKETCH_WIDTH of the total with probability 1 - e^-APPROX_SKETCH_DEPTH;
+ * - a SpaceSaving summary of APPROX_HEAVY_HITTERS pairs: once full, a new pair replaces the lightest one and inherits
+ * its count as error. The count of a pair is never below its actual count, nor above it by more than its error, and
+ * every pair heavier than total / APPROX_HEAVY_HITTERS is in the summary.
+ * Summaries are mergeable: the summaries of the workers are written to their approx_summary.<worker> file, then merged
+ * by the parent process (sketches counter by counter, heavy hitters as in Agarwal et al., "Mergeable summaries").
+ */
+#define APPROX_SKETCH_DEPTH 4
+#define APPROX_SKETCH_WIDTH (64 * 1024)
+#define APPROX_HEAVY_HITTERS 4096
+// Buckets of the hash table of the heavy hitters (a power of 2)
+#define APPROX_BUCKETS (2 * APPROX_HEAVY_HITTERS)
+#define APPROX_SUMMARY_MAGIC "LPAS"
+#define APPROX_SUMMARY_MAGIC_SIZE 4
+#define APPROX_SUMMARY_VERSION 1
+// Index of no entry
+#define APPROX_NO_ENTRY UINT32_MAX
+
+// A heavy hitter, its pair being stored as "sender\0recipient\0"
+typedef struct {
+    uint64_t count;
+    uint64_t error;
+    uint64_t hash;
+    char *pair;
+    uint32_t sender_length;
+    uint32_t recipient_length;
+    uint32_t next;              // Next entry of the same bucket
+    uint32_t heap_index;        // Position of the entry in the heap
+} approx_entry_t;
+
+typedef struct {
+    uint64_t *counters;         // APPROX_SKETCH_DEPTH rows of APPROX_SKETCH_WIDTH counters
+    uint64_t total;             // Pairs added
+    approx_entry_t *entries;    // APPROX_HEAVY_HITTERS entries at most
+    uint32_t entries_count;
+    uint32_t *buckets;          // First entry of each bucket
+    uint32_t *heap;             // Entries by increasing count: the first one is replaced by a new pair
+} approx_summary_t;
+
+// Header of a summary in an approx_summary file, followed by its counters, then by its entries
+typedef struct {
+    char magic[APPROX_SUMMARY_MAGIC_SIZE];
+    uint8_t version;
+    uint8_t is_sparse;          // Only the counters above 0 are written, each one after its index (uint32_t)
+    uint8_t reserved[2];
+    uint32_t depth;
+    uint32_t width;
+    uint32_t capacity;
+    uint32_t entries_count;
+    uint32_t counters_count;    // Counters written
+    uint64_t total;
+} approx_summary_header_t;
+
+// Header of an entry in an approx_summary file, followed by its pair
+typedef struct {
+    uint64_t count;
+    uint64_t error;
+    uint32_t sender_length;
+    uint32_t recipient_length;
+} approx_entry_header_t;
+
+bool approx_summary_init(approx_summary_t *summary);
+void approx_summary_free(approx_summary_t *summary);
+bool approx_summary_add(approx_summary_t *summary, const char *sender, size_t sender_length, const char *recipient,
+                        size_t recipient_length);
+uint64_t approx_summary_estimate(approx_summary_t *summary, approx_entry_t *entry);
+bool approx_summary_write(approx_summary_t *summary, FILE *file);
+bool approx_summary_merge_file(approx_summary_t *summary, char *path);
+
+#endif //A2022_APPROX_SUMMARY_H
@@ -0,0 +1,71 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <stdalign.h>
+
+/*!
+ * @brief make_arena_block allocates a new block for an arena
+ * @param size the minimum usable size of the block
+ * @return a pointer to the new block, NULL if allocation failed
+ */
+static arena_block_t *make_arena_block(size_t size) {
+    if(size < ARENA_BLOCK_SIZE) size = ARENA_BLOCK_SIZE;
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if(block == NULL) return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/*!
+ * @brief arena_alloc allocates memory from an arena. Blocks are only allocated when the arena is used for the first
+ * time or when all its blocks are full, so that an arena reset between uses does not allocate anymore.
+ * @param arena the arena to allocate from
+ * @param size the size to allocate
+ * @return a pointer to the allocated memory (aligned for any type), NULL if allocation failed
+ */
+void *arena_alloc(arena_t *arena, size_t size) {
+    if(arena == NULL) return NULL;
+    size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+    // Look for room in the current block, then in the next (already allocated) blocks
+    while(arena->current != NULL && arena->current->used + size > arena->current->size){
+        if(arena->current->next == NULL) break;
+        arena->current = arena->current->next;
+        arena->current->used = 0;
+    }
+    if(arena->current == NULL || arena->current->used + size > arena->current->size){
+        arena_block_t *block = make_arena_block(size);
+        if(block == NULL) return NULL;
+        if(arena->current == NULL) arena->head = block;
+        else arena->current->next = block;
+        arena->current = block;
+    }
+    void *memory = arena->current->data + arena->current->used;
+    arena->current->used += size;
+    return memory;
+}
+
+/*!
+ * @brief arena_reset gives back all the memory allocated from an arena, keeping its blocks for later allocations
+ * @param arena the arena to reset
+ */
+void arena_reset(arena_t *arena) {
+    if(arena == NULL) return;
+    arena->current = arena->head;
+    if(arena->current != NULL) arena->current->used = 0;
+}
+
+/*!
+ * @brief arena_free frees all the blocks of an arena
+ * @param arena the arena to free
+ */
+void arena_free(arena_t *arena) {
+    if(arena == NULL) return;
+    while(arena->head != NULL){
+        arena_block_t *next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+    arena->current = NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef A2022_ARENA_H
+#define A2022_ARENA_H
+
+#include <stddef.h>
+#include <stdalign.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct _arena_block {
+    struct _arena_block *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];   // Aligned as malloc'ed memory, so that the allocations are aligned for any type
+} arena_block_t;
+
+// Bump allocator: memory is only given back all at once, by arena_reset (kept for reuse) or arena_free
+typedef struct {
+    arena_block_t *head;
+    arena_block_t *current;
+} arena_t;
+
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_reset(arena_t *arena);
+void arena_free(arena_t *arena);
+
+#endif //A2022_ARENA_H
@@ -0,0 +1,326 @@
+#include "checkpoint.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "analysis.h"
+#include "utility.h"
+
+#define CHECKSUM_SEED 2166136261u
+
+// Name prefixes of the files of a worker for a partition, in the order of the sizes of its commits
+static char *step2_files_prefixes[STEP2_PARTITION_FILES_COUNT] = {
+    STEP2_DICT_PREFIX, STEP2_SHARD_PREFIX, STEP2_KEYS_PREFIX, STEP2_HITS_PREFIX
+};
+
+/*!
+ * @brief checksum_bytes continues the FNV-1a checksum of a record with some bytes
+ * @param data the bytes
+ * @param size the number of bytes
+ * @param checksum the checksum of the previous bytes (CHECKSUM_SEED for the first ones)
+ * @return the checksum
+ */
+static uint32_t checksum_bytes(const void *data, size_t size, uint32_t checksum) {
+    const uint8_t *bytes = data;
+    for(size_t i = 0; i < size; ++i){
+        checksum ^= bytes[i];
+        checksum *= 16777619u;
+    }
+    return checksum;
+}
+
+/*!
+ * @brief write_commit_record appends a commit to the commits log of a worker, once the results of a task are flushed
+ * @param commits the commits log of the worker
+ * @param task_id the ID of the task done
+ * @param sizes the sizes of the files of the worker (dictionary, shard, keys and hits of each partition)
+ * @return true on success, false on error
+ */
+bool write_commit_record(FILE *commits, uint32_t task_id, uint64_t sizes[STEP2_FILES_COUNT]) {
+    commit_record_t record;
+    memset(&record, 0, sizeof(commit_record_t));
+    record.magic = CHECKPOINT_COMMIT_MAGIC;
+    record.task_id = task_id;
+    memcpy(record.sizes, sizes, sizeof(record.sizes));
+    record.checksum = checksum_bytes(&record, sizeof(commit_record_t), CHECKSUM_SEED);
+    return fwrite(&record, sizeof(commit_record_t), 1, commits) == 1 && fflush(commits) == 0;
+}
+
+/*!
+ * @brief mark_task_done sets the flag of a committed task
+ * @param done a pointer to the flags of the tasks, by ID (grown as needed)
+ * @param done_size a pointer to the number of flags
+ * @param task_id the ID of the task
+ * @return true on success, false if allocation failed
+ */
+static bool mark_task_done(uint8_t **done, uint32_t *done_size, uint32_t task_id) {
+    if(task_id >= *done_size){
+        uint32_t size = (*done_size == 0) ? 1024 : *done_size;
+        while(size <= task_id) size *= 2;
+        uint8_t *flags = realloc(*done, size);
+        if(flags == NULL) return false;
+        memset(flags + *done_size, 0, size - *done_size);
+        *done = flags;
+        *done_size = size;
+    }
+    (*done)[task_id] = 1;
+    return true;
+}
+
+/*!
+ * @brief resume_worker truncates the files of a worker to the sizes of its last valid commit, and marks its committed
+ * tasks. A commit is valid if its checksum is right and if the files are at least as large as it says.
+ * @param temp_files the temporary files directory
+ * @param suffix the suffix of the names of the worker's files (its number)
+ * @param done a pointer to the flags of the committed tasks, by ID
+ * @param done_size a pointer to the number of flags
+ * @return true on success, false if the checkpoint can not be resumed
+ */
+static bool resume_worker(char *temp_files, char *suffix, uint8_t **done, uint32_t *done_size) {
+    char file_name[STR_MAX_LEN] = "";
+    char paths[STEP2_FILES_COUNT][STR_MAX_LEN];
+    uint64_t sizes[STEP2_FILES_COUNT];
+    for(size_t i = 0; i < STEP2_FILES_COUNT; ++i){
+        snprintf(file_name, STR_MAX_LEN, "%s%s.%zu", step2_files_prefixes[i % STEP2_PARTITION_FILES_COUNT], suffix,
+                 i / STEP2_PARTITION_FILES_COUNT);
+        concat_path(temp_files, file_name, paths[i]);
+        struct stat file_stat;
+        sizes[i] = (stat(paths[i], &file_stat) == 0) ? (uint64_t)file_stat.st_size : 0;
+    }
+    char commits_path[STR_MAX_LEN] = "";
+    snprintf(file_name, STR_MAX_LEN, STEP2_COMMIT_PREFIX "%s", suffix);
+    concat_path(temp_files, file_name, commits_path);
+    FILE *commits = fopen(commits_path, "r");
+    if(commits == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", commits_path, strerror(errno));
+        return false;
+    }
+
+    commit_record_t record;
+    uint64_t committed[STEP2_FILES_COUNT] = {0};
+    size_t valid_count = 0;
+    bool is_resumable = true;
+    while(is_resumable && fread(&record, sizeof(commit_record_t), 1, commits) == 1){
+        uint32_t checksum = record.checksum;
+        record.checksum = 0;
+        bool is_valid = record.magic == CHECKPOINT_COMMIT_MAGIC &&
+                        checksum_bytes(&record, sizeof(commit_record_t), CHECKSUM_SEED) == checksum;
+        for(size_t i = 0; i < STEP2_FILES_COUNT && is_valid; ++i){
+            is_valid = record.sizes[i] >= committed[i] && record.sizes[i] <= sizes[i];
+        }
+        // The first torn (or lost) commit ends the log
+        if(!is_valid) break;
+        memcpy(committed, record.sizes, sizeof(committed));
+        ++valid_count;
+        is_resumable = record.task_id != CHECKPOINT_NO_TASK && mark_task_done(done, done_size, record.task_id);
+    }
+    fclose(commits);
+
+    // What was written after the last commit belongs to unfinished tasks
+    for(size_t i = 0; i < STEP2_FILES_COUNT && is_resumable; ++i){
+        if(sizes[i] > committed[i] && truncate(paths[i], committed[i]) != 0){
+            fprintf(stderr, "[ERROR] Could not truncate %s : %s\n", paths[i], strerror(errno));
+            is_resumable = false;
+        }
+    }
+    if(is_resumable && truncate(commits_path, valid_count * sizeof(commit_record_t)) != 0){
+        fprintf(stderr, "[ERROR] Could not truncate %s : %s\n", commits_path, strerror(errno));
+        is_resumable = false;
+    }
+    return is_resumable;
+}
+
+/*!
+ * @brief load_done_paths reads the tasks log, keeping the paths of the committed tasks. The log is truncated after its
+ * last valid record.
+ * @param checkpoint the checkpoint
+ * @param tasks_path the path to the tasks log
+ * @param done the flags of the committed tasks, by ID (set to 2 when the task is found)
+ * @param done_size the number of flags
+ * @return true on success, false if the checkpoint can not be resumed (a committed task is not in the log)
+ */
+static bool load_done_paths(checkpoint_t *checkpoint, char *tasks_path, uint8_t *done, uint32_t done_size) {
+    int fd = open(tasks_path, O_RDWR);
+    struct stat tasks_stat;
+    if(fd < 0 || fstat(fd, &tasks_stat) != 0){
+        if(fd >= 0) close(fd);
+        // Without a log, there must be no committed task
+        return done_size == 0 || memchr(done, 1, done_size) == NULL;
+    }
+    size_t size = tasks_stat.st_size;
+    uint8_t *data = (size == 0) ? NULL : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED){
+        fprintf(stderr, "[ERROR] Could not map %s : %s\n", tasks_path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    size_t offset = 0;
+    bool is_resumable = true;
+    task_record_t record;
+    while(is_resumable && offset + sizeof(task_record_t) <= size){
+        memcpy(&record, data + offset, sizeof(task_record_t));
+        uint32_t checksum = record.checksum;
+        record.checksum = 0;
+        char *paths = (char *)data + offset + sizeof(task_record_t);
+        if(record.magic != CHECKPOINT_TASK_MAGIC || record.paths_size > size - offset - sizeof(task_record_t) ||
+           checksum_bytes(paths, record.paths_size, checksum_bytes(&record, sizeof(task_record_t), CHECKSUM_SEED))
+           != checksum){
+            break;
+        }
+        offset += sizeof(task_record_t) + record.paths_size;
+        if(record.task_id == CHECKPOINT_NO_TASK) continue;
+        if(record.task_id >= checkpoint->next_task_id) checkpoint->next_task_id = record.task_id + 1;
+        if(record.task_id >= done_size || done[record.task_id] == 0) continue;
+        done[record.task_id] = 2;
+        for(char *path = paths; path < paths + record.paths_size && is_resumable; path += strlen(path) + 1){
+            is_resumable = address_dict_intern(&checkpoint->done_paths, path, strlen(path), NULL)
+                           != ADDRESS_DICT_INVALID_ID;
+        }
+    }
+    if(data != NULL) munmap(data, size);
+    if(is_resumable && offset < size && ftruncate(fd, offset) != 0){
+        fprintf(stderr, "[ERROR] Could not truncate %s : %s\n", tasks_path, strerror(errno));
+        is_resumable = false;
+    }
+    close(fd);
+    return is_resumable && (done_size == 0 || memchr(done, 1, done_size) == NULL);
+}
+
+/*!
+ * @brief resume_checkpoint prepares the temporary files of an interrupted run to be resumed
+ * @param checkpoint the checkpoint
+ * @param temp_files the temporary files directory
+ * @param tasks_path the path to the tasks log
+ * @return true on success, false if the checkpoint can not be resumed
+ */
+static bool resume_checkpoint(checkpoint_t *checkpoint, char *temp_files, char *tasks_path) {
+    DIR *temp_dir = opendir(temp_files);
+    if(temp_dir == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", temp_files, strerror(errno));
+        return false;
+    }
+    uint8_t *done = NULL;
+    uint32_t done_size = 0;
+    bool is_resumable = true;
+    size_t commit_prefix_length = strlen(STEP2_COMMIT_PREFIX);
+    struct dirent *entry;
+    while(is_resumable && (entry = readdir(temp_dir)) != NULL){
+        if(strncmp(entry->d_name, STEP2_COMMIT_PREFIX, commit_prefix_length) == 0){
+            is_resumable = resume_worker(temp_files, entry->d_name + commit_prefix_length, &done, &done_size);
+            continue;
+        }
+        // Files of workers that never committed a task are dropped (their names are <prefix><worker>.<partition>)
+        for(size_t i = 0; i < STEP2_PARTITION_FILES_COUNT; ++i){
+            size_t prefix_length = strlen(step2_files_prefixes[i]);
+            if(strncmp(entry->d_name, step2_files_prefixes[i], prefix_length) != 0) continue;
+            char commits_name[STR_MAX_LEN] = "";
+            snprintf(commits_name, STR_MAX_LEN, STEP2_COMMIT_FORMAT,
+                     (unsigned)strtoul(entry->d_name + prefix_length, NULL, 10));
+            if(faccessat(dirfd(temp_dir), commits_name, F_OK, 0) != 0) unlinkat(dirfd(temp_dir), entry->d_name, 0);
+        }
+    }
+    closedir(temp_dir);
+    is_resumable = is_resumable && load_done_paths(checkpoint, tasks_path, done, done_size);
+    free(done);
+    return is_resumable;
+}
+
+/*!
+ * @brief open_checkpoint prepares the checkpoints of the files step. A new run removes the files of the previous one
+ * (workers append to them); a resumed run keeps what the interrupted run committed.
+ * @param checkpoint the checkpoint to initialize
+ * @param temp_files the temporary files directory
+ * @param is_resumed true to resume an interrupted run
+ * @return true on success, false if the tasks log could not be opened
+ */
+bool open_checkpoint(checkpoint_t *checkpoint, char *temp_files, bool is_resumed) {
+    memset(checkpoint, 0, sizeof(checkpoint_t));
+    checkpoint->tasks_fd = -1;
+    address_dict_init(&checkpoint->done_paths);
+    char tasks_path[STR_MAX_LEN] = "";
+    concat_path(temp_files, STEP2_TASKS_FILE, tasks_path);
+    if(is_resumed && !resume_checkpoint(checkpoint, temp_files, tasks_path)){
+        fprintf(stderr, "[ERROR] The interrupted run can not be resumed, all the files are processed again\n");
+        address_dict_free(&checkpoint->done_paths);
+        checkpoint->next_task_id = 0;
+        is_resumed = false;
+    }
+    if(!is_resumed){
+        remove_step2_shards(temp_files);
+        remove_checkpoint(temp_files);
+    }
+    checkpoint->tasks_fd = open(tasks_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(checkpoint->tasks_fd < 0){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", tasks_path, strerror(errno));
+        address_dict_free(&checkpoint->done_paths);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief log_task writes a task to the tasks log, before it is sent
+ * @param checkpoint the checkpoint
+ * @param paths the paths of the files of the task (relative to the data source, '\0' terminated)
+ * @param paths_size the size of the paths
+ * @return the ID of the task, CHECKPOINT_NO_TASK if it could not be logged
+ */
+uint32_t log_task(checkpoint_t *checkpoint, char *paths, size_t paths_size) {
+    if(checkpoint == NULL || checkpoint->tasks_fd < 0) return CHECKPOINT_NO_TASK;
+    task_record_t record = {CHECKPOINT_TASK_MAGIC, checkpoint->next_task_id, paths_size, 0};
+    record.checksum = checksum_bytes(paths, paths_size, checksum_bytes(&record, sizeof(task_record_t), CHECKSUM_SEED));
+    // The record and its paths are written at once: a crash can only tear the end of the log
+    struct iovec parts[2] = {{&record, sizeof(task_record_t)}, {paths, paths_size}};
+    ssize_t written = writev(checkpoint->tasks_fd, parts, 2);
+    if(written != (ssize_t)(sizeof(task_record_t) + paths_size)){
+        fprintf(stderr, "[ERROR] Could not write the tasks log : %s\n", (written < 0) ? strerror(errno) : "short write");
+        close(checkpoint->tasks_fd);
+        checkpoint->tasks_fd = -1;
+        return CHECKPOINT_NO_TASK;
+    }
+    return checkpoint->next_task_id++;
+}
+
+/*!
+ * @brief is_path_done tells if a file was processed by a task committed before the run was interrupted
+ * @param checkpoint the checkpoint
+ * @param path the path of the file, relative to the data source (not necessarily null terminated)
+ * @param length the length of the path
+ * @return true if the file must not be processed again
+ */
+bool is_path_done(checkpoint_t *checkpoint, char *path, size_t length) {
+    if(checkpoint == NULL || checkpoint->done_paths.count == 0) return false;
+    return address_dict_find(&checkpoint->done_paths, path, length) != ADDRESS_DICT_INVALID_ID;
+}
+
+/*!
+ * @brief close_checkpoint closes the tasks log and frees the memory of a checkpoint
+ * @param checkpoint the checkpoint
+ */
+void close_checkpoint(checkpoint_t *checkpoint) {
+    if(checkpoint->tasks_fd >= 0) close(checkpoint->tasks_fd);
+    checkpoint->tasks_fd = -1;
+    address_dict_free(&checkpoint->done_paths);
+}
+
+/*!
+ * @brief remove_checkpoint removes the tasks log and the commits logs, once their results are reduced (or when a new
+ * run starts)
+ * @param temp_files the temporary files directory
+ */
+void remove_checkpoint(char *temp_files) {
+    char tasks_path[STR_MAX_LEN] = "";
+    concat_path(temp_files, STEP2_TASKS_FILE, tasks_path);
+    if(remove(tasks_path) != 0 && errno != ENOENT){
+        fprintf(stderr, "[ERROR] Could not remove %s : %s\n", tasks_path, strerror(errno));
+    }
+    remove_files_with_prefix(temp_files, STEP2_COMMIT_PREFIX);
+}
@@ -0,0 +1,64 @@
+#ifndef A2022_CHECKPOINT_H
+#define A2022_CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "address_dict.h"
+#include "step2_format.h"
+
+/*
+ * Checkpoints of the files step, so that an interrupted run can be resumed (-R) instead of started over.
+ * - The parent process logs each task before sending it (step2_tasks): its ID and the paths of its files, relative to
+ * the data source.
+ * - Once a task is done and its results flushed, the worker appends a commit to its own log (step2_commit.<worker_id>):
+ * the task ID and the sizes of its files (dictionary, shard, keys and hits of each partition, in this order).
+ * Records are framed by a magic and a checksum, so that a record torn by a crash is detected. When resuming, the files
+ * of each worker are truncated to the sizes of its last valid commit (dropping what was written by unfinished tasks),
+ * and the files of the committed tasks are not sent again.
+ */
+#define STEP2_TASKS_FILE "step2_tasks"
+#define STEP2_COMMIT_PREFIX "step2_commit."
+#define STEP2_COMMIT_FORMAT STEP2_COMMIT_PREFIX "%u"
+#define CHECKPOINT_TASK_MAGIC 0x4B534154u      // "TASK"
+#define CHECKPOINT_COMMIT_MAGIC 0x4D4D4F43u    // "COMM"
+// ID of the tasks sent while the tasks log can not be written: their commits make the checkpoint unusable
+#define CHECKPOINT_NO_TASK UINT32_MAX
+// Files of a worker whose sizes are committed, for each partition and in all
+#define STEP2_PARTITION_FILES_COUNT 4
+#define STEP2_FILES_COUNT (STEP2_PARTITION_FILES_COUNT * STEP2_PARTITIONS_COUNT)
+
+// Record of the tasks log, followed by the paths of the task ('\0' terminated)
+typedef struct {
+    uint32_t magic;
+    uint32_t task_id;
+    uint32_t paths_size;
+    uint32_t checksum;          // Checksum of the record (this field being 0) and of the paths
+} task_record_t;
+
+// Record of the commits log of a worker
+typedef struct {
+    uint32_t magic;
+    uint32_t task_id;
+    uint64_t sizes[STEP2_FILES_COUNT];
+    uint32_t checksum;          // Checksum of the record, this field being 0
+    uint32_t reserved;
+} commit_record_t;
+
+typedef struct {
+    int tasks_fd;               // Tasks log, -1 when it can not be written
+    uint32_t next_task_id;
+    address_dict_t done_paths;  // Paths of the tasks committed by the interrupted run, when resuming
+} checkpoint_t;
+
+bool open_checkpoint(checkpoint_t *checkpoint, char *temp_files, bool is_resumed);
+uint32_t log_task(checkpoint_t *checkpoint, char *paths, size_t paths_size);
+bool is_path_done(checkpoint_t *checkpoint, char *path, size_t length);
+void close_checkpoint(checkpoint_t *checkpoint);
+void remove_checkpoint(char *temp_files);
+
+bool write_commit_record(FILE *commits, uint32_t task_id, uint64_t sizes[STEP2_FILES_COUNT]);
+
+#endif //A2022_CHECKPOINT_H
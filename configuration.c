@@ -29,8 +29,29 @@ configuration_t *make_configuration(configuration_t *base_configuration, char *a
     char output_file[STR_MAX_LEN] = "";
     bool is_verbose = false;
     int cpu_core_multiplier = 0;
+    int chunk_size = 0;
+    bool is_text_step2 = false;
+    bool is_step_by_step = false;
+    bool is_full_run = false;
+    bool is_resumed = false;
+    long top_k = -1;
+    long memory_budget = -1;
+    bool is_combined = false;
+    char graph_file[STR_MAX_LEN] = "";
+    char analytics_file[STR_MAX_LEN] = "";
+    long approximate_edges = -1;
+    static struct option long_options[] = {
+        {"resume", no_argument, NULL, 'R'},
+        {"top-k", required_argument, NULL, 'k'},
+        {"memory-budget", required_argument, NULL, 'm'},
+        {"combine", no_argument, NULL, 'C'},
+        {"graph", required_argument, NULL, 'g'},
+        {"analytics", required_argument, NULL, 'a'},
+        {"approximate", required_argument, NULL, 'A'},
+        {NULL, 0, NULL, 0}
+    };
 
-    while((opt = getopt(argc, argv, "d:t:o:n:vf:")) != -1){
+    while((opt = getopt_long(argc, argv, "d:t:o:n:vf:c:TSFRk:m:Cg:a:A:", long_options, NULL)) != -1){
         switch (opt){
         case 'd':
             strcpy(data_path, optarg);
@@ -55,6 +76,57 @@ configuration_t *make_configuration(configuration_t *base_configuration, char *a
         case 'f':
             read_cfg_file(base_configuration, optarg);
             break;
+        case 'c':
+            chunk_size = atoi(optarg);
+            if(chunk_size < 1){
+                fprintf(stderr, "[WARN] Invalid chunk size, keeping default : %u\n", base_configuration->chunk_size);
+                chunk_size = 0;
+            }
+            break;
+        case 'T':
+            is_text_step2 = true;
+            break;
+        case 'S':
+            is_step_by_step = true;
+            break;
+        case 'F':
+            is_full_run = true;
+            break;
+        case 'R':
+            is_resumed = true;
+            break;
+        case 'k':
+            top_k = strtol(optarg, NULL, 10);
+            if(top_k < 0 || top_k > UINT32_MAX){
+                fprintf(stderr, "[WARN] Invalid top-k, keeping default : %u\n", base_configuration->top_k);
+                top_k = -1;
+            }
+            break;
+        case 'm':
+            memory_budget = strtol(optarg, NULL, 10);
+            if(memory_budget < 0 || memory_budget > UINT32_MAX){
+                fprintf(stderr, "[WARN] Invalid memory budget, keeping default : %u\n",
+                        base_configuration->memory_budget);
+                memory_budget = -1;
+            }
+            break;
+        case 'C':
+            is_combined = true;
+            break;
+        case 'g':
+            strcpy(graph_file, optarg);
+            break;
+        case 'a':
+            strcpy(analytics_file, optarg);
+            break;
+        case 'A':
+            approximate_edges = strtol(optarg, NULL, 10);
+            if(approximate_edges < 0 || approximate_edges > UINT32_MAX){
+                fprintf(stderr, "[WARN] Invalid approximate edges, keeping default : %u\n",
+                        base_configuration->approximate_edges);
+                approximate_edges = -1;
+            }
+            break;
         }
     }
     if(data_path[0] != '\0'){
@@ -72,6 +144,39 @@ configuration_t *make_configuration(configuration_t *base_configuration, char *a
     if(cpu_core_multiplier != base_configuration->cpu_core_multiplier && cpu_core_multiplier != 0){
         base_configuration->cpu_core_multiplier = cpu_core_multiplier;
     }
+    if(chunk_size != 0){
+        base_configuration->chunk_size = chunk_size;
+    }
+    if(is_text_step2){
+        base_configuration->is_text_step2 = true;
+    }
+    if(is_step_by_step){
+        base_configuration->is_step_by_step = true;
+    }
+    if(is_full_run){
+        base_configuration->is_full_run = true;
+    }
+    if(is_resumed){
+        base_configuration->is_resumed = true;
+    }
+    if(top_k >= 0){
+        base_configuration->top_k = top_k;
+    }
+    if(memory_budget >= 0){
+        base_configuration->memory_budget = memory_budget;
+    }
+    if(is_combined){
+        base_configuration->is_combined = true;
+    }
+    if(graph_file[0] != '\0'){
+        strcpy(base_configuration->graph_file, graph_file);
+    }
+    if(analytics_file[0] != '\0'){
+        strcpy(base_configuration->analytics_file, analytics_file);
+    }
+    if(approximate_edges >= 0){
+        base_configuration->approximate_edges = approximate_edges;
+    }
     return base_configuration;
 }
 
@@ -123,7 +228,9 @@ char *get_word(char *source, char *target) {
 
 /*!
  * @brief read_cfg_file reads a configuration file (with key = value lines) and extracts all key/values for
- * configuring the program (data_path, output_file, temporary_directory, is_verbose, cpu_core_multiplier)
+ * configuring the program (data_path, output_file, temporary_directory, is_verbose, cpu_core_multiplier, chunk_size,
+ * is_text_step2, is_step_by_step, is_full_run, is_resumed, top_k, memory_budget, is_combined, graph_file,
+ * analytics_file, approximate_edges)
  * @param base_configuration a pointer to the configuration to update and return
  * @param path_to_cfg_file the path to the configuration file
  * @return a pointer to the base configuration after update, NULL is reading failed.
@@ -160,6 +267,28 @@ configuration_t *read_cfg_file(configuration_t *base_configuration, char *path_t
             strcpy(base_configuration->output_file, value);
         }else if(strcmp(key, "cpu_core_multiplier") == 0){
             base_configuration->cpu_core_multiplier = atoi(value);
+        }else if(strcmp(key, "chunk_size") == 0){
+            if(atoi(value) > 0) base_configuration->chunk_size = atoi(value);
+        }else if(strcmp(key, "is_text_step2") == 0){
+            base_configuration->is_text_step2 = (strcmp(value, "yes") == 0);
+        }else if(strcmp(key, "is_step_by_step") == 0){
+            base_configuration->is_step_by_step = (strcmp(value, "yes") == 0);
+        }else if(strcmp(key, "is_full_run") == 0){
+            base_configuration->is_full_run = (strcmp(value, "yes") == 0);
+        }else if(strcmp(key, "is_resumed") == 0){
+            base_configuration->is_resumed = (strcmp(value, "yes") == 0);
+        }else if(strcmp(key, "top_k") == 0){
+            if(atol(value) >= 0) base_configuration->top_k = atol(value);
+        }else if(strcmp(key, "memory_budget") == 0){
+            if(atol(value) >= 0) base_configuration->memory_budget = atol(value);
+        }else if(strcmp(key, "is_combined") == 0){
+            base_configuration->is_combined = (strcmp(value, "yes") == 0);
+        }else if(strcmp(key, "graph_file") == 0){
+            strcpy(base_configuration->graph_file, value);
+        }else if(strcmp(key, "analytics_file") == 0){
+            strcpy(base_configuration->analytics_file, value);
+        }else if(strcmp(key, "approximate_edges") == 0){
+            if(atol(value) >= 0) base_configuration->approximate_edges = atol(value);
         }
         memset(key, 0, STR_MAX_LEN); //reset string to empty
         memset(value, 0, STR_MAX_LEN);
@@ -180,6 +309,21 @@ void display_configuration(configuration_t *configuration) {
     printf("\tVerbose mode is %s\n", configuration->is_verbose?"on":"off");
     printf("\tCPU multiplier is %d\n", configuration->cpu_core_multiplier);
     printf("\tProcess count is %d\n", configuration->process_count);
+    printf("\tChunk size is %u files\n", configuration->chunk_size);
+    printf("\tStep2 format is %s\n", configuration->is_text_step2?"text":"binary");
+    printf("\tFiles are %s\n", configuration->is_step_by_step?"parsed step by step":"streamed");
+    printf("\tMail cache is %s\n", configuration->is_full_run?"ignored (full run)":"used");
+    printf("\tInterrupted run is %s\n", configuration->is_resumed?"resumed":"started over");
+    if(configuration->top_k == 0) printf("\tAll the recipients are written\n");
+    else printf("\tTop %u recipients are written\n", configuration->top_k);
+    if(configuration->memory_budget == 0) printf("\tReducers keep their results in memory\n");
+    else printf("\tReducers spill their results beyond %u MiB\n", configuration->memory_budget);
+    printf("\tRecords are %s\n", configuration->is_combined?"combined by the workers (not cached)":"written per e-mail");
+    if(configuration->graph_file[0] != '\0') printf("\tGraph file: %s\n", configuration->graph_file);
+    if(configuration->analytics_file[0] != '\0') printf("\tAnalytics report: %s\n", configuration->analytics_file);
+    if(configuration->approximate_edges > 0){
+        printf("\tThe %u heaviest pairs are approximated\n", configuration->approximate_edges);
+    }
     printf("End configuration\n");
 }
 
@@ -193,5 +337,7 @@ bool is_configuration_valid(configuration_t *configuration) {
     if(!directory_exists(configuration->data_path)) return false;
     if(!directory_exists(configuration->temporary_directory)) return false;
     if(!path_to_file_exists(configuration->output_file)) return false;
+    if(configuration->graph_file[0] != '\0' && !path_to_file_exists(configuration->graph_file)) return false;
+    if(configuration->analytics_file[0] != '\0' && !path_to_file_exists(configuration->analytics_file)) return false;
     return true;
 }
\ No newline at end of file
@@ -17,6 +17,17 @@ typedef struct {
     bool is_verbose;
     uint8_t cpu_core_multiplier;
     uint16_t process_count;
+    uint32_t chunk_size;
+    bool is_text_step2; // Debug option: step2 shards are written as text instead of binary records
+    bool is_step_by_step; // Debug option: files are parsed once step1_output is complete, instead of being streamed
+    bool is_full_run; // The mail cache of the previous run is ignored, all the e-mails are parsed
+    bool is_resumed; // The files step of an interrupted run restarts at its last checkpoint
+    uint32_t top_k; // Only the top_k recipients with the most occurrences are written for each sender (0 for all)
+    uint32_t memory_budget; // MiB of results held by the reducers before they spill to runs (0 for no budget)
+    bool is_combined; // Workers combine the records of their e-mails by sender (the mail cache is then not used)
+    char graph_file[STR_MAX_LEN]; // Communication graph written from the output, for lp25-query ("" for none)
+    char analytics_file[STR_MAX_LEN]; // Report of the analytics of the communication graph ("" for none)
+    uint32_t approximate_edges; // Only the heaviest pairs are estimated, in bounded memory (0 for the exact output)
 } configuration_t;
 
 configuration_t *make_configuration(configuration_t *base_configuration, char *argv[], int argc);
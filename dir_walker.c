@@ -0,0 +1,392 @@
+#include "dir_walker.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "global_defs.h"
+
+/*
+ * The walker lists the files of a tree without recursion: directories waiting to be read are kept in deques, one per
+ * thread. A thread takes the newest directory of its own deque (depth first, the directory entries are still in
+ * cache), and when it is empty steals the oldest directory of another deque (the closest to the root, likely the
+ * largest subtree). Directories are read with getdents64 in large buffers, relative to the root directory, and the
+ * paths found are given by blocks to a sink (the output file, or the streamed files step).
+ */
+
+// Entry returned by getdents64
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Directories waiting to be read (paths relative to the root, malloc'ed), from top (oldest) to bottom (newest)
+typedef struct {
+    char **items;
+    size_t capacity;
+    size_t top;
+    size_t bottom;
+    pthread_mutex_t lock;
+} walker_deque_t;
+
+typedef struct _walker walker_t;
+
+typedef struct {
+    walker_t *walker;
+    walker_deque_t deque;
+    char *dents;
+    char *output;
+    size_t output_length;
+    pthread_t thread;
+    bool started;
+} walker_thread_t;
+
+struct _walker {
+    int root_fd;
+    char prefix[STR_MAX_LEN];   // Root path, ending with '/', written before each path
+    size_t prefix_length;
+    walker_sink_t sink;
+    void *sink_context;
+    pthread_mutex_t output_lock;
+    bool failed;
+    walker_thread_t threads[WALKER_MAX_THREADS];
+    size_t threads_count;
+    size_t pending;             // Directories queued or being read: the walk ends when there is none
+    size_t queued;              // Directories queued
+    size_t idle_count;          // Threads waiting for directories
+    pthread_mutex_t idle_lock;
+    pthread_cond_t work_available;
+};
+
+/*!
+ * @brief push_directory adds a directory to the bottom of a deque
+ * @param deque the deque
+ * @param directory the relative path of the directory (owned by the deque on success)
+ * @return true on success, false if allocation failed
+ */
+static bool push_directory(walker_deque_t *deque, char *directory) {
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom == deque->capacity && deque->top > 0){
+        memmove(deque->items, deque->items + deque->top, (deque->bottom - deque->top) * sizeof(char *));
+        deque->bottom -= deque->top;
+        deque->top = 0;
+    }else if(deque->bottom == deque->capacity){
+        size_t capacity = (deque->capacity == 0) ? WALKER_DEQUE_INITIAL_CAPACITY : deque->capacity * 2;
+        char **items = realloc(deque->items, capacity * sizeof(char *));
+        if(items == NULL){
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        deque->items = items;
+        deque->capacity = capacity;
+    }
+    deque->items[deque->bottom++] = directory;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+/*!
+ * @brief take_directory removes a directory from a deque
+ * @param deque the deque
+ * @param steal true to take the oldest directory (other threads), false for the newest (owner)
+ * @return the relative path of the directory, NULL if the deque is empty
+ */
+static char *take_directory(walker_deque_t *deque, bool steal) {
+    pthread_mutex_lock(&deque->lock);
+    char *directory = NULL;
+    if(deque->top < deque->bottom){
+        directory = steal ? deque->items[deque->top++] : deque->items[--deque->bottom];
+        if(deque->top == deque->bottom) deque->top = deque->bottom = 0;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return directory;
+}
+
+/*!
+ * @brief flush_paths gives the paths buffered by a thread to the sink of the walk
+ * @param thread the thread
+ */
+static void flush_paths(walker_thread_t *thread) {
+    if(thread->output_length == 0) return;
+    walker_t *walker = thread->walker;
+    pthread_mutex_lock(&walker->output_lock);
+    if(!walker->sink(thread->output, thread->output_length, walker->sink_context)) walker->failed = true;
+    pthread_mutex_unlock(&walker->output_lock);
+    thread->output_length = 0;
+}
+
+/*!
+ * @brief add_path buffers the full path of a file: root path, directory and name
+ * @param thread the thread which found the file
+ * @param directory the relative path of the directory holding the file ("" for the root)
+ * @param name the name of the file
+ */
+static void add_path(walker_thread_t *thread, char *directory, char *name) {
+    walker_t *walker = thread->walker;
+    size_t directory_length = strlen(directory);
+    size_t name_length = strlen(name);
+    size_t length = walker->prefix_length + directory_length + (directory_length > 0) + name_length;
+    // Paths are read back with fgets in STR_MAX_LEN buffers
+    if(length + 1 >= STR_MAX_LEN){
+        fprintf(stderr, "[ERROR] Path too long in %s%s, %s skipped\n", walker->prefix, directory, name);
+        return;
+    }
+    if(thread->output_length + length + 1 > WALKER_OUTPUT_SIZE) flush_paths(thread);
+    char *cur = thread->output + thread->output_length;
+    memcpy(cur, walker->prefix, walker->prefix_length);
+    cur += walker->prefix_length;
+    if(directory_length > 0){
+        memcpy(cur, directory, directory_length);
+        cur += directory_length;
+        *cur++ = '/';
+    }
+    memcpy(cur, name, name_length);
+    cur[name_length] = '\n';
+    thread->output_length += length + 1;
+}
+
+static void *walk_directories(void *argument);
+
+/*!
+ * @brief start_helper starts one more thread on the walk, if the maximum is not reached
+ * @param walker the walker
+ */
+static void start_helper(walker_t *walker) {
+    size_t count = __atomic_load_n(&walker->threads_count, __ATOMIC_SEQ_CST);
+    if(count >= WALKER_MAX_THREADS) return;
+    if(!__atomic_compare_exchange_n(&walker->threads_count, &count, count + 1, false, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST)){
+        return;
+    }
+    walker_thread_t *helper = &walker->threads[count];
+    helper->started = pthread_create(&helper->thread, NULL, walk_directories, helper) == 0;
+}
+
+/*!
+ * @brief queue_directory queues a subdirectory found by a thread, waking an idle thread (or starting a helper) to
+ * share the work
+ * @param thread the thread which found the subdirectory
+ * @param directory the relative path of the directory holding the subdirectory ("" for the root)
+ * @param name the name of the subdirectory
+ */
+static void queue_directory(walker_thread_t *thread, char *directory, char *name) {
+    walker_t *walker = thread->walker;
+    size_t directory_length = strlen(directory);
+    size_t name_length = strlen(name);
+    char *subdirectory = malloc(directory_length + name_length + 2);
+    if(subdirectory == NULL){
+        fprintf(stderr, "[ERROR] Could not allocate memory for %s%s/%s\n", walker->prefix, directory, name);
+        return;
+    }
+    if(directory_length > 0){
+        memcpy(subdirectory, directory, directory_length);
+        subdirectory[directory_length++] = '/';
+    }
+    memcpy(subdirectory + directory_length, name, name_length + 1);
+
+    // Counted before being visible to the other threads, which decrement the counts when they take it
+    __atomic_add_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST);
+    size_t queued = __atomic_add_fetch(&walker->queued, 1, __ATOMIC_SEQ_CST);
+    if(!push_directory(&thread->deque, subdirectory)){
+        fprintf(stderr, "[ERROR] Could not allocate memory for %s%s\n", walker->prefix, subdirectory);
+        free(subdirectory);
+        __atomic_sub_fetch(&walker->queued, 1, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+    if(__atomic_load_n(&walker->idle_count, __ATOMIC_SEQ_CST) > 0){
+        pthread_mutex_lock(&walker->idle_lock);
+        pthread_cond_signal(&walker->work_available);
+        pthread_mutex_unlock(&walker->idle_lock);
+    }else if(queued > 1){
+        start_helper(walker);
+    }
+}
+
+/*!
+ * @brief read_directory lists the entries of a directory: files are buffered, subdirectories are queued
+ * @param thread the thread reading the directory
+ * @param directory the relative path of the directory ("" for the root)
+ */
+static void read_directory(walker_thread_t *thread, char *directory) {
+    walker_t *walker = thread->walker;
+    int fd = openat(walker->root_fd, (directory[0] == '\0') ? "." : directory, O_RDONLY | O_DIRECTORY);
+    if(fd < 0){
+        fprintf(stderr, "[ERROR] Could not open the directory %s%s : %s\n", walker->prefix, directory, strerror(errno));
+        return;
+    }
+    long length;
+    while((length = syscall(SYS_getdents64, fd, thread->dents, WALKER_DENTS_SIZE)) > 0){
+        for(long offset = 0; offset < length;){
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(thread->dents + offset);
+            offset += entry->d_reclen;
+            char *name = entry->d_name;
+            if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            unsigned char type = entry->d_type;
+            if(type == DT_UNKNOWN){
+                // Some file systems do not fill d_type
+                struct stat entry_stat;
+                if(fstatat(fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(entry_stat.st_mode)){
+                    type = DT_DIR;
+                }
+            }
+            if(type == DT_DIR) queue_directory(thread, directory, name);
+            else add_path(thread, directory, name);
+        }
+    }
+    if(length < 0){
+        fprintf(stderr, "[ERROR] Could not read the directory %s%s : %s\n", walker->prefix, directory, strerror(errno));
+    }
+    close(fd);
+}
+
+/*!
+ * @brief walk_directories reads directories until none is left in the tree, taking them from the thread's deque or
+ * stealing them from the other threads
+ * @param argument the thread, as a walker_thread_t pointer
+ * @return NULL
+ */
+static void *walk_directories(void *argument) {
+    walker_thread_t *thread = argument;
+    walker_t *walker = thread->walker;
+    if(thread->dents == NULL) thread->dents = malloc(WALKER_DENTS_SIZE);
+    if(thread->output == NULL) thread->output = malloc(WALKER_OUTPUT_SIZE);
+    if(thread->dents == NULL || thread->output == NULL){
+        // The directories are left to the other threads
+        fprintf(stderr, "[ERROR] Could not allocate the buffers of a directory walker\n");
+        return NULL;
+    }
+
+    for(;;){
+        char *directory = take_directory(&thread->deque, false);
+        for(size_t i = 0; directory == NULL && i < WALKER_MAX_THREADS; ++i){
+            if(&walker->threads[i] != thread) directory = take_directory(&walker->threads[i].deque, true);
+        }
+        if(directory != NULL){
+            __atomic_sub_fetch(&walker->queued, 1, __ATOMIC_SEQ_CST);
+            read_directory(thread, directory);
+            free(directory);
+            if(__atomic_sub_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST) == 0){
+                pthread_mutex_lock(&walker->idle_lock);
+                pthread_cond_broadcast(&walker->work_available);
+                pthread_mutex_unlock(&walker->idle_lock);
+            }
+            continue;
+        }
+
+        // Nothing to take: wait for a directory to be queued, or for the end of the walk
+        pthread_mutex_lock(&walker->idle_lock);
+        __atomic_add_fetch(&walker->idle_count, 1, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&walker->queued, __ATOMIC_SEQ_CST) == 0 &&
+              __atomic_load_n(&walker->pending, __ATOMIC_SEQ_CST) > 0){
+            pthread_cond_wait(&walker->work_available, &walker->idle_lock);
+        }
+        __atomic_sub_fetch(&walker->idle_count, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&walker->idle_lock);
+        if(__atomic_load_n(&walker->pending, __ATOMIC_SEQ_CST) == 0) break;
+    }
+    flush_paths(thread);
+    return NULL;
+}
+
+/*!
+ * @brief walk_directory_to_sink gives the paths of all files in a directory and its subdirectories to a sink. Large
+ * trees are shared between up to WALKER_MAX_THREADS threads.
+ * @param path the path to the directory
+ * @param sink the function receiving the paths (@see walker_sink_t)
+ * @param context passed to the sink
+ * @return true on success, false if the directory could not be opened or the sink failed
+ */
+bool walk_directory_to_sink(char *path, walker_sink_t sink, void *context) {
+    if(path == NULL || sink == NULL) return false;
+    size_t path_length = strlen(path);
+    if(path_length == 0 || path_length + 1 >= STR_MAX_LEN) return false;
+
+    walker_t *walker = calloc(1, sizeof(walker_t));
+    if(walker == NULL){
+        fprintf(stderr, "[ERROR] Could not allocate a directory walker for %s\n", path);
+        return false;
+    }
+    walker->root_fd = open(path, O_RDONLY | O_DIRECTORY);
+    if(walker->root_fd < 0){
+        fprintf(stderr, "[ERROR] Could not open the directory %s : %s\n", path, strerror(errno));
+        free(walker);
+        return false;
+    }
+    memcpy(walker->prefix, path, path_length);
+    if(path[path_length - 1] != '/') walker->prefix[path_length++] = '/';
+    walker->prefix_length = path_length;
+    walker->sink = sink;
+    walker->sink_context = context;
+    pthread_mutex_init(&walker->output_lock, NULL);
+    pthread_mutex_init(&walker->idle_lock, NULL);
+    pthread_cond_init(&walker->work_available, NULL);
+    for(size_t i = 0; i < WALKER_MAX_THREADS; ++i){
+        walker->threads[i].walker = walker;
+        pthread_mutex_init(&walker->threads[i].deque.lock, NULL);
+    }
+
+    // The calling thread walks the tree from the root, helpers are started when directories pile up
+    walker->threads_count = 1;
+    char *root = calloc(1, 1);
+    if(root != NULL && push_directory(&walker->threads[0].deque, root)){
+        walker->pending = walker->queued = 1;
+        walk_directories(&walker->threads[0]);
+    }else{
+        free(root);
+        walker->failed = true;
+    }
+
+    // Helpers may still look at all the deques until they end
+    for(size_t i = 0; i < WALKER_MAX_THREADS; ++i){
+        if(walker->threads[i].started) pthread_join(walker->threads[i].thread, NULL);
+    }
+    for(size_t i = 0; i < WALKER_MAX_THREADS; ++i){
+        walker_thread_t *thread = &walker->threads[i];
+        // Directories left by threads which could not allocate their buffers
+        while(thread->deque.top < thread->deque.bottom) free(thread->deque.items[thread->deque.top++]);
+        free(thread->deque.items);
+        free(thread->dents);
+        free(thread->output);
+        pthread_mutex_destroy(&thread->deque.lock);
+    }
+    bool success = !walker->failed && __atomic_load_n(&walker->pending, __ATOMIC_SEQ_CST) == 0;
+    pthread_cond_destroy(&walker->work_available);
+    pthread_mutex_destroy(&walker->idle_lock);
+    pthread_mutex_destroy(&walker->output_lock);
+    close(walker->root_fd);
+    free(walker);
+    return success;
+}
+
+/*!
+ * @brief write_paths is the sink of walk_directory, writing the paths to a file
+ * @param paths the block of paths
+ * @param length the length of the block
+ * @param output_file the output file
+ * @return true on success, false if the block could not be written
+ */
+static bool write_paths(char *paths, size_t length, void *output_file) {
+    return fwrite(paths, 1, length, output_file) == length;
+}
+
+/*!
+ * @brief walk_directory writes the paths of all files in a directory and its subdirectories to a file, one per line
+ * @param path the path to the directory
+ * @param output_file the opened output file
+ * @return true on success, false if the directory could not be opened or the output could not be written
+ */
+bool walk_directory(char *path, FILE *output_file) {
+    if(output_file == NULL) return false;
+    return walk_directory_to_sink(path, write_paths, output_file);
+}
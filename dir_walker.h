@@ -0,0 +1,21 @@
+#ifndef A2022_DIR_WALKER_H
+#define A2022_DIR_WALKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Size of the buffers given to getdents64, and of the buffers where the paths found are kept before the sink
+#define WALKER_DENTS_SIZE (64 * 1024)
+#define WALKER_OUTPUT_SIZE (64 * 1024)
+// Maximum number of threads walking one tree, helpers being started only when directories are waiting
+#define WALKER_MAX_THREADS 4
+#define WALKER_DEQUE_INITIAL_CAPACITY 64
+
+// Receives the paths found by a walk, by blocks of '\n' terminated lines. It is never called concurrently.
+typedef bool (* walker_sink_t)(char *paths, size_t length, void *context);
+
+bool walk_directory(char *path, FILE *output_file);
+bool walk_directory_to_sink(char *path, walker_sink_t sink, void *context);
+
+#endif //A2022_DIR_WALKER_H
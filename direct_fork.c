@@ -12,6 +12,7 @@
 #include <errno.h>
 
 #include "analysis.h"
+#include "reducers.h"
 #include "utility.h"
 
 /*!
@@ -63,55 +64,78 @@ void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_pr
 }
 
 /*!
- * @brief direct_fork_files runs the files analysis with direct calls to fork
- * @param data_source the data source containing the files
+ * @brief direct_fork_files runs the files analysis with direct calls to fork. Each process handles a task (a range of
+ * chunk_size files from the files list, or a batch of streamed files), so that the count of forks is proportional to
+ * the count of chunks. Processes are given the number of a free slot (between 0 and nb_proc - 1) as worker number,
+ * for their output shard.
+ * @param tasks the tasks of the files step
  * @param temp_files the temporary files to write the output (step2_output)
  * @param nb_proc the maximum number of simultaneous processes
  */
-void direct_fork_files(char *data_source, char *temp_files, uint16_t nb_proc) {
+void direct_fork_files(file_tasks_t *tasks, char *temp_files, uint16_t nb_proc) {
     // 1. Check parameters
-    if(!(directory_exists(temp_files) && directory_exists(data_source) && nb_proc > 0)) return;
-    
-    char file_name[STR_MAX_LEN] = "";
-    concat_path(temp_files, "step1_output", file_name);
-    FILE *files_list = fopen(file_name, "r");
-    if(files_list == NULL){
-        fprintf(stderr, "[ERROR] Could not open : %s : %s\n",file_name, strerror(errno));
-        return;
-    }
+    if(tasks == NULL || temp_files == NULL || nb_proc == 0) return;
 
-    // 2. Iterate over files in files list (step1_output)
-    char line[STR_MAX_LEN] = "";
+    // 2. Iterate over the tasks (ranges of step1_output, or batches of files as soon as they are found)
     int task_sent = 0;
-    while(fgets(line, STR_MAX_LEN, files_list) != NULL){
-        int last_char_pos = strlen(line) - 1;
-        line[last_char_pos] = 0;
-        task_t new_task = {
-            .task_callback = process_file,
-            .argument = "",
-        };
-        strcpy(new_task.argument, line);
-        strcpy(new_task.argument+STR_MAX_LEN, temp_files);
+    pid_t slots[nb_proc];
+    for(int i = 0; i < nb_proc; ++i) slots[i] = 0;
+    task_t new_task;
+    while(next_file_task(tasks, &new_task)){
         // 3 bis: if max processes count already run, wait for one to end before starting a task.
         if(task_sent >= nb_proc){
-            wait(NULL);
+            pid_t ended = wait(NULL);
+            for(int i = 0; i < nb_proc; ++i) if(slots[i] == ended) slots[i] = 0;
             --task_sent;
         }
-        // 3. fork and start a task on current file.
+        int slot = 0;
+        while(slot < nb_proc - 1 && slots[slot] != 0) ++slot;
+        // 3. fork and start a task on current range of files.
         pid_t pid = fork();
-        if(pid != 0) ++task_sent;
+        if(pid > 0){
+            slots[slot] = pid;
+            ++task_sent;
+        }
         else if (pid == 0){
-            fclose(files_list);
+            // The tasks are left alone: closing step1_output would move the file offset it shares with the parent
+            set_worker_id(slot);
             new_task.task_callback(&new_task);
-            exit(0);
+            close_step2_shards();
+            _exit(0);
         }
         else perror("Could not create child");
-
-        memset(line, 0, STR_MAX_LEN);
     }
     // 4. Cleanup
     for(int i = 0; i < task_sent; ++i){
         wait(NULL);
     }
-    fclose(files_list);
-}
\ No newline at end of file
+}
+
+/*!
+ * @brief direct_fork_partitions runs the reduction of the partitions of the senders with direct calls to fork, one
+ * process per partition
+ * @param temp_files the temporary files directory (the step3_output of each partition is written here)
+ * @param nb_proc the maximum number of simultaneous processes
+ */
+void direct_fork_partitions(char *temp_files, uint16_t nb_proc) {
+    if(temp_files == NULL || nb_proc == 0) return;
+    int child_number = 0;
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        partition_task_t new_task = {.task_callback = reduce_partition, .partition = p};
+        strcpy(new_task.temporary_directory, temp_files);
+        if(child_number >= nb_proc){
+            wait(NULL);
+            --child_number;
+        }
+        pid_t pid = fork();
+        if(pid > 0) ++child_number;
+        else if(pid == 0){
+            new_task.task_callback((task_t *)&new_task);
+            _exit(0);
+        }
+        else perror("Could not create child");
+    }
+    for(int i = 0; i < child_number; ++i){
+        wait(NULL);
+    }
+}
@@ -6,8 +6,10 @@
 #define A2022_DIRECT_FORK_H
 
 #include "global_defs.h"
+#include "file_tasks.h"
 
 void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_proc);
-void direct_fork_files(char *data_source, char *temp_files, uint16_t nb_proc);
+void direct_fork_files(file_tasks_t *tasks, char *temp_files, uint16_t nb_proc);
+void direct_fork_partitions(char *temp_files, uint16_t nb_proc);
 
 #endif //A2022_DIRECT_FORK_H
@@ -14,8 +14,10 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/epoll.h>
 
 #include "analysis.h"
+#include "reducers.h"
 #include "utility.h"
 
 /*!
@@ -47,12 +49,27 @@ void erase_fifos(uint16_t processes_count, char *file_format) {
     }
 }
 
+// Workers found exited by the parent: they are given no more tasks, in any step (allocated by make_processes)
+static bool *lost_workers = NULL;
+
+/*!
+ * @brief lose_worker records that a worker has exited, and reports it once
+ * @param worker the index of the worker
+ */
+static void lose_worker(uint16_t worker) {
+    if(lost_workers == NULL || lost_workers[worker]) return;
+    lost_workers[worker] = true;
+    fprintf(stderr, "[ERROR] Worker %u exited, the results it had not written yet are lost\n", worker);
+}
+
 /*!
  * @brief make_processes creates processes and starts their code (waiting for commands)
  * @param processes_count the number of processes to create
+ * @param input_format the name pattern of the FIFOs the processes read their commands from
+ * @param output_format the name pattern of the FIFOs the processes notify their parent on
  * @return a malloc'ed array with the PIDs of the created processes
  */
-pid_t *make_processes(uint16_t processes_count) {
+pid_t *make_processes(uint16_t processes_count, char *input_format, char *output_format) {
     // 1. Create PIDs array
     pid_t* pids = malloc(sizeof(pid_t)*processes_count);
     // 2. Loop over processes_count to fork
@@ -61,27 +78,31 @@ pid_t *make_processes(uint16_t processes_count) {
         if(pids[i] == 0){
             free(pids);
             // 2 bis. in fork child part, open reading and writing FIFOs, and start listening on reading FIFO
-            char input_file_path[STR_MAX_LEN] = "./temp/fifo-in-%d";
-            char output_file_path[STR_MAX_LEN] = "./temp/fifo-out-%d";
-            sprintf(input_file_path, input_file_path, i);
-            sprintf(output_file_path, output_file_path, i);
+            char input_file_path[STR_MAX_LEN] = "";
+            char output_file_path[STR_MAX_LEN] = "";
+            sprintf(input_file_path, input_format, i);
+            sprintf(output_file_path, output_format, i);
             int input_file = open(input_file_path, O_RDONLY);
             int output_file = open(output_file_path, O_WRONLY);
+            set_worker_id(i);
             // 3. Upon reception, apply task
             task_t* task = calloc(1, sizeof(task_t));
-            do{
-                if(read(input_file, task, sizeof(task_t)) == -1) perror("read");
+            while(read(input_file, task, sizeof(task_t)) > 0 && task->task_callback != NULL){
                 task->task_callback(task);
                 bool temp = 1;
                 if(write(output_file, &temp, sizeof(bool)) == -1) perror("write");
-            }while(task->task_callback != NULL);
+            }
             // 3 bis. If task has a NULL callback, terminate process (don't forget cleanup).
+            close_step2_shards();
             free(task);
             close(input_file);
             close(output_file);
             exit(0);
         }
     }
+    // A write to the FIFO of an exited worker must fail with EPIPE instead of killing the parent
+    signal(SIGPIPE, SIG_IGN);
+    lost_workers = calloc(processes_count, sizeof(bool));
     return pids;
 }
 
@@ -115,45 +136,38 @@ void close_fifos(uint16_t processes_count, int *files) {
     for(int i = 0; i < processes_count; ++i) close(files[i]);
 }
 
+/*!
+ * @brief send_file_task sends a task of the files step (range of step1_output or batch of streamed files) to a child
+ * process
+ * @param task the task, made by next_file_task
+ * @param command_fd the child process command FIFO file descriptor
+ * @return true on success, false if the task could not be sent (EPIPE if the child process has exited)
+ */
+bool send_file_task(task_t *task, int command_fd) {
+    if(task == NULL) return false;
+    if(write(command_fd, task, sizeof(task_t)) == -1){
+        if(errno != EPIPE) perror("write");
+        return false;
+    }
+    return true;
+}
+
 /*!
  * @brief shutdown_processes terminates all worker processes by sending a task with a NULL callback
  * @param processes_count the number of processes to terminate
  * @param fifos the array to the output FIFOs (used to command the processes) file descriptors
  */
 void shutdown_processes(uint16_t processes_count, int *fifos) {
-    // 1. Loop over processes_count
+    // 1. Loop over processes_count (the workers that have exited are skipped)
     for(int i =0; i< processes_count; ++i){
+        if(lost_workers != NULL && lost_workers[i]) continue;
         // 2. Create an empty task (with a NULL callback)
         task_t task = {.task_callback=NULL};
         // 3. Send task to current process
-        if(write(fifos[i], &task, sizeof(task_t)) == -1) perror("write");
+        if(!send_file_task(&task, fifos[i])) lose_worker(i);
     }
-}
-
-/*!
- * @brief prepare_select prepares fd_set for select with all file descriptors to look at
- * @param fds the fd_set to initialize
- * @param filesdes the array of file descriptors
- * @param nb_proc the number of processes (elements in the array)
- * @return the maximum file descriptor value (as used in select)
- */
-int prepare_select(fd_set *fds, const int *filesdes, uint16_t nb_proc) {
-    if(filesdes == NULL) return -1;
-    FD_ZERO(fds);
-    int max = -1;
-    for(int i = 0; i < nb_proc; ++i){
-        if(filesdes[i] > max) max = filesdes[i];
-        FD_SET(filesdes[i], fds);
-    }
-    return max;
-}
-
-void send_file_task(char *file_path, char *temp_files, int command_fd) {
-    if(file_path == NULL || temp_files == NULL) return;
-    file_task_t task = {.task_callback=process_file};
-    strcpy(task.object_file, file_path);
-    strcpy(task.temporary_directory, temp_files);
-    if(write(command_fd, &task, sizeof(file_task_t)) == -1) perror("write");
+    free(lost_workers);
+    lost_workers = NULL;
 }
 
 /*!
@@ -163,34 +177,178 @@ void send_file_task(char *file_path, char *temp_files, int command_fd) {
  * @param temp_files the temporary output files directory
  * @param dir_name the current dir name to analyze
  * @param command_fd the child process command FIFO file descriptor
+ * @return true on success, false if the task could not be sent (EPIPE if the child process has exited)
  */
-void send_directory_task(char *data_source, char *temp_files, char *dir_name, int command_fd) {
-    if(data_source == NULL || temp_files == NULL || dir_name == NULL) return;
+bool send_directory_task(char *data_source, char *temp_files, char *dir_name, int command_fd) {
+    if(data_source == NULL || temp_files == NULL || dir_name == NULL) return false;
     directory_task_t task = {.task_callback=process_directory};
     concat_path(data_source, dir_name, task.object_directory);
     strcpy(task.temporary_directory, temp_files);
-    if(write(command_fd, &task, sizeof(directory_task_t)) == -1) perror("write");
+    if(write(command_fd, &task, sizeof(directory_task_t)) == -1){
+        if(errno != EPIPE) perror("write");
+        return false;
+    }
+    return true;
 }
 
-int oneIsFree(bool* fifo_free, uint16_t nb_proc){
-    for(int i = 0; i < nb_proc; ++i){
-        if(fifo_free[i]) return i;
+// Workers of the FIFO backend: the end of their tasks is read from their notify FIFOs, watched by one epoll set
+typedef struct {
+    int epoll_fd;
+    int *notify_fifos;
+    uint16_t nb_proc;
+    uint16_t *free_workers;     // Queue of the free workers, in the order they finished their tasks
+    uint16_t free_first;
+    uint16_t free_count;
+    bool *is_busy;
+    uint16_t busy_count;
+} fifo_dispatcher_t;
+
+/*!
+ * @brief open_dispatcher prepares the dispatching of tasks to workers, all of them being free but the exited ones
+ * @param dispatcher the dispatcher to initialize
+ * @param notify_fifos the FIFOs on which workers notify the end of their tasks
+ * @param nb_proc the number of workers
+ * @return true on success, false on error
+ */
+static bool open_dispatcher(fifo_dispatcher_t *dispatcher, int *notify_fifos, uint16_t nb_proc) {
+    dispatcher->notify_fifos = notify_fifos;
+    dispatcher->nb_proc = nb_proc;
+    dispatcher->free_first = 0;
+    dispatcher->free_count = 0;
+    dispatcher->busy_count = 0;
+    dispatcher->free_workers = malloc(nb_proc * sizeof(uint16_t));
+    dispatcher->is_busy = calloc(nb_proc, sizeof(bool));
+    dispatcher->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(dispatcher->free_workers == NULL || dispatcher->is_busy == NULL || dispatcher->epoll_fd < 0){
+        fprintf(stderr, "[ERROR] Could not create the workers dispatcher : %s\n", strerror(errno));
+        if(dispatcher->epoll_fd >= 0) close(dispatcher->epoll_fd);
+        free(dispatcher->free_workers);
+        free(dispatcher->is_busy);
+        return false;
     }
-    return -1;
+    for(uint16_t i = 0; i < nb_proc; ++i){
+        if(lost_workers != NULL && lost_workers[i]) continue;
+        struct epoll_event event = {.events = EPOLLIN, .data.u32 = i};
+        if(epoll_ctl(dispatcher->epoll_fd, EPOLL_CTL_ADD, notify_fifos[i], &event) != 0){
+            fprintf(stderr, "[ERROR] Could not watch the FIFO of worker %u : %s\n", i, strerror(errno));
+            continue;
+        }
+        dispatcher->free_workers[dispatcher->free_count++] = i;
+    }
+    return true;
 }
 
-int getFreeIndex(bool* fifo_free, uint16_t nb_proc, int* notify_fifos){
-    // for(int i=0; i < nb_proc; ++i) printf("%i ", fifo_free[i]);
-    // printf("\n");
-    int indexOfFree = oneIsFree(fifo_free, nb_proc);
-    if(indexOfFree != -1){
-        return indexOfFree;
-    }else{
-        while(oneIsFree(fifo_free, nb_proc) == -1){
-            for(int i = 0; i < nb_proc; ++i) if(read(notify_fifos[i], fifo_free+i, sizeof(bool)) == -1) perror("read");
+/*!
+ * @brief close_dispatcher releases a dispatcher
+ * @param dispatcher the dispatcher
+ */
+static void close_dispatcher(fifo_dispatcher_t *dispatcher) {
+    close(dispatcher->epoll_fd);
+    free(dispatcher->free_workers);
+    free(dispatcher->is_busy);
+}
+
+/*!
+ * @brief drop_worker stops giving tasks to a worker that has exited
+ * @param dispatcher the dispatcher
+ * @param worker the index of the worker
+ */
+static void drop_worker(fifo_dispatcher_t *dispatcher, uint16_t worker) {
+    if(dispatcher->is_busy[worker]) --dispatcher->busy_count;
+    dispatcher->is_busy[worker] = false;
+    epoll_ctl(dispatcher->epoll_fd, EPOLL_CTL_DEL, dispatcher->notify_fifos[worker], NULL);
+    lose_worker(worker);
+}
+
+/*!
+ * @brief wait_for_completions waits for at least one busy worker to end its task, then reads all the ends notified
+ * at once: the workers are queued as free in that order. A worker whose FIFO is closed has exited, busy or free, and
+ * is dropped.
+ * @param dispatcher the dispatcher, with at least one busy worker
+ * @return true on success, false if the FIFOs could not be watched
+ */
+static bool wait_for_completions(fifo_dispatcher_t *dispatcher) {
+    struct epoll_event events[dispatcher->nb_proc];
+    int ready_count = epoll_wait(dispatcher->epoll_fd, events, dispatcher->nb_proc, -1);
+    if(ready_count < 0){
+        if(errno == EINTR) return true;
+        fprintf(stderr, "[ERROR] Could not wait for the workers : %s\n", strerror(errno));
+        return false;
+    }
+    for(int i = 0; i < ready_count; ++i){
+        uint16_t worker = events[i].data.u32;
+        bool is_done;
+        ssize_t length = read(dispatcher->notify_fifos[worker], &is_done, sizeof(bool));
+        if(length < 0 && errno == EINTR) continue;
+        if(length != sizeof(bool)){
+            drop_worker(dispatcher, worker);
+            continue;
+        }
+        if(dispatcher->is_busy[worker]){
+            --dispatcher->busy_count;
+            dispatcher->is_busy[worker] = false;
+            uint16_t last = (dispatcher->free_first + dispatcher->free_count++) % dispatcher->nb_proc;
+            dispatcher->free_workers[last] = worker;
         }
-        return oneIsFree(fifo_free, nb_proc);
     }
+    return true;
+}
+
+/*!
+ * @brief take_free_worker takes the first worker that ended its task, which is then busy, without waiting
+ * @param dispatcher the dispatcher
+ * @return the index of the worker, -1 if no worker is free
+ */
+static int take_free_worker(fifo_dispatcher_t *dispatcher) {
+    while(dispatcher->free_count > 0){
+        uint16_t worker = dispatcher->free_workers[dispatcher->free_first];
+        dispatcher->free_first = (dispatcher->free_first + 1) % dispatcher->nb_proc;
+        --dispatcher->free_count;
+        if(lost_workers != NULL && lost_workers[worker]) continue;
+        ++dispatcher->busy_count;
+        dispatcher->is_busy[worker] = true;
+        return worker;
+    }
+    return -1;
+}
+
+/*!
+ * @brief next_free_worker gives the worker to send the next task to, which is then busy: the first worker that ended
+ * its task, waiting for one if all of them are busy
+ * @param dispatcher the dispatcher
+ * @return the index of the worker, -1 if no worker is left
+ */
+static int next_free_worker(fifo_dispatcher_t *dispatcher) {
+    int worker;
+    while((worker = take_free_worker(dispatcher)) < 0){
+        if(dispatcher->busy_count == 0 || !wait_for_completions(dispatcher)) return -1;
+    }
+    return worker;
+}
+
+/*!
+ * @brief dispatch_task sends a task to the next free worker. A worker the task can't be sent to has exited: it is
+ * dropped, and the task is sent to the next free worker instead.
+ * @param dispatcher the dispatcher
+ * @param command_fifos the FIFOs on which to send tasks to workers
+ * @param task the task to send
+ * @return true if the task was sent, false if no worker is left
+ */
+static bool dispatch_task(fifo_dispatcher_t *dispatcher, int *command_fifos, task_t *task) {
+    int worker;
+    while((worker = next_free_worker(dispatcher)) >= 0){
+        if(send_file_task(task, command_fifos[worker])) return true;
+        drop_worker(dispatcher, worker);
+    }
+    return false;
+}
+
+/*!
+ * @brief wait_for_workers waits for all busy workers to notify the end of their task
+ * @param dispatcher the dispatcher
+ */
+static void wait_for_workers(fifo_dispatcher_t *dispatcher) {
+    while(dispatcher->busy_count > 0 && wait_for_completions(dispatcher));
 }
 
 /*!
@@ -206,17 +364,27 @@ void fifo_process_directory(char *data_source, char *temp_files, int *notify_fif
     // 1. Check parameters
     if(!directory_exists(data_source)) return;
     // 2. Iterate over directories (ignore . and ..)
+    fifo_dispatcher_t dispatcher;
+    if(!open_dispatcher(&dispatcher, notify_fifos, nb_proc)) return;
     DIR* dir = opendir(data_source);
     struct dirent* current_dir;
-    bool fifo_free[nb_proc];
-    for(int i = 0; i < nb_proc; ++i) fifo_free[i] = 1;
     while((current_dir = next_dir(current_dir, dir)) != NULL){
         // 4. Iterate over remaining directories by waiting for a process to finish its task before sending a new one.
-        int fifo_index = getFreeIndex(fifo_free, nb_proc, notify_fifos);
-        fifo_free[fifo_index] = 0;
-        // 3. Send a file task to each running worker process (you may create a utility function for this)
-        send_directory_task(data_source, temp_files, current_dir->d_name, command_fifos[fifo_index]);
+        // 3. Send a file task to each running worker process (a worker that has exited is dropped, and the task is
+        // sent to the next one)
+        int fifo_index;
+        bool is_sent = false;
+        while(!is_sent && (fifo_index = next_free_worker(&dispatcher)) >= 0){
+            is_sent = send_directory_task(data_source, temp_files, current_dir->d_name, command_fifos[fifo_index]);
+            if(!is_sent) drop_worker(&dispatcher, fifo_index);
+        }
+        if(!is_sent){
+            fprintf(stderr, "[ERROR] No worker left to process %s\n", current_dir->d_name);
+            break;
+        }
     }
+    wait_for_workers(&dispatcher);
+    close_dispatcher(&dispatcher);
     // 5. Cleanup
     free(current_dir);
     closedir(dir);
@@ -225,43 +393,68 @@ void fifo_process_directory(char *data_source, char *temp_files, int *notify_fif
 
 /*!
  * @brief fifo_process_files is the main function to distribute files analysis to worker processes.
- * @param data_source the data source with the files to analyze
- * @param temp_files the temporary files directory (step1_output is here)
+ * @param tasks the tasks of the files step (ranges of step1_output, or batches of streamed files)
+ * @param temp_files the temporary files directory (the step2_output shards are written here)
  * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
  * @param command_fifos the FIFOs on which to send tasks to workers
  * @param nb_proc  the maximum number of simultaneous tasks, = to number of workers
  */
-void fifo_process_files(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc) {
+void fifo_process_files(file_tasks_t *tasks, char *temp_files, int *notify_fifos, int *command_fifos,
+                        uint16_t nb_proc) {
     // 1. Check parameters
-    bool good_params = directory_exists(temp_files) && directory_exists(data_source) && nb_proc > 0;
-    if(!good_params) return;
+    if(tasks == NULL || temp_files == NULL || nb_proc == 0) return;
 
-    char file_name[STR_MAX_LEN] = "";
-    concat_path(temp_files, "step1_output", file_name);
-    FILE *files_list = fopen(file_name, "r");
-    if(files_list == NULL){
-        fprintf(stderr, "[ERROR] Could not open : %s : %s\n",file_name, strerror(errno));
-        return;
-    }
     //init var
-    char current_file[STR_MAX_LEN];
-    bool fifo_free[nb_proc];
-    for(int i = 0; i < nb_proc; ++i) fifo_free[i] = 1;
+    task_t task;
+    fifo_dispatcher_t dispatcher;
+    if(!open_dispatcher(&dispatcher, notify_fifos, nb_proc)) return;
 
-    //remove step2_output
-    char step2_file[STR_MAX_LEN] = "";
-    concat_path(temp_files, "step2_output", step2_file);
-    remove(step2_file);
+    // 2. Iterate over the tasks (ranges of step1_output, or batches of files as soon as they are found)
+    while(next_file_task(tasks, &task)){
+        // 3. Send a task to each running worker process
+        // 4. Iterate over remaining tasks by sending each one to the first worker that ends its task
+        if(!dispatch_task(&dispatcher, command_fifos, &task)){
+            fprintf(stderr, "[ERROR] No worker left to process the files, results are incomplete\n");
+            break;
+        }
+    }
+    wait_for_workers(&dispatcher);
 
-    // 2. Iterate over files in step1_output
-    while(fgets(current_file, STR_MAX_LEN, files_list)){
-        // 3. Send a file task to each running worker process (you may create a utility function for this)
-        // 4. Iterate over remaining files by waiting for a process to finish its task before sending a new one.
-        current_file[strlen(current_file)-1] = '\0';
-        int fifo_index = getFreeIndex(fifo_free, nb_proc, notify_fifos);
-        fifo_free[fifo_index] = 0;
-        send_file_task(current_file, temp_files, command_fifos[fifo_index]);
+    // 5. Each worker writes the records left in its combiners before the partitions are reduced (all the workers left
+    // are free)
+    task_t end_task = {.task_callback=process_files_end};
+    int fifo_index;
+    while((fifo_index = take_free_worker(&dispatcher)) >= 0){
+        if(!send_file_task(&end_task, command_fifos[fifo_index])) drop_worker(&dispatcher, fifo_index);
     }
-    // 5. Cleanup
-    fclose(files_list);
+    wait_for_workers(&dispatcher);
+    close_dispatcher(&dispatcher);
+}
+
+/*!
+ * @brief fifo_process_partitions distributes the reduction of the partitions of the senders to worker processes.
+ * @param temp_files the temporary files directory (the step3_output of each partition is written here)
+ * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
+ * @param command_fifos the FIFOs on which to send tasks to workers
+ * @param nb_proc the maximum number of simultaneous tasks, = to number of workers
+ * Uses @see reduce_partition
+ */
+void fifo_process_partitions(char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc) {
+    if(temp_files == NULL || nb_proc == 0) return;
+    fifo_dispatcher_t dispatcher;
+    if(!open_dispatcher(&dispatcher, notify_fifos, nb_proc)) return;
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        task_t task;
+        memset(&task, 0, sizeof(task_t));
+        partition_task_t *partition_task = (partition_task_t *)&task;
+        partition_task->task_callback = reduce_partition;
+        strcpy(partition_task->temporary_directory, temp_files);
+        partition_task->partition = p;
+        if(!dispatch_task(&dispatcher, command_fifos, &task)){
+            fprintf(stderr, "[ERROR] No worker left to reduce partition %u\n", p);
+            break;
+        }
+    }
+    wait_for_workers(&dispatcher);
+    close_dispatcher(&dispatcher);
 }
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include "file_tasks.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "analysis.h"
+#include "dir_walker.h"
+#include "utility.h"
+
+#define FILE_STREAM_INITIAL_CAPACITY (64 * 1024)
+
+// Paths found by the walk and not sent yet ('\0' terminated, relative to the data source), shared with its thread
+struct _file_stream {
+    pthread_t walker_thread;
+    char data_source[STR_MAX_LEN];
+    size_t prefix_length;       // Length of the data source path and its '/', removed from the paths found
+    char *paths;
+    size_t capacity;
+    size_t read_offset;
+    size_t write_offset;
+    uint32_t paths_count;
+    uint32_t chunk_size;
+    bool is_done;
+    bool is_successful;
+    checkpoint_t *checkpoint;   // Files of the tasks committed by an interrupted run are skipped (read only)
+    pthread_mutex_t lock;
+    pthread_cond_t paths_available;
+};
+
+/*!
+ * @brief init_file_tasks initializes the tasks of the files step and opens their checkpoint
+ * @param tasks the tasks to initialize
+ * @param data_source the data source directory
+ * @param temp_files the temporary files directory
+ * @param chunk_size the maximum number of files in a task
+ * @param is_resumed true to resume an interrupted run
+ * @return true on success, false if the checkpoint could not be opened
+ */
+static bool init_file_tasks(file_tasks_t *tasks, char *data_source, char *temp_files, uint32_t chunk_size,
+                            bool is_resumed) {
+    memset(tasks, 0, sizeof(file_tasks_t));
+    tasks->chunk_size = chunk_size;
+    strncpy(tasks->temporary_directory, temp_files, STR_MAX_LEN - 1);
+    strncpy(tasks->data_source, data_source, STR_MAX_LEN - 1);
+    return open_checkpoint(&tasks->checkpoint, temp_files, is_resumed);
+}
+
+/*!
+ * @brief open_files_list_tasks prepares the tasks of the files step as ranges of step1_output (step by step)
+ * @param tasks the tasks to initialize
+ * @param data_source the data source directory (the paths of step1_output start with it)
+ * @param temp_files the temporary files directory (step1_output is here)
+ * @param chunk_size the maximum number of files in a task
+ * @param is_resumed true to resume an interrupted run
+ * @return true on success, false if step1_output or the checkpoint could not be opened
+ */
+bool open_files_list_tasks(file_tasks_t *tasks, char *data_source, char *temp_files, uint32_t chunk_size,
+                           bool is_resumed) {
+    if(tasks == NULL || data_source == NULL || temp_files == NULL || chunk_size == 0) return false;
+    if(!init_file_tasks(tasks, data_source, temp_files, chunk_size, is_resumed)) return false;
+
+    char file_name[STR_MAX_LEN] = "";
+    concat_path(temp_files, "step1_output", file_name);
+    tasks->files_list = fopen(file_name, "r");
+    if(tasks->files_list == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", file_name, strerror(errno));
+        close_checkpoint(&tasks->checkpoint);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief stream_paths is the sink of the walk when streaming: it keeps the paths found for the next tasks
+ * @param paths the block of paths, one per line
+ * @param length the length of the block
+ * @param context the stream
+ * @return true on success, false if allocation failed
+ */
+static bool stream_paths(char *paths, size_t length, void *context) {
+    file_stream_t *stream = context;
+    pthread_mutex_lock(&stream->lock);
+    // The block is at most as long as its relative paths with their terminators, plus the prefixes
+    if(stream->write_offset + length > stream->capacity){
+        memmove(stream->paths, stream->paths + stream->read_offset, stream->write_offset - stream->read_offset);
+        stream->write_offset -= stream->read_offset;
+        stream->read_offset = 0;
+    }
+    if(stream->write_offset + length > stream->capacity){
+        size_t capacity = stream->capacity * 2;
+        while(stream->write_offset + length > capacity) capacity *= 2;
+        char *stream_paths = realloc(stream->paths, capacity);
+        if(stream_paths == NULL){
+            pthread_mutex_unlock(&stream->lock);
+            return false;
+        }
+        stream->paths = stream_paths;
+        stream->capacity = capacity;
+    }
+
+    char *end = paths + length;
+    for(char *line = paths; line < end;){
+        char *line_end = memchr(line, '\n', end - line);
+        if(line_end == NULL) line_end = end;
+        char *relative_path = line + stream->prefix_length;
+        size_t relative_length = (relative_path < line_end) ? (size_t)(line_end - relative_path) : 0;
+        // Like step 1, only the files of the subdirectories (the mailboxes) are analyzed
+        if(relative_length > 0 && memchr(relative_path, '/', relative_length) != NULL &&
+           !is_path_done(stream->checkpoint, relative_path, relative_length)){
+            memcpy(stream->paths + stream->write_offset, relative_path, relative_length);
+            stream->write_offset += relative_length;
+            stream->paths[stream->write_offset++] = '\0';
+            ++stream->paths_count;
+        }
+        line = line_end + 1;
+    }
+    pthread_cond_signal(&stream->paths_available);
+    pthread_mutex_unlock(&stream->lock);
+    return true;
+}
+
+/*!
+ * @brief walk_data_source is the thread walking the data source when streaming
+ * @param argument the stream
+ * @return NULL
+ */
+static void *walk_data_source(void *argument) {
+    file_stream_t *stream = argument;
+    bool is_successful = walk_directory_to_sink(stream->data_source, stream_paths, stream);
+    pthread_mutex_lock(&stream->lock);
+    stream->is_done = true;
+    stream->is_successful = is_successful;
+    pthread_cond_signal(&stream->paths_available);
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+/*!
+ * @brief start_file_stream starts the walk of the data source, whose paths are then given as tasks (streaming)
+ * @param tasks the tasks to initialize
+ * @param data_source the data source directory
+ * @param temp_files the temporary files directory
+ * @param chunk_size the maximum number of files in a task
+ * @param is_resumed true to resume an interrupted run
+ * @return true on success, false if the walk could not be started
+ */
+bool start_file_stream(file_tasks_t *tasks, char *data_source, char *temp_files, uint32_t chunk_size,
+                       bool is_resumed) {
+    if(tasks == NULL || data_source == NULL || temp_files == NULL || chunk_size == 0) return false;
+    size_t data_source_length = strlen(data_source);
+    if(data_source_length == 0 || data_source_length + 1 >= STR_MAX_LEN) return false;
+    if(!init_file_tasks(tasks, data_source, temp_files, chunk_size, is_resumed)) return false;
+
+    file_stream_t *stream = calloc(1, sizeof(file_stream_t));
+    if(stream == NULL || (stream->paths = malloc(FILE_STREAM_INITIAL_CAPACITY)) == NULL){
+        fprintf(stderr, "[ERROR] Could not allocate the files stream\n");
+        free(stream);
+        close_checkpoint(&tasks->checkpoint);
+        return false;
+    }
+    stream->capacity = FILE_STREAM_INITIAL_CAPACITY;
+    stream->chunk_size = chunk_size;
+    strcpy(stream->data_source, data_source);
+    stream->prefix_length = data_source_length + (data_source[data_source_length - 1] != '/');
+    stream->checkpoint = &tasks->checkpoint;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->paths_available, NULL);
+    if(pthread_create(&stream->walker_thread, NULL, walk_data_source, stream) != 0){
+        fprintf(stderr, "[ERROR] Could not start the walk of %s\n", data_source);
+        pthread_cond_destroy(&stream->paths_available);
+        pthread_mutex_destroy(&stream->lock);
+        free(stream->paths);
+        free(stream);
+        close_checkpoint(&tasks->checkpoint);
+        return false;
+    }
+    tasks->stream = stream;
+    return true;
+}
+
+/*!
+ * @brief next_stream_task waits for a batch of paths from the walk, and packs it into a task
+ * @param stream the stream
+ * @param batch_task the task to fill
+ * @return the size of the paths of the task, 0 once the walk is over and all paths were sent
+ */
+static size_t next_stream_task(file_stream_t *stream, file_batch_task_t *batch_task) {
+    pthread_mutex_lock(&stream->lock);
+    // A task is sent once full, or with the last paths of the walk
+    while(!stream->is_done && stream->paths_count < stream->chunk_size &&
+          stream->write_offset - stream->read_offset < FILE_BATCH_PATHS_SIZE){
+        pthread_cond_wait(&stream->paths_available, &stream->lock);
+    }
+    size_t used = 0;
+    while(stream->paths_count > 0 && batch_task->files_count < stream->chunk_size){
+        char *path = stream->paths + stream->read_offset;
+        size_t length = strlen(path) + 1;
+        if(used + length > FILE_BATCH_PATHS_SIZE) break;
+        memcpy(batch_task->paths + used, path, length);
+        used += length;
+        stream->read_offset += length;
+        --stream->paths_count;
+        ++batch_task->files_count;
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return used;
+}
+
+/*!
+ * @brief relative_data_path gives the path of a file of step1_output relative to the data source
+ * @param tasks the tasks
+ * @param path the path listed in step1_output
+ * @return the relative path (in path), path itself if it is not in the data source
+ */
+static char *relative_data_path(file_tasks_t *tasks, char *path) {
+    size_t data_source_length = strlen(tasks->data_source);
+    if(data_source_length == 0 || strncmp(path, tasks->data_source, data_source_length) != 0) return path;
+    char *suffix = path + data_source_length;
+    if(*suffix != '/' && tasks->data_source[data_source_length - 1] != '/') return path;
+    while(*suffix == '/') ++suffix;
+    return (*suffix == '\0') ? path : suffix;
+}
+
+/*!
+ * @brief next_range_task reads the next range of lines of step1_output, keeping its paths for the tasks log
+ * @param tasks the tasks
+ * @param range_task the task to fill
+ * @param paths_size set to the size of the paths of the range, 0 if they could not all be kept
+ * @return true if a non empty range was read, false at the end of step1_output
+ */
+static bool next_range_task(file_tasks_t *tasks, file_range_task_t *range_task, size_t *paths_size) {
+    range_task->start_offset = ftello(tasks->files_list);
+    char line[STR_MAX_LEN] = "";
+    uint32_t lines_count = 0;
+    bool is_complete = true;
+    *paths_size = 0;
+    while(lines_count < tasks->chunk_size && fgets(line, STR_MAX_LEN, tasks->files_list) != NULL){
+        // Lines longer than the buffer are read in several times, but counted once
+        char *line_end = strchr(line, '\n');
+        if(line_end == NULL) continue;
+        ++lines_count;
+        *line_end = '\0';
+        char *path = relative_data_path(tasks, line);
+        size_t length = strlen(path) + 1;
+        if(!is_complete) continue;
+        if(*paths_size + length > tasks->range_paths_capacity){
+            size_t capacity = (tasks->range_paths_capacity == 0) ? 16 * STR_MAX_LEN : 2 * tasks->range_paths_capacity;
+            while(*paths_size + length > capacity) capacity *= 2;
+            char *range_paths = realloc(tasks->range_paths, capacity);
+            if(range_paths == NULL){
+                fprintf(stderr, "[ERROR] Could not allocate the paths of a task, it will not be resumable\n");
+                is_complete = false;
+                continue;
+            }
+            tasks->range_paths = range_paths;
+            tasks->range_paths_capacity = capacity;
+        }
+        memcpy(tasks->range_paths + *paths_size, path, length);
+        *paths_size += length;
+    }
+    if(!is_complete) *paths_size = 0;
+    range_task->end_offset = ftello(tasks->files_list);
+    return range_task->end_offset > range_task->start_offset;
+}
+
+/*!
+ * @brief next_list_batch_task packs the next files of step1_output that are not done into a task (resuming step by
+ * step: the files of committed tasks are skipped, so ranges can not be used)
+ * @param tasks the tasks
+ * @param batch_task the task to fill
+ * @return the size of the paths of the task, 0 at the end of step1_output
+ */
+static size_t next_list_batch_task(file_tasks_t *tasks, file_batch_task_t *batch_task) {
+    char line[STR_MAX_LEN] = "";
+    size_t used = 0;
+    while(batch_task->files_count < tasks->chunk_size){
+        off_t line_offset = ftello(tasks->files_list);
+        if(fgets(line, STR_MAX_LEN, tasks->files_list) == NULL) break;
+        char *line_end = strchr(line, '\n');
+        if(line_end != NULL) *line_end = '\0';
+        char *path = relative_data_path(tasks, line);
+        size_t length = strlen(path) + 1;
+        if(length == 1 || is_path_done(&tasks->checkpoint, path, length - 1)) continue;
+        // The path is read again by the next task
+        if(used + length > FILE_BATCH_PATHS_SIZE){
+            fseeko(tasks->files_list, line_offset, SEEK_SET);
+            break;
+        }
+        memcpy(batch_task->paths + used, path, length);
+        used += length;
+        ++batch_task->files_count;
+    }
+    return used;
+}
+
+/*!
+ * @brief next_file_task gives the next task of the files step: a range of step1_output, or a batch of streamed paths
+ * (waiting for the walk to find them). The task is written to the tasks log before it is returned.
+ * @param tasks the tasks
+ * @param task the task to fill
+ * @return true if a task was filled, false when there is no task left
+ */
+bool next_file_task(file_tasks_t *tasks, task_t *task) {
+    if(tasks == NULL || task == NULL) return false;
+    memset(task, 0, sizeof(task_t));
+    if(tasks->stream != NULL || tasks->checkpoint.done_paths.count > 0){
+        file_batch_task_t *batch_task = (file_batch_task_t *)task;
+        batch_task->task_callback = process_file_batch;
+        size_t paths_size = (tasks->stream != NULL) ? next_stream_task(tasks->stream, batch_task)
+                                                    : next_list_batch_task(tasks, batch_task);
+        if(paths_size == 0) return false;
+        batch_task->task_id = log_task(&tasks->checkpoint, batch_task->paths, paths_size);
+        return true;
+    }
+    file_range_task_t *range_task = (file_range_task_t *)task;
+    range_task->task_callback = process_file_range;
+    strcpy(range_task->temporary_directory, tasks->temporary_directory);
+    size_t paths_size = 0;
+    if(!next_range_task(tasks, range_task, &paths_size)) return false;
+    range_task->task_id = (paths_size > 0) ? log_task(&tasks->checkpoint, tasks->range_paths, paths_size)
+                                           : CHECKPOINT_NO_TASK;
+    return true;
+}
+
+/*!
+ * @brief close_file_tasks releases the tasks, waiting for the end of the walk when streaming
+ * @param tasks the tasks
+ * @return true if all the files were listed, false if the walk failed
+ */
+bool close_file_tasks(file_tasks_t *tasks) {
+    if(tasks == NULL) return false;
+    bool is_successful = true;
+    if(tasks->files_list != NULL) fclose(tasks->files_list);
+    if(tasks->stream != NULL){
+        file_stream_t *stream = tasks->stream;
+        pthread_join(stream->walker_thread, NULL);
+        is_successful = stream->is_successful;
+        pthread_cond_destroy(&stream->paths_available);
+        pthread_mutex_destroy(&stream->lock);
+        free(stream->paths);
+        free(stream);
+    }
+    close_checkpoint(&tasks->checkpoint);
+    free(tasks->range_paths);
+    memset(tasks, 0, sizeof(file_tasks_t));
+    return is_successful;
+}
@@ -0,0 +1,38 @@
+#ifndef A2022_FILE_TASKS_H
+#define A2022_FILE_TASKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "global_defs.h"
+#include "checkpoint.h"
+
+typedef struct _file_stream file_stream_t;
+
+/*
+ * Source of the tasks of the files step. Step by step, the tasks are ranges of step1_output, written once the whole
+ * data source is listed. When streaming, a walk of the data source runs in the background and the tasks are batches
+ * of the paths it found, so that files are parsed while the data source is still being listed.
+ * Each task is written to the tasks log of the checkpoint before it is sent. When resuming an interrupted run, the
+ * files of its committed tasks are skipped, and step by step the other files are sent by batches instead of ranges.
+ */
+typedef struct {
+    FILE *files_list;           // step1_output, step by step
+    file_stream_t *stream;      // Paths found by the walk, when streaming
+    uint32_t chunk_size;
+    char temporary_directory[STR_MAX_LEN];
+    char data_source[STR_MAX_LEN];
+    checkpoint_t checkpoint;
+    char *range_paths;          // Paths of the last range of step1_output, relative to the data source, for the log
+    size_t range_paths_capacity;
+} file_tasks_t;
+
+bool open_files_list_tasks(file_tasks_t *tasks, char *data_source, char *temp_files, uint32_t chunk_size,
+                           bool is_resumed);
+bool start_file_stream(file_tasks_t *tasks, char *data_source, char *temp_files, uint32_t chunk_size,
+                       bool is_resumed);
+bool next_file_task(file_tasks_t *tasks, task_t *task);
+bool close_file_tasks(file_tasks_t *tasks);
+
+#endif //A2022_FILE_TASKS_H
@@ -0,0 +1,266 @@
+#include "graph_analytics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Degrees of the addresses, either as senders or as recipients
+typedef struct {
+    uint64_t addresses;         // Addresses with a degree of 1 or more
+    uint64_t buckets[GRAPH_DEGREE_BUCKETS];
+    uint64_t max;
+    uint32_t max_id;            // Lowest ID with the maximum degree
+} degree_stats_t;
+
+// Analytics of a range of sender IDs, computed by a thread
+typedef struct {
+    graph_t *graph;
+    uint32_t first_id;
+    uint32_t end_id;
+    degree_stats_t out_degrees;
+    degree_stats_t in_degrees;
+    uint64_t volume;            // Sum of the counts of the pairs
+    uint64_t reciprocal_pairs;
+    uint64_t self_pairs;
+    graph_pair_t top_pairs[GRAPH_ANALYTICS_TOP_PAIRS];   // Heap of the heaviest pairs, the lightest one first
+    uint32_t top_pairs_count;
+    bool is_failed;
+    pthread_t thread;
+    bool is_started;
+} analytics_range_t;
+
+/*!
+ * @brief add_degree counts the degree of an address
+ * @param stats the degrees
+ * @param id the ID of the address (IDs are added in increasing order)
+ * @param degree the degree of the address
+ */
+static void add_degree(degree_stats_t *stats, uint32_t id, uint64_t degree) {
+    if(degree == 0) return;
+    ++stats->addresses;
+    ++stats->buckets[63 - __builtin_clzll(degree)];
+    if(degree > stats->max){
+        stats->max = degree;
+        stats->max_id = id;
+    }
+}
+
+/*!
+ * @brief merge_degrees adds the degrees of a range of IDs to those of the previous ranges
+ * @param stats the degrees of the previous ranges
+ * @param range_stats the degrees of the next range
+ */
+static void merge_degrees(degree_stats_t *stats, degree_stats_t *range_stats) {
+    stats->addresses += range_stats->addresses;
+    for(uint32_t b = 0; b < GRAPH_DEGREE_BUCKETS; ++b) stats->buckets[b] += range_stats->buckets[b];
+    if(range_stats->max > stats->max){
+        stats->max = range_stats->max;
+        stats->max_id = range_stats->max_id;
+    }
+}
+
+/*!
+ * @brief push_top_pair keeps a pair if it is among the heaviest pairs of a range (a heap of at most
+ * GRAPH_ANALYTICS_TOP_PAIRS pairs, whose first pair is the lightest one)
+ * @param range the range
+ * @param pair the pair
+ */
+static void push_top_pair(analytics_range_t *range, graph_pair_t pair) {
+    graph_pair_t *heap = range->top_pairs;
+    uint32_t index;
+    if(range->top_pairs_count < GRAPH_ANALYTICS_TOP_PAIRS){
+        index = range->top_pairs_count++;
+        while(index > 0 && graph_compare_pairs(&pair, &heap[(index - 1) / 2]) > 0){
+            heap[index] = heap[(index - 1) / 2];
+            index = (index - 1) / 2;
+        }
+        heap[index] = pair;
+        return;
+    }
+    if(graph_compare_pairs(&pair, &heap[0]) >= 0) return;
+    index = 0;
+    while(true){
+        uint32_t lightest = index;
+        uint32_t child = 2 * index + 1;
+        graph_pair_t *lightest_pair = &pair;
+        for(uint32_t c = child; c < child + 2 && c < range->top_pairs_count; ++c){
+            if(graph_compare_pairs(&heap[c], lightest_pair) > 0){
+                lightest = c;
+                lightest_pair = &heap[c];
+            }
+        }
+        if(lightest == index) break;
+        heap[index] = heap[lightest];
+        index = lightest;
+    }
+    heap[index] = pair;
+}
+
+/*!
+ * @brief analyze_range computes the analytics of a range of sender IDs. A pair is reciprocal if its sender is among
+ * the recipients of its recipient: the senders of each address are marked with it, before its recipients are checked.
+ * @param arg the range (analytics_range_t)
+ * @return NULL
+ */
+static void *analyze_range(void *arg) {
+    analytics_range_t *range = arg;
+    graph_t *graph = range->graph;
+    uint32_t *marks = calloc((size_t)graph->addresses_count + 1, sizeof(uint32_t));
+    if(marks == NULL){
+        range->is_failed = true;
+        return NULL;
+    }
+    for(uint32_t id = range->first_id; id < range->end_id && !range->is_failed; ++id){
+        const graph_edge_t *senders;
+        const graph_edge_t *recipients;
+        uint64_t senders_count = graph_senders(graph, id, &senders);
+        uint64_t recipients_count = graph_recipients(graph, id, &recipients);
+        add_degree(&range->out_degrees, id, recipients_count);
+        add_degree(&range->in_degrees, id, senders_count);
+        for(uint64_t i = 0; i < senders_count && !range->is_failed; ++i){
+            range->is_failed = senders[i].id >= graph->addresses_count;
+            if(!range->is_failed) marks[senders[i].id] = id + 1;
+        }
+        for(uint64_t i = 0; i < recipients_count && !range->is_failed; ++i){
+            uint32_t recipient_id = recipients[i].id;
+            range->is_failed = recipient_id >= graph->addresses_count;
+            if(range->is_failed) break;
+            range->volume += recipients[i].count;
+            if(recipient_id == id) ++range->self_pairs;
+            else if(marks[recipient_id] == id + 1) ++range->reciprocal_pairs;
+            push_top_pair(range, (graph_pair_t){id, recipient_id, recipients[i].count, 0});
+        }
+    }
+    free(marks);
+    return NULL;
+}
+
+/*!
+ * @brief first_id_of_edge gives the first sender whose edges start at or after an edge (binary search of the rows)
+ * @param graph the graph
+ * @param edge the index of the edge
+ * @return the ID of the sender, addresses_count if there is none
+ */
+static uint32_t first_id_of_edge(graph_t *graph, uint64_t edge) {
+    uint32_t low = 0;
+    uint32_t high = graph->addresses_count;
+    while(low < high){
+        uint32_t middle = low + (high - low) / 2;
+        if(graph->sender_rows[middle] < edge) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+/*!
+ * @brief print_distribution writes the distribution of the degrees by powers of 2
+ * @param report the report
+ * @param title the title of the distribution
+ * @param stats the degrees
+ */
+static void print_distribution(FILE *report, const char *title, degree_stats_t *stats) {
+    fprintf(report, "%s distribution:\n", title);
+    for(uint32_t b = 0; b < GRAPH_DEGREE_BUCKETS; ++b){
+        if(stats->buckets[b] == 0) continue;
+        uint64_t first = (uint64_t)1 << b;
+        if(b == 0) fprintf(report, "\t1: %lu\n", stats->buckets[b]);
+        else fprintf(report, "\t%lu-%lu: %lu\n", first, 2 * first - 1, stats->buckets[b]);
+    }
+}
+
+/*!
+ * @brief print_report writes the analytics of the graph, merged from its ranges
+ * @param report the report
+ * @param graph the graph
+ * @param ranges the ranges, in order of ID
+ * @param ranges_count the count of ranges
+ */
+static void print_report(FILE *report, graph_t *graph, analytics_range_t *ranges, uint32_t ranges_count) {
+    degree_stats_t out_degrees;
+    degree_stats_t in_degrees;
+    memset(&out_degrees, 0, sizeof(degree_stats_t));
+    memset(&in_degrees, 0, sizeof(degree_stats_t));
+    uint64_t volume = 0;
+    uint64_t reciprocal_pairs = 0;
+    uint64_t self_pairs = 0;
+    graph_pair_t top_pairs[GRAPH_ANALYTICS_TOP_PAIRS * GRAPH_ANALYTICS_MAX_THREADS];
+    uint32_t top_pairs_count = 0;
+    for(uint32_t r = 0; r < ranges_count; ++r){
+        merge_degrees(&out_degrees, &ranges[r].out_degrees);
+        merge_degrees(&in_degrees, &ranges[r].in_degrees);
+        volume += ranges[r].volume;
+        reciprocal_pairs += ranges[r].reciprocal_pairs;
+        self_pairs += ranges[r].self_pairs;
+        memcpy(&top_pairs[top_pairs_count], ranges[r].top_pairs, ranges[r].top_pairs_count * sizeof(graph_pair_t));
+        top_pairs_count += ranges[r].top_pairs_count;
+    }
+    qsort(top_pairs, top_pairs_count, sizeof(graph_pair_t), graph_compare_pairs);
+    if(top_pairs_count > GRAPH_ANALYTICS_TOP_PAIRS) top_pairs_count = GRAPH_ANALYTICS_TOP_PAIRS;
+
+    uint64_t pairs = graph->edges_count;
+    fprintf(report, "Addresses: %u\n", graph->addresses_count);
+    fprintf(report, "Pairs: %lu, for %lu recipients of e-mails\n", pairs, volume);
+    fprintf(report, "Senders: %lu, out-degree mean %.2f, max %lu (%s)\n", out_degrees.addresses,
+            out_degrees.addresses ? (double)pairs / out_degrees.addresses : 0.0, out_degrees.max,
+            out_degrees.addresses ? graph_address(graph, out_degrees.max_id) : "none");
+    fprintf(report, "Recipients: %lu, in-degree mean %.2f, max %lu (%s)\n", in_degrees.addresses,
+            in_degrees.addresses ? (double)pairs / in_degrees.addresses : 0.0, in_degrees.max,
+            in_degrees.addresses ? graph_address(graph, in_degrees.max_id) : "none");
+    fprintf(report, "Reciprocal pairs: %lu of %lu (%.2f%%), %lu mutual relations, %lu self pairs\n", reciprocal_pairs,
+            pairs - self_pairs, (pairs > self_pairs) ? 100.0 * reciprocal_pairs / (pairs - self_pairs) : 0.0,
+            reciprocal_pairs / 2, self_pairs);
+    print_distribution(report, "Out-degree", &out_degrees);
+    print_distribution(report, "In-degree", &in_degrees);
+    fprintf(report, "Top %u pairs:\n", top_pairs_count);
+    for(uint32_t i = 0; i < top_pairs_count; ++i){
+        fprintf(report, "\t%u: %s %s\n", top_pairs[i].count, graph_address(graph, top_pairs[i].sender_id),
+                graph_address(graph, top_pairs[i].recipient_id));
+    }
+}
+
+/*!
+ * @brief write_graph_report computes the analytics of a graph (@see graph_analytics.h) and writes them to a report.
+ * The senders are split in ranges of about the same count of pairs, each one analyzed by a thread (or by the caller,
+ * if the thread can not be created).
+ * @param graph the graph
+ * @param report_path the path to the report
+ * @param threads_count the count of threads (at most GRAPH_ANALYTICS_MAX_THREADS)
+ * @return true on success, false on error
+ */
+bool write_graph_report(graph_t *graph, char *report_path, uint32_t threads_count) {
+    if(threads_count < 1) threads_count = 1;
+    if(threads_count > GRAPH_ANALYTICS_MAX_THREADS) threads_count = GRAPH_ANALYTICS_MAX_THREADS;
+    analytics_range_t ranges[GRAPH_ANALYTICS_MAX_THREADS];
+    memset(ranges, 0, threads_count * sizeof(analytics_range_t));
+    for(uint32_t t = 0; t < threads_count; ++t){
+        ranges[t].graph = graph;
+        ranges[t].first_id = (t == 0) ? 0 : ranges[t - 1].end_id;
+        if(t + 1 == threads_count) ranges[t].end_id = graph->addresses_count;
+        else ranges[t].end_id = first_id_of_edge(graph, graph->edges_count * (t + 1) / threads_count);
+        if(ranges[t].end_id < ranges[t].first_id) ranges[t].end_id = ranges[t].first_id;
+        ranges[t].is_started = pthread_create(&ranges[t].thread, NULL, analyze_range, &ranges[t]) == 0;
+        if(!ranges[t].is_started) analyze_range(&ranges[t]);
+    }
+    bool is_analyzed = true;
+    for(uint32_t t = 0; t < threads_count; ++t){
+        if(ranges[t].is_started) pthread_join(ranges[t].thread, NULL);
+        if(ranges[t].is_failed) is_analyzed = false;
+    }
+    if(!is_analyzed){
+        fprintf(stderr, "[ERROR] Could not analyze the graph\n");
+        return false;
+    }
+
+    FILE *report = fopen(report_path, "w");
+    if(report == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", report_path, strerror(errno));
+        return false;
+    }
+    print_report(report, graph, ranges, threads_count);
+    bool is_written = !ferror(report);
+    if(fclose(report) != 0) is_written = false;
+    if(!is_written) fprintf(stderr, "[ERROR] Could not write %s\n", report_path);
+    return is_written;
+}
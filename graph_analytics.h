@@ -0,0 +1,24 @@
+#ifndef A2022_GRAPH_ANALYTICS_H
+#define A2022_GRAPH_ANALYTICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "graph_file.h"
+
+/*
+ * Analytics of the communication graph, computed by threads over ranges of sender IDs (holding about the same count of
+ * pairs each) and written as a text report:
+ * - degrees: distinct recipients of each sender (out-degree) and distinct senders of each recipient (in-degree), with
+ * their mean, maximum and distribution by powers of 2;
+ * - reciprocity: pairs whose recipient also wrote to the sender (pairs of an address with itself aside);
+ * - the heaviest pairs, by count.
+ */
+#define GRAPH_ANALYTICS_TOP_PAIRS 20
+#define GRAPH_ANALYTICS_MAX_THREADS 64
+// Buckets of the degree distributions: 1, 2-3, 4-7... up to 2^32 - 1
+#define GRAPH_DEGREE_BUCKETS 33
+
+bool write_graph_report(graph_t *graph, char *report_path, uint32_t threads_count);
+
+#endif //A2022_GRAPH_ANALYTICS_H
@@ -0,0 +1,472 @@
+#include "graph_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "address_dict.h"
+#include "global_defs.h"
+
+// Sections of the file are aligned on this size, so that their arrays can be read in place once mapped
+#define GRAPH_ALIGNMENT 8
+
+// Address of the dictionary, with its ID in the dictionary, sorted to give its ID in the graph
+typedef struct {
+    const char *address;
+    uint32_t id;
+} graph_address_t;
+
+// Pairs of the output, with the addresses of the graph
+typedef struct {
+    graph_pair_t *pairs;
+    uint64_t count;
+    uint64_t capacity;
+} graph_pairs_t;
+
+/*!
+ * @brief align_offset rounds an offset up to the alignment of the sections
+ * @param offset the offset
+ * @return the aligned offset
+ */
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + GRAPH_ALIGNMENT - 1) & ~(uint64_t)(GRAPH_ALIGNMENT - 1);
+}
+
+/*!
+ * @brief add_pair appends a (sender, recipient) pair to the pairs read from the output
+ * @param pairs the pairs
+ * @param sender_id the ID of the sender in the dictionary
+ * @param recipient_id the ID of the recipient in the dictionary
+ * @param count the occurrences of the pair
+ * @return true on success, false if allocation failed
+ */
+static bool add_pair(graph_pairs_t *pairs, uint32_t sender_id, uint32_t recipient_id, uint32_t count) {
+    if(pairs->count == pairs->capacity){
+        uint64_t capacity = (pairs->capacity == 0) ? 4096 : 2 * pairs->capacity;
+        graph_pair_t *grown = realloc(pairs->pairs, capacity * sizeof(graph_pair_t));
+        if(grown == NULL) return false;
+        pairs->pairs = grown;
+        pairs->capacity = capacity;
+    }
+    pairs->pairs[pairs->count++] = (graph_pair_t){sender_id, recipient_id, count, 0};
+    return true;
+}
+
+/*!
+ * @brief read_output_line adds the pairs of a line of the output ("sender N: recipient N: recipient...")
+ * @param line the line, without its end of line
+ * @param addresses the dictionary of the addresses
+ * @param pairs the pairs
+ * @return true on success, false if the line is malformed or allocation failed
+ */
+static bool read_output_line(char *line, address_dict_t *addresses, graph_pairs_t *pairs) {
+    size_t length = strcspn(line, " ");
+    if(length == 0) return false;
+    uint32_t sender_id = address_dict_intern(addresses, line, length, NULL);
+    if(sender_id == ADDRESS_DICT_INVALID_ID) return false;
+    char *cur = line + length;
+    while(*cur == ' '){
+        char *end;
+        errno = 0;
+        unsigned long count = strtoul(cur + 1, &end, 10);
+        if(end == cur + 1 || errno != 0 || count > UINT32_MAX || end[0] != ':' || end[1] != ' ') return false;
+        cur = end + 2;
+        length = strcspn(cur, " ");
+        if(length == 0) return false;
+        uint32_t recipient_id = address_dict_intern(addresses, cur, length, NULL);
+        if(recipient_id == ADDRESS_DICT_INVALID_ID || !add_pair(pairs, sender_id, recipient_id, count)) return false;
+        cur += length;
+    }
+    return *cur == '\0';
+}
+
+/*!
+ * @brief compare_addresses orders two addresses of the dictionary
+ * @param a a pointer to a graph_address_t
+ * @param b a pointer to a graph_address_t
+ * @return a negative value if a comes first, a positive value if b comes first
+ */
+static int compare_addresses(const void *a, const void *b) {
+    return strcmp(((const graph_address_t *)a)->address, ((const graph_address_t *)b)->address);
+}
+
+/*!
+ * @brief compare_edges orders the edges of a row by descending count, then by address (IDs follow the addresses)
+ * @param a a pointer to a graph_edge_t
+ * @param b a pointer to a graph_edge_t
+ * @return a negative value if a comes first, a positive value if b comes first
+ */
+static int compare_edges(const void *a, const void *b) {
+    const graph_edge_t *first = a;
+    const graph_edge_t *second = b;
+    if(first->count != second->count) return (first->count > second->count) ? -1 : 1;
+    return (first->id > second->id) - (first->id < second->id);
+}
+
+/*!
+ * @brief graph_compare_pairs orders pairs by descending count, then by sender and recipient
+ * @param a a pointer to a graph_pair_t
+ * @param b a pointer to a graph_pair_t
+ * @return a negative value if a comes first, a positive value if b comes first
+ */
+int graph_compare_pairs(const void *a, const void *b) {
+    const graph_pair_t *first = a;
+    const graph_pair_t *second = b;
+    if(first->count != second->count) return (first->count > second->count) ? -1 : 1;
+    if(first->sender_id != second->sender_id) return (first->sender_id > second->sender_id) ? 1 : -1;
+    return (first->recipient_id > second->recipient_id) - (first->recipient_id < second->recipient_id);
+}
+
+/*!
+ * @brief build_rows builds the compressed sparse rows of the pairs, by sender or by recipient (counting sort)
+ * @param pairs the pairs, with the IDs of the graph
+ * @param addresses_count the count of addresses
+ * @param is_by_sender true for the rows of the senders (edges to their recipients), false for those of the recipients
+ * @param rows set to the index of the first edge of each address, plus the count of edges (zeroed by the caller)
+ * @param edges set to the edges, one per pair, sorted in each row (@see compare_edges)
+ * @return true on success, false if allocation failed
+ */
+static bool build_rows(graph_pairs_t *pairs, uint32_t addresses_count, bool is_by_sender, uint64_t *rows,
+                       graph_edge_t *edges) {
+    uint64_t *next_edges = malloc(((size_t)addresses_count + 1) * sizeof(uint64_t));
+    if(next_edges == NULL) return false;
+    for(uint64_t i = 0; i < pairs->count; ++i){
+        ++rows[(is_by_sender ? pairs->pairs[i].sender_id : pairs->pairs[i].recipient_id) + 1];
+    }
+    for(uint32_t id = 0; id < addresses_count; ++id) rows[id + 1] += rows[id];
+    memcpy(next_edges, rows, ((size_t)addresses_count + 1) * sizeof(uint64_t));
+    for(uint64_t i = 0; i < pairs->count; ++i){
+        graph_pair_t *pair = &pairs->pairs[i];
+        uint32_t row = is_by_sender ? pair->sender_id : pair->recipient_id;
+        edges[next_edges[row]++] = (graph_edge_t){is_by_sender ? pair->recipient_id : pair->sender_id, pair->count};
+    }
+    free(next_edges);
+    for(uint32_t id = 0; id < addresses_count; ++id){
+        qsort(edges + rows[id], rows[id + 1] - rows[id], sizeof(graph_edge_t), compare_edges);
+    }
+    return true;
+}
+
+/*!
+ * @brief is_section_valid tells if an array of the graph lies in its image, aligned
+ * @param size the size of the image
+ * @param offset the offset of the array
+ * @param count the count of elements
+ * @param element_size the size of an element
+ * @return true if the array can be read in place
+ */
+static bool is_section_valid(uint64_t size, uint64_t offset, uint64_t count, uint64_t element_size) {
+    return offset % GRAPH_ALIGNMENT == 0 && offset <= size && count <= (size - offset) / element_size;
+}
+
+/*!
+ * @brief attach_sections points a graph to the sections of its image, once its header is checked
+ * @param graph the graph, holding its image
+ * @param path the path to the graph file (or to the output file it is built from), for errors
+ * @return true on success, false if the image is not a valid graph (the graph is then closed)
+ */
+static bool attach_sections(graph_t *graph, char *path) {
+    graph_header_t header;
+    memcpy(&header, graph->data, sizeof(graph_header_t));
+    if(memcmp(header.magic, GRAPH_MAGIC, GRAPH_MAGIC_SIZE) != 0 || header.version != GRAPH_VERSION){
+        fprintf(stderr, "[ERROR] %s is not a graph file of version %u\n", path, GRAPH_VERSION);
+        graph_close(graph);
+        return false;
+    }
+    uint64_t rows_count = (uint64_t)header.addresses_count + 1;
+    if(!is_section_valid(graph->size, header.addresses_offset, header.addresses_count, sizeof(uint64_t)) ||
+       !is_section_valid(graph->size, header.strings_offset, header.strings_size, 1) ||
+       !is_section_valid(graph->size, header.sender_rows_offset, rows_count, sizeof(uint64_t)) ||
+       !is_section_valid(graph->size, header.sender_edges_offset, header.edges_count, sizeof(graph_edge_t)) ||
+       !is_section_valid(graph->size, header.recipient_rows_offset, rows_count, sizeof(uint64_t)) ||
+       !is_section_valid(graph->size, header.recipient_edges_offset, header.edges_count, sizeof(graph_edge_t)) ||
+       !is_section_valid(graph->size, header.top_pairs_offset, header.top_pairs_count, sizeof(graph_pair_t)) ||
+       (header.strings_size > 0 && graph->data[header.strings_offset + header.strings_size - 1] != '\0')){
+        fprintf(stderr, "[ERROR] %s is truncated or corrupted\n", path);
+        graph_close(graph);
+        return false;
+    }
+    graph->addresses_count = header.addresses_count;
+    graph->top_pairs_count = header.top_pairs_count;
+    graph->edges_count = header.edges_count;
+    graph->addresses = (const uint64_t *)(graph->data + header.addresses_offset);
+    graph->strings = (const char *)(graph->data + header.strings_offset);
+    graph->strings_size = header.strings_size;
+    graph->sender_rows = (const uint64_t *)(graph->data + header.sender_rows_offset);
+    graph->sender_edges = (const graph_edge_t *)(graph->data + header.sender_edges_offset);
+    graph->recipient_rows = (const uint64_t *)(graph->data + header.recipient_rows_offset);
+    graph->recipient_edges = (const graph_edge_t *)(graph->data + header.recipient_edges_offset);
+    graph->top_pairs = (const graph_pair_t *)(graph->data + header.top_pairs_offset);
+    return true;
+}
+
+/*!
+ * @brief build_graph_image lays out a graph in memory the way it is written to a graph file
+ * @param graph the graph, set to own the image
+ * @param addresses the addresses, sorted
+ * @param addresses_count the count of addresses
+ * @param pairs the pairs, with the IDs of the graph (sorted by the function, @see graph_compare_pairs)
+ * @return true on success, false if allocation failed
+ */
+static bool build_graph_image(graph_t *graph, graph_address_t *addresses, uint32_t addresses_count,
+                              graph_pairs_t *pairs) {
+    graph_header_t header;
+    memset(&header, 0, sizeof(graph_header_t));
+    memcpy(header.magic, GRAPH_MAGIC, GRAPH_MAGIC_SIZE);
+    header.version = GRAPH_VERSION;
+    header.addresses_count = addresses_count;
+    header.edges_count = pairs->count;
+    for(uint32_t id = 0; id < addresses_count; ++id) header.strings_size += strlen(addresses[id].address) + 1;
+    header.top_pairs_count = (pairs->count < GRAPH_TOP_PAIRS) ? pairs->count : GRAPH_TOP_PAIRS;
+    uint64_t rows_size = ((uint64_t)addresses_count + 1) * sizeof(uint64_t);
+    uint64_t edges_size = header.edges_count * sizeof(graph_edge_t);
+    header.addresses_offset = align_offset(sizeof(graph_header_t));
+    header.strings_offset = align_offset(header.addresses_offset + (uint64_t)addresses_count * sizeof(uint64_t));
+    header.sender_rows_offset = align_offset(header.strings_offset + header.strings_size);
+    header.sender_edges_offset = align_offset(header.sender_rows_offset + rows_size);
+    header.recipient_rows_offset = align_offset(header.sender_edges_offset + edges_size);
+    header.recipient_edges_offset = align_offset(header.recipient_rows_offset + rows_size);
+    header.top_pairs_offset = align_offset(header.recipient_edges_offset + edges_size);
+    size_t size = header.top_pairs_offset + header.top_pairs_count * sizeof(graph_pair_t);
+
+    uint8_t *data = calloc(size, 1);
+    if(data == NULL) return false;
+    memcpy(data, &header, sizeof(graph_header_t));
+    uint64_t *address_offsets = (uint64_t *)(data + header.addresses_offset);
+    uint64_t strings_size = 0;
+    for(uint32_t id = 0; id < addresses_count; ++id){
+        size_t length = strlen(addresses[id].address) + 1;
+        address_offsets[id] = strings_size;
+        memcpy(data + header.strings_offset + strings_size, addresses[id].address, length);
+        strings_size += length;
+    }
+    if(!build_rows(pairs, addresses_count, true, (uint64_t *)(data + header.sender_rows_offset),
+                   (graph_edge_t *)(data + header.sender_edges_offset)) ||
+       !build_rows(pairs, addresses_count, false, (uint64_t *)(data + header.recipient_rows_offset),
+                   (graph_edge_t *)(data + header.recipient_edges_offset))){
+        free(data);
+        return false;
+    }
+    // The heaviest pairs are the first ones once they are all sorted: the pairs are not needed anymore
+    qsort(pairs->pairs, pairs->count, sizeof(graph_pair_t), graph_compare_pairs);
+    memcpy(data + header.top_pairs_offset, pairs->pairs, header.top_pairs_count * sizeof(graph_pair_t));
+    graph->data = data;
+    graph->size = size;
+    graph->is_mapped = false;
+    return true;
+}
+
+/*!
+ * @brief graph_build builds the communication graph of an output file in memory (@see graph_file.h), to be queried
+ * (@see graph_analytics.h) or written (@see graph_write)
+ * @param graph the graph to initialize
+ * @param output_path the path to the output file
+ * @return true on success, false on error (the graph is then empty)
+ */
+bool graph_build(graph_t *graph, char *output_path) {
+    memset(graph, 0, sizeof(graph_t));
+    FILE *output = fopen(output_path, "r");
+    if(output == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", output_path, strerror(errno));
+        return false;
+    }
+    address_dict_t addresses;
+    address_dict_init(&addresses);
+    graph_pairs_t pairs = {NULL, 0, 0};
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t line_length;
+    bool is_read = true;
+    while(is_read && (line_length = getline(&line, &line_size, output)) > 0){
+        if(line[line_length - 1] == '\n') line[line_length - 1] = '\0';
+        is_read = read_output_line(line, &addresses, &pairs);
+    }
+    free(line);
+    fclose(output);
+    if(!is_read){
+        fprintf(stderr, "[ERROR] Could not read the pairs of %s\n", output_path);
+        address_dict_free(&addresses);
+        free(pairs.pairs);
+        return false;
+    }
+
+    // IDs of the graph follow the order of the addresses, so that they are found by binary search
+    graph_address_t *sorted = malloc(((size_t)addresses.count + 1) * sizeof(graph_address_t));
+    uint32_t *ranks = malloc(((size_t)addresses.count + 1) * sizeof(uint32_t));
+    bool is_built = sorted != NULL && ranks != NULL;
+    if(is_built){
+        for(uint32_t id = 0; id < addresses.count; ++id){
+            sorted[id] = (graph_address_t){address_dict_get(&addresses, id), id};
+        }
+        qsort(sorted, addresses.count, sizeof(graph_address_t), compare_addresses);
+        for(uint32_t rank = 0; rank < addresses.count; ++rank) ranks[sorted[rank].id] = rank;
+        for(uint64_t i = 0; i < pairs.count; ++i){
+            pairs.pairs[i].sender_id = ranks[pairs.pairs[i].sender_id];
+            pairs.pairs[i].recipient_id = ranks[pairs.pairs[i].recipient_id];
+        }
+        is_built = build_graph_image(graph, sorted, addresses.count, &pairs);
+    }
+    if(!is_built) fprintf(stderr, "[ERROR] Could not allocate the graph of %s\n", output_path);
+    free(sorted);
+    free(ranks);
+    free(pairs.pairs);
+    address_dict_free(&addresses);
+    return is_built && attach_sections(graph, output_path);
+}
+
+/*!
+ * @brief graph_write writes a graph to a graph file. The graph is written to a temporary file, renamed once complete:
+ * a graph file is never partially written.
+ * @param graph the graph
+ * @param path the path to the graph file
+ * @return true on success, false on error
+ */
+bool graph_write(graph_t *graph, char *path) {
+    char written_path[STR_MAX_LEN] = "";
+    snprintf(written_path, STR_MAX_LEN, "%s.part", path);
+    FILE *file = fopen(written_path, "w");
+    if(file == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", written_path, strerror(errno));
+        return false;
+    }
+    bool is_written = fwrite(graph->data, 1, graph->size, file) == graph->size;
+    if(fclose(file) != 0) is_written = false;
+    if(!is_written){
+        fprintf(stderr, "[ERROR] Could not write %s : %s\n", written_path, strerror(errno));
+    }else if(rename(written_path, path) != 0){
+        fprintf(stderr, "[ERROR] Could not rename %s : %s\n", written_path, strerror(errno));
+        is_written = false;
+    }
+    if(!is_written) remove(written_path);
+    return is_written;
+}
+
+/*!
+ * @brief graph_open maps a graph file in memory. Only its header is checked: the pages of the sections are read when
+ * they are queried.
+ * @param graph the graph to initialize
+ * @param path the path to the graph file
+ * @return true on success, false on error (the graph is then empty)
+ */
+bool graph_open(graph_t *graph, char *path) {
+    memset(graph, 0, sizeof(graph_t));
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat graph_stat;
+    if(fstat(fd, &graph_stat) != 0){
+        fprintf(stderr, "[ERROR] Could not stat %s : %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    if((size_t)graph_stat.st_size < sizeof(graph_header_t)){
+        fprintf(stderr, "[ERROR] %s is not a graph file\n", path);
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, graph_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        fprintf(stderr, "[ERROR] Could not map %s : %s\n", path, strerror(errno));
+        return false;
+    }
+    graph->data = data;
+    graph->size = graph_stat.st_size;
+    graph->is_mapped = true;
+    return attach_sections(graph, path);
+}
+
+/*!
+ * @brief graph_close unmaps a graph file, or frees a graph built in memory
+ * @param graph the graph to close
+ */
+void graph_close(graph_t *graph) {
+    if(graph == NULL) return;
+    if(graph->data != NULL && graph->is_mapped) munmap(graph->data, graph->size);
+    else free(graph->data);
+    memset(graph, 0, sizeof(graph_t));
+}
+
+/*!
+ * @brief graph_address gives the address of an ID of the graph
+ * @param graph the graph
+ * @param id the ID
+ * @return the address, NULL if the ID or its offset is out of the graph
+ */
+const char *graph_address(graph_t *graph, uint32_t id) {
+    if(graph == NULL || id >= graph->addresses_count || graph->addresses[id] >= graph->strings_size) return NULL;
+    return graph->strings + graph->addresses[id];
+}
+
+/*!
+ * @brief graph_find looks for the ID of an address, by binary search of the sorted addresses
+ * @param graph the graph
+ * @param address the address
+ * @return the ID of the address, GRAPH_NO_ADDRESS if it is not in the graph
+ */
+uint32_t graph_find(graph_t *graph, const char *address) {
+    if(graph == NULL || address == NULL) return GRAPH_NO_ADDRESS;
+    uint32_t low = 0;
+    uint32_t high = graph->addresses_count;
+    while(low < high){
+        uint32_t middle = low + (high - low) / 2;
+        const char *middle_address = graph_address(graph, middle);
+        if(middle_address == NULL) return GRAPH_NO_ADDRESS;
+        int comparison = strcmp(address, middle_address);
+        if(comparison == 0) return middle;
+        if(comparison < 0) high = middle;
+        else low = middle + 1;
+    }
+    return GRAPH_NO_ADDRESS;
+}
+
+/*!
+ * @brief graph_row gives the edges of a row of the graph
+ * @param graph the graph
+ * @param rows the rows (of the senders or of the recipients)
+ * @param all_edges the edges of these rows
+ * @param id the ID of the address of the row
+ * @param edges set to the first edge of the row
+ * @return the count of edges of the row, 0 if the ID or the row is out of the graph
+ */
+static uint64_t graph_row(graph_t *graph, const uint64_t *rows, const graph_edge_t *all_edges, uint32_t id,
+                          const graph_edge_t **edges) {
+    *edges = NULL;
+    if(id >= graph->addresses_count) return 0;
+    uint64_t first = rows[id];
+    uint64_t end = rows[id + 1];
+    if(first > end || end > graph->edges_count) return 0;
+    *edges = all_edges + first;
+    return end - first;
+}
+
+/*!
+ * @brief graph_recipients gives the recipients of a sender, by descending count, then by address
+ * @param graph the graph
+ * @param id the ID of the sender
+ * @param edges set to the first edge of the sender (the ID of a recipient and its count)
+ * @return the count of recipients
+ */
+uint64_t graph_recipients(graph_t *graph, uint32_t id, const graph_edge_t **edges) {
+    if(graph == NULL) return 0;
+    return graph_row(graph, graph->sender_rows, graph->sender_edges, id, edges);
+}
+
+/*!
+ * @brief graph_senders gives the senders to a recipient, by descending count, then by address
+ * @param graph the graph
+ * @param id the ID of the recipient
+ * @param edges set to the first edge of the recipient (the ID of a sender and its count)
+ * @return the count of senders
+ */
+uint64_t graph_senders(graph_t *graph, uint32_t id, const graph_edge_t **edges) {
+    if(graph == NULL) return 0;
+    return graph_row(graph, graph->recipient_rows, graph->recipient_edges, id, edges);
+}
@@ -0,0 +1,88 @@
+#ifndef A2022_GRAPH_FILE_H
+#define A2022_GRAPH_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The communication graph is the output in binary form, built in memory from the output for the analytics (@see
+ * graph_analytics.h), and written as is to be mapped in memory and queried without being read (@see lp25-query). Its
+ * image is made of a header (graph_header_t) followed by these sections, each one aligned on 8 bytes:
+ * - the offsets of the addresses in the strings (uint64_t), sorted by address: the ID of an address is its rank, found
+ * by binary search;
+ * - the addresses, null terminated;
+ * - the rows of the senders, as compressed sparse rows: the index of the first edge of each address ID, plus the count
+ * of edges (addresses_count + 1 uint64_t), then the edges (graph_edge_t: recipient ID and count), sorted by descending
+ * count, then by address;
+ * - the rows of the recipients, the same way (each edge being a sender ID and its count);
+ * - the heaviest pairs of the graph (graph_pair_t), sorted by descending count, then by sender and recipient.
+ * Integers are in the byte order of the machine that wrote the file.
+ */
+#define GRAPH_MAGIC "LP2G"
+#define GRAPH_MAGIC_SIZE 4
+#define GRAPH_VERSION 1
+// Heaviest pairs kept in the graph
+#define GRAPH_TOP_PAIRS 1024
+// Returned by graph_find for unknown addresses
+#define GRAPH_NO_ADDRESS UINT32_MAX
+
+typedef struct {
+    uint32_t id;
+    uint32_t count;
+} graph_edge_t;
+
+typedef struct {
+    uint32_t sender_id;
+    uint32_t recipient_id;
+    uint32_t count;
+    uint32_t reserved;
+} graph_pair_t;
+
+typedef struct {
+    char magic[GRAPH_MAGIC_SIZE];
+    uint8_t version;
+    uint8_t reserved[3];
+    uint32_t addresses_count;
+    uint32_t top_pairs_count;
+    uint64_t edges_count;
+    uint64_t strings_size;
+    // Offsets of the sections in the file
+    uint64_t addresses_offset;
+    uint64_t strings_offset;
+    uint64_t sender_rows_offset;
+    uint64_t sender_edges_offset;
+    uint64_t recipient_rows_offset;
+    uint64_t recipient_edges_offset;
+    uint64_t top_pairs_offset;
+} graph_header_t;
+
+// A graph file mapped in memory, or a graph built in memory
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    bool is_mapped;
+    uint32_t addresses_count;
+    uint32_t top_pairs_count;
+    uint64_t edges_count;
+    const uint64_t *addresses;
+    const char *strings;
+    size_t strings_size;
+    const uint64_t *sender_rows;
+    const graph_edge_t *sender_edges;
+    const uint64_t *recipient_rows;
+    const graph_edge_t *recipient_edges;
+    const graph_pair_t *top_pairs;
+} graph_t;
+
+bool graph_build(graph_t *graph, char *output_path);
+bool graph_write(graph_t *graph, char *path);
+bool graph_open(graph_t *graph, char *path);
+void graph_close(graph_t *graph);
+uint32_t graph_find(graph_t *graph, const char *address);
+const char *graph_address(graph_t *graph, uint32_t id);
+uint64_t graph_recipients(graph_t *graph, uint32_t id, const graph_edge_t **edges);
+uint64_t graph_senders(graph_t *graph, uint32_t id, const graph_edge_t **edges);
+int graph_compare_pairs(const void *a, const void *b);
+
+#endif //A2022_GRAPH_FILE_H
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "graph_file.h"
+
+/*
+ * lp25-query answers queries on the communication graph written by lp25-project -g, without reading it: the graph is
+ * mapped in memory, and a query only reads the pages of the rows it needs.
+ * - sender <address> [N]: the (N first) recipients of an address, by descending count
+ * - recipient <address> [N]: the (N first) senders to an address, by descending count
+ * - top [N]: the N heaviest (sender, recipient) pairs of the graph (10 by default, at most 1024)
+ * Each line is "count: address", or "count: sender recipient" for the pairs. The time of the query is printed to the
+ * error output.
+ * Usage: lp25-query <graph> sender|recipient <address> [N] | top [N]
+ */
+
+/*!
+ * @brief print_edges prints the edges of a row of the graph
+ * @param graph the graph
+ * @param edges the edges
+ * @param count the count of edges
+ * @param limit the edges to print, 0 for all of them
+ * @return true on success, false if an edge is out of the graph
+ */
+static bool print_edges(graph_t *graph, const graph_edge_t *edges, uint64_t count, uint64_t limit) {
+    if(limit != 0 && limit < count) count = limit;
+    for(uint64_t i = 0; i < count; ++i){
+        const char *address = graph_address(graph, edges[i].id);
+        if(address == NULL) return false;
+        printf("%u: %s\n", edges[i].count, address);
+    }
+    return true;
+}
+
+/*!
+ * @brief print_top_pairs prints the heaviest pairs of the graph
+ * @param graph the graph
+ * @param limit the pairs to print
+ * @return true on success, false if a pair is out of the graph
+ */
+static bool print_top_pairs(graph_t *graph, uint64_t limit) {
+    if(limit > graph->top_pairs_count){
+        if(graph->top_pairs_count < graph->edges_count){
+            fprintf(stderr, "[WARN] Only the %u heaviest pairs are in the graph\n", graph->top_pairs_count);
+        }
+        limit = graph->top_pairs_count;
+    }
+    for(uint64_t i = 0; i < limit; ++i){
+        const char *sender = graph_address(graph, graph->top_pairs[i].sender_id);
+        const char *recipient = graph_address(graph, graph->top_pairs[i].recipient_id);
+        if(sender == NULL || recipient == NULL) return false;
+        printf("%u: %s %s\n", graph->top_pairs[i].count, sender, recipient);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    bool is_top = argc >= 3 && argc <= 4 && strcmp(argv[2], "top") == 0;
+    bool is_sender = argc >= 4 && argc <= 5 && strcmp(argv[2], "sender") == 0;
+    bool is_recipient = argc >= 4 && argc <= 5 && strcmp(argv[2], "recipient") == 0;
+    if(!is_top && !is_sender && !is_recipient){
+        fprintf(stderr, "Usage: %s <graph> sender|recipient <address> [N]\n       %s <graph> top [N]\n", argv[0],
+                argv[0]);
+        return 1;
+    }
+    char *limit_arg = is_top ? ((argc == 4) ? argv[3] : NULL) : ((argc == 5) ? argv[4] : NULL);
+    uint64_t limit = is_top ? 10 : 0;
+    if(limit_arg != NULL){
+        char *end;
+        limit = strtoull(limit_arg, &end, 10);
+        if(end == limit_arg || *end != '\0' || limit_arg[0] == '-'){
+            fprintf(stderr, "[ERROR] Invalid count : %s\n", limit_arg);
+            return 1;
+        }
+    }
+
+    graph_t graph;
+    if(!graph_open(&graph, argv[1])) return 1;
+    struct timeval tv_start, tv_end;
+    gettimeofday(&tv_start, NULL);
+    bool is_answered = true;
+    if(is_top){
+        is_answered = print_top_pairs(&graph, limit);
+    }else{
+        uint32_t id = graph_find(&graph, argv[3]);
+        if(id == GRAPH_NO_ADDRESS){
+            fprintf(stderr, "[ERROR] Unknown address : %s\n", argv[3]);
+            graph_close(&graph);
+            return 1;
+        }
+        const graph_edge_t *edges;
+        uint64_t count = is_sender ? graph_recipients(&graph, id, &edges) : graph_senders(&graph, id, &edges);
+        is_answered = print_edges(&graph, edges, count, limit);
+    }
+    gettimeofday(&tv_end, NULL);
+    if(!is_answered) fprintf(stderr, "[ERROR] %s is corrupted\n", argv[1]);
+    fprintf(stderr, "Answered in %ld us\n",
+            (tv_end.tv_sec - tv_start.tv_sec) * 1000000 + tv_end.tv_usec - tv_start.tv_usec);
+    graph_close(&graph);
+    return is_answered ? 0 : 1;
+}
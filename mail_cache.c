@@ -0,0 +1,314 @@
+#include "mail_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "step2_format.h"
+
+#define MAIL_CACHE_INITIAL_CAPACITY 1024
+
+/*!
+ * @brief mail_key_from_stat makes the cache key of an e-mail from the status of its file
+ * @param file_stat the status of the file
+ * @param key the key to fill
+ */
+void mail_key_from_stat(struct stat *file_stat, mail_key_t *key) {
+    memset(key, 0, sizeof(mail_key_t));
+    key->device = file_stat->st_dev;
+    key->inode = file_stat->st_ino;
+    key->size = file_stat->st_size;
+    key->mtime_sec = file_stat->st_mtim.tv_sec;
+    key->mtime_nsec = file_stat->st_mtim.tv_nsec;
+}
+
+/*!
+ * @brief hash_key hashes a cache key (the inode is mixed with the other fields, as it is the most distinctive)
+ * @param key the key
+ * @return the hash of the key
+ */
+static uint32_t hash_key(mail_key_t *key) {
+    uint64_t hash = key->inode * 0x9E3779B97F4A7C15ULL;
+    hash ^= key->device + (hash << 6) + (hash >> 2);
+    hash ^= key->size * 0xC2B2AE3D27D4EB4FULL;
+    hash ^= (uint64_t)key->mtime_sec * 0x165667B19E3779F9ULL + (uint64_t)key->mtime_nsec;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return (uint32_t)hash;
+}
+
+/*!
+ * @brief mail_cache_open maps the cache file of a previous run. A missing cache is not an error: the cache is then
+ * empty, and all the e-mails are parsed.
+ * @param cache the cache to initialize
+ * @param path the path to the cache file
+ * @param partition the partition of the records the cache is expected to hold
+ * @return true on success (cache found or missing), false if it could not be read or is corrupted (it is then empty)
+ */
+bool mail_cache_open(mail_cache_t *cache, char *path, uint32_t partition) {
+    memset(cache, 0, sizeof(mail_cache_t));
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        if(errno == ENOENT) return true;
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat cache_stat;
+    if(fstat(fd, &cache_stat) != 0){
+        fprintf(stderr, "[ERROR] Could not stat %s : %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    if((size_t)cache_stat.st_size < sizeof(mail_cache_header_t)){
+        fprintf(stderr, "[ERROR] Corrupted mail cache %s, ignored\n", path);
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, cache_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        fprintf(stderr, "[ERROR] Could not map %s : %s\n", path, strerror(errno));
+        return false;
+    }
+    cache->data = data;
+    cache->size = cache_stat.st_size;
+
+    // The sections must fill the file exactly
+    const mail_cache_header_t *header = data;
+    uint64_t expected_size = sizeof(mail_cache_header_t) + (uint64_t)header->entries_count * sizeof(mail_cache_entry_t)
+                             + (uint64_t)header->slots_count * sizeof(uint32_t) + header->strings_size
+                             + header->records_size + header->aggregate_size;
+    if(memcmp(header->magic, MAIL_CACHE_MAGIC, MAIL_CACHE_MAGIC_SIZE) != 0 || header->version != MAIL_CACHE_VERSION ||
+       header->strings_size > cache->size || header->records_size > cache->size ||
+       header->aggregate_size > cache->size || expected_size != cache->size ||
+       (header->slots_count & (header->slots_count - 1)) != 0 || header->slots_count < 2 * header->entries_count ||
+       header->partition != partition || header->partitions_count != STEP2_PARTITIONS_COUNT){
+        fprintf(stderr, "[ERROR] Corrupted mail cache %s, ignored\n", path);
+        mail_cache_close(cache);
+        return false;
+    }
+    cache->addresses_count = header->addresses_count;
+    cache->entries_count = header->entries_count;
+    cache->slots_count = header->slots_count;
+    cache->entries = (const mail_cache_entry_t *)(cache->data + sizeof(mail_cache_header_t));
+    cache->slots = (const uint32_t *)(cache->entries + cache->entries_count);
+    cache->strings = (const char *)(cache->slots + cache->slots_count);
+    cache->strings_size = header->strings_size;
+    cache->records = (const uint8_t *)cache->strings + cache->strings_size;
+    cache->records_size = header->records_size;
+    cache->aggregate = cache->records + cache->records_size;
+    cache->aggregate_size = header->aggregate_size;
+    if(cache->strings_size > 0 && cache->strings[cache->strings_size - 1] != '\0'){
+        fprintf(stderr, "[ERROR] Corrupted mail cache %s, ignored\n", path);
+        mail_cache_close(cache);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief mail_cache_find looks for the entry of an e-mail in the cache
+ * @param cache the cache
+ * @param key the key of the e-mail
+ * @return the index of its entry, MAIL_CACHE_MISS if the e-mail is not in the cache
+ */
+uint32_t mail_cache_find(mail_cache_t *cache, mail_key_t *key) {
+    if(cache == NULL || cache->slots_count == 0) return MAIL_CACHE_MISS;
+    uint32_t slot = hash_key(key) & (cache->slots_count - 1);
+    while(cache->slots[slot] != 0){
+        uint32_t index = cache->slots[slot] - 1;
+        if(index < cache->entries_count && memcmp(&cache->entries[index].key, key, sizeof(mail_key_t)) == 0){
+            return index;
+        }
+        slot = (slot + 1) & (cache->slots_count - 1);
+    }
+    return MAIL_CACHE_MISS;
+}
+
+/*!
+ * @brief mail_cache_close unmaps a cache
+ * @param cache the cache
+ */
+void mail_cache_close(mail_cache_t *cache) {
+    if(cache->data != NULL) munmap(cache->data, cache->size);
+    memset(cache, 0, sizeof(mail_cache_t));
+}
+
+/*!
+ * @brief reserve_buffer makes room at the end of a buffer
+ * @param buffer the buffer
+ * @param size the number of bytes to add
+ * @return true on success, false if allocation failed
+ */
+static bool reserve_buffer(mail_cache_buffer_t *buffer, size_t size) {
+    if(buffer->size + size <= buffer->capacity) return true;
+    size_t capacity = (buffer->capacity == 0) ? 64 * MAIL_CACHE_INITIAL_CAPACITY : 2 * buffer->capacity;
+    while(buffer->size + size > capacity) capacity *= 2;
+    uint8_t *data = realloc(buffer->data, capacity);
+    if(data == NULL) return false;
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+/*!
+ * @brief mail_cache_buffer_append appends a varint to a buffer
+ * @param buffer the buffer
+ * @param value the integer to append
+ * @return true on success, false if allocation failed
+ */
+bool mail_cache_buffer_append(mail_cache_buffer_t *buffer, uint32_t value) {
+    if(!reserve_buffer(buffer, VARINT_MAX_SIZE)) return false;
+    buffer->size += encode_varint(value, buffer->data + buffer->size);
+    return true;
+}
+
+/*!
+ * @brief mail_cache_buffer_free frees the memory of a buffer
+ * @param buffer the buffer
+ */
+void mail_cache_buffer_free(mail_cache_buffer_t *buffer) {
+    free(buffer->data);
+    memset(buffer, 0, sizeof(mail_cache_buffer_t));
+}
+
+/*!
+ * @brief mail_cache_builder_init initializes the entries of the next cache
+ * @param builder the builder to initialize
+ */
+void mail_cache_builder_init(mail_cache_builder_t *builder) {
+    memset(builder, 0, sizeof(mail_cache_builder_t));
+}
+
+/*!
+ * @brief grow_builder_slots doubles the table of a builder, and places its entries again
+ * @param builder the builder
+ * @return true on success, false if allocation failed
+ */
+static bool grow_builder_slots(mail_cache_builder_t *builder) {
+    uint32_t slots_count = (builder->slots_count == 0) ? 2 * MAIL_CACHE_INITIAL_CAPACITY : 2 * builder->slots_count;
+    uint32_t *slots = calloc(slots_count, sizeof(uint32_t));
+    if(slots == NULL) return false;
+    for(uint32_t index = 0; index < builder->count; ++index){
+        uint32_t slot = hash_key(&builder->entries[index].key) & (slots_count - 1);
+        while(slots[slot] != 0) slot = (slot + 1) & (slots_count - 1);
+        slots[slot] = index + 1;
+    }
+    free(builder->slots);
+    builder->slots = slots;
+    builder->slots_count = slots_count;
+    return true;
+}
+
+/*!
+ * @brief mail_cache_builder_add adds the entry of an e-mail to the next cache. An e-mail already added (another path
+ * to the same file) only has its count of paths increased.
+ * @param builder the builder
+ * @param key the key of the e-mail
+ * @param record its step2 record (binary format, with the address IDs of the next cache), NULL if it has no sender
+ * @param record_size the size of the record
+ * @param paths_count the number of paths to the e-mail
+ * @return true on success, false if allocation failed
+ */
+bool mail_cache_builder_add(mail_cache_builder_t *builder, mail_key_t *key, const uint8_t *record, size_t record_size,
+                            uint32_t paths_count) {
+    if(builder == NULL || key == NULL) return false;
+    uint32_t hash = hash_key(key);
+    if(builder->slots_count > 0){
+        uint32_t slot = hash & (builder->slots_count - 1);
+        while(builder->slots[slot] != 0){
+            mail_cache_entry_t *entry = &builder->entries[builder->slots[slot] - 1];
+            if(memcmp(&entry->key, key, sizeof(mail_key_t)) == 0){
+                entry->paths_count += paths_count;
+                return true;
+            }
+            slot = (slot + 1) & (builder->slots_count - 1);
+        }
+    }
+
+    if(builder->count == builder->capacity){
+        uint32_t capacity = (builder->capacity == 0) ? MAIL_CACHE_INITIAL_CAPACITY : 2 * builder->capacity;
+        mail_cache_entry_t *entries = realloc(builder->entries, capacity * sizeof(mail_cache_entry_t));
+        if(entries == NULL) return false;
+        builder->entries = entries;
+        builder->capacity = capacity;
+    }
+    // Keep the table at most half full
+    if(2 * (builder->count + 1) > builder->slots_count && !grow_builder_slots(builder)) return false;
+    if(record != NULL && !reserve_buffer(&builder->records, record_size)) return false;
+
+    mail_cache_entry_t *entry = &builder->entries[builder->count];
+    memset(entry, 0, sizeof(mail_cache_entry_t));
+    entry->key = *key;
+    entry->paths_count = paths_count;
+    entry->record_offset = MAIL_CACHE_NO_RECORD;
+    if(record != NULL){
+        entry->record_offset = builder->records.size;
+        memcpy(builder->records.data + builder->records.size, record, record_size);
+        builder->records.size += record_size;
+    }
+    uint32_t slot = hash & (builder->slots_count - 1);
+    while(builder->slots[slot] != 0) slot = (slot + 1) & (builder->slots_count - 1);
+    builder->slots[slot] = ++builder->count;
+    return true;
+}
+
+/*!
+ * @brief mail_cache_builder_free frees the memory of a builder
+ * @param builder the builder
+ */
+void mail_cache_builder_free(mail_cache_builder_t *builder) {
+    free(builder->entries);
+    free(builder->slots);
+    mail_cache_buffer_free(&builder->records);
+    memset(builder, 0, sizeof(mail_cache_builder_t));
+}
+
+/*!
+ * @brief mail_cache_write writes a cache file
+ * @param path the path of the cache file (replaced if it exists)
+ * @param partition the partition of the records of the cache
+ * @param addresses the addresses of the records and of the aggregation
+ * @param builder the entries of the cache
+ * @param aggregate the encoded aggregation
+ * @return true on success, false on error (the file is then incomplete)
+ */
+bool mail_cache_write(char *path, uint32_t partition, address_dict_t *addresses, mail_cache_builder_t *builder,
+                      mail_cache_buffer_t *aggregate) {
+    FILE *cache_file = fopen(path, "w");
+    if(cache_file == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", path, strerror(errno));
+        return false;
+    }
+    mail_cache_header_t header;
+    memset(&header, 0, sizeof(mail_cache_header_t));
+    memcpy(header.magic, MAIL_CACHE_MAGIC, MAIL_CACHE_MAGIC_SIZE);
+    header.version = MAIL_CACHE_VERSION;
+    header.addresses_count = addresses->count;
+    header.entries_count = builder->count;
+    header.slots_count = builder->slots_count;
+    header.partition = partition;
+    header.partitions_count = STEP2_PARTITIONS_COUNT;
+    header.strings_size = addresses->strings_size;
+    header.records_size = builder->records.size;
+    header.aggregate_size = aggregate->size;
+
+    bool is_written = fwrite(&header, sizeof(mail_cache_header_t), 1, cache_file) == 1;
+    is_written = is_written && fwrite(builder->entries, sizeof(mail_cache_entry_t), builder->count, cache_file)
+                               == builder->count;
+    is_written = is_written && fwrite(builder->slots, sizeof(uint32_t), builder->slots_count, cache_file)
+                               == builder->slots_count;
+    is_written = is_written && fwrite(addresses->strings, 1, addresses->strings_size, cache_file)
+                               == addresses->strings_size;
+    is_written = is_written && fwrite(builder->records.data, 1, builder->records.size, cache_file)
+                               == builder->records.size;
+    is_written = is_written && fwrite(aggregate->data, 1, aggregate->size, cache_file) == aggregate->size;
+    if(fclose(cache_file) != 0) is_written = false;
+    if(!is_written) fprintf(stderr, "[ERROR] Could not write %s : %s\n", path, strerror(errno));
+    return is_written;
+}
@@ -0,0 +1,120 @@
+#ifndef A2022_MAIL_CACHE_H
+#define A2022_MAIL_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "address_dict.h"
+
+/*
+ * The mail cache keeps, from one run to the next, the result of each e-mail parsed (its step2 record) and the final
+ * aggregation of all of them. An e-mail is identified by the device, inode, size and modification time of its file:
+ * a rerun only parses the e-mails that are not in the cache, and updates the aggregation with deltas (the records of
+ * new e-mails are added, those of deleted or modified e-mails subtracted).
+ *
+ * The cache is a single file of the temporary files directory, mapped in memory by the workers, which only look for
+ * keys in it. It is made of a header (mail_cache_header_t) followed by:
+ * - the entries (mail_cache_entry_t), and their open addressing table of entry index + 1 (0 is an empty slot);
+ * - the addresses, null terminated, in the order of their IDs;
+ * - the records of the entries, in the binary step2 format (without header), with these address IDs;
+ * - the aggregation: for each sender, its ID, its count of e-mails and its count of recipients, then the ID and the
+ * occurrences of each recipient, all as varints.
+ * There is one cache per partition of the step2 records (@see step2_format.h), holding the e-mails whose sender is in
+ * the partition (and, for partition 0, the e-mails without a sender). Each cache is written by the reducer of its
+ * partition at the end of each run, to a temporary name, then renamed over the previous one once all the partitions
+ * are reduced.
+ */
+#define MAIL_CACHE_PREFIX "mail_cache."
+#define MAIL_CACHE_FORMAT MAIL_CACHE_PREFIX "%u"
+#define MAIL_CACHE_UPDATE_PREFIX "mail_cache_update."
+#define MAIL_CACHE_UPDATE_FORMAT MAIL_CACHE_UPDATE_PREFIX "%u"
+#define MAIL_CACHE_MAGIC "LP2C"
+#define MAIL_CACHE_MAGIC_SIZE 4
+#define MAIL_CACHE_VERSION 2
+// Returned by mail_cache_find for unknown keys
+#define MAIL_CACHE_MISS UINT32_MAX
+// Record offset of the entries of e-mails without a sender (they are cached, but count for no one)
+#define MAIL_CACHE_NO_RECORD UINT64_MAX
+
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} mail_key_t;
+
+typedef struct {
+    mail_key_t key;
+    uint64_t record_offset;     // Offset in the records section, MAIL_CACHE_NO_RECORD if the e-mail has no sender
+    uint32_t paths_count;       // Number of paths with this key in the run (hard links of the same e-mail)
+    uint32_t reserved;
+} mail_cache_entry_t;
+
+typedef struct {
+    char magic[MAIL_CACHE_MAGIC_SIZE];
+    uint8_t version;
+    uint8_t reserved[3];
+    uint32_t addresses_count;
+    uint32_t entries_count;
+    uint32_t slots_count;       // A power of 2, at least twice entries_count (0 if there is no entry)
+    uint16_t partition;
+    uint16_t partitions_count;  // The cache is ignored if the records are not partitioned the same way anymore
+    uint64_t strings_size;
+    uint64_t records_size;
+    uint64_t aggregate_size;
+} mail_cache_header_t;
+
+// A cache file mapped in memory (empty when there is no cache yet)
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    uint32_t addresses_count;
+    uint32_t entries_count;
+    uint32_t slots_count;
+    const mail_cache_entry_t *entries;
+    const uint32_t *slots;
+    const char *strings;
+    size_t strings_size;
+    const uint8_t *records;
+    size_t records_size;
+    const uint8_t *aggregate;
+    size_t aggregate_size;
+} mail_cache_t;
+
+// Growable buffer of varints
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} mail_cache_buffer_t;
+
+// Entries of the next cache, built by the reducer
+typedef struct {
+    mail_cache_entry_t *entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *slots;
+    uint32_t slots_count;
+    mail_cache_buffer_t records;
+} mail_cache_builder_t;
+
+void mail_key_from_stat(struct stat *file_stat, mail_key_t *key);
+
+bool mail_cache_open(mail_cache_t *cache, char *path, uint32_t partition);
+uint32_t mail_cache_find(mail_cache_t *cache, mail_key_t *key);
+void mail_cache_close(mail_cache_t *cache);
+
+bool mail_cache_buffer_append(mail_cache_buffer_t *buffer, uint32_t value);
+void mail_cache_buffer_free(mail_cache_buffer_t *buffer);
+
+void mail_cache_builder_init(mail_cache_builder_t *builder);
+bool mail_cache_builder_add(mail_cache_builder_t *builder, mail_key_t *key, const uint8_t *record, size_t record_size,
+                            uint32_t paths_count);
+void mail_cache_builder_free(mail_cache_builder_t *builder);
+bool mail_cache_write(char *path, uint32_t partition, address_dict_t *addresses, mail_cache_builder_t *builder,
+                      mail_cache_buffer_t *aggregate);
+
+#endif //A2022_MAIL_CACHE_H
@@ -0,0 +1,381 @@
+#include "mail_reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * Mails are read by batches: each mail of a batch is opened, its first MAIL_READ_SIZE bytes are read, then it is
+ * given to the callback and closed. With io_uring, the opens, reads and closes of the whole batch are submitted
+ * together, and each mail is handed to the callback as soon as its read completes. Where io_uring is not available
+ * (old kernel, or disabled), a thread opens and reads the mails of the batch ahead of the callbacks.
+ */
+
+// Operation of a submission, stored in the upper half of its user data (the lower half is the slot in the batch)
+typedef enum { MAIL_OP_OPEN = 1, MAIL_OP_READ, MAIL_OP_CLOSE } mail_op_t;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+/*!
+ * @brief ring_supports_mail_ops checks that a ring supports the openat, read and close operations (kernel 5.6+)
+ * @param ring_fd the ring
+ * @return true if the 3 operations are supported, false else
+ */
+static bool ring_supports_mail_ops(int ring_fd) {
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    if(probe == NULL) return false;
+    bool supported = false;
+    if(sys_io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0){
+        supported = probe->last_op >= IORING_OP_CLOSE && probe->last_op >= IORING_OP_READ &&
+                    (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+/*!
+ * @brief unmap_ring releases the ring of a reader, which then reads with the prefetch thread
+ * @param reader the reader
+ */
+static void unmap_ring(mail_reader_t *reader) {
+    if(reader->sqes != NULL) munmap(reader->sqes, reader->sqes_size);
+    if(reader->cq_ring != NULL && reader->cq_ring != reader->sq_ring) munmap(reader->cq_ring, reader->cq_ring_size);
+    if(reader->sq_ring != NULL) munmap(reader->sq_ring, reader->sq_ring_size);
+    if(reader->ring_fd >= 0) close(reader->ring_fd);
+    reader->sqes = reader->cq_ring = reader->sq_ring = NULL;
+    reader->ring_fd = -1;
+}
+
+/*!
+ * @brief setup_ring creates the io_uring instance of a reader and maps its rings
+ * @param reader the reader
+ * @return true on success, false if io_uring can not be used
+ */
+static bool setup_ring(mail_reader_t *reader) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    reader->ring_fd = sys_io_uring_setup(MAIL_BATCH_SIZE, &params);
+    if(reader->ring_fd < 0 || !ring_supports_mail_ops(reader->ring_fd)){
+        unmap_ring(reader);
+        return false;
+    }
+
+    reader->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    reader->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single_mmap && reader->cq_ring_size > reader->sq_ring_size) reader->sq_ring_size = reader->cq_ring_size;
+    reader->sq_ring = mmap(NULL, reader->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           reader->ring_fd, IORING_OFF_SQ_RING);
+    if(reader->sq_ring == MAP_FAILED){
+        reader->sq_ring = NULL;
+        unmap_ring(reader);
+        return false;
+    }
+    if(single_mmap){
+        reader->cq_ring = reader->sq_ring;
+    }else{
+        reader->cq_ring = mmap(NULL, reader->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               reader->ring_fd, IORING_OFF_CQ_RING);
+        if(reader->cq_ring == MAP_FAILED){
+            reader->cq_ring = NULL;
+            unmap_ring(reader);
+            return false;
+        }
+    }
+    reader->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    reader->sqes = mmap(NULL, reader->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        reader->ring_fd, IORING_OFF_SQES);
+    if(reader->sqes == MAP_FAILED){
+        reader->sqes = NULL;
+        unmap_ring(reader);
+        return false;
+    }
+
+    char *sq_ring = reader->sq_ring;
+    char *cq_ring = reader->cq_ring;
+    reader->sq_head = (uint32_t *)(sq_ring + params.sq_off.head);
+    reader->sq_tail = (uint32_t *)(sq_ring + params.sq_off.tail);
+    reader->sq_mask = (uint32_t *)(sq_ring + params.sq_off.ring_mask);
+    reader->sq_array = (uint32_t *)(sq_ring + params.sq_off.array);
+    reader->cq_head = (uint32_t *)(cq_ring + params.cq_off.head);
+    reader->cq_tail = (uint32_t *)(cq_ring + params.cq_off.tail);
+    reader->cq_mask = (uint32_t *)(cq_ring + params.cq_off.ring_mask);
+    reader->cqes = cq_ring + params.cq_off.cqes;
+    return true;
+}
+
+/*!
+ * @brief mail_reader_init initializes a reader, using io_uring if the kernel allows it
+ * @param reader the reader to initialize
+ * @return true on success, false if the reader could not be initialized
+ */
+bool mail_reader_init(mail_reader_t *reader) {
+    memset(reader, 0, sizeof(mail_reader_t));
+    reader->ring_fd = -1;
+    reader->buffers = malloc(MAIL_BATCH_SIZE * MAIL_READ_SIZE);
+    if(reader->buffers == NULL) return false;
+    setup_ring(reader);
+    return true;
+}
+
+/*!
+ * @brief mail_reader_close releases the resources of a reader
+ * @param reader the reader
+ */
+void mail_reader_close(mail_reader_t *reader) {
+    unmap_ring(reader);
+    free(reader->buffers);
+    reader->buffers = NULL;
+}
+
+/*!
+ * @brief queue_submission adds a submission to the submission ring (it is submitted by the next io_uring_enter)
+ * @param reader the reader
+ * @param opcode the io_uring operation
+ * @param fd the file descriptor of the operation
+ * @param addr the path (open) or the buffer (read)
+ * @param length the length to read
+ * @param op the operation, with slot, identifying the completion
+ * @param slot the slot of the mail in the batch
+ */
+static void queue_submission(mail_reader_t *reader, uint8_t opcode, int fd, void *addr, uint32_t length, mail_op_t op,
+                             uint32_t slot) {
+    uint32_t tail = *reader->sq_tail;
+    uint32_t index = tail & *reader->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)reader->sqes + index;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = length;
+    if(opcode == IORING_OP_OPENAT) sqe->open_flags = O_RDONLY;
+    sqe->user_data = ((uint64_t)op << 32) | slot;
+    reader->sq_array[index] = index;
+    __atomic_store_n(reader->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Batch shared between the prefetch thread (reading the mails in order) and the callbacks
+typedef struct {
+    int directory_fd;
+    char **paths;
+    size_t count;
+    char *buffers;
+    int fds[MAIL_BATCH_SIZE];
+    ssize_t lengths[MAIL_BATCH_SIZE];
+    int errors[MAIL_BATCH_SIZE];
+    size_t ready_count;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} prefetch_batch_t;
+
+/*!
+ * @brief prefetch_mails opens and reads the mails of a batch in order, signaling each mail once read
+ * @param argument the batch, as a prefetch_batch_t pointer
+ * @return NULL
+ */
+static void *prefetch_mails(void *argument) {
+    prefetch_batch_t *batch = argument;
+    for(size_t slot = 0; slot < batch->count; ++slot){
+        int fd = openat(batch->directory_fd, batch->paths[slot], O_RDONLY);
+        ssize_t length = -1;
+        int error = errno;
+        if(fd >= 0){
+            length = pread(fd, batch->buffers + slot * MAIL_READ_SIZE, MAIL_READ_SIZE, 0);
+            error = errno;
+        }
+        pthread_mutex_lock(&batch->lock);
+        batch->fds[slot] = fd;
+        batch->lengths[slot] = length;
+        batch->errors[slot] = error;
+        batch->ready_count = slot + 1;
+        pthread_cond_signal(&batch->ready);
+        pthread_mutex_unlock(&batch->lock);
+    }
+    return NULL;
+}
+
+/*!
+ * @brief read_batch_with_thread reads a batch of mails with a prefetch thread, the callbacks running while the next
+ * mails are read. Without a thread, the mails are read before the callbacks.
+ * Parameters are the same as @see mail_reader_read
+ */
+static void read_batch_with_thread(mail_reader_t *reader, int directory_fd, char **paths, size_t count,
+                                   mail_callback_t callback, void *context) {
+    prefetch_batch_t batch = {
+        .directory_fd = directory_fd, .paths = paths, .count = count, .buffers = reader->buffers, .ready_count = 0
+    };
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.ready, NULL);
+    pthread_t prefetcher;
+    bool threaded = pthread_create(&prefetcher, NULL, prefetch_mails, &batch) == 0;
+    if(!threaded) prefetch_mails(&batch);
+
+    for(size_t slot = 0; slot < count; ++slot){
+        pthread_mutex_lock(&batch.lock);
+        while(batch.ready_count <= slot) pthread_cond_wait(&batch.ready, &batch.lock);
+        pthread_mutex_unlock(&batch.lock);
+        if(batch.fds[slot] < 0){
+            fprintf(stderr, "[ERROR] Could not open %s : %s\n", paths[slot], strerror(batch.errors[slot]));
+            continue;
+        }
+        if(batch.lengths[slot] < 0){
+            fprintf(stderr, "[ERROR] Could not read %s : %s\n", paths[slot], strerror(batch.errors[slot]));
+        }else{
+            callback(paths[slot], batch.fds[slot], reader->buffers + slot * MAIL_READ_SIZE, batch.lengths[slot],
+                     context);
+        }
+        close(batch.fds[slot]);
+    }
+
+    if(threaded) pthread_join(prefetcher, NULL);
+    pthread_cond_destroy(&batch.ready);
+    pthread_mutex_destroy(&batch.lock);
+}
+
+/*!
+ * @brief reap_completions handles the completions of a batch read with io_uring: an opened mail is read, a read mail
+ * is given to the callback then closed. When the ring has failed, nothing is queued anymore and the opened mails are
+ * left to be closed by the caller.
+ * @param reader the reader
+ * @param paths the paths to the mails
+ * @param fds the descriptors of the opened mails, -1 if not opened or once their close is queued
+ * @param is_done for each mail, true once it is given to the callback or reported as unreadable
+ * @param callback the function processing each mail
+ * @param context passed to the callback
+ * @param can_queue false if the ring has failed
+ * @param to_submit incremented by the operations queued
+ * @param remaining decremented by the mails closed or that could not be opened
+ * @return the number of completions handled
+ */
+static uint32_t reap_completions(mail_reader_t *reader, char **paths, int *fds, bool *is_done, mail_callback_t callback,
+                                 void *context, bool can_queue, uint32_t *to_submit, size_t *remaining) {
+    uint32_t head = *reader->cq_head;
+    uint32_t tail = __atomic_load_n(reader->cq_tail, __ATOMIC_ACQUIRE);
+    uint32_t reaped = tail - head;
+    for(; head != tail; ++head){
+        struct io_uring_cqe *cqe = (struct io_uring_cqe *)reader->cqes + (head & *reader->cq_mask);
+        uint32_t slot = (uint32_t)cqe->user_data;
+        mail_op_t op = (mail_op_t)(cqe->user_data >> 32);
+        char *buffer = reader->buffers + (size_t)slot * MAIL_READ_SIZE;
+        if(op == MAIL_OP_OPEN){
+            if(cqe->res < 0){
+                fprintf(stderr, "[ERROR] Could not open %s : %s\n", paths[slot], strerror(-cqe->res));
+                is_done[slot] = true;
+                --*remaining;
+                continue;
+            }
+            fds[slot] = cqe->res;
+            if(!can_queue) continue;
+            queue_submission(reader, IORING_OP_READ, fds[slot], buffer, MAIL_READ_SIZE, MAIL_OP_READ, slot);
+            ++*to_submit;
+        }else if(op == MAIL_OP_READ){
+            if(cqe->res < 0){
+                fprintf(stderr, "[ERROR] Could not read %s : %s\n", paths[slot], strerror(-cqe->res));
+            }else{
+                callback(paths[slot], fds[slot], buffer, cqe->res, context);
+            }
+            is_done[slot] = true;
+            if(!can_queue) continue;
+            queue_submission(reader, IORING_OP_CLOSE, fds[slot], NULL, 0, MAIL_OP_CLOSE, slot);
+            fds[slot] = -1;
+            ++*to_submit;
+        }else{
+            --*remaining;
+        }
+    }
+    __atomic_store_n(reader->cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+/*!
+ * @brief read_batch_with_ring reads a batch of mails with io_uring. If io_uring fails, the completions of the
+ * operations already submitted are awaited and the opened mails are closed, then the ring is released: the mails left
+ * in the batch, and all the next batches, are read with the prefetch thread.
+ * Parameters are the same as @see mail_reader_read
+ */
+static void read_batch_with_ring(mail_reader_t *reader, int directory_fd, char **paths, size_t count,
+                                 mail_callback_t callback, void *context) {
+    int fds[MAIL_BATCH_SIZE];
+    bool is_done[MAIL_BATCH_SIZE];
+    for(uint32_t slot = 0; slot < count; ++slot){
+        fds[slot] = -1;
+        is_done[slot] = false;
+        queue_submission(reader, IORING_OP_OPENAT, directory_fd, paths[slot], 0, MAIL_OP_OPEN, slot);
+    }
+    // Each mail has at most one operation in flight, so the rings never overflow
+    uint32_t to_submit = count;
+    uint32_t in_flight = 0;
+    size_t remaining = count;
+    while(remaining > 0){
+        int submitted = sys_io_uring_enter(reader->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+        if(submitted < 0){
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            break;
+        }
+        to_submit -= submitted;
+        in_flight += submitted;
+        in_flight -= reap_completions(reader, paths, fds, is_done, callback, context, true, &to_submit, &remaining);
+    }
+    if(remaining == 0) return;
+
+    fprintf(stderr, "[ERROR] io_uring failed : %s, the mails are read without it\n", strerror(errno));
+    // If the submitted operations can not be awaited, the mails they open are lost, but no descriptor owned by a
+    // submitted close is closed twice
+    in_flight -= reap_completions(reader, paths, fds, is_done, callback, context, false, &to_submit, &remaining);
+    while(in_flight > 0){
+        if(sys_io_uring_enter(reader->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) break;
+        in_flight -= reap_completions(reader, paths, fds, is_done, callback, context, false, &to_submit, &remaining);
+    }
+    // The operations not submitted are dropped with the ring: the closes among them are done here
+    uint32_t sq_tail = *reader->sq_tail;
+    for(uint32_t head = __atomic_load_n(reader->sq_head, __ATOMIC_ACQUIRE); head != sq_tail; ++head){
+        struct io_uring_sqe *sqe = (struct io_uring_sqe *)reader->sqes + reader->sq_array[head & *reader->sq_mask];
+        if(sqe->opcode == IORING_OP_CLOSE) close(sqe->fd);
+    }
+    unmap_ring(reader);
+    char *left_paths[MAIL_BATCH_SIZE];
+    size_t left_count = 0;
+    for(uint32_t slot = 0; slot < count; ++slot){
+        if(fds[slot] >= 0) close(fds[slot]);
+        if(!is_done[slot]) left_paths[left_count++] = paths[slot];
+    }
+    if(left_count > 0) read_batch_with_thread(reader, directory_fd, left_paths, left_count, callback, context);
+}
+
+/*!
+ * @brief mail_reader_read reads a batch of mails, calling the callback for each mail once its beginning is read (in
+ * completion order, which may differ from the order of the paths)
+ * @param reader the reader
+ * @param directory_fd the directory the paths are relative to (AT_FDCWD for the current directory)
+ * @param paths the paths to the mails
+ * @param count the number of mails, at most MAIL_BATCH_SIZE
+ * @param callback the function processing each mail
+ * @param context passed to the callback
+ */
+void mail_reader_read(mail_reader_t *reader, int directory_fd, char **paths, size_t count, mail_callback_t callback,
+                      void *context) {
+    if(reader == NULL || paths == NULL || callback == NULL || count == 0) return;
+    if(count > MAIL_BATCH_SIZE) count = MAIL_BATCH_SIZE;
+    if(reader->ring_fd >= 0) read_batch_with_ring(reader, directory_fd, paths, count, callback, context);
+    else read_batch_with_thread(reader, directory_fd, paths, count, callback, context);
+}
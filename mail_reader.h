@@ -0,0 +1,43 @@
+#ifndef A2022_MAIL_READER_H
+#define A2022_MAIL_READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of mails read together, and number of bytes read at the beginning of each mail (enough for most headers)
+#define MAIL_BATCH_SIZE 64
+#define MAIL_READ_SIZE 4096
+
+/*
+ * Called for each mail of a batch once its first bytes are read: data holds the first length bytes of the mail (the
+ * whole mail if length < MAIL_READ_SIZE). fd is the opened mail, to read more of it if needed; it is closed by the
+ * reader after the call.
+ */
+typedef void (* mail_callback_t)(char *path, int fd, char *data, size_t length, void *context);
+
+typedef struct {
+    int ring_fd;                // io_uring instance, -1 when reading with the prefetch thread
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    void *sqes;
+    void *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    char *buffers;              // MAIL_BATCH_SIZE buffers of MAIL_READ_SIZE bytes
+} mail_reader_t;
+
+bool mail_reader_init(mail_reader_t *reader);
+void mail_reader_read(mail_reader_t *reader, int directory_fd, char **paths, size_t count, mail_callback_t callback,
+                      void *context);
+void mail_reader_close(mail_reader_t *reader);
+
+#endif //A2022_MAIL_READER_H
@@ -0,0 +1,323 @@
+#include "mail_scanner.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+ * The scanners split a buffer into tokens separated by ',', spaces, tabs and line breaks. A token is an e-mail address
+ * if it contains a '@' followed (anywhere after it) by a '.'. All scanners share the same state so that the vectorized
+ * ones only have to find the interesting bytes of a block, the tokens being followed across block boundaries.
+ * When scanning the value of a header field, they also stop at the end of the field: a line break that is not followed
+ * by a space or a tab (which would make the next line a continuation of the field).
+ */
+
+typedef enum { CHAR_OTHER, CHAR_DELIMITER, CHAR_AT, CHAR_DOT } char_class_t;
+
+typedef struct {
+    bool in_token;
+    bool seen_at;
+    bool is_mail;
+    uint32_t token_start;
+    mail_span_t *spans;
+    size_t max_spans;
+    size_t spans_count;
+    const char *buffer;
+    size_t length;
+    bool stop_at_field_end;
+    bool stopped;
+    size_t field_length;
+} scan_state_t;
+
+static const uint8_t char_classes[256] = {
+    [','] = CHAR_DELIMITER,
+    [' '] = CHAR_DELIMITER,
+    ['\t'] = CHAR_DELIMITER,
+    ['\r'] = CHAR_DELIMITER,
+    ['\n'] = CHAR_DELIMITER,
+    ['@'] = CHAR_AT,
+    ['.'] = CHAR_DOT,
+};
+
+/*!
+ * @brief start_token records the beginning of a new token
+ * @param state the scanner state
+ * @param offset the offset of the first character of the token
+ */
+static inline void start_token(scan_state_t *state, uint32_t offset) {
+    state->in_token = true;
+    state->seen_at = false;
+    state->is_mail = false;
+    state->token_start = offset;
+}
+
+/*!
+ * @brief end_token closes the current token, and outputs it as a span if it is an e-mail address
+ * @param state the scanner state
+ * @param offset the offset of the delimiter ending the token
+ */
+static inline void end_token(scan_state_t *state, uint32_t offset) {
+    if(state->is_mail && state->spans_count < state->max_spans){
+        state->spans[state->spans_count].offset = state->token_start;
+        state->spans[state->spans_count].length = offset - state->token_start;
+        ++state->spans_count;
+    }
+    state->in_token = false;
+}
+
+/*!
+ * @brief stop_at_line_break tests if a line break ends the scanned field, and stops the scan if it does
+ * @param state the scanner state
+ * @param offset the offset of the line break
+ * @return true if the scan is stopped
+ */
+static inline bool stop_at_line_break(scan_state_t *state, uint32_t offset) {
+    if(!state->stop_at_field_end) return false;
+    if(offset + 1 < state->length){
+        char next = state->buffer[offset + 1];
+        if(next == ' ' || next == '\t') return false;
+    }
+    state->stopped = true;
+    state->field_length = offset + 1;
+    return true;
+}
+
+/*!
+ * @brief init_scan_state initializes the state of a scanner
+ * @param state the state to initialize
+ * @param buffer the buffer to scan
+ * @param length the length of the buffer
+ * @param spans the array receiving the addresses found
+ * @param max_spans the capacity of spans
+ * @param field_length if not NULL, the scan stops at the end of the header field
+ */
+static inline void init_scan_state(scan_state_t *state, const char *buffer, size_t length, mail_span_t *spans,
+                                   size_t max_spans, size_t *field_length) {
+    memset(state, 0, sizeof(scan_state_t));
+    state->spans = spans;
+    state->max_spans = max_spans;
+    state->buffer = buffer;
+    state->length = length;
+    state->stop_at_field_end = (field_length != NULL);
+}
+
+/*!
+ * @brief finish_scan closes the last token of a scan
+ * @param state the scanner state
+ * @param field_length if not NULL, set to the length of the header field (the whole buffer if its end was not found)
+ * @return the number of addresses found
+ */
+static inline size_t finish_scan(scan_state_t *state, size_t *field_length) {
+    if(!state->stopped && state->in_token) end_token(state, state->length);
+    if(field_length != NULL) *field_length = state->stopped ? state->field_length : state->length;
+    return state->spans_count;
+}
+
+/*!
+ * @brief scan_mail_spans_scalar finds the e-mail addresses in a buffer, one byte at a time
+ * @param buffer the buffer to scan
+ * @param length the length of the buffer
+ * @param spans the array receiving the addresses found
+ * @param max_spans the capacity of spans, extra addresses are ignored
+ * @param field_length if not NULL, the scan stops at the end of the header field starting the buffer, and its length
+ * (line break included) is stored there
+ * @return the number of addresses found
+ */
+size_t scan_mail_spans_scalar(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans,
+                              size_t *field_length) {
+    scan_state_t state;
+    init_scan_state(&state, buffer, length, spans, max_spans, field_length);
+    for(uint32_t cur = 0; cur < length; ++cur){
+        uint8_t char_class = char_classes[(uint8_t)buffer[cur]];
+        if(char_class == CHAR_DELIMITER){
+            if(state.in_token) end_token(&state, cur);
+            if(buffer[cur] == '\n' && stop_at_line_break(&state, cur)) break;
+            continue;
+        }
+        if(!state.in_token) start_token(&state, cur);
+        if(char_class == CHAR_AT) state.seen_at = true;
+        else if(char_class == CHAR_DOT && state.seen_at) state.is_mail = true;
+    }
+    return finish_scan(&state, field_length);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*!
+ * @brief scan_block_masks follows the tokens of a block described by bit masks (bit i for byte i of the block)
+ * @param state the scanner state
+ * @param base the offset of the block in the buffer
+ * @param delimiters the mask of delimiters
+ * @param ats the mask of '@'
+ * @param dots the mask of '.'
+ * @param newlines the mask of line breaks
+ * @param block_mask the mask of the bytes belonging to the block
+ * @param previous_is_delimiter true if the byte before the block is a delimiter (or if the block is the first one)
+ * @return true if the block ends with a delimiter (to be passed as previous_is_delimiter for the next block)
+ */
+static inline bool scan_block_masks(scan_state_t *state, uint32_t base, uint32_t delimiters, uint32_t ats,
+                                    uint32_t dots, uint32_t newlines, uint32_t block_mask, bool previous_is_delimiter) {
+    uint32_t others = ~delimiters & block_mask;
+    // A token starts after a delimiter, and ends on a delimiter following a token character
+    uint32_t starts = others & ((delimiters << 1) | (previous_is_delimiter ? 1 : 0));
+    uint32_t ends = delimiters & ((others << 1) | (previous_is_delimiter ? 0 : 1));
+    // Line breaks are only looked at when the scan stops at the end of a field
+    if(!state->stop_at_field_end) newlines = 0;
+    uint32_t events = starts | ends | ats | dots | newlines;
+    while(events != 0){
+        uint32_t position = __builtin_ctz(events);
+        uint32_t bit = 1u << position;
+        events &= events - 1;
+        if((ends | newlines) & bit){
+            if(state->in_token) end_token(state, base + position);
+            if((newlines & bit) && stop_at_line_break(state, base + position)) return true;
+            continue;
+        }
+        if(starts & bit) start_token(state, base + position);
+        if(ats & bit) state->seen_at = true;
+        else if((dots & bit) && state->seen_at) state->is_mail = true;
+    }
+    return (delimiters >> (__builtin_popcount(block_mask) - 1)) & 1;
+}
+
+/*!
+ * @brief classify_block_sse2 computes the masks of delimiters, '@', '.' and line breaks of a 16 bytes block
+ */
+__attribute__((target("sse2")))
+static inline void classify_block_sse2(const char *block, uint32_t *delimiters, uint32_t *ats, uint32_t *dots,
+                                       uint32_t *newlines) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)block);
+    __m128i newline = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'));
+    __m128i delimiter = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(',')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))),
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t')),
+                         _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')), newline)));
+    *delimiters = (uint32_t)_mm_movemask_epi8(delimiter);
+    *newlines = (uint32_t)_mm_movemask_epi8(newline);
+    *ats = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('@')));
+    *dots = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('.')));
+}
+
+/*!
+ * @brief classify_block_avx2 computes the masks of delimiters, '@', '.' and line breaks of a 32 bytes block
+ */
+__attribute__((target("avx2")))
+static inline void classify_block_avx2(const char *block, uint32_t *delimiters, uint32_t *ats, uint32_t *dots,
+                                       uint32_t *newlines) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)block);
+    __m256i newline = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'));
+    __m256i delimiter = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(',')),
+                            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t')),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r')), newline)));
+    *delimiters = (uint32_t)_mm256_movemask_epi8(delimiter);
+    *newlines = (uint32_t)_mm256_movemask_epi8(newline);
+    *ats = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('@')));
+    *dots = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('.')));
+}
+
+/*!
+ * @brief scan_mail_spans_sse2 finds the e-mail addresses in a buffer, 16 bytes at a time
+ * Parameters and return value are the same as @see scan_mail_spans_scalar
+ */
+__attribute__((target("sse2")))
+size_t scan_mail_spans_sse2(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans,
+                            size_t *field_length) {
+    scan_state_t state;
+    init_scan_state(&state, buffer, length, spans, max_spans, field_length);
+    uint32_t delimiters, ats, dots, newlines;
+    bool previous_is_delimiter = true;
+    size_t cur = 0;
+    for(; cur + 16 <= length && !state.stopped; cur += 16){
+        classify_block_sse2(buffer + cur, &delimiters, &ats, &dots, &newlines);
+        previous_is_delimiter = scan_block_masks(&state, cur, delimiters, ats, dots, newlines, 0xFFFF,
+                                                 previous_is_delimiter);
+    }
+    if(cur < length && !state.stopped){
+        // The tail is padded with delimiters, which closes the last token at the end of the buffer
+        char tail[16];
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, buffer + cur, length - cur);
+        classify_block_sse2(tail, &delimiters, &ats, &dots, &newlines);
+        scan_block_masks(&state, cur, delimiters, ats, dots, newlines, 0xFFFF, previous_is_delimiter);
+    }
+    return finish_scan(&state, field_length);
+}
+
+/*!
+ * @brief scan_mail_spans_avx2 finds the e-mail addresses in a buffer, 32 bytes at a time
+ * Parameters and return value are the same as @see scan_mail_spans_scalar
+ */
+__attribute__((target("avx2")))
+size_t scan_mail_spans_avx2(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans,
+                            size_t *field_length) {
+    scan_state_t state;
+    init_scan_state(&state, buffer, length, spans, max_spans, field_length);
+    uint32_t delimiters, ats, dots, newlines;
+    bool previous_is_delimiter = true;
+    size_t cur = 0;
+    for(; cur + 32 <= length && !state.stopped; cur += 32){
+        classify_block_avx2(buffer + cur, &delimiters, &ats, &dots, &newlines);
+        previous_is_delimiter = scan_block_masks(&state, cur, delimiters, ats, dots, newlines, 0xFFFFFFFF,
+                                                 previous_is_delimiter);
+    }
+    if(cur < length && !state.stopped){
+        char tail[32];
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, buffer + cur, length - cur);
+        classify_block_avx2(tail, &delimiters, &ats, &dots, &newlines);
+        scan_block_masks(&state, cur, delimiters, ats, dots, newlines, 0xFFFFFFFF, previous_is_delimiter);
+    }
+    return finish_scan(&state, field_length);
+}
+
+#endif
+
+/*!
+ * @brief select_mail_scanner chooses the fastest scanner supported by the CPU running the program
+ * @return a pointer to the chosen scanner
+ */
+static mail_scanner_t select_mail_scanner() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return scan_mail_spans_avx2;
+    if(__builtin_cpu_supports("sse2")) return scan_mail_spans_sse2;
+#endif
+    return scan_mail_spans_scalar;
+}
+
+static mail_scanner_t scanner = NULL;
+
+/*!
+ * @brief scan_mail_spans finds the e-mail addresses in a buffer, without copying them. The scanner is chosen at the
+ * first call, depending on the instruction sets available (AVX2, then SSE2, then scalar).
+ * @param buffer the buffer to scan
+ * @param length the length of the buffer
+ * @param spans the array receiving the addresses found (offsets are relative to buffer)
+ * @param max_spans the capacity of spans, extra addresses are ignored
+ * @return the number of addresses found
+ */
+size_t scan_mail_spans(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans) {
+    if(scanner == NULL) scanner = select_mail_scanner();
+    return scanner(buffer, length, spans, max_spans, NULL);
+}
+
+/*!
+ * @brief scan_mail_field finds the e-mail addresses in the value of a header field, which may be folded on several
+ * lines. The scan stops at the end of the field, so that the addresses and the end of the field are found in a single
+ * pass.
+ * @param buffer the buffer holding the value of the field, followed by the next fields
+ * @param length the length of the buffer
+ * @param spans the array receiving the addresses found (offsets are relative to buffer)
+ * @param max_spans the capacity of spans, extra addresses are ignored
+ * @param field_length a pointer set to the length of the field value, line break included
+ * @return the number of addresses found
+ */
+size_t scan_mail_field(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans, size_t *field_length) {
+    if(scanner == NULL) scanner = select_mail_scanner();
+    return scanner(buffer, length, spans, max_spans, field_length);
+}
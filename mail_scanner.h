@@ -0,0 +1,27 @@
+#ifndef A2022_MAIL_SCANNER_H
+#define A2022_MAIL_SCANNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// An e-mail address found in a buffer, as an offset from the beginning of the buffer and a length
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} mail_span_t;
+
+typedef size_t (* mail_scanner_t)(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans,
+                                  size_t *field_length);
+
+size_t scan_mail_spans(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans);
+size_t scan_mail_field(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans, size_t *field_length);
+size_t scan_mail_spans_scalar(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans,
+                              size_t *field_length);
+#if defined(__x86_64__) || defined(__i386__)
+size_t scan_mail_spans_sse2(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans,
+                            size_t *field_length);
+size_t scan_mail_spans_avx2(const char *buffer, size_t length, mail_span_t *spans, size_t max_spans,
+                            size_t *field_length);
+#endif
+
+#endif //A2022_MAIL_SCANNER_H
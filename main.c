@@ -9,6 +9,7 @@
 #include "reducers.h"
 #include "utility.h"
 #include "analysis.h"
+#include "file_tasks.h"
 
 #include <sys/msg.h>
 #include <sys/select.h>
@@ -38,6 +39,36 @@
 #endif
 #endif
 
+/*!
+ * @brief open_file_tasks prepares the tasks of the files step. Step by step, step1_output is made from the files lists
+ * of step 1 (which must be over); else the walk of the data source starts, its files being streamed to the tasks.
+ * @param config a pointer to the configuration
+ * @param tasks the tasks to initialize
+ * @return true on success, false if the tasks could not be prepared
+ */
+static bool open_file_tasks(configuration_t *config, file_tasks_t *tasks)
+{
+    if (!config->is_step_by_step)
+        return start_file_stream(tasks, config->data_path, config->temporary_directory, config->chunk_size,
+                                 config->is_resumed);
+    sync_temporary_files(config->temporary_directory);
+    char step1_output[STR_MAX_LEN];
+    concat_path(config->temporary_directory, "step1_output", step1_output);
+    files_list_reducer(config->data_path, config->temporary_directory, step1_output);
+    return open_files_list_tasks(tasks, config->data_path, config->temporary_directory, config->chunk_size,
+                                 config->is_resumed);
+}
+
+/*!
+ * @brief close_file_tasks_of_run releases the tasks of the files step, reporting an incomplete walk
+ * @param tasks the tasks
+ */
+static void close_file_tasks_of_run(file_tasks_t *tasks)
+{
+    if (!close_file_tasks(tasks))
+        fprintf(stderr, "[ERROR] The data source could not be fully listed, results are incomplete\n");
+}
+
 int main(int argc, char *argv[])
 {
     struct timeval tv_init, tv_end;
@@ -50,6 +81,17 @@ int main(int argc, char *argv[])
         .output_file = "",
         .is_verbose = false,
         .cpu_core_multiplier = 2,
+        .chunk_size = 256,
+        .is_text_step2 = false,
+        .is_step_by_step = false,
+        .is_full_run = false,
+        .is_resumed = false,
+        .top_k = 0,
+        .memory_budget = 0,
+        .is_combined = false,
+        .graph_file = "",
+        .analytics_file = "",
+        .approximate_edges = 0,
     };
     make_configuration(&config, argv, argc);
     if (!is_configuration_valid(&config))
@@ -60,6 +102,62 @@ int main(int argc, char *argv[])
         return -1;
     }
     config.process_count = get_nprocs() * config.cpu_core_multiplier;
+    set_step2_format(config.is_text_step2 ? STEP2_FORMAT_TEXT : STEP2_FORMAT_BINARY);
+    set_step2_combiner(config.is_combined);
+    // The approximate mode writes summaries instead of shards: they are neither committed nor cached, and its output
+    // is not the one the graph is built from
+    bool is_approximate = config.approximate_edges > 0;
+    set_approximate_mode(is_approximate);
+    if (is_approximate && config.is_resumed)
+    {
+        printf("[WARNING] An approximate run can not be resumed, -R is ignored\n");
+        config.is_resumed = false;
+    }
+    if (is_approximate && (config.graph_file[0] != '\0' || config.analytics_file[0] != '\0'))
+    {
+        printf("[WARNING] No graph is written from an approximate run, -g and -a are ignored\n");
+        config.graph_file[0] = '\0';
+        config.analytics_file[0] = '\0';
+    }
+    // The analytics are those of the whole aggregation, and their graph is built from the output: it must keep all
+    // the recipients of each sender
+    if (config.top_k != 0 && config.analytics_file[0] != '\0')
+    {
+        printf("[WARNING] The analytics need all the recipients of each sender, -k is ignored\n");
+        config.top_k = 0;
+    }
+    set_output_top_k(config.top_k);
+    set_output_graph(config.graph_file);
+    set_output_analytics(config.analytics_file, get_nprocs());
+    // The memory budget is shared by the partitions reduced at once
+    uint32_t reducers_count = (config.process_count < STEP2_PARTITIONS_COUNT) ? config.process_count
+                                                                              : STEP2_PARTITIONS_COUNT;
+    set_reducer_memory_budget((size_t)config.memory_budget * 1024 * 1024 / (reducers_count ? reducers_count : 1));
+    // Directories are checked and opened once: workers inherit them and open their files relative to them
+    run_context_t run_context;
+    if (!open_run_context(&run_context, config.data_path, config.temporary_directory))
+    {
+        printf("[ERROR] Could not open the data source or temporary directory, exiting\n");
+        return -1;
+    }
+    set_run_context(&run_context);
+    // E-mails of the previous run are found in its cache (mapped before the workers are created), unless all of them
+    // must be parsed again, or their records are combined (they can not be cached). A resumed run keeps the cache of
+    // the interrupted run, which its committed tasks refer to.
+    if (config.is_full_run && config.is_resumed)
+        printf("[WARNING] The interrupted run is resumed with its mail caches, -F is ignored\n");
+    mail_cache_t mail_caches[STEP2_PARTITIONS_COUNT];
+    for (uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p)
+    {
+        char mail_cache_name[STR_MAX_LEN];
+        char mail_cache_path[STR_MAX_LEN];
+        snprintf(mail_cache_name, STR_MAX_LEN, MAIL_CACHE_FORMAT, p);
+        concat_path(config.temporary_directory, mail_cache_name, mail_cache_path);
+        if ((config.is_full_run || config.is_combined) && !config.is_resumed)
+            remove(mail_cache_path);
+        mail_cache_open(&mail_caches[p], mail_cache_path, p);
+    }
+    set_mail_caches(is_approximate ? NULL : mail_caches);
     printf("[INFO] Running analysis on configuration:\n");
     display_configuration(&config);
     printf("\n[INFO] Please wait, it can take a while\n\n");
@@ -75,17 +173,26 @@ int main(int argc, char *argv[])
     }
     pid_t *my_children = mq_make_processes(&config, mq);
 
-    // Execution
-    mq_process_directory(&config, mq, my_children);
-    sync_temporary_files(config.temporary_directory);
-    char temp_result_name[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step1_output", temp_result_name);
-    files_list_reducer(config.data_path, config.temporary_directory, temp_result_name);
-    mq_process_files(&config, mq, my_children);
+    // Execution (step 1 is only run on its own step by step: files are streamed from the walk of the data source)
+    if (config.is_step_by_step)
+        mq_process_directory(&config, mq, my_children);
+    file_tasks_t file_tasks;
+    if (open_file_tasks(&config, &file_tasks))
+    {
+        mq_process_files(&config, mq, my_children, &file_tasks);
+        close_file_tasks_of_run(&file_tasks);
+    }
     sync_temporary_files(config.temporary_directory);
-    char step2_file[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step2_output", step2_file);
-    files_reducer(step2_file, config.output_file);
+    // Each partition of the senders is reduced by a worker, then the results are merged (in approximate mode, the
+    // summaries of the workers are merged instead)
+    if (is_approximate)
+        approximate_files_reducer(config.temporary_directory, config.output_file, config.approximate_edges);
+    else
+    {
+        remove_partitions_results(config.temporary_directory);
+        mq_process_partitions(&config, mq, my_children);
+        files_reducer(config.temporary_directory, config.output_file);
+    }
 
     // Clean
     close_processes(&config, mq, my_children);
@@ -100,19 +207,29 @@ int main(int argc, char *argv[])
     concat_path(config.temporary_directory, "fifo-out-%d", output_file_format);
     make_fifos(config.process_count, input_file_format);
     make_fifos(config.process_count, output_file_format);
-    make_processes(config.process_count);
+    make_processes(config.process_count, input_file_format, output_file_format);
     int *command_fifos = open_fifos(config.process_count, input_file_format, O_WRONLY);
     int *notify_fifos = open_fifos(config.process_count, output_file_format, O_RDONLY);
-    fifo_process_directory(config.data_path, config.temporary_directory, notify_fifos, command_fifos, config.process_count);
-    sync_temporary_files(config.temporary_directory);
-    char fifo_temp_result_name[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step1_output", fifo_temp_result_name);
-    files_list_reducer(config.data_path, config.temporary_directory, fifo_temp_result_name);
-    fifo_process_files(config.data_path, config.temporary_directory, notify_fifos, command_fifos, config.process_count);
+    if (config.is_step_by_step)
+        fifo_process_directory(config.data_path, config.temporary_directory, notify_fifos, command_fifos,
+                               config.process_count);
+    file_tasks_t file_tasks;
+    if (open_file_tasks(&config, &file_tasks))
+    {
+        fifo_process_files(&file_tasks, config.temporary_directory, notify_fifos, command_fifos, config.process_count);
+        close_file_tasks_of_run(&file_tasks);
+    }
     sync_temporary_files(config.temporary_directory);
-    char fifo_step2_file[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step2_output", fifo_step2_file);
-    //files_reducer(fifo_step2_file, config.output_file);
+    // Each partition of the senders is reduced by a worker, then the results are merged (in approximate mode, the
+    // summaries of the workers are merged instead)
+    if (is_approximate)
+        approximate_files_reducer(config.temporary_directory, config.output_file, config.approximate_edges);
+    else
+    {
+        remove_partitions_results(config.temporary_directory);
+        fifo_process_partitions(config.temporary_directory, notify_fifos, command_fifos, config.process_count);
+        files_reducer(config.temporary_directory, config.output_file);
+    }
     shutdown_processes(config.process_count, command_fifos);
     close_fifos(config.process_count, command_fifos);
     close_fifos(config.process_count, notify_fifos);
@@ -121,33 +238,45 @@ int main(int argc, char *argv[])
 #endif
 
 #ifdef METHOD_DIRECT
-    if (config.is_verbose)
-        printf("[VERBOSE] Parsing the data source...\n");
-    direct_fork_directories(config.data_path, config.temporary_directory, config.process_count);
-    if (config.is_verbose){
-        printf("[VERBOSE] Finished parsing the data source\n");
-        printf("[VERBOSE] Syncing the temporary files\n");
+    if (config.is_step_by_step)
+    {
+        if (config.is_verbose)
+            printf("[VERBOSE] Parsing the data source...\n");
+        direct_fork_directories(config.data_path, config.temporary_directory, config.process_count);
+        if (config.is_verbose){
+            printf("[VERBOSE] Finished parsing the data source\n");
+            printf("[VERBOSE] Syncing the temporary files\n");
+        }
     }
-    sync_temporary_files(config.temporary_directory);
-    char direct_temp_result_name[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step1_output", direct_temp_result_name);
-    files_list_reducer(config.data_path, config.temporary_directory, direct_temp_result_name);
     if (config.is_verbose) printf("[VERBOSE] Parsing the mails found...\n");
     // parse_file("/home/olivier/Documents/UTBM/TC3/LP25/lp25-project/maildir/horton-s/_sent_mail/9.", "./temp");
-    direct_fork_files(config.data_path, config.temporary_directory, config.process_count);
+    file_tasks_t file_tasks;
+    if (open_file_tasks(&config, &file_tasks))
+    {
+        direct_fork_files(&file_tasks, config.temporary_directory, config.process_count);
+        close_file_tasks_of_run(&file_tasks);
+    }
     if(config.is_verbose) {
         printf("[VERBOSE] Finished parsing the mails\n");
         printf("[VERBOSE] Now compiling...\n");
     }
     sync_temporary_files(config.temporary_directory);
-    char direct_step2_file[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step2_output", direct_step2_file);
     gettimeofday(&tv_end, NULL);
     uint32_t exec_time = 1000000*(tv_end.tv_sec - tv_init.tv_sec) + (tv_end.tv_usec - tv_init.tv_usec);
     printf("Execution time: %lu microseconds\n", exec_time);
 
-    files_reducer(direct_step2_file, config.output_file);
+    if (is_approximate)
+        approximate_files_reducer(config.temporary_directory, config.output_file, config.approximate_edges);
+    else
+    {
+        remove_partitions_results(config.temporary_directory);
+        direct_fork_partitions(config.temporary_directory, config.process_count);
+        files_reducer(config.temporary_directory, config.output_file);
+    }
 #endif
 
+    for (uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p)
+        mail_cache_close(&mail_caches[p]);
+    close_run_context(&run_context);
     return 0;
 }
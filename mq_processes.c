@@ -18,6 +18,7 @@
 
 #include "utility.h"
 #include "analysis.h"
+#include "reducers.h"
 
 
 /*!
@@ -54,7 +55,7 @@ void child_process(int mq) {
     // 1. Endless loop (interrupted by a task whose callback is NULL
     while (1){
 
-        if ((msgrcv(mq, &msg_received, sizeof(mq_message_t), pid, 0)) == -1) {
+        if ((msgrcv(mq, &msg_received, sizeof(msg_received.mtext), pid, 0)) == -1) {
             fprintf(stderr, "[ERROR] msgrcv child_process\n");
             return;
         }
@@ -72,7 +73,7 @@ void child_process(int mq) {
             msg_sent.mtype = 1;
             msg_sent.pid_child = pid;
 
-            if (msgsnd(mq,&msg_sent, sizeof(mq_message_t),0) == -1){
+            if (msgsnd(mq,&msg_sent, sizeof(msg_sent.pid_child),0) == -1){
                 fprintf(stderr, "[ERROR] msgsnd child_process\n");
                 return;
             }
@@ -101,7 +102,9 @@ pid_t *mq_make_processes(configuration_t *config, int mq) {
     for(int i = 0; i < config->process_count; i++){
         my_children[i] = fork();
         if(my_children[i] == 0){
+            set_worker_id(i);
             child_process(mq);
+            close_step2_shards();
             free(my_children);
             exit (1);
         }
@@ -126,7 +129,7 @@ void close_processes(configuration_t *config, int mq, pid_t children[]) {
 
     for(int i = 0; i < config->process_count; i++){
         msg.mtype = children[i];
-        if (msgsnd(mq, &msg, sizeof(mq_message_t), 0) == -1) {
+        if (msgsnd(mq, &msg, sizeof(msg.mtext), 0) == -1) {
             fprintf(stderr, "[ERROR] msgsnd mq_process_directory\n");
             return;
         }
@@ -156,43 +159,51 @@ void send_task_to_mq(char data_source[], char temp_files[], char target_dir[], i
 
     directoryTask->task_callback = process_directory;
     concat_path(data_source,target_dir,directoryTask->object_directory);
-    concat_path(temp_files,target_dir,directoryTask->temporary_directory);
+    strcpy(directoryTask->temporary_directory, temp_files);
 
-    if (msgsnd(mq,&msg, sizeof(mq_message_t),0) == -1){
+    if (msgsnd(mq,&msg, sizeof(msg.mtext),0) == -1){
         fprintf(stderr, "[ERROR] msgsnd send_task_to_mq\n");
         return;
     }
 }
 
 /*!
- * @brief send_file_task_to_mq sends a file task to a worker. It operates similarly to @see send_task_to_mq
- * @param data_source the data source directory
- * @param temp_files the temporary files directory
- * @param target_file the target filename
+ * @brief send_file_task_to_mq sends a task of the files step (range of step1_output or batch of streamed files) to a
+ * worker. It operates similarly to @see send_task_to_mq
+ * @param task the task, made by next_file_task
  * @param mq the MQ descriptor
  * @param worker_pid the worker's PID
  */
-
-void send_file_task_to_mq(char data_source[], char temp_files[], char target_file[], int mq, pid_t worker_pid) {
-    if (!path_to_file_exists(data_source) || mq < 0 || worker_pid == 0) {
+void send_file_task_to_mq(task_t *task, int mq, pid_t worker_pid) {
+    if (task == NULL || mq < 0 || worker_pid == 0) {
         fprintf(stderr, "[ERROR] Invalid parameters send_file_task_to_mq\n");
         return;
     }
-    file_task_t *fileTask;
     mq_message_t msg;
     msg.mtype = worker_pid;
-    fileTask = (file_task_t *)&msg.mtext;
+    memcpy(msg.mtext, task, sizeof(task_t));
 
-    fileTask->task_callback = process_file;
-    concat_path(data_source,target_file,fileTask->object_file);
-    concat_path(temp_files,target_file,fileTask->temporary_directory);
-
-    if (msgsnd(mq,&msg, sizeof(mq_message_t),0) == -1){
+    if (msgsnd(mq,&msg, sizeof(msg.mtext),0) == -1){
         fprintf(stderr, "[ERROR] msgsnd send_file_task_to_mq\n");
         return;
     }
 }
 
+/*!
+ * @brief wait_for_mq_workers waits for the end of the tasks still running on workers
+ * @param mq the MQ descriptor
+ * @param busy_workers the number of workers running a task
+ */
+void wait_for_mq_workers(int mq, int busy_workers) {
+    mq_reponse_t msg_received;
+    for (int i = 0; i < busy_workers; ++i) {
+        if ((msgrcv(mq, &msg_received, sizeof(msg_received.pid_child), 1, 0)) == -1) {
+            fprintf(stderr, "[ERROR] msgrcv wait_for_mq_workers\n");
+            return;
+        }
+    }
+}
+
 /*!
  * @brief mq_process_directory root function for parallelizing directory analysis over workers. Must keep track of the
  * tasks count to ensure every worker handles one and only one task. Relies on two steps: one to fill all workers with
@@ -219,7 +230,7 @@ void mq_process_directory(configuration_t *config, int mq, pid_t children[]) {
 
     // 2. Iterate over children and provide one directory to each
     int i = 0;
-    while ((current_dir = next_dir(current_dir, dir)) != NULL && i < config->process_count){
+    while (i < config->process_count && (current_dir = next_dir(current_dir, dir)) != NULL){
         send_task_to_mq(config->data_path, config->temporary_directory, current_dir->d_name, mq, children[i]);
         ++i;
     }
@@ -232,7 +243,7 @@ void mq_process_directory(configuration_t *config, int mq, pid_t children[]) {
         mq_reponse_t msg_received;
 
         // if a worker has finish send new task
-        if ((msgrcv(mq, &msg_received, sizeof(mq_message_t), 1, 0)) == -1) {
+        if ((msgrcv(mq, &msg_received, sizeof(msg_received.pid_child), 1, 0)) == -1) {
             fprintf(stderr, "[ERROR] msgrcv mq_process_directory\n");
             return;
         }
@@ -240,6 +251,7 @@ void mq_process_directory(configuration_t *config, int mq, pid_t children[]) {
         send_task_to_mq(config->data_path, config->temporary_directory, current_dir->d_name, mq, msg_received.pid_child);
 
     }
+    wait_for_mq_workers(mq, i);
 
     // 4. Cleanup
     free(current_dir);
@@ -248,60 +260,78 @@ void mq_process_directory(configuration_t *config, int mq, pid_t children[]) {
 
 /*!
  * @brief mq_process_files root function for parallelizing files analysis over workers. Operates as
- * @see mq_process_directory to limit tasks to one on each worker.
+ * @see mq_process_directory to limit tasks to one on each worker. Each task is a range of chunk_size files of the
+ * files list, or a batch of files streamed from the walk of the data source.
  * @param config a pointer to the configuration with all relevant path and values
  * @param mq the MQ descriptor
  * @param children the children's PIDs used as MQ topics number
+ * @param tasks the tasks of the files step
  */
-void mq_process_files(configuration_t *config, int mq, pid_t children[]) {
-     // 1. Check parameters
-      if (config == NULL || mq < 0 || children == NULL) {
-          fprintf(stderr, "[ERROR] Invalid parameters\n");
-          return;
-      }
-
-      // Open email file
-      FILE *f = fopen(config->data_path,"r");
-      if (f == NULL){
-          fprintf(stderr, "[ERROR] Invalid file\n");
-          return;
-      }
-
-      // 2. Iterate over children and provide one file to each
-      char * line = NULL;
-      size_t len = 2*STR_MAX_LEN;
-      ssize_t read;
-      int i = 0;
-      while ((read = getline(&line, &len , f)) != -1 && i < config->process_count) {
-          // Send the task
-          send_file_task_to_mq((char *)read , config->temporary_directory, config->output_file, mq, children[i]);
-          ++i;
-      }
-
-      // 3. Loop while there are files to process, and while all workers are processing
-
-      while ((read = getline(&line, &len , f)) != -1) {
-          mq_message_t msg_received;
-          // if a worker has finish send new task
-          do {
-              if (msgsnd(mq, &msg_received, sizeof(task_t), 0) == -1) {
-                  fprintf(stderr, "[ERROR] msgsnd\n");
-                  return;
-              }
-              if (msg_received.mtext[0] != 1){
-                  break;
-              }
-              if ((msgrcv(mq, &msg_received, sizeof(task_t), 0, 0)) == -1) {
-                  fprintf(stderr, "[ERROR] msgrcv\n");
-                  return;
-              }
-          } while (msg_received.mtext[0] != 1);
-          send_file_task_to_mq((char *)read, config->temporary_directory, config->output_file, mq, msg_received.mtype);
-
-      }
-      if (line)
-          free(line);
-
-      // 4. Cleanup
-      fclose(f);
+void mq_process_files(configuration_t *config, int mq, pid_t children[], file_tasks_t *tasks) {
+    // 1. Check parameters
+    if (config == NULL || mq < 0 || children == NULL || tasks == NULL) {
+        fprintf(stderr, "[ERROR] Invalid parameters mq_process_files\n");
+        return;
+    }
+
+    // 2. Iterate over children and provide one task to each
+    task_t task;
+    int busy_workers = 0;
+    while (busy_workers < config->process_count && next_file_task(tasks, &task)) {
+        send_file_task_to_mq(&task, mq, children[busy_workers]);
+        ++busy_workers;
+    }
+
+    // 3. Loop while there are tasks to process, and while all workers are processing
+    while (next_file_task(tasks, &task)) {
+        mq_reponse_t msg_received;
+        // if a worker has finish send new task
+        if ((msgrcv(mq, &msg_received, sizeof(msg_received.pid_child), 1, 0)) == -1) {
+            fprintf(stderr, "[ERROR] msgrcv mq_process_files\n");
+            break;
+        }
+        send_file_task_to_mq(&task, mq, msg_received.pid_child);
+    }
+    wait_for_mq_workers(mq, busy_workers);
+
+    // 4. Each worker writes the records left in its combiners before the partitions are reduced
+    task_t end_task = {.task_callback = process_files_end};
+    for (int i = 0; i < config->process_count; ++i) send_file_task_to_mq(&end_task, mq, children[i]);
+    wait_for_mq_workers(mq, config->process_count);
+}
+
+/*!
+ * @brief mq_process_partitions root function for parallelizing the reduction of the partitions of the senders over
+ * workers. Operates as @see mq_process_files, with one task per partition.
+ * @param config a pointer to the configuration with all relevant path and values
+ * @param mq the MQ descriptor
+ * @param children the children's PIDs used as MQ topics number
+ */
+void mq_process_partitions(configuration_t *config, int mq, pid_t children[]) {
+    if (config == NULL || mq < 0 || children == NULL) {
+        fprintf(stderr, "[ERROR] Invalid parameters mq_process_partitions\n");
+        return;
+    }
+    task_t task;
+    memset(&task, 0, sizeof(task_t));
+    partition_task_t *partition_task = (partition_task_t *)&task;
+    partition_task->task_callback = reduce_partition;
+    strcpy(partition_task->temporary_directory, config->temporary_directory);
+
+    int busy_workers = 0;
+    for (uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p) {
+        partition_task->partition = p;
+        if (busy_workers < config->process_count) {
+            send_file_task_to_mq(&task, mq, children[busy_workers]);
+            ++busy_workers;
+            continue;
+        }
+        mq_reponse_t msg_received;
+        if ((msgrcv(mq, &msg_received, sizeof(msg_received.pid_child), 1, 0)) == -1) {
+            fprintf(stderr, "[ERROR] msgrcv mq_process_partitions\n");
+            break;
+        }
+        send_file_task_to_mq(&task, mq, msg_received.pid_child);
+    }
+    wait_for_mq_workers(mq, busy_workers);
 }
@@ -9,6 +9,7 @@
 #include <sys/types.h>
 
 #include "configuration.h"
+#include "file_tasks.h"
 
 typedef struct {
     long mtype;
@@ -28,6 +29,7 @@ void child_process(int mq);
 pid_t *mq_make_processes(configuration_t *config, int mq);
 void close_processes(configuration_t *config, int mq, pid_t children[]);
 void mq_process_directory(configuration_t *config, int mq, pid_t children[]);
-void mq_process_files(configuration_t *config, int mq, pid_t children[]);
+void mq_process_files(configuration_t *config, int mq, pid_t children[], file_tasks_t *tasks);
+void mq_process_partitions(configuration_t *config, int mq, pid_t children[]);
 
 #endif //A2022_MQ_PROCESSES_H
@@ -0,0 +1,172 @@
+#include "pair_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief hash_pair computes the hash of a (sender, recipient) pair (multiplicative hashing of both IDs)
+ * @param sender_id the ID of the sender
+ * @param recipient_id the ID of the recipient
+ * @return the hash
+ */
+static uint32_t hash_pair(uint32_t sender_id, uint32_t recipient_id) {
+    uint64_t key = ((uint64_t)sender_id << 32) | recipient_id;
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/*!
+ * @brief pair_table_init initializes an empty table (memory is allocated at the first insertion)
+ * @param table the table to initialize
+ */
+void pair_table_init(pair_table_t *table) {
+    if(table == NULL) return;
+    memset(table, 0, sizeof(pair_table_t));
+}
+
+/*!
+ * @brief pair_table_free frees all the memory of a table, leaving it empty
+ * @param table the table to free
+ */
+void pair_table_free(pair_table_t *table) {
+    if(table == NULL) return;
+    free(table->pairs);
+    free(table->slots);
+    free(table->old_slots);
+    pair_table_init(table);
+}
+
+/*!
+ * @brief pair_table_clear removes all the pairs of a table, keeping its memory for the next ones
+ * @param table the table to clear
+ */
+void pair_table_clear(pair_table_t *table) {
+    if(table == NULL) return;
+    free(table->old_slots);
+    table->old_slots = NULL;
+    table->old_slots_count = 0;
+    table->old_count = 0;
+    table->migrated = 0;
+    table->count = 0;
+    if(table->slots != NULL) memset(table->slots, 0, table->slots_count * sizeof(uint32_t));
+}
+
+/*!
+ * @brief find_in_slots looks for a pair in a hash table
+ * @param table the table holding the pairs
+ * @param slots the hash table
+ * @param slots_count the size of the hash table (a power of 2)
+ * @param sender_id the ID of the sender
+ * @param recipient_id the ID of the recipient
+ * @return the index of the pair, PAIR_TABLE_END if it is not in this hash table
+ */
+static uint32_t find_in_slots(pair_table_t *table, uint32_t *slots, uint32_t slots_count, uint32_t sender_id,
+                              uint32_t recipient_id) {
+    if(slots_count == 0) return PAIR_TABLE_END;
+    uint32_t slot = hash_pair(sender_id, recipient_id) & (slots_count - 1);
+    while(slots[slot] != 0){
+        pair_t *pair = &table->pairs[slots[slot] - 1];
+        if(pair->sender_id == sender_id && pair->recipient_id == recipient_id) return slots[slot] - 1;
+        slot = (slot + 1) & (slots_count - 1);
+    }
+    return PAIR_TABLE_END;
+}
+
+/*!
+ * @brief insert_in_slots adds a pair, that is not there yet, to the current hash table
+ * @param table the table
+ * @param index the index of the pair
+ */
+static void insert_in_slots(pair_table_t *table, uint32_t index) {
+    uint32_t slot = hash_pair(table->pairs[index].sender_id, table->pairs[index].recipient_id) &
+                    (table->slots_count - 1);
+    while(table->slots[slot] != 0) slot = (slot + 1) & (table->slots_count - 1);
+    table->slots[slot] = index + 1;
+}
+
+/*!
+ * @brief migrate_pairs moves pairs from the previous hash table to the current one, and frees the previous one once
+ * all its pairs are moved
+ * @param table the table
+ * @param count the maximum number of pairs to move
+ */
+static void migrate_pairs(pair_table_t *table, uint32_t count) {
+    if(table->old_slots == NULL) return;
+    for(uint32_t i = 0; i < count && table->migrated < table->old_count; ++i) insert_in_slots(table, table->migrated++);
+    if(table->migrated == table->old_count){
+        free(table->old_slots);
+        table->old_slots = NULL;
+        table->old_slots_count = 0;
+    }
+}
+
+/*!
+ * @brief reserve_pair makes room in a table for a new pair. When the hash table is half full, a twice larger one
+ * replaces it, the pairs being moved by the next insertions (@see migrate_pairs).
+ * @param table the table
+ * @return true on success, false if allocation failed
+ */
+static bool reserve_pair(pair_table_t *table) {
+    if(table->count == table->capacity){
+        uint32_t capacity = (table->capacity == 0) ? PAIR_TABLE_INITIAL_CAPACITY : 2 * table->capacity;
+        pair_t *pairs = realloc(table->pairs, capacity * sizeof(pair_t));
+        if(pairs == NULL) return false;
+        table->pairs = pairs;
+        table->capacity = capacity;
+    }
+    if(2 * (table->count + 1) <= table->slots_count) return true;
+
+    uint32_t slots_count = (table->slots_count == 0) ? 2 * PAIR_TABLE_INITIAL_CAPACITY : 2 * table->slots_count;
+    uint32_t *slots = calloc(slots_count, sizeof(uint32_t));
+    if(slots == NULL) return false;
+    // The previous migration is normally over by now: pairs are moved faster than the table fills up
+    migrate_pairs(table, UINT32_MAX);
+    table->old_slots = table->slots;
+    table->old_slots_count = table->slots_count;
+    table->old_count = table->count;
+    table->migrated = 0;
+    table->slots = slots;
+    table->slots_count = slots_count;
+    if(table->old_slots == NULL) table->old_count = 0;
+    return true;
+}
+
+/*!
+ * @brief pair_table_find returns the index of a (sender, recipient) pair, without adding it to the table
+ * @param table the table
+ * @param sender_id the ID of the sender
+ * @param recipient_id the ID of the recipient
+ * @return the index of the pair in pairs, PAIR_TABLE_END if it is not in the table
+ */
+uint32_t pair_table_find(pair_table_t *table, uint32_t sender_id, uint32_t recipient_id) {
+    if(table == NULL) return PAIR_TABLE_END;
+    uint32_t index = find_in_slots(table, table->slots, table->slots_count, sender_id, recipient_id);
+    if(index == PAIR_TABLE_END && table->old_slots != NULL){
+        index = find_in_slots(table, table->old_slots, table->old_slots_count, sender_id, recipient_id);
+    }
+    return index;
+}
+
+/*!
+ * @brief pair_table_add returns the index of a (sender, recipient) pair, adding the pair to the table (with 0
+ * occurrences, and not linked to the other pairs of the sender) if it is not known yet
+ * @param table the table
+ * @param sender_id the ID of the sender
+ * @param recipient_id the ID of the recipient
+ * @param is_new if not NULL, set to true if the pair was added, false if it was already known
+ * @return the index of the pair in pairs (pointers to pairs are only valid until the next insertion), PAIR_TABLE_END if
+ * it could not be added
+ */
+uint32_t pair_table_add(pair_table_t *table, uint32_t sender_id, uint32_t recipient_id, bool *is_new) {
+    if(is_new != NULL) *is_new = false;
+    if(table == NULL) return PAIR_TABLE_END;
+    uint32_t known_index = pair_table_find(table, sender_id, recipient_id);
+    if(known_index != PAIR_TABLE_END) return known_index;
+
+    if(!reserve_pair(table)) return PAIR_TABLE_END;
+    migrate_pairs(table, PAIR_TABLE_MIGRATION_STEP);
+    uint32_t index = table->count++;
+    table->pairs[index] = (pair_t){sender_id, recipient_id, 0, PAIR_TABLE_END};
+    insert_in_slots(table, index);
+    if(is_new != NULL) *is_new = true;
+    return index;
+}
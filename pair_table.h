@@ -0,0 +1,45 @@
+#ifndef A2022_PAIR_TABLE_H
+#define A2022_PAIR_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PAIR_TABLE_INITIAL_CAPACITY 4096
+// Index of no pair: end of the pairs of a sender, or a pair that could not be added
+#define PAIR_TABLE_END UINT32_MAX
+// Pairs moved from the previous hash table to the new one at each insertion, while the table is resized
+#define PAIR_TABLE_MIGRATION_STEP 4
+
+// Occurrences of a recipient for a sender (address IDs of the results dictionary)
+typedef struct {
+    uint32_t sender_id;
+    uint32_t recipient_id;
+    int32_t occurrences;        // 0 once its e-mails were all removed (pairs are never deleted), a delta once spilled
+    uint32_t next;              // Index of the next pair of the same sender, PAIR_TABLE_END for its last pair
+} pair_t;
+
+/*
+ * Flat table of the (sender, recipient) pairs, in a single array in order of insertion, indexed by an open addressing
+ * table of pair index + 1 (0 is an empty slot). When the hash table is full, a twice larger one is allocated, and the
+ * pairs are moved to it a few at a time by the next insertions (no insertion rehashes all the pairs): meanwhile, a pair
+ * that is not in the new table is looked for in the previous one.
+ */
+typedef struct {
+    pair_t *pairs;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *slots;
+    uint32_t slots_count;       // Always a power of 2, at least twice count
+    uint32_t *old_slots;        // Previous hash table while the pairs are moved, NULL otherwise
+    uint32_t old_slots_count;
+    uint32_t old_count;         // Pairs [migrated, old_count) are only in old_slots
+    uint32_t migrated;
+} pair_table_t;
+
+void pair_table_init(pair_table_t *table);
+void pair_table_free(pair_table_t *table);
+void pair_table_clear(pair_table_t *table);
+uint32_t pair_table_find(pair_table_t *table, uint32_t sender_id, uint32_t recipient_id);
+uint32_t pair_table_add(pair_table_t *table, uint32_t sender_id, uint32_t recipient_id, bool *is_new);
+
+#endif //A2022_PAIR_TABLE_H
@@ -10,101 +10,355 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <math.h>
 
 #include "global_defs.h"
 #include "utility.h"
+#include "analysis.h"
+#include "step2_format.h"
+#include "checkpoint.h"
+#include "graph_file.h"
+#include "graph_analytics.h"
+#include "approx_summary.h"
 
 /*!
- * @brief add_source_to_list adds an e-mail to the sources list. If the e-mail already exists, do not add it.
- * @param list the list to update
- * @param source_email the e-mail to add as a string
- * @return a pointer to the updated beginning of the list
+ * @brief init_step2_results initializes empty results (memory is allocated at the first insertion)
+ * @param results the results to initialize
  */
-sender_t *add_source_to_list(sender_t *list, char *source_email) {
-    if(source_email == NULL) return list;
-    sender_t *list_start = list;
-    while(list_start != NULL){
-        if(strcmp(list_start->sender_address, source_email)==0) return list;
-        list_start = list_start->next;
+void init_step2_results(step2_results_t *results) {
+    if(results == NULL) return;
+    memset(results, 0, sizeof(step2_results_t));
+    address_dict_init(&results->addresses);
+    pair_table_init(&results->recipients);
+}
+
+/*!
+ * @brief free_step2_results frees all the memory of results, leaving them empty
+ * @param results the results to free
+ */
+void free_step2_results(step2_results_t *results) {
+    if(results == NULL) return;
+    address_dict_free(&results->addresses);
+    pair_table_free(&results->recipients);
+    free(results->sources);
+    free(results->sources_by_id);
+    init_step2_results(results);
+}
+
+/*!
+ * @brief add_source adds an address ID to the sources. If the ID already exists, do not add it.
+ * @param results the results holding the sources to update
+ * @param source_id the ID of the address to add
+ * @return a pointer to the source with this ID (valid until the next source is added), NULL if it could not be added
+ */
+sender_t *add_source(step2_results_t *results, uint32_t source_id) {
+    if(results == NULL || source_id == ADDRESS_DICT_INVALID_ID) return NULL;
+    sender_t *source = find_source(results, source_id);
+    if(source != NULL) return source;
+
+    if(source_id >= results->sources_by_id_size){
+        uint32_t new_size = (results->sources_by_id_size == 0) ? ADDRESS_DICT_INITIAL_CAPACITY
+                                                               : results->sources_by_id_size;
+        while(new_size <= source_id) new_size *= 2;
+        uint32_t *new_index = realloc(results->sources_by_id, new_size * sizeof(uint32_t));
+        if(new_index == NULL) return NULL;
+        memset(new_index + results->sources_by_id_size, 0,
+               (new_size - results->sources_by_id_size) * sizeof(uint32_t));
+        results->sources_by_id = new_index;
+        results->sources_by_id_size = new_size;
+    }
+    if(results->sources_count == results->sources_capacity){
+        uint32_t capacity = (results->sources_capacity == 0) ? ADDRESS_DICT_INITIAL_CAPACITY
+                                                             : 2 * results->sources_capacity;
+        sender_t *sources = realloc(results->sources, capacity * sizeof(sender_t));
+        if(sources == NULL) return NULL;
+        results->sources = sources;
+        results->sources_capacity = capacity;
     }
 
-    sender_t *new_node = malloc(sizeof(sender_t));
-    if(new_node == NULL) return list;
-    new_node->next = list;
-    new_node->prev = NULL;
-    new_node->head = NULL;
-    new_node->tail = NULL;
-    strcpy(new_node->sender_address, source_email);
-    return new_node;
+    source = &results->sources[results->sources_count++];
+    source->sender_id = source_id;
+    source->mails = 0;
+    source->head = PAIR_TABLE_END;
+    source->tail = PAIR_TABLE_END;
+    results->sources_by_id[source_id] = results->sources_count;
+    return source;
 }
 
 /*!
- * @brief clear_sources_list clears the list of e-mail sources (therefore clearing the recipients of each source)
- * @param list a pointer to the list to clear
+ * @brief clear_source sets the e-mails of a source and the occurrences of all its recipients to 0, leaving it out of
+ * the results (it is kept, with its recipients, in case it sends e-mails again)
+ * @param results the results holding the source
+ * @param source a pointer to the source to clear
  */
-void clear_sources_list(sender_t *list) {
-    if(list == NULL) return;
-    sender_t *next_sender;
-    while (list != NULL){
-        next_sender = list->next;
-        free(list);
-        list = next_sender;
-        recipient_t *next_recipient;
-        while(list->head != NULL){
-            next_recipient = list->head->next;
-            free(list->head);
-            list->head = next_recipient;
-        }
+void clear_source(step2_results_t *results, sender_t *source) {
+    if(results == NULL || source == NULL) return;
+    source->mails = 0;
+    for(uint32_t index = source->head; index != PAIR_TABLE_END; index = results->recipients.pairs[index].next){
+        results->recipients.pairs[index].occurrences = 0;
     }
 }
 
 /*!
- * @brief find_source_in_list looks for an e-mail address in the sources list and returns a pointer to it.
- * @param list the list to look into for the e-mail
- * @param source_email the e-mail as a string to look for
+ * @brief find_source looks for an address ID in the sources and returns a pointer to it.
+ * @param results the results holding the sources to look into
+ * @param source_id the ID of the address to look for
  * @return a pointer to the matching source, NULL if none exists
  */
-sender_t *find_source_in_list(sender_t *list, char *source_email) {
-    sender_t *list_cpy = list;
-    while(list_cpy != NULL){
-        if(strcmp(list_cpy->sender_address , source_email) != 0) return list_cpy;
-        list_cpy = list_cpy->next;
-    }
-    return NULL;
+sender_t *find_source(step2_results_t *results, uint32_t source_id) {
+    if(results == NULL || source_id >= results->sources_by_id_size) return NULL;
+    uint32_t index = results->sources_by_id[source_id];
+    return (index == 0) ? NULL : &results->sources[index - 1];
 }
 
 /*!
- * @brief add_recipient_to_source adds or updates a recipient in the recipients list of a source. It looks for
- * the e-mail in the recipients list: if it is found, its occurrences is incremented, else a new recipient is created
- * with its occurrences = to 1.
+ * @brief add_recipient_to_source adds or updates a recipient of a source. If the (source, recipient) pair is found,
+ * its occurrences is incremented, else a new pair is created with its occurrences = to 1.
+ * @param results the results holding the source
  * @param source a pointer to the source to add/update the recipient to
- * @param recipient_email the recipient e-mail to add/update as a string
+ * @param recipient_id the ID of the recipient address to add/update
  */
-void add_recipient_to_source(sender_t *source, char *recipient_email) {
-    if(source == NULL) return;
-    if(recipient_email == NULL) return;
+void add_recipient_to_source(step2_results_t *results, sender_t *source, uint32_t recipient_id) {
+    update_recipient_of_source(results, source, recipient_id, 1);
+}
 
-    recipient_t *recipent_start = source->head;
-    while(recipent_start != NULL){
-        if(strcmp(recipent_start->recipient_address, recipient_email) == 0){
-            ++recipent_start->occurrences;
-            return;
+/*!
+ * @brief update_recipient_of_source adds a count of occurrences (possibly negative) to a recipient of a source. The
+ * pair is created and linked after the other recipients of the source if it is not known yet. Occurrences falling to 0
+ * leave the recipient out of the results. Once results are spilled, the pair holds a delta, which may be negative.
+ * @param results the results holding the source
+ * @param source a pointer to the source of the recipient
+ * @param recipient_id the ID of the recipient address to update
+ * @param delta the occurrences to add
+ */
+void update_recipient_of_source(step2_results_t *results, sender_t *source, uint32_t recipient_id, int64_t delta) {
+    if(results == NULL || source == NULL) return;
+    if(recipient_id == ADDRESS_DICT_INVALID_ID || delta == 0) return;
+
+    bool is_new = false;
+    bool is_delta = results->spill.runs_count > 0;
+    uint32_t index = (delta > 0 || is_delta)
+                     ? pair_table_add(&results->recipients, source->sender_id, recipient_id, &is_new)
+                     : pair_table_find(&results->recipients, source->sender_id, recipient_id);
+    if(index == PAIR_TABLE_END) return;
+    pair_t *pair = &results->recipients.pairs[index];
+    int64_t occurrences = (int64_t)pair->occurrences + delta;
+    pair->occurrences = (occurrences > 0 || is_delta) ? occurrences : 0;
+    if(!is_new) return;
+    if(source->tail != PAIR_TABLE_END) results->recipients.pairs[source->tail].next = index;
+    else source->head = index;
+    source->tail = index;
+}
+
+// A sender or a recipient of the output, with the address it is sorted by
+typedef struct {
+    const char *address;
+    uint32_t value;             // Index of the source, or occurrences of the recipient
+} ranked_address_t;
+
+// Memory of the results of each partition reducer beyond which they are spilled, 0 for no budget
+static size_t reducer_memory_budget = 0;
+
+/*!
+ * @brief set_reducer_memory_budget sets the memory of the sources and pairs of each partition reducer beyond which they
+ * are sorted and spilled to a run (to be called before the partitions are reduced)
+ * @param memory_budget the budget in bytes, 0 to keep all the results in memory
+ */
+void set_reducer_memory_budget(size_t memory_budget) {
+    reducer_memory_budget = memory_budget;
+}
+
+/*!
+ * @brief compare_senders orders the senders by address
+ * @param a a pointer to a ranked_address_t
+ * @param b a pointer to a ranked_address_t
+ * @return a negative value if a comes first, a positive value if b comes first
+ */
+static int compare_senders(const void *a, const void *b) {
+    return strcmp(((const ranked_address_t *)a)->address, ((const ranked_address_t *)b)->address);
+}
+
+/*!
+ * @brief sort_senders lists the sources with e-mails (or deltas, once spilled) in order of address
+ * @param results the results
+ * @param count a pointer to the number of senders listed
+ * @return a malloc'ed array of the senders (with their index in sources), NULL if allocation failed
+ */
+static ranked_address_t *sort_senders(step2_results_t *results, uint32_t *count) {
+    ranked_address_t *senders = malloc((results->sources_count + 1) * sizeof(ranked_address_t));
+    if(senders == NULL) return NULL;
+    *count = 0;
+    for(uint32_t i = 0; i < results->sources_count; ++i){
+        sender_t *source = &results->sources[i];
+        if(source->mails == 0 && (results->spill.runs_count == 0 || source->head == PAIR_TABLE_END)) continue;
+        senders[(*count)++] = (ranked_address_t){address_dict_get(&results->addresses, source->sender_id), i};
+    }
+    qsort(senders, *count, sizeof(ranked_address_t), compare_senders);
+    return senders;
+}
+
+/*!
+ * @brief spill_run_path gives the path of a run of a partition
+ * @param spill the runs of the partition
+ * @param run the number of the run
+ * @param path the path to fill
+ */
+static void spill_run_path(step2_spill_t *spill, uint32_t run, char *path) {
+    char file_name[STR_MAX_LEN] = "";
+    snprintf(file_name, STR_MAX_LEN, STEP3_RUN_FORMAT, spill->partition, run);
+    concat_path(spill->directory, file_name, path);
+}
+
+/*!
+ * @brief write_compacted_sender writes a sender of merged runs to a run, leaving out what sums to 0
+ * @param sender the sender
+ * @param recipients its recipients
+ * @param context the run (a FILE *)
+ * @return true on success, false on error
+ */
+static bool write_compacted_sender(spill_sender_t *sender, spill_recipient_t *recipients, void *context) {
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < sender->recipients_count; ++i){
+        if(recipients[i].occurrences != 0) recipients[count++] = recipients[i];
+    }
+    sender->recipients_count = count;
+    if(sender->mails == 0 && count == 0) return true;
+    return write_spill_sender((FILE *)context, sender, recipients);
+}
+
+/*!
+ * @brief compact_spill_runs merges all the runs of a partition into a single one, so that the number of runs (and of
+ * files opened by the final merge) stays bounded
+ * @param results the results
+ * @return true on success, false on error
+ */
+static bool compact_spill_runs(step2_results_t *results) {
+    step2_spill_t *spill = &results->spill;
+    char (*runs_paths)[STR_MAX_LEN] = malloc((spill->runs_count + 1) * STR_MAX_LEN);
+    if(runs_paths == NULL) return false;
+    for(uint32_t i = 0; i <= spill->runs_count; ++i) spill_run_path(spill, i, runs_paths[i]);
+    char *compacted_path = runs_paths[spill->runs_count];
+    FILE *compacted = fopen(compacted_path, "w");
+    if(compacted == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", compacted_path, strerror(errno));
+        free(runs_paths);
+        return false;
+    }
+    bool is_compacted = merge_spill_runs(runs_paths, spill->runs_count, &results->addresses, write_compacted_sender,
+                                         compacted);
+    if(fclose(compacted) != 0) is_compacted = false;
+    for(uint32_t i = 0; i < spill->runs_count; ++i) remove(runs_paths[i]);
+    is_compacted = is_compacted && rename(compacted_path, runs_paths[0]) == 0;
+    if(!is_compacted) remove(compacted_path);
+    spill->runs_count = 1;
+    free(runs_paths);
+    return is_compacted;
+}
+
+/*!
+ * @brief spill_step2_results writes the results in memory to a new run, sender by sender in order of address, then
+ * clears them: from then on, the results in memory are deltas to add to the runs
+ * @param results the results
+ * @return true on success, false on error (the results are cleared anyway, and incomplete)
+ */
+static bool spill_step2_results(step2_results_t *results) {
+    step2_spill_t *spill = &results->spill;
+    char run_path[STR_MAX_LEN] = "";
+    spill_run_path(spill, spill->runs_count, run_path);
+    uint32_t senders_count = 0;
+    ranked_address_t *senders = sort_senders(results, &senders_count);
+    FILE *run = (senders == NULL) ? NULL : fopen(run_path, "w");
+    bool is_spilled = run != NULL;
+    if(!is_spilled) fprintf(stderr, "[ERROR] Could not open %s : %s\n", run_path, strerror(errno));
+
+    spill_recipient_t *recipients = NULL;
+    uint32_t recipients_capacity = 0;
+    pair_t *pairs = results->recipients.pairs;
+    for(uint32_t i = 0; i < senders_count && is_spilled; ++i){
+        sender_t *source = &results->sources[senders[i].value];
+        spill_sender_t sender = {source->sender_id, source->mails, 0};
+        for(uint32_t index = source->head; index != PAIR_TABLE_END && is_spilled; index = pairs[index].next){
+            if(pairs[index].occurrences == 0) continue;
+            if(sender.recipients_count == recipients_capacity){
+                recipients_capacity = (recipients_capacity == 0) ? 64 : 2 * recipients_capacity;
+                spill_recipient_t *new_recipients = realloc(recipients,
+                                                            recipients_capacity * sizeof(spill_recipient_t));
+                if(new_recipients == NULL){
+                    is_spilled = false;
+                    break;
+                }
+                recipients = new_recipients;
+            }
+            recipients[sender.recipients_count++] = (spill_recipient_t){pairs[index].recipient_id,
+                                                                        pairs[index].occurrences};
         }
-        recipent_start = recipent_start->next;
+        qsort(recipients, sender.recipients_count, sizeof(spill_recipient_t), compare_spill_recipients);
+        is_spilled = is_spilled && write_spill_sender(run, &sender, recipients);
+    }
+    if(run != NULL && fclose(run) != 0) is_spilled = false;
+    free(recipients);
+    free(senders);
+    ++spill->runs_count;
+
+    pair_table_clear(&results->recipients);
+    if(results->sources_by_id != NULL){
+        memset(results->sources_by_id, 0, results->sources_by_id_size * sizeof(uint32_t));
     }
+    results->sources_count = 0;
+    if(is_spilled && spill->runs_count == SPILL_MAX_RUNS) is_spilled = compact_spill_runs(results);
+    if(!is_spilled){
+        fprintf(stderr, "[ERROR] Could not spill the results of partition %u\n", spill->partition);
+        spill->is_failed = true;
+    }
+    return is_spilled;
+}
+
+/*!
+ * @brief spill_over_budget spills the results if their sources and pairs exceed the memory budget
+ * @param results the results
+ */
+static void spill_over_budget(step2_results_t *results) {
+    if(results->spill.memory_budget == 0) return;
+    size_t memory = (size_t)results->recipients.count * (sizeof(pair_t) + 2 * sizeof(uint32_t)) +
+                    (size_t)results->sources_count * sizeof(sender_t);
+    if(memory > results->spill.memory_budget) spill_step2_results(results);
+}
 
-    recipient_t *new_recipient = malloc(sizeof(recipient_t));
-    if(new_recipient == NULL) return;
-    strcpy(new_recipient->recipient_address, recipient_email);
-    new_recipient->prev = NULL;
-    new_recipient->next = source->head;
-    new_recipient->occurrences = 1;
-    source->head = new_recipient;
+/*!
+ * @brief apply_step2_record adds the record of an e-mail to the results, or subtracts it, as many times as the e-mail
+ * was added to or removed from the data source. The results are spilled if they exceed their memory budget.
+ * A combined record (@see step2_combiner.h) is added with the e-mails of the sender and the occurrences of each
+ * recipient.
+ * @param results the results to update
+ * @param sender_id the ID of the sender
+ * @param recipients the IDs of the recipients
+ * @param occurrences the occurrences of each recipient, NULL if each one occurs once
+ * @param recipients_count the count of recipients
+ * @param mails the count of e-mails of the record
+ * @param factor the number of times the record is added (removed if negative)
+ */
+static void apply_step2_record(step2_results_t *results, uint32_t sender_id, uint32_t *recipients,
+                               uint32_t *occurrences, uint32_t recipients_count, uint32_t mails, int64_t factor) {
+    // Once spilled, the e-mails of the source may be in the runs: only the delta is kept in memory
+    bool is_delta = results->spill.runs_count > 0;
+    sender_t *source = (factor > 0 || is_delta) ? add_source(results, sender_id) : find_source(results, sender_id);
+    if(source == NULL) return;
+    for(uint32_t i = 0; i < recipients_count; ++i){
+        update_recipient_of_source(results, source, recipients[i], (occurrences == NULL) ? factor
+                                                                                         : factor * occurrences[i]);
+    }
+    int64_t source_mails = (int64_t)source->mails + factor * mails;
+    if(source_mails > 0 || is_delta) source->mails = source_mails;
+    else clear_source(results, source);
+    spill_over_budget(results);
 }
 
 /*!
  * @brief files_list_reducer is the first reducer. It uses concatenates all temporary files from the first step into
  * a single file. Don't forget to sync filesystem before leaving the function.
+ * The files are appended by the kernel (@see append_file_contents) instead of line by line, and are removed once the
+ * list is synced.
  * @param data_source the data source directory (its directories have the same names as the temp files to concatenate)
  * @param temp_files the temporary files directory, where to read files to be concatenated
  * @param output_file path to the output file (default name is step1_output, but we'll keep it as a parameter).
@@ -116,8 +370,8 @@ void files_list_reducer(char *data_source, char *temp_files, char *output_file)
         return;
     }
 
-    FILE *out_file = fopen(output_file, "w");
-    if(out_file == NULL){
+    int out_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out_fd < 0){
         fprintf(stderr, "[ERROR] Could not open %s : %s\n", output_file, strerror(errno));
         closedir(data_dir);
         return;
@@ -127,97 +381,924 @@ void files_list_reducer(char *data_source, char *temp_files, char *output_file)
     while((entry = next_dir(entry, data_dir)) != NULL){
         char file_name[STR_MAX_LEN] = "";
         concat_path(temp_files, entry->d_name, file_name);
-        FILE* temp_file = fopen(file_name, "r");
-        if(temp_file == NULL){
+        int temp_fd = open(file_name, O_RDONLY);
+        if(temp_fd < 0){
             fprintf(stderr, "[ERROR] Could not open %s : %s\n", file_name, strerror(errno));
-            fclose(out_file);
+            close(out_fd);
             closedir(data_dir);
             return;
         }
 
-        char line[STR_MAX_LEN] = "";
-        while(fgets(line, STR_MAX_LEN, temp_file) != NULL){
-            fputs(line, out_file);
+        bool is_appended = append_file_contents(temp_fd, out_fd);
+        close(temp_fd);
+        if(!is_appended){
+            fprintf(stderr, "[ERROR] Could not append %s to %s : %s\n", file_name, output_file, strerror(errno));
+            close(out_fd);
+            closedir(data_dir);
+            return;
         }
-        fclose(temp_file);
     }
 
     sync_temporary_files(temp_files);
+    close(out_fd);
 
-    fclose(out_file);
+    // The files of the mappers are only removed once the list is on disk
+    rewinddir(data_dir);
+    entry = NULL;
+    while((entry = next_dir(entry, data_dir)) != NULL){
+        char file_name[STR_MAX_LEN] = "";
+        concat_path(temp_files, entry->d_name, file_name);
+        unlink(file_name);
+    }
     closedir(data_dir);
 }
 
 /*!
- * @brief files_reducer opens the second temporary output file (default step2_output) and collates all sender/recipient
- * information as defined in the project instructions. Stores data in a double level linked list (list of source e-mails
- * containing each a list of recipients with their occurrences).
- * @param temp_file path to temp output file
- * @param output_file final output file to be written by your function
+ * @brief reduce_step2_file collates the sender/recipient information of one shard of step2_output (binary or text
+ * format) into the results.
+ * The address IDs of the shard are those of the worker's dictionary: they are translated to the IDs of the results
+ * dictionary. Each record is also added to the next mail cache, with the key of its e-mail (the keys of the shard
+ * follow its records). Combined records have no key: they can not be cached.
+ * @param shard_path path to the shard
+ * @param dict_path path to the dictionary of the worker that wrote the shard
+ * @param keys_path path to the keys of the e-mails of the shard (NULL if the mail cache is not updated)
+ * @param results the results to update
+ * @param builder the entries of the next mail cache, with the IDs of the results dictionary (NULL if not updated)
+ * @return true on success, false on error (the mail cache can then not be updated)
  */
-void files_reducer(char *temp_file, char *output_file) {
-    if(!path_to_file_exists(temp_file) || !path_to_file_exists(output_file)) return;
-    FILE *step2 = fopen(temp_file, "r");
-    if(step2 == NULL){
-        fprintf(stderr, "[ERROR] Could not open %s : %s", temp_file, strerror(errno));
-        return;
+bool reduce_step2_file(char *shard_path, char *dict_path, char *keys_path, step2_results_t *results,
+                       mail_cache_builder_t *builder) {
+    uint32_t *ids = NULL;
+    uint32_t ids_count = 0;
+    if(!address_dict_load(&results->addresses, dict_path, &ids, &ids_count)) return false;
+    step2_reader_t step2;
+    if(!step2_reader_open(&step2, shard_path)){
+        free(ids);
+        return false;
+    }
+    FILE *keys_file = (keys_path == NULL || builder == NULL) ? NULL : fopen(keys_path, "r");
+    if(keys_path != NULL && builder != NULL && keys_file == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", keys_path, strerror(errno));
+    }
+
+    bool is_cached = keys_file != NULL;
+    mail_cache_buffer_t record = {NULL, 0, 0};
+    step2_key_t mail_key;
+    uint32_t sender_id;
+    uint32_t mails;
+    uint32_t *recipients;
+    uint32_t *occurrences;
+    uint32_t recipients_count;
+    while(true){
+        bool has_key = keys_file != NULL && fread(&mail_key, sizeof(step2_key_t), 1, keys_file) == 1;
+        // E-mails without a sender have no record: they are only cached
+        if(has_key && (mail_key.flags & STEP2_KEY_HAS_RECORD) == 0){
+            is_cached = is_cached && mail_cache_builder_add(builder, &mail_key.key, NULL, 0, 1);
+            continue;
+        }
+        if(!step2_reader_next_combined(&step2, &sender_id, &mails, &recipients, &occurrences, &recipients_count)){
+            // A key left without its record
+            if(has_key) is_cached = false;
+            break;
+        }
+        if(step2.is_combined) results->is_combined = true;
+        is_cached = is_cached && has_key && (mail_key.flags & STEP2_KEY_IS_VALID) != 0 && !step2.is_combined;
+        if(sender_id >= ids_count){
+            fprintf(stderr, "[ERROR] Unknown address ID %u in %s\n", sender_id, shard_path);
+            is_cached = false;
+            continue;
+        }
+        // IDs are translated in place, unknown recipients being dropped
+        uint32_t count = 0;
+        for(uint32_t i = 0; i < recipients_count; ++i){
+            if(recipients[i] >= ids_count) continue;
+            occurrences[count] = occurrences[i];
+            recipients[count++] = ids[recipients[i]];
+        }
+        apply_step2_record(results, ids[sender_id], recipients, step2.is_combined ? occurrences : NULL, count, mails,
+                           1);
+        if(!is_cached) continue;
+
+        record.size = 0;
+        bool is_encoded = mail_cache_buffer_append(&record, ids[sender_id]) && mail_cache_buffer_append(&record, count);
+        for(uint32_t i = 0; i < count && is_encoded; ++i) is_encoded = mail_cache_buffer_append(&record, recipients[i]);
+        is_cached = is_encoded && mail_cache_builder_add(builder, &mail_key.key, record.data, record.size, 1);
+    }
+    if(keys_file != NULL) fclose(keys_file);
+    mail_cache_buffer_free(&record);
+    step2_reader_close(&step2);
+    free(ids);
+    return is_cached || builder == NULL;
+}
+
+/*!
+ * @brief load_cached_results adds the results of the previous run, kept in the mail cache, to empty results. The
+ * addresses of the cache are added first, so that they keep their IDs.
+ * @param cache the mail cache
+ * @param results the results to update (empty)
+ * @return true on success, false if the cache is corrupted
+ */
+static bool load_cached_results(mail_cache_t *cache, step2_results_t *results) {
+    size_t offset = 0;
+    for(uint32_t id = 0; id < cache->addresses_count; ++id){
+        if(offset >= cache->strings_size) return false;
+        size_t length = strlen(cache->strings + offset);
+        if(address_dict_intern(&results->addresses, cache->strings + offset, length, NULL) != id) return false;
+        offset += length + 1;
     }
 
-    char sender_email[STR_MAX_LEN] = "";
-    size_t c = 0;
-    char *adress = NULL;
-    char *line = NULL;
-    ssize_t line_length = 0;
-    sender_t *sources = NULL;
-    uint64_t lines = 0;
-    line_length = getline(&line, &c , step2);
-    while (line_length != -1){
-        line[line_length - 1] = '\0';
-        char **line_cpy = &line;
-        adress = strtok(*line_cpy, " ");
-        
-        while(adress != NULL) {
-            if(sender_email[0] == '\0') {
-                sources = add_source_to_list(sources, adress);
-                strcpy(sender_email,adress);
-            }else{
-                sender_t *current_sender = find_source_in_list(sources, sender_email);
-                if(current_sender != NULL)  add_recipient_to_source(current_sender, adress);
+    size_t cur = 0;
+    while(cur < cache->aggregate_size){
+        uint32_t sender_id, mails, recipients_count;
+        if(!decode_varint(cache->aggregate, cache->aggregate_size, &cur, &sender_id) ||
+           !decode_varint(cache->aggregate, cache->aggregate_size, &cur, &mails) ||
+           !decode_varint(cache->aggregate, cache->aggregate_size, &cur, &recipients_count) ||
+           sender_id >= cache->addresses_count){
+            return false;
+        }
+        // Each sender is only listed once
+        sender_t *source = add_source(results, sender_id);
+        if(source == NULL || source->mails > 0) return false;
+        source->mails = mails;
+        for(uint32_t i = 0; i < recipients_count; ++i){
+            uint32_t recipient_id, occurrences;
+            if(!decode_varint(cache->aggregate, cache->aggregate_size, &cur, &recipient_id) ||
+               !decode_varint(cache->aggregate, cache->aggregate_size, &cur, &occurrences) ||
+               recipient_id >= cache->addresses_count){
+                return false;
             }
-            adress = strtok(NULL, " ");
+            update_recipient_of_source(results, source, recipient_id, occurrences);
         }
-        memset(sender_email, '\0', strlen(sender_email));
-        free(line);
-        line = NULL;
-        line_length = getline(&line, &c , step2);
-        printf("%d\n",++lines);
+        spill_over_budget(results);
     }
+    return true;
+}
 
-    printf("[D]INGOjrpgnsidf\n");
-    fclose(step2);
+/*!
+ * @brief count_cache_hits counts the e-mails of the mail cache found by a worker (@see skip_cached_mail)
+ * @param hits_path path to the hits of the worker
+ * @param hits the number of paths found for each entry of the cache, to update
+ * @param entries_count the count of entries of the cache
+ * @return true on success, false on error
+ */
+static bool count_cache_hits(char *hits_path, uint32_t *hits, uint32_t entries_count) {
+    FILE *hits_file = fopen(hits_path, "r");
+    if(hits_file == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", hits_path, strerror(errno));
+        return false;
+    }
+    uint32_t indexes[1024];
+    size_t count;
+    bool is_valid = true;
+    while((count = fread(indexes, sizeof(uint32_t), 1024, hits_file)) > 0){
+        for(size_t i = 0; i < count; ++i){
+            if(indexes[i] < entries_count) ++hits[indexes[i]];
+            else is_valid = false;
+        }
+    }
+    fclose(hits_file);
+    return is_valid;
+}
 
+/*!
+ * @brief update_cached_mails applies the deltas of the e-mails of the mail cache: the records of the e-mails that are
+ * not found anymore (deleted or modified) are subtracted from the results, and those found with more paths than before
+ * are added. The e-mails found are kept for the next cache.
+ * @param cache the mail cache
+ * @param hits the number of paths found for each entry of the cache
+ * @param results the results to update (with the addresses of the cache, @see load_cached_results)
+ * @param builder the entries of the next mail cache
+ * @return true on success, false on error (the mail cache can then not be updated)
+ */
+static bool update_cached_mails(mail_cache_t *cache, uint32_t *hits, step2_results_t *results,
+                                mail_cache_builder_t *builder) {
+    bool is_cached = true;
+    step2_reader_t records;
+    step2_reader_open_buffer(&records, cache->records, cache->records_size);
+    for(uint32_t index = 0; index < cache->entries_count; ++index){
+        const mail_cache_entry_t *entry = &cache->entries[index];
+        if(hits[index] == 0 && entry->paths_count == 0) continue;
+        mail_key_t key = entry->key;
+        if(entry->record_offset == MAIL_CACHE_NO_RECORD){
+            if(hits[index] > 0) is_cached = mail_cache_builder_add(builder, &key, NULL, 0, hits[index]) && is_cached;
+            continue;
+        }
 
+        uint32_t sender_id;
+        uint32_t *recipients;
+        uint32_t recipients_count;
+        records.cur = entry->record_offset;
+        if(entry->record_offset >= cache->records_size ||
+           !step2_reader_next(&records, &sender_id, &recipients, &recipients_count)){
+            is_cached = false;
+            continue;
+        }
+        bool is_valid = sender_id < cache->addresses_count;
+        for(uint32_t i = 0; i < recipients_count && is_valid; ++i) is_valid = recipients[i] < cache->addresses_count;
+        if(!is_valid){
+            is_cached = false;
+            continue;
+        }
+        if(hits[index] != entry->paths_count){
+            apply_step2_record(results, sender_id, recipients, NULL, recipients_count, 1,
+                               (int64_t)hits[index] - entry->paths_count);
+        }
+        // Addresses keep their IDs: the record is kept as is
+        if(hits[index] > 0){
+            is_cached = mail_cache_builder_add(builder, &key, cache->records + entry->record_offset,
+                                               records.cur - entry->record_offset, hits[index]) && is_cached;
+        }
+    }
+    step2_reader_close(&records);
+    return is_cached;
+}
 
-    FILE *final_output = fopen(output_file, "w");
-    if(final_output == NULL){
-        clear_sources_list(sources);
-        fclose(step2);
-        fprintf(stderr, "[ERROR] Could not open %s : %s", temp_file, strerror(errno));
+/*!
+ * @brief append_cached_sender encodes a sender and its recipients into the aggregate of the mail cache
+ * @param aggregate the aggregate of the mail cache
+ * @param sender_id the ID of the sender
+ * @param mails the count of e-mails of the sender
+ * @param recipients_count the count of its recipients
+ * @return true on success, false if allocation failed
+ */
+static bool append_cached_sender(mail_cache_buffer_t *aggregate, uint32_t sender_id, uint32_t mails,
+                                 uint32_t recipients_count) {
+    return mail_cache_buffer_append(aggregate, sender_id) && mail_cache_buffer_append(aggregate, mails) &&
+           mail_cache_buffer_append(aggregate, recipients_count);
+}
+
+/*!
+ * @brief encode_cached_results encodes the results in memory into the aggregate of the mail cache
+ * @param results the results of the partition
+ * @param aggregate the aggregate to fill
+ * @return true on success, false if allocation failed
+ */
+static bool encode_cached_results(step2_results_t *results, mail_cache_buffer_t *aggregate) {
+    bool is_encoded = true;
+    pair_t *pairs = results->recipients.pairs;
+    for(uint32_t i = 0; i < results->sources_count && is_encoded; ++i){
+        sender_t *source = &results->sources[i];
+        if(source->mails == 0) continue;
+        uint32_t recipients_count = 0;
+        for(uint32_t index = source->head; index != PAIR_TABLE_END; index = pairs[index].next){
+            if(pairs[index].occurrences > 0) ++recipients_count;
+        }
+        is_encoded = append_cached_sender(aggregate, source->sender_id, source->mails, recipients_count);
+        for(uint32_t index = source->head; index != PAIR_TABLE_END && is_encoded; index = pairs[index].next){
+            if(pairs[index].occurrences == 0) continue;
+            is_encoded = mail_cache_buffer_append(aggregate, pairs[index].recipient_id) &&
+                         mail_cache_buffer_append(aggregate, pairs[index].occurrences);
+        }
+    }
+    return is_encoded;
+}
+
+/*!
+ * @brief save_mail_cache writes the mail cache of a partition for the next run: the entries of the e-mails of this run
+ * and the results. It is written to an update file, renamed over the cache of the previous run once all the partitions
+ * are reduced (@see files_reducer).
+ * @param update_path path to the update of the cache
+ * @param partition the partition
+ * @param results the results of the partition (for their addresses)
+ * @param builder the entries of the e-mails, with the IDs of the results dictionary
+ * @param aggregate the results, encoded
+ * @return true on success, false on error
+ */
+static bool save_mail_cache(char *update_path, uint32_t partition, step2_results_t *results,
+                            mail_cache_builder_t *builder, mail_cache_buffer_t *aggregate) {
+    bool is_saved = mail_cache_write(update_path, partition, &results->addresses, builder, aggregate);
+    if(!is_saved) remove(update_path);
+    return is_saved;
+}
+
+// Recipients written for each sender, 0 for all of them (@see set_output_top_k)
+static uint32_t output_top_k = 0;
+
+/*!
+ * @brief set_output_top_k limits the recipients written for each sender to those with the most occurrences (to be
+ * called before the partitions are reduced)
+ * @param top_k the number of recipients written for each sender, 0 to write all of them
+ */
+void set_output_top_k(uint32_t top_k) {
+    output_top_k = top_k;
+}
+
+/*!
+ * @brief compare_recipients orders the recipients by descending occurrences, then by address
+ * @param a a pointer to a ranked_address_t
+ * @param b a pointer to a ranked_address_t
+ * @return a negative value if a comes first, a positive value if b comes first
+ */
+static int compare_recipients(const void *a, const void *b) {
+    const ranked_address_t *first = a;
+    const ranked_address_t *second = b;
+    if(first->value != second->value) return (first->value > second->value) ? -1 : 1;
+    return strcmp(first->address, second->address);
+}
+
+/*!
+ * @brief sift_down restores the heap of the top recipients from its root: the root is the weakest of the recipients
+ * kept, the first one to be replaced by a stronger one
+ * @param heap the heap
+ * @param count the number of recipients in the heap
+ * @param index the index of the recipient to move down
+ */
+static void sift_down(ranked_address_t *heap, uint32_t count, uint32_t index) {
+    while(true){
+        uint32_t weakest = index;
+        uint32_t left = 2 * index + 1;
+        uint32_t right = left + 1;
+        if(left < count && compare_recipients(&heap[left], &heap[weakest]) > 0) weakest = left;
+        if(right < count && compare_recipients(&heap[right], &heap[weakest]) > 0) weakest = right;
+        if(weakest == index) return;
+        ranked_address_t swapped = heap[index];
+        heap[index] = heap[weakest];
+        heap[weakest] = swapped;
+        index = weakest;
+    }
+}
+
+/*!
+ * @brief push_recipient adds a recipient to those selected for a sender. With a top-k, only the k strongest ones are
+ * kept, in a bounded heap.
+ * @param recipients the recipients selected (large enough for the top-k, or for all the recipients without it)
+ * @param count a pointer to the number of recipients selected
+ * @param recipient the recipient
+ */
+static void push_recipient(ranked_address_t *recipients, uint32_t *count, ranked_address_t recipient) {
+    if(output_top_k == 0 || *count < output_top_k){
+        recipients[(*count)++] = recipient;
+        if(*count == output_top_k){
+            for(uint32_t i = *count / 2; i-- > 0;) sift_down(recipients, *count, i);
+        }
+    }else if(compare_recipients(&recipient, &recipients[0]) < 0){
+        recipients[0] = recipient;
+        sift_down(recipients, *count, 0);
+    }
+}
+
+/*!
+ * @brief write_sender_line writes the line of a sender to an output, with its recipients in output order
+ * @param output the output
+ * @param sender the address of the sender
+ * @param recipients the recipients selected (@see push_recipient), sorted by this function
+ * @param count the number of recipients
+ */
+static void write_sender_line(FILE *output, const char *sender, ranked_address_t *recipients, uint32_t count) {
+    qsort(recipients, count, sizeof(ranked_address_t), compare_recipients);
+    fputs(sender, output);
+    for(uint32_t i = 0; i < count; ++i) fprintf(output, " %u: %s", recipients[i].value, recipients[i].address);
+    fwrite("\n", 1, 1, output);
+}
+
+/*!
+ * @brief write_step3_output writes the results of a partition, as defined in the project instructions: senders are
+ * sorted by address, and their recipients by descending occurrences (then by address), so that the output does not
+ * depend on the order the e-mails were parsed in
+ * @param output_path path to the output of the partition
+ * @param results the results of the partition
+ * @return true on success, false on error
+ */
+static bool write_step3_output(char *output_path, step2_results_t *results) {
+    pair_t *pairs = results->recipients.pairs;
+    uint32_t max_recipients = 0;
+    for(uint32_t i = 0; i < results->sources_count; ++i){
+        uint32_t recipients_count = 0;
+        for(uint32_t index = results->sources[i].head; index != PAIR_TABLE_END; index = pairs[index].next){
+            ++recipients_count;
+        }
+        if(recipients_count > max_recipients) max_recipients = recipients_count;
+    }
+    if(output_top_k != 0 && output_top_k < max_recipients) max_recipients = output_top_k;
+    uint32_t senders_count = 0;
+    ranked_address_t *senders = sort_senders(results, &senders_count);
+    ranked_address_t *recipients = malloc((max_recipients + 1) * sizeof(ranked_address_t));
+    FILE *output = (senders == NULL || recipients == NULL) ? NULL : fopen(output_path, "w");
+    if(output == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", output_path, strerror(errno));
+        free(senders);
+        free(recipients);
+        return false;
+    }
+
+    for(uint32_t i = 0; i < senders_count; ++i){
+        sender_t *source = &results->sources[senders[i].value];
+        uint32_t recipients_count = 0;
+        for(uint32_t index = source->head; index != PAIR_TABLE_END; index = pairs[index].next){
+            if(pairs[index].occurrences == 0) continue;
+            push_recipient(recipients, &recipients_count,
+                           (ranked_address_t){address_dict_get(&results->addresses, pairs[index].recipient_id),
+                                              pairs[index].occurrences});
+        }
+        write_sender_line(output, senders[i].address, recipients, recipients_count);
+    }
+    free(senders);
+    free(recipients);
+    if(fclose(output) != 0){
+        fprintf(stderr, "[ERROR] Could not write %s : %s\n", output_path, strerror(errno));
+        remove(output_path);
+        return false;
+    }
+    return true;
+}
+
+// Output of the merged runs of a partition
+typedef struct {
+    step2_results_t *results;
+    FILE *output;
+    mail_cache_buffer_t *aggregate;     // NULL if the mail cache is not updated
+    bool is_encoded;
+    ranked_address_t *recipients;
+    uint32_t recipients_capacity;
+} merged_output_t;
+
+/*!
+ * @brief write_merged_sender writes a sender of the merged runs to the output of the partition, and encodes it into
+ * the aggregate of the mail cache. Senders and recipients whose e-mails were all removed are left out.
+ * @param sender the sender
+ * @param recipients its recipients
+ * @param context the merged output (a merged_output_t *)
+ * @return true on success, false on error
+ */
+static bool write_merged_sender(spill_sender_t *sender, spill_recipient_t *recipients, void *context) {
+    merged_output_t *merged = context;
+    if(sender->mails <= 0) return true;
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < sender->recipients_count; ++i){
+        if(recipients[i].occurrences > 0) recipients[count++] = recipients[i];
+    }
+    if(merged->aggregate != NULL && merged->is_encoded){
+        merged->is_encoded = append_cached_sender(merged->aggregate, sender->sender_id, sender->mails, count);
+        for(uint32_t i = 0; i < count && merged->is_encoded; ++i){
+            merged->is_encoded = mail_cache_buffer_append(merged->aggregate, recipients[i].recipient_id) &&
+                                 mail_cache_buffer_append(merged->aggregate, recipients[i].occurrences);
+        }
+    }
+
+    uint32_t capacity = (output_top_k != 0 && output_top_k < count) ? output_top_k : count;
+    if(capacity >= merged->recipients_capacity){
+        ranked_address_t *new_recipients = realloc(merged->recipients, (capacity + 1) * sizeof(ranked_address_t));
+        if(new_recipients == NULL) return false;
+        merged->recipients = new_recipients;
+        merged->recipients_capacity = capacity + 1;
+    }
+    address_dict_t *addresses = &merged->results->addresses;
+    uint32_t selected = 0;
+    for(uint32_t i = 0; i < count; ++i){
+        push_recipient(merged->recipients, &selected,
+                       (ranked_address_t){address_dict_get(addresses, recipients[i].recipient_id),
+                                          recipients[i].occurrences});
+    }
+    write_sender_line(merged->output, address_dict_get(addresses, sender->sender_id), merged->recipients, selected);
+    return !ferror(merged->output);
+}
+
+/*!
+ * @brief write_merged_output merges the runs of a partition (the results left in memory being spilled first) into the
+ * output of the partition, and into the aggregate of its mail cache
+ * @param output_path path to the output of the partition
+ * @param results the spilled results of the partition
+ * @param aggregate the aggregate of the mail cache to fill, NULL if the mail cache is not updated
+ * @param is_encoded a pointer set to false if the aggregate could not be filled
+ * @return true on success, false on error
+ */
+static bool write_merged_output(char *output_path, step2_results_t *results, mail_cache_buffer_t *aggregate,
+                                bool *is_encoded) {
+    step2_spill_t *spill = &results->spill;
+    if(!spill_step2_results(results)) return false;
+    char (*runs_paths)[STR_MAX_LEN] = malloc(spill->runs_count * STR_MAX_LEN);
+    FILE *output = (runs_paths == NULL) ? NULL : fopen(output_path, "w");
+    if(output == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", output_path, strerror(errno));
+        free(runs_paths);
+        return false;
+    }
+    for(uint32_t i = 0; i < spill->runs_count; ++i) spill_run_path(spill, i, runs_paths[i]);
+    merged_output_t merged = {results, output, aggregate, true, NULL, 0};
+    bool is_written = merge_spill_runs(runs_paths, spill->runs_count, &results->addresses, write_merged_sender,
+                                       &merged);
+    if(!merged.is_encoded) *is_encoded = false;
+    if(fclose(output) != 0 || !is_written){
+        fprintf(stderr, "[ERROR] Could not write %s : %s\n", output_path, strerror(errno));
+        remove(output_path);
+        is_written = false;
+    }
+    for(uint32_t i = 0; i < spill->runs_count; ++i) remove(runs_paths[i]);
+    free(merged.recipients);
+    free(runs_paths);
+    return is_written;
+}
+
+/*!
+ * @brief partition_of_file gives the partition of a file of a worker, named <prefix><worker>.<partition>
+ * @param file_name the name of the file
+ * @param prefix_length the length of the prefix
+ * @return the partition, STEP2_PARTITIONS_COUNT if the name is not the one of a worker's file
+ */
+static uint32_t partition_of_file(char *file_name, size_t prefix_length) {
+    unsigned worker, partition;
+    int length = 0;
+    if(sscanf(file_name + prefix_length, "%u.%u%n", &worker, &partition, &length) != 2 ||
+       file_name[prefix_length + length] != '\0' || partition >= STEP2_PARTITIONS_COUNT){
+        return STEP2_PARTITIONS_COUNT;
+    }
+    return partition;
+}
+
+/*!
+ * @brief reduce_partition is the task of reducing a partition of the senders: it collates the sender/recipient
+ * information of the step2_output shards of the partition written by each worker. Sources are indexed by address ID,
+ * and the occurrences of each (source, recipient) pair are counted in a single hash table (with the pairs of each
+ * source linked in order of appearance), so that each record is reduced in constant time: addresses are only turned
+ * back into strings when writing the output of the partition (step3_output.<partition>).
+ * The results start from those of the previous run, kept in the mail cache of the partition: only the deltas of the
+ * e-mails that were added, modified or removed since are applied, then the update of the cache for the next run is
+ * written (mail_cache_update.<partition>). Records combined by the workers are not cached: the cache is then removed.
+ * Beyond the memory budget of the reducer, the results are spilled to runs sorted by sender, which are merged into the
+ * output once all the shards are reduced (@see spill_run.h).
+ * Partitions share no sender, so they are reduced (and sorted) in parallel by the workers; files_reducer then merges
+ * them.
+ * @param task a partition_task_t
+ */
+void reduce_partition(task_t *task) {
+    partition_task_t *partition_task = (partition_task_t *)task;
+    char *temp_files = partition_task->temporary_directory;
+    uint32_t partition = partition_task->partition;
+    DIR *temp_dir = opendir(temp_files);
+    if(temp_dir == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", temp_files, strerror(errno));
         return;
     }
 
-    sender_t *sources_start = sources;
-    while(sources != NULL){
-        fwrite(sources->sender_address, 1, strlen(sources->sender_address), final_output);
-        recipient_t *recipients_start = sources->head;
-        while(recipients_start != NULL){
-            fprintf(final_output, " %d: %s",recipients_start->occurrences, recipients_start->recipient_address);
-            recipients_start = recipients_start->next;
+    step2_results_t results;
+    init_step2_results(&results);
+    // Beyond their budget, the results are spilled to runs, merged into the output once all the files are reduced
+    results.spill.memory_budget = reducer_memory_budget;
+    strcpy(results.spill.directory, temp_files);
+    results.spill.partition = partition;
+    mail_cache_builder_t builder;
+    mail_cache_builder_init(&builder);
+    char file_name[STR_MAX_LEN] = "";
+    char cache_path[STR_MAX_LEN] = "";
+    snprintf(file_name, STR_MAX_LEN, MAIL_CACHE_FORMAT, partition);
+    concat_path(temp_files, file_name, cache_path);
+    mail_cache_t cache;
+    // A corrupted cache was ignored by the workers too: the results are then made from scratch
+    mail_cache_open(&cache, cache_path, partition);
+    bool is_cached = load_cached_results(&cache, &results);
+    if(!is_cached) fprintf(stderr, "[ERROR] Could not load the mail cache %u, results are incomplete\n", partition);
+    uint32_t *hits = calloc(cache.entries_count + 1, sizeof(uint32_t));
+    if(hits == NULL) is_cached = false;
+
+    struct dirent *entry;
+    size_t prefix_length = strlen(STEP2_SHARD_PREFIX);
+    size_t hits_prefix_length = strlen(STEP2_HITS_PREFIX);
+    while((entry = readdir(temp_dir)) != NULL){
+        if(hits != NULL && strncmp(entry->d_name, STEP2_HITS_PREFIX, hits_prefix_length) == 0){
+            if(partition_of_file(entry->d_name, hits_prefix_length) != partition) continue;
+            char hits_path[STR_MAX_LEN] = "";
+            concat_path(temp_files, entry->d_name, hits_path);
+            is_cached = count_cache_hits(hits_path, hits, cache.entries_count) && is_cached;
+            continue;
+        }
+        if(strncmp(entry->d_name, STEP2_SHARD_PREFIX, prefix_length) != 0 ||
+           partition_of_file(entry->d_name, prefix_length) != partition){
+            continue;
         }
-        fwrite("\n", 1, 1, final_output);
-        sources = sources->next;
+        char shard_path[STR_MAX_LEN] = "";
+        char dict_path[STR_MAX_LEN] = "";
+        char keys_path[STR_MAX_LEN] = "";
+        concat_path(temp_files, entry->d_name, shard_path);
+        // The dictionary and the keys have the same worker number and partition suffix as the shard
+        snprintf(file_name, STR_MAX_LEN, STEP2_DICT_PREFIX "%s", entry->d_name + prefix_length);
+        concat_path(temp_files, file_name, dict_path);
+        snprintf(file_name, STR_MAX_LEN, STEP2_KEYS_PREFIX "%s", entry->d_name + prefix_length);
+        concat_path(temp_files, file_name, keys_path);
+        is_cached = reduce_step2_file(shard_path, dict_path, keys_path, &results, &builder) && is_cached;
+    }
+    closedir(temp_dir);
+    if(hits != NULL) is_cached = update_cached_mails(&cache, hits, &results, &builder) && is_cached;
+    free(hits);
+    mail_cache_close(&cache);
+
+    // The output is written to a temporary file, renamed once the mail cache is updated: once the output exists, the
+    // partition is fully reduced
+    char output_path[STR_MAX_LEN] = "";
+    char written_path[STR_MAX_LEN] = "";
+    snprintf(file_name, STR_MAX_LEN, STEP3_OUTPUT_FORMAT, partition);
+    concat_path(temp_files, file_name, output_path);
+    snprintf(written_path, STR_MAX_LEN, "%s.part", output_path);
+    mail_cache_buffer_t aggregate = {NULL, 0, 0};
+    bool is_written;
+    if(results.spill.runs_count > 0){
+        is_written = !results.spill.is_failed &&
+                     write_merged_output(written_path, &results, is_cached ? &aggregate : NULL, &is_cached);
+    }else{
+        is_cached = is_cached && encode_cached_results(&results, &aggregate);
+        is_written = write_step3_output(written_path, &results);
+    }
+
+    // Without an update, the cache of the partition is removed: the next run parses its e-mails again
+    char update_path[STR_MAX_LEN] = "";
+    snprintf(file_name, STR_MAX_LEN, MAIL_CACHE_UPDATE_FORMAT, partition);
+    concat_path(temp_files, file_name, update_path);
+    if(is_written && !results.is_combined &&
+       !(is_cached && save_mail_cache(update_path, partition, &results, &builder, &aggregate))){
+        fprintf(stderr, "[ERROR] Could not update the mail cache %u, its e-mails will be parsed by the next run\n",
+                partition);
     }
+    if(is_written && rename(written_path, output_path) != 0){
+        fprintf(stderr, "[ERROR] Could not rename %s : %s\n", written_path, strerror(errno));
+        remove(written_path);
+    }
+    mail_cache_buffer_free(&aggregate);
+    mail_cache_builder_free(&builder);
+    free_step2_results(&results);
+}
+
+/*!
+ * @brief remove_partitions_results removes the outputs of the partitions, their runs and the updates of their mail
+ * caches
+ * @param temp_files the temporary files directory
+ */
+void remove_partitions_results(char *temp_files) {
+    remove_files_with_prefix(temp_files, STEP3_OUTPUT_PREFIX);
+    remove_files_with_prefix(temp_files, STEP3_RUN_PREFIX);
+    remove_files_with_prefix(temp_files, MAIL_CACHE_UPDATE_PREFIX);
+}
+
+// Output of a partition, read line by line while the outputs are merged
+typedef struct {
+    FILE *file;
+    char *line;                 // Current line (NULL once the output is over)
+    size_t line_size;
+} partition_output_t;
+
+/*!
+ * @brief next_output_line reads the next line of the output of a partition
+ * @param output the output of the partition
+ */
+static void next_output_line(partition_output_t *output) {
+    if(output->file == NULL || getline(&output->line, &output->line_size, output->file) < 0){
+        free(output->line);
+        output->line = NULL;
+    }
+}
+
+/*!
+ * @brief compare_output_lines orders two lines of the outputs by sender address (the first word of the line)
+ * @param first a line
+ * @param second another line
+ * @return a negative value if first comes first, a positive value if second comes first
+ */
+static int compare_output_lines(const char *first, const char *second) {
+    size_t i = 0;
+    while(first[i] == second[i] && first[i] != ' ' && first[i] != '\n' && first[i] != '\0') ++i;
+    unsigned char first_char = (first[i] == ' ' || first[i] == '\n') ? '\0' : first[i];
+    unsigned char second_char = (second[i] == ' ' || second[i] == '\n') ? '\0' : second[i];
+    return first_char - second_char;
+}
 
-    clear_sources_list(sources_start);
-    fclose(final_output);
+/*!
+ * @brief merge_partitions_outputs writes the outputs of the partitions (each sorted by sender) to the final output, in
+ * order of sender: partitions share no sender, so a line is never merged with another one
+ * @param outputs_paths the paths to the outputs of the partitions
+ * @param final_output the final output file
+ * @return true on success, false on error
+ */
+static bool merge_partitions_outputs(char outputs_paths[STEP2_PARTITIONS_COUNT][STR_MAX_LEN], FILE *final_output) {
+    partition_output_t outputs[STEP2_PARTITIONS_COUNT];
+    bool is_merged = true;
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        outputs[p] = (partition_output_t){fopen(outputs_paths[p], "r"), NULL, 0};
+        if(outputs[p].file == NULL){
+            fprintf(stderr, "[ERROR] Could not open %s : %s\n", outputs_paths[p], strerror(errno));
+            is_merged = false;
+        }
+        next_output_line(&outputs[p]);
+    }
+    while(true){
+        partition_output_t *first = NULL;
+        for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+            if(outputs[p].line == NULL) continue;
+            if(first == NULL || compare_output_lines(outputs[p].line, first->line) < 0) first = &outputs[p];
+        }
+        if(first == NULL) break;
+        if(fputs(first->line, final_output) == EOF) is_merged = false;
+        next_output_line(first);
+    }
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        if(outputs[p].file != NULL) fclose(outputs[p].file);
+    }
+    return is_merged;
+}
+
+// Communication graph written from the final output, "" for none (@see set_output_graph)
+static char output_graph[STR_MAX_LEN] = "";
+// Report of the analytics of the graph, "" for none, and the threads computing them (@see set_output_analytics)
+static char output_report[STR_MAX_LEN] = "";
+static uint32_t analytics_threads_count = 1;
+
+/*!
+ * @brief set_output_graph makes files_reducer write the communication graph of the final output (@see graph_file.h)
+ * @param graph_file the path to the graph file, "" to write no graph
+ */
+void set_output_graph(char *graph_file) {
+    snprintf(output_graph, STR_MAX_LEN, "%s", graph_file);
+}
+
+/*!
+ * @brief set_output_analytics makes files_reducer write the analytics of the communication graph of the final output
+ * (@see graph_analytics.h)
+ * @param report_file the path to the report, "" to write no report
+ * @param threads_count the count of threads computing the analytics
+ */
+void set_output_analytics(char *report_file, uint32_t threads_count) {
+    snprintf(output_report, STR_MAX_LEN, "%s", report_file);
+    analytics_threads_count = threads_count;
+}
+
+/*!
+ * @brief write_output_graph builds the communication graph of the final output in memory, then writes it and its
+ * analytics, as required (@see set_output_graph and set_output_analytics)
+ * @param output_file the final output file
+ */
+static void write_output_graph(char *output_file) {
+    graph_t graph;
+    if(!graph_build(&graph, output_file)){
+        fprintf(stderr, "[ERROR] Could not build the graph of %s\n", output_file);
+        return;
+    }
+    if(output_graph[0] != '\0' && !graph_write(&graph, output_graph)){
+        fprintf(stderr, "[ERROR] Could not write the graph %s\n", output_graph);
+    }
+    if(output_report[0] != '\0' && !write_graph_report(&graph, output_report, analytics_threads_count)){
+        fprintf(stderr, "[ERROR] Could not write the analytics report %s\n", output_report);
+    }
+    graph_close(&graph);
+}
+
+/*!
+ * @brief files_reducer merges the results of the partitions, once they are all reduced (@see reduce_partition): their
+ * sorted outputs are merged into the final output file, and their mail caches are replaced by their updates for the
+ * next run. The communication graph and its analytics are then written from the final output, if required (@see
+ * write_output_graph).
+ * @param temp_files path to the temporary files directory, holding the outputs of the partitions
+ * @param output_file final output file to be written by your function
+ */
+void files_reducer(char *temp_files, char *output_file) {
+    if(!directory_exists(temp_files) || !path_to_file_exists(output_file)) return;
+    char file_name[STR_MAX_LEN] = "";
+    char outputs_paths[STEP2_PARTITIONS_COUNT][STR_MAX_LEN];
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        snprintf(file_name, STR_MAX_LEN, STEP3_OUTPUT_FORMAT, p);
+        concat_path(temp_files, file_name, outputs_paths[p]);
+        // The checkpoint is kept: the run can be resumed, and the partitions reduced again
+        if(access(outputs_paths[p], F_OK) != 0){
+            fprintf(stderr, "[ERROR] Partition %u could not be reduced, the run can be resumed with -R\n", p);
+            remove_partitions_results(temp_files);
+            return;
+        }
+    }
+    // The results of all the tasks are reduced: from now on, resuming this run would count them twice
+    remove_checkpoint(temp_files);
+
+    for(uint32_t p = 0; p < STEP2_PARTITIONS_COUNT; ++p){
+        char cache_path[STR_MAX_LEN] = "";
+        char update_path[STR_MAX_LEN] = "";
+        snprintf(file_name, STR_MAX_LEN, MAIL_CACHE_FORMAT, p);
+        concat_path(temp_files, file_name, cache_path);
+        snprintf(file_name, STR_MAX_LEN, MAIL_CACHE_UPDATE_FORMAT, p);
+        concat_path(temp_files, file_name, update_path);
+        if(rename(update_path, cache_path) != 0){
+            if(errno != ENOENT) fprintf(stderr, "[ERROR] Could not rename %s : %s\n", update_path, strerror(errno));
+            remove(cache_path);
+        }
+    }
+
+    FILE *final_output = fopen(output_file, "w");
+    if(final_output == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", output_file, strerror(errno));
+    }else{
+        bool is_written = merge_partitions_outputs(outputs_paths, final_output);
+        if(fclose(final_output) != 0) is_written = false;
+        if(!is_written){
+            fprintf(stderr, "[ERROR] Could not write all the results to %s\n", output_file);
+        }else if(output_graph[0] != '\0' || output_report[0] != '\0'){
+            write_output_graph(output_file);
+        }
+    }
+    remove_partitions_results(temp_files);
+}
+
+// A pair of the approximate output, with the bounds of its count
+typedef struct {
+    uint64_t lower;
+    uint64_t upper;
+    approx_entry_t *entry;
+} approx_edge_t;
+
+/*!
+ * @brief compare_approx_edges orders pairs by descending upper bound, then descending lower bound, then sender and
+ * recipient
+ * @param a a pointer to an approx_edge_t
+ * @param b another pointer to an approx_edge_t
+ * @return a negative value if a comes first, a positive value if b comes first
+ */
+static int compare_approx_edges(const void *a, const void *b) {
+    const approx_edge_t *first = a;
+    const approx_edge_t *second = b;
+    if(first->upper != second->upper) return (first->upper > second->upper) ? -1 : 1;
+    if(first->lower != second->lower) return (first->lower > second->lower) ? -1 : 1;
+    int order = strcmp(first->entry->pair, second->entry->pair);
+    if(order != 0) return order;
+    return strcmp(first->entry->pair + first->entry->sender_length + 1,
+                  second->entry->pair + second->entry->sender_length + 1);
+}
+
+/*!
+ * @brief write_approx_output writes the heaviest pairs of the merged summary, each line being "lower-upper: sender
+ * recipient" (or "count: sender recipient" when the count is exact), after comment lines giving the error bounds
+ * @param output_file the final output file
+ * @param summary the merged summary
+ * @param edges_count the count of pairs to write
+ * @return true on success, false on error
+ */
+static bool write_approx_output(char *output_file, approx_summary_t *summary, uint32_t edges_count) {
+    approx_edge_t *edges = malloc(((size_t)summary->entries_count + 1) * sizeof(approx_edge_t));
+    if(edges == NULL) return false;
+    for(uint32_t i = 0; i < summary->entries_count; ++i){
+        approx_entry_t *entry = &summary->entries[i];
+        uint64_t estimate = approx_summary_estimate(summary, entry);
+        edges[i] = (approx_edge_t){entry->count - entry->error, (estimate < entry->count) ? estimate : entry->count,
+                                   entry};
+    }
+    qsort(edges, summary->entries_count, sizeof(approx_edge_t), compare_approx_edges);
+    if(edges_count > summary->entries_count) edges_count = summary->entries_count;
+
+    FILE *output = fopen(output_file, "w");
+    if(output == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", output_file, strerror(errno));
+        free(edges);
+        return false;
+    }
+    // Bounds of the sketch (@see approx_summary.h): the pairs heavier than the lightest heavy hitter are all listed
+    fprintf(output, "# Approximate output: the %u heaviest (sender, recipient) pairs of %lu, as lower-upper bounds\n",
+            edges_count, summary->total);
+    fprintf(output, "# Every pair counted more than %lu times is kept by the summary of %u pairs\n",
+            summary->total / APPROX_HEAVY_HITTERS, APPROX_HEAVY_HITTERS);
+    fprintf(output, "# Upper bounds exceed the counts by at most %.0f with probability %.1f%%\n",
+            ceil(M_E * summary->total / APPROX_SKETCH_WIDTH), 100.0 * (1.0 - exp(-APPROX_SKETCH_DEPTH)));
+    for(uint32_t i = 0; i < edges_count; ++i){
+        approx_entry_t *entry = edges[i].entry;
+        if(edges[i].lower == edges[i].upper) fprintf(output, "%lu: ", edges[i].upper);
+        else fprintf(output, "%lu-%lu: ", edges[i].lower, edges[i].upper);
+        fprintf(output, "%s %s\n", entry->pair, entry->pair + entry->sender_length + 1);
+    }
+    free(edges);
+    bool is_written = !ferror(output);
+    if(fclose(output) != 0) is_written = false;
+    return is_written;
+}
+
+/*!
+ * @brief approximate_files_reducer merges the summaries written by the workers in approximate mode (@see
+ * approx_summary.h) into one summary, in fixed memory whatever the count of pairs, then writes its heaviest pairs with
+ * the bounds of their counts to the final output file
+ * @param temp_files path to the temporary files directory, holding the summaries of the workers
+ * @param output_file final output file
+ * @param edges_count the count of pairs to write
+ */
+void approximate_files_reducer(char *temp_files, char *output_file, uint32_t edges_count) {
+    if(!directory_exists(temp_files) || !path_to_file_exists(output_file)) return;
+    DIR *temp_dir = opendir(temp_files);
+    if(temp_dir == NULL){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", temp_files, strerror(errno));
+        return;
+    }
+    approx_summary_t summary;
+    if(!approx_summary_init(&summary)){
+        fprintf(stderr, "[ERROR] Could not allocate the merged summary\n");
+        closedir(temp_dir);
+        return;
+    }
+    bool is_merged = true;
+    struct dirent *entry;
+    size_t prefix_length = strlen(APPROX_SUMMARY_PREFIX);
+    while((entry = readdir(temp_dir)) != NULL){
+        if(strncmp(entry->d_name, APPROX_SUMMARY_PREFIX, prefix_length) != 0) continue;
+        char summary_path[STR_MAX_LEN] = "";
+        concat_path(temp_files, entry->d_name, summary_path);
+        is_merged = approx_summary_merge_file(&summary, summary_path) && is_merged;
+    }
+    closedir(temp_dir);
+    // Summaries are not committed: an interrupted approximate run is started over
+    remove_checkpoint(temp_files);
+
+    if(!is_merged) fprintf(stderr, "[ERROR] Some summaries could not be merged, results are incomplete\n");
+    if(!write_approx_output(output_file, &summary, edges_count)){
+        fprintf(stderr, "[ERROR] Could not write all the results to %s\n", output_file);
+    }
+    approx_summary_free(&summary);
+    remove_files_with_prefix(temp_files, APPROX_SUMMARY_PREFIX);
 }
@@ -6,28 +6,71 @@
 #define A2022_REDUCERS_H
 
 #include "global_defs.h"
+#include "address_dict.h"
+#include "mail_cache.h"
+#include "pair_table.h"
+#include "spill_run.h"
 
-typedef struct _recipient {
-    char recipient_address[STR_MAX_LEN];
-    uint32_t occurrences;
-    struct _recipient *prev;
-    struct _recipient *next;
-} recipient_t;
-
-typedef struct _sender {
-    char sender_address[STR_MAX_LEN];
-    recipient_t *head; // Head of recipient list
-    recipient_t *tail; // Tail of recipient list
-    struct _sender *prev;
-    struct _sender *next;
+// Each partition of the senders (@see step2_format.h) is reduced into its own output, named after the partition
+#define STEP3_OUTPUT_PREFIX "step3_output."
+#define STEP3_OUTPUT_FORMAT STEP3_OUTPUT_PREFIX "%u"
+
+// Senders and recipients are IDs of the addresses dictionary of step2_results_t
+typedef struct {
+    uint32_t sender_id;
+    int32_t mails; // Count of e-mails sent (the source is left out of the results when a rerun brings it to 0)
+    uint32_t head; // Index of the first pair of its recipients, PAIR_TABLE_END if none
+    uint32_t tail; // Index of the last pair of its recipients
 } sender_t;
 
-sender_t *add_source_to_list(sender_t *list, char *source_email);
-void clear_sources_list(sender_t *list);
-sender_t *find_source_in_list(sender_t *list, char *source_email);
-void add_recipient_to_source(sender_t *source, char *recipient_email);
+// Spill runs of results exceeding their memory budget (@see spill_run.h)
+typedef struct {
+    size_t memory_budget; // Memory of the sources and pairs beyond which they are spilled, 0 for no budget
+    char directory[STR_MAX_LEN]; // Directory of the runs
+    uint32_t partition;
+    uint32_t runs_count; // Once runs are spilled, the results in memory are deltas (possibly negative)
+    bool is_failed;
+} step2_spill_t;
+
+// Results of all the workers, their address IDs being translated into the IDs of a single dictionary
+typedef struct {
+    address_dict_t addresses;
+    sender_t *sources; // Sources in order of first appearance
+    uint32_t sources_count;
+    uint32_t sources_capacity;
+    uint32_t *sources_by_id; // Index + 1 of the source of each address ID (0 if the address is not a sender)
+    uint32_t sources_by_id_size;
+    pair_table_t recipients; // Occurrences of the recipients of all the sources, linked source by source
+    step2_spill_t spill;
+    bool is_combined; // Records combined by the workers were reduced: the mail cache can not be updated
+} step2_results_t;
+
+void init_step2_results(step2_results_t *results);
+void free_step2_results(step2_results_t *results);
+sender_t *add_source(step2_results_t *results, uint32_t source_id);
+void clear_source(step2_results_t *results, sender_t *source);
+sender_t *find_source(step2_results_t *results, uint32_t source_id);
+void add_recipient_to_source(step2_results_t *results, sender_t *source, uint32_t recipient_id);
+void update_recipient_of_source(step2_results_t *results, sender_t *source, uint32_t recipient_id, int64_t delta);
+
+typedef struct {
+    void (* task_callback)(task_t *);
+    char temporary_directory[STR_MAX_LEN];
+    uint32_t partition;
+} partition_task_t;
+
+_Static_assert(sizeof(partition_task_t) <= sizeof(task_t), "partition_task_t must fit in a task_t");
 
 void files_list_reducer(char *data_source, char *temp_files, char *output_file);
-void files_reducer(char *temp_file, char *output_file);
+bool reduce_step2_file(char *shard_path, char *dict_path, char *keys_path, step2_results_t *results,
+                       mail_cache_builder_t *builder);
+void set_output_top_k(uint32_t top_k);
+void set_reducer_memory_budget(size_t memory_budget);
+void reduce_partition(task_t *task);
+void remove_partitions_results(char *temp_files);
+void set_output_graph(char *graph_file);
+void set_output_analytics(char *report_file, uint32_t threads_count);
+void files_reducer(char *temp_files, char *output_file);
+void approximate_files_reducer(char *temp_files, char *output_file, uint32_t edges_count);
 
 #endif //A2022_REDUCERS_H
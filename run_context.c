@@ -0,0 +1,85 @@
+#include "run_context.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*!
+ * @brief open_run_context checks and opens the directories of a run
+ * @param context the context to initialize
+ * @param data_source the data source directory
+ * @param temp_files the temporary files directory
+ * @return true on success, false if a directory can not be opened (the context is then closed)
+ */
+bool open_run_context(run_context_t *context, char *data_source, char *temp_files) {
+    if(context == NULL || data_source == NULL || temp_files == NULL) return false;
+    memset(context, 0, sizeof(run_context_t));
+    context->data_fd = open(data_source, O_RDONLY | O_DIRECTORY);
+    if(context->data_fd < 0){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", data_source, strerror(errno));
+        context->temp_fd = -1;
+        return false;
+    }
+    context->temp_fd = open(temp_files, O_RDONLY | O_DIRECTORY);
+    if(context->temp_fd < 0){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", temp_files, strerror(errno));
+        close_run_context(context);
+        return false;
+    }
+    strncpy(context->temp_path, temp_files, STR_MAX_LEN - 1);
+    strncpy(context->data_path, data_source, STR_MAX_LEN - 1);
+    context->data_path_length = strlen(context->data_path);
+    // A trailing slash is not part of the prefix of the files: "maildir/" and "maildir" both match "maildir/a/1."
+    while(context->data_path_length > 1 && context->data_path[context->data_path_length - 1] == '/'){
+        context->data_path[--context->data_path_length] = '\0';
+    }
+    return true;
+}
+
+/*!
+ * @brief close_run_context closes the directories of a run
+ * @param context the context
+ */
+void close_run_context(run_context_t *context) {
+    if(context == NULL) return;
+    if(context->data_fd >= 0) close(context->data_fd);
+    if(context->temp_fd >= 0) close(context->temp_fd);
+    context->data_fd = context->temp_fd = -1;
+}
+
+/*!
+ * @brief resolve_data_path gives the directory and the relative path to open a file of the data source with openat
+ * @param context the context of the run
+ * @param path the path to the file, as listed in step1_output (starting with the data source path)
+ * @param relative_path a pointer to the path to open, relative to the returned directory (in path)
+ * @return the data source directory, or AT_FDCWD (relative_path is then path) if path is not in the data source
+ */
+int resolve_data_path(run_context_t *context, char *path, char **relative_path) {
+    *relative_path = path;
+    if(context == NULL || context->data_fd < 0 || strncmp(path, context->data_path, context->data_path_length) != 0){
+        return AT_FDCWD;
+    }
+    char *suffix = path + context->data_path_length;
+    if(*suffix != '/' && context->data_path[context->data_path_length - 1] != '/') return AT_FDCWD;
+    while(*suffix == '/') ++suffix;
+    if(*suffix == '\0') return AT_FDCWD;
+    *relative_path = suffix;
+    return context->data_fd;
+}
+
+/*!
+ * @brief open_temp_file opens a file of the temporary files directory
+ * @param context the context of the run
+ * @param name the name of the file in the temporary files directory
+ * @param flags the flags of open (a created file gets 0644 permissions)
+ * @return the file descriptor, -1 on error (errno is set)
+ */
+int open_temp_file(run_context_t *context, char *name, int flags) {
+    if(context == NULL || context->temp_fd < 0){
+        errno = EBADF;
+        return -1;
+    }
+    return openat(context->temp_fd, name, flags, 0644);
+}
@@ -0,0 +1,26 @@
+#ifndef A2022_RUN_CONTEXT_H
+#define A2022_RUN_CONTEXT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "global_defs.h"
+
+/*
+ * Directories of a run, validated and opened once before the workers are created (which inherit the descriptors).
+ * Files are then opened relative to them with openat, without checking or resolving the directories again.
+ */
+typedef struct {
+    int data_fd;                // Data source directory, -1 when not opened
+    int temp_fd;                // Temporary files directory, -1 when not opened
+    char data_path[STR_MAX_LEN];
+    size_t data_path_length;
+    char temp_path[STR_MAX_LEN];
+} run_context_t;
+
+bool open_run_context(run_context_t *context, char *data_source, char *temp_files);
+void close_run_context(run_context_t *context);
+int resolve_data_path(run_context_t *context, char *path, char **relative_path);
+int open_temp_file(run_context_t *context, char *name, int flags);
+
+#endif //A2022_RUN_CONTEXT_H
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mail_scanner.h"
+
+/*
+ * scanner-test checks that the vectorized scanners of mail_scanner.c (SSE2, and AVX2 if the CPU supports it) find
+ * the same addresses as the scalar one, which is itself checked on a few known buffers. Each buffer is scanned with
+ * and without the stop at the end of the header field, and with a capacity of spans from 0 to more than needed.
+ * The buffers are random ones, and adversarial ones: addresses straddling the edges of the 16 and 32 bytes blocks,
+ * line breaks (continued or not) at every offset, and more addresses than the capacity.
+ * Usage: scanner-test [seed]
+ */
+
+#define MAX_TEST_SPANS 256
+#define RANDOM_BUFFERS_COUNT 200000
+#define RANDOM_BUFFER_MAX_LENGTH 160
+
+typedef struct {
+    const char *name;
+    mail_scanner_t scanner;
+} named_scanner_t;
+
+static named_scanner_t scanners[3];
+static int scanners_count = 0;
+static uint64_t cases_count = 0;
+static uint64_t failures_count = 0;
+
+/*!
+ * @brief print_buffer prints a buffer on the error output, with its control characters escaped
+ * @param buffer the buffer
+ * @param length the length of the buffer
+ */
+static void print_buffer(const char *buffer, size_t length) {
+    fputc('"', stderr);
+    for(size_t i = 0; i < length; ++i){
+        if(buffer[i] == '\n') fputs("\\n", stderr);
+        else if(buffer[i] == '\r') fputs("\\r", stderr);
+        else if(buffer[i] == '\t') fputs("\\t", stderr);
+        else if((uint8_t)buffer[i] < 0x20 || (uint8_t)buffer[i] >= 0x7F) fprintf(stderr, "\\x%02x", (uint8_t)buffer[i]);
+        else fputc(buffer[i], stderr);
+    }
+    fprintf(stderr, "\" (%zu bytes)\n", length);
+}
+
+/*!
+ * @brief compare_scan scans a buffer with the scalar scanner and each vectorized one, and reports their differences
+ * (number of addresses, addresses, and length of the field)
+ * @param buffer the buffer to scan, of exactly length bytes (a copy is scanned, for over-reads to be caught by tools)
+ * @param length the length of the buffer
+ * @param max_spans the capacity of spans
+ * @param is_field true to stop the scan at the end of the header field
+ */
+static void compare_scan(const char *buffer, size_t length, size_t max_spans, bool is_field) {
+    char *copy = malloc(length > 0 ? length : 1);
+    if(copy == NULL){
+        fprintf(stderr, "[ERROR] Could not allocate a buffer of %zu bytes\n", length);
+        exit(2);
+    }
+    memcpy(copy, buffer, length);
+    mail_span_t expected[MAX_TEST_SPANS], got[MAX_TEST_SPANS];
+    size_t expected_field_length = 0, got_field_length = 0;
+    size_t expected_count = scan_mail_spans_scalar(copy, length, expected, max_spans,
+                                                   is_field ? &expected_field_length : NULL);
+    for(int i = 0; i < scanners_count; ++i){
+        ++cases_count;
+        memset(got, 0xFF, sizeof(got));
+        size_t got_count = scanners[i].scanner(copy, length, got, max_spans, is_field ? &got_field_length : NULL);
+        bool is_same = (got_count == expected_count && got_field_length == expected_field_length);
+        for(size_t s = 0; is_same && s < expected_count; ++s){
+            is_same = (got[s].offset == expected[s].offset && got[s].length == expected[s].length);
+        }
+        if(is_same) continue;
+        if(++failures_count > 20) continue;
+        fprintf(stderr, "[ERROR] %s scanner differs (max_spans %zu, %s): ", scanners[i].name, max_spans,
+                is_field ? "field" : "buffer");
+        print_buffer(buffer, length);
+        fprintf(stderr, "  scalar: %zu addresses, field length %zu\n", expected_count, expected_field_length);
+        fprintf(stderr, "  %s: %zu addresses, field length %zu\n", scanners[i].name, got_count, got_field_length);
+        for(size_t s = 0; s < expected_count || s < got_count; ++s){
+            if(s < expected_count) fprintf(stderr, "  scalar [%u, +%u]", expected[s].offset, expected[s].length);
+            else fprintf(stderr, "  scalar none");
+            if(s < got_count) fprintf(stderr, " %s [%u, +%u]\n", scanners[i].name, got[s].offset, got[s].length);
+            else fprintf(stderr, " %s none\n", scanners[i].name);
+        }
+    }
+    free(copy);
+}
+
+/*!
+ * @brief compare_all_scans compares the scanners on a buffer, in both modes and with capacities of spans from 0 to
+ * more than the addresses of the buffer
+ * @param buffer the buffer to scan
+ * @param length the length of the buffer
+ */
+static void compare_all_scans(const char *buffer, size_t length) {
+    mail_span_t spans[MAX_TEST_SPANS];
+    size_t count = scan_mail_spans_scalar(buffer, length, spans, MAX_TEST_SPANS, NULL);
+    for(size_t max_spans = 0; max_spans <= count + 1 && max_spans <= MAX_TEST_SPANS; ++max_spans){
+        compare_scan(buffer, length, max_spans, false);
+        compare_scan(buffer, length, max_spans, true);
+    }
+}
+
+/*!
+ * @brief check_scalar checks the scalar scanner on a known buffer
+ * @param buffer the buffer, a string
+ * @param is_field true to stop the scan at the end of the header field
+ * @param expected the addresses that must be found, separated by spaces
+ * @param expected_field_length the length of the field that must be found (ignored if is_field is false)
+ */
+static void check_scalar(const char *buffer, bool is_field, const char *expected, size_t expected_field_length) {
+    mail_span_t spans[MAX_TEST_SPANS];
+    size_t field_length = 0;
+    size_t length = strlen(buffer);
+    size_t count = scan_mail_spans_scalar(buffer, length, spans, MAX_TEST_SPANS, is_field ? &field_length : NULL);
+    char found[1024] = "";
+    for(size_t s = 0; s < count; ++s){
+        if(s > 0) strcat(found, " ");
+        strncat(found, buffer + spans[s].offset, spans[s].length);
+    }
+    ++cases_count;
+    if(strcmp(found, expected) == 0 && (!is_field || field_length == expected_field_length)) return;
+    ++failures_count;
+    fprintf(stderr, "[ERROR] scalar scanner is wrong on ");
+    print_buffer(buffer, length);
+    fprintf(stderr, "  expected \"%s\", field length %zu\n  found \"%s\", field length %zu\n", expected,
+            expected_field_length, found, field_length);
+}
+
+/*!
+ * @brief test_known_buffers checks the scalar scanner on buffers whose addresses are known
+ */
+static void test_known_buffers() {
+    check_scalar("", false, "", 0);
+    check_scalar("a@b.c", false, "a@b.c", 0);
+    check_scalar("a@b, c.d@e, f@g.h", false, "f@g.h", 0);
+    check_scalar(" a.b@c.d,e@f.g\t\r\nnot-an-address @. x@y.", false, "a.b@c.d e@f.g @. x@y.", 0);
+    check_scalar("a@b.c\r\n d@e.f\r\nTo: g@h.i", true, "a@b.c d@e.f", 15);
+    check_scalar("a@b.c\n\te@f.g\n", true, "a@b.c e@f.g", 13);
+    check_scalar("a@b.c\r\n", true, "a@b.c", 7);
+    check_scalar("a@b.c\r\nd@e.f", false, "a@b.c d@e.f", 0);
+    check_scalar("a@b.c d@e.f", true, "a@b.c d@e.f", 11);
+}
+
+/*!
+ * @brief test_block_edges places addresses at every offset around the edges of the 16 and 32 bytes blocks, in
+ * buffers whose length is also around those edges, between delimiters or glued to other characters
+ */
+static void test_block_edges() {
+    const char *fillers = " ,\t\nx@.";
+    char buffer[128];
+    for(const char *filler = fillers; *filler != '\0'; ++filler){
+        for(size_t address_length = 3; address_length <= 40; ++address_length){
+            for(size_t start = 0; start + address_length <= 100; ++start){
+                size_t lengths[] = {start + address_length, start + address_length + 1, 16, 31, 32, 33, 48, 64, 65,
+                                    96, 100};
+                for(size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l){
+                    size_t length = lengths[l];
+                    if(length < start + address_length) continue;
+                    memset(buffer, *filler, length);
+                    // An address with its '@' and '.' at different places, e.g. "ab@cde.f" or "a@b.c"
+                    memset(buffer + start, 'a', address_length);
+                    buffer[start + address_length / 3] = '@';
+                    buffer[start + address_length - 2] = '.';
+                    compare_scan(buffer, length, MAX_TEST_SPANS, false);
+                    compare_scan(buffer, length, MAX_TEST_SPANS, true);
+                }
+            }
+        }
+    }
+}
+
+/*!
+ * @brief test_line_breaks places line breaks at every offset of a header field, followed by a space or a tab (the
+ * field goes on) or by another character or the end of the buffer (the field ends)
+ */
+static void test_line_breaks() {
+    const char *field = "a@b.cd, efg@hij.kl,mn@op.qr ,\tst@uv.wx yz@ab.cd, ef@gh.ij kl@mn.op\tqr@st.uv ";
+    const char *followers = " \tT\n@.";
+    char buffer[160];
+    size_t field_length = strlen(field);
+    for(const char *follower = followers; *follower != '\0'; ++follower){
+        for(size_t position = 0; position < field_length; ++position){
+            for(int with_cr = 0; with_cr <= 1; ++with_cr){
+                size_t length = 0;
+                memcpy(buffer, field, position);
+                length += position;
+                if(with_cr) buffer[length++] = '\r';
+                buffer[length++] = '\n';
+                buffer[length++] = *follower;
+                memcpy(buffer + length, field + position, field_length - position);
+                length += field_length - position;
+                // The line break as the last byte, then with the rest of the field after it
+                compare_all_scans(buffer, position + with_cr + 1);
+                compare_all_scans(buffer, length);
+            }
+        }
+    }
+}
+
+/*!
+ * @brief test_truncation scans buffers with more addresses than the capacity of spans, the addresses crossing the
+ * edges of the blocks at different places
+ */
+static void test_truncation() {
+    char buffer[1024];
+    for(size_t address_length = 5; address_length <= 35; ++address_length){
+        size_t length = 0;
+        while(length + address_length + 1 <= sizeof(buffer)){
+            memset(buffer + length, 'z', address_length);
+            buffer[length + 1] = '@';
+            buffer[length + address_length - 2] = '.';
+            length += address_length;
+            buffer[length] = (length % 3 == 0) ? ',' : ' ';
+            ++length;
+        }
+        compare_all_scans(buffer, length);
+        compare_all_scans(buffer, length - 1);
+    }
+}
+
+/*!
+ * @brief test_random_buffers compares the scanners on random buffers, made mostly of the characters the scanners
+ * look for
+ */
+static void test_random_buffers() {
+    const char alphabet[] = "ab@@..  ,,\t\r\n\n\nxyz";
+    char buffer[RANDOM_BUFFER_MAX_LENGTH];
+    for(int b = 0; b < RANDOM_BUFFERS_COUNT; ++b){
+        size_t length = rand() % (RANDOM_BUFFER_MAX_LENGTH + 1);
+        for(size_t i = 0; i < length; ++i){
+            // A few bytes out of the alphabet, including bytes with their high bit set
+            buffer[i] = (rand() % 64 == 0) ? (char)(rand() % 256) : alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        compare_scan(buffer, length, MAX_TEST_SPANS, false);
+        compare_scan(buffer, length, MAX_TEST_SPANS, true);
+        compare_scan(buffer, length, rand() % 4, rand() % 2);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int seed = (argc > 1) ? strtoul(argv[1], NULL, 10) : 25;
+    srand(seed);
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")){
+        scanners[scanners_count].name = "SSE2";
+        scanners[scanners_count++].scanner = scan_mail_spans_sse2;
+    } else {
+        fprintf(stderr, "[WARN] SSE2 is not supported by this CPU, its scanner is not tested\n");
+    }
+    if(__builtin_cpu_supports("avx2")){
+        scanners[scanners_count].name = "AVX2";
+        scanners[scanners_count++].scanner = scan_mail_spans_avx2;
+    } else {
+        fprintf(stderr, "[WARN] AVX2 is not supported by this CPU, its scanner is not tested\n");
+    }
+#else
+    fprintf(stderr, "[WARN] No vectorized scanner on this architecture, only the scalar one is tested\n");
+#endif
+
+    test_known_buffers();
+    test_block_edges();
+    test_line_breaks();
+    test_truncation();
+    test_random_buffers();
+
+    printf("%lu cases, %lu failed (seed %u)\n", cases_count, failures_count, seed);
+    return failures_count == 0 ? 0 : 1;
+}
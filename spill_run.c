@@ -0,0 +1,148 @@
+#include "spill_run.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// Current sender of a run while the runs are merged
+typedef struct {
+    FILE *file;
+    spill_sender_t sender;
+    spill_recipient_t *recipients;
+    uint32_t recipients_capacity;
+    bool has_sender;
+} spill_cursor_t;
+
+/*!
+ * @brief write_spill_sender appends a sender and its recipients to a run
+ * @param run the run
+ * @param sender the sender
+ * @param recipients its recipients, in order of ID
+ * @return true on success, false on error
+ */
+bool write_spill_sender(FILE *run, spill_sender_t *sender, spill_recipient_t *recipients) {
+    return fwrite(sender, sizeof(spill_sender_t), 1, run) == 1 &&
+           fwrite(recipients, sizeof(spill_recipient_t), sender->recipients_count, run) == sender->recipients_count;
+}
+
+/*!
+ * @brief grow_recipients makes room for recipients in a buffer
+ * @param recipients a pointer to the buffer
+ * @param capacity a pointer to the capacity of the buffer, in recipients
+ * @param count the number of recipients to hold
+ * @return true on success, false if allocation failed
+ */
+static bool grow_recipients(spill_recipient_t **recipients, uint32_t *capacity, uint32_t count) {
+    if(count <= *capacity) return true;
+    uint32_t new_capacity = (*capacity == 0) ? 64 : *capacity;
+    while(new_capacity < count) new_capacity *= 2;
+    spill_recipient_t *new_recipients = realloc(*recipients, new_capacity * sizeof(spill_recipient_t));
+    if(new_recipients == NULL) return false;
+    *recipients = new_recipients;
+    *capacity = new_capacity;
+    return true;
+}
+
+/*!
+ * @brief next_spill_sender reads the next sender of a run
+ * @param cursor the cursor of the run
+ * @return true on success (has_sender is false once the run is over), false if the run is truncated
+ */
+static bool next_spill_sender(spill_cursor_t *cursor) {
+    cursor->has_sender = fread(&cursor->sender, sizeof(spill_sender_t), 1, cursor->file) == 1;
+    if(!cursor->has_sender) return !ferror(cursor->file);
+    uint32_t count = cursor->sender.recipients_count;
+    if(!grow_recipients(&cursor->recipients, &cursor->recipients_capacity, count) ||
+       fread(cursor->recipients, sizeof(spill_recipient_t), count, cursor->file) != count){
+        cursor->has_sender = false;
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief compare_spill_recipients orders recipients by ID
+ * @param a a pointer to a spill_recipient_t
+ * @param b a pointer to a spill_recipient_t
+ * @return a negative value if a comes first, a positive value if b comes first
+ */
+int compare_spill_recipients(const void *a, const void *b) {
+    uint32_t first = ((const spill_recipient_t *)a)->recipient_id;
+    uint32_t second = ((const spill_recipient_t *)b)->recipient_id;
+    return (first > second) - (first < second);
+}
+
+/*!
+ * @brief merge_spill_runs merges runs sender by sender (in order of address), summing their deltas
+ * @param runs_paths the paths to the runs
+ * @param runs_count the number of runs
+ * @param addresses the dictionary of the IDs of the runs
+ * @param callback the function called with each merged sender
+ * @param context the context of the callback
+ * @return true on success, false on error
+ */
+bool merge_spill_runs(char (*runs_paths)[STR_MAX_LEN], uint32_t runs_count, address_dict_t *addresses,
+                      spill_merge_callback_t callback, void *context) {
+    spill_cursor_t *cursors = calloc(runs_count + 1, sizeof(spill_cursor_t));
+    if(cursors == NULL) return false;
+    bool is_merged = true;
+    for(uint32_t i = 0; i < runs_count && is_merged; ++i){
+        cursors[i].file = fopen(runs_paths[i], "r");
+        if(cursors[i].file == NULL){
+            fprintf(stderr, "[ERROR] Could not open %s : %s\n", runs_paths[i], strerror(errno));
+            is_merged = false;
+        }else{
+            is_merged = next_spill_sender(&cursors[i]);
+        }
+    }
+
+    spill_recipient_t *merged = NULL;
+    uint32_t merged_capacity = 0;
+    while(is_merged){
+        spill_cursor_t *first = NULL;
+        for(uint32_t i = 0; i < runs_count; ++i){
+            if(!cursors[i].has_sender) continue;
+            if(first == NULL || strcmp(address_dict_get(addresses, cursors[i].sender.sender_id),
+                                       address_dict_get(addresses, first->sender.sender_id)) < 0){
+                first = &cursors[i];
+            }
+        }
+        if(first == NULL) break;
+
+        // The recipients of the sender in all the runs are gathered, then the deltas of each recipient summed
+        spill_sender_t sender = {first->sender.sender_id, 0, 0};
+        for(uint32_t i = 0; i < runs_count && is_merged; ++i){
+            spill_cursor_t *cursor = &cursors[i];
+            if(!cursor->has_sender || cursor->sender.sender_id != sender.sender_id) continue;
+            uint32_t count = cursor->sender.recipients_count;
+            if(!grow_recipients(&merged, &merged_capacity, sender.recipients_count + count)){
+                is_merged = false;
+                break;
+            }
+            memcpy(merged + sender.recipients_count, cursor->recipients, count * sizeof(spill_recipient_t));
+            sender.recipients_count += count;
+            sender.mails += cursor->sender.mails;
+            is_merged = next_spill_sender(cursor);
+        }
+        if(!is_merged) break;
+        qsort(merged, sender.recipients_count, sizeof(spill_recipient_t), compare_spill_recipients);
+        uint32_t count = 0;
+        for(uint32_t i = 0; i < sender.recipients_count; ++i){
+            if(count > 0 && merged[count - 1].recipient_id == merged[i].recipient_id){
+                merged[count - 1].occurrences += merged[i].occurrences;
+            }else{
+                merged[count++] = merged[i];
+            }
+        }
+        sender.recipients_count = count;
+        is_merged = callback(&sender, merged, context);
+    }
+
+    for(uint32_t i = 0; i < runs_count; ++i){
+        if(cursors[i].file != NULL) fclose(cursors[i].file);
+        free(cursors[i].recipients);
+    }
+    free(cursors);
+    free(merged);
+    return is_merged;
+}
@@ -0,0 +1,43 @@
+#ifndef A2022_SPILL_RUN_H
+#define A2022_SPILL_RUN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "global_defs.h"
+#include "address_dict.h"
+
+/*
+ * Spill runs of a partition reducer, written when its results exceed their memory budget (@see
+ * set_reducer_memory_budget). A run holds partial results as signed deltas (e-mails removed since the previous run
+ * count negatively), sender by sender in order of address, each sender with its recipients in order of ID. Addresses
+ * are IDs of the dictionary of the reducer, which stays in memory. Runs are merged sender by sender, their deltas being
+ * summed.
+ */
+#define STEP3_RUN_PREFIX "step3_run."
+#define STEP3_RUN_FORMAT STEP3_RUN_PREFIX "%u.%u"
+// Runs of a partition merged at once: beyond, they are first merged into a single run
+#define SPILL_MAX_RUNS 32
+
+typedef struct {
+    uint32_t recipient_id;
+    int32_t occurrences;
+} spill_recipient_t;
+
+// A sender of a run, followed by its recipients
+typedef struct {
+    uint32_t sender_id;
+    int32_t mails;
+    uint32_t recipients_count;
+} spill_sender_t;
+
+// Called with each sender of the merged runs, and its recipients (in order of ID). Returns false to stop the merge.
+typedef bool (* spill_merge_callback_t)(spill_sender_t *sender, spill_recipient_t *recipients, void *context);
+
+int compare_spill_recipients(const void *a, const void *b);
+bool write_spill_sender(FILE *run, spill_sender_t *sender, spill_recipient_t *recipients);
+bool merge_spill_runs(char (*runs_paths)[STR_MAX_LEN], uint32_t runs_count, address_dict_t *addresses,
+                      spill_merge_callback_t callback, void *context);
+
+#endif //A2022_SPILL_RUN_H
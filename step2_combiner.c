@@ -0,0 +1,161 @@
+#include "step2_combiner.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief step2_combiner_init initializes an empty combiner (memory is allocated at the first record)
+ * @param combiner the combiner to initialize
+ */
+void step2_combiner_init(step2_combiner_t *combiner) {
+    if(combiner == NULL) return;
+    memset(combiner, 0, sizeof(step2_combiner_t));
+    pair_table_init(&combiner->pairs);
+}
+
+/*!
+ * @brief step2_combiner_free frees all the memory of a combiner, leaving it empty (its records are lost)
+ * @param combiner the combiner to free
+ */
+void step2_combiner_free(step2_combiner_t *combiner) {
+    if(combiner == NULL) return;
+    pair_table_free(&combiner->pairs);
+    free(combiner->senders);
+    free(combiner->sender_ids);
+    free(combiner->recipients);
+    free(combiner->occurrences);
+    step2_combiner_init(combiner);
+}
+
+/*!
+ * @brief reserve_sender makes room in a combiner for a sender ID
+ * @param combiner the combiner
+ * @param sender_id the ID of the sender
+ * @return true on success, false if allocation failed
+ */
+static bool reserve_sender(step2_combiner_t *combiner, uint32_t sender_id) {
+    if(sender_id < combiner->senders_capacity) return true;
+    uint32_t capacity = (combiner->senders_capacity == 0) ? 1024 : combiner->senders_capacity;
+    while(capacity <= sender_id) capacity *= 2;
+    combined_sender_t *senders = realloc(combiner->senders, capacity * sizeof(combined_sender_t));
+    if(senders == NULL) return false;
+    combiner->senders = senders;
+    for(uint32_t id = combiner->senders_capacity; id < capacity; ++id){
+        senders[id] = (combined_sender_t){0, PAIR_TABLE_END, PAIR_TABLE_END};
+    }
+    uint32_t *sender_ids = realloc(combiner->sender_ids, capacity * sizeof(uint32_t));
+    if(sender_ids == NULL) return false;
+    combiner->sender_ids = sender_ids;
+    combiner->senders_capacity = capacity;
+    return true;
+}
+
+/*!
+ * @brief step2_combiner_add adds the record of an e-mail to a combiner
+ * @param combiner the combiner
+ * @param sender_id the ID of the sender
+ * @param recipients the IDs of the recipients
+ * @param recipients_count the count of recipients
+ * @return true on success, false if allocation failed (the record is then not added at all, it must be written as is)
+ */
+bool step2_combiner_add(step2_combiner_t *combiner, uint32_t sender_id, uint32_t *recipients,
+                        uint32_t recipients_count) {
+    if(combiner == NULL || !reserve_sender(combiner, sender_id)) return false;
+    // A sender is listed when it is first met, its pairs being reset by the next flush
+    combined_sender_t *sender = &combiner->senders[sender_id];
+    bool is_listed = sender->mails > 0 || sender->head != PAIR_TABLE_END;
+    if(!is_listed) combiner->sender_ids[combiner->sender_ids_count++] = sender_id;
+    for(uint32_t i = 0; i < recipients_count; ++i){
+        bool is_new;
+        uint32_t index = pair_table_add(&combiner->pairs, sender_id, recipients[i], &is_new);
+        if(index == PAIR_TABLE_END){
+            // The pairs already counted are taken back: those left with no occurrence are not written
+            for(uint32_t j = 0; j < i; ++j){
+                --combiner->pairs.pairs[pair_table_find(&combiner->pairs, sender_id, recipients[j])].occurrences;
+            }
+            if(!is_listed && sender->head == PAIR_TABLE_END) --combiner->sender_ids_count;
+            return false;
+        }
+        ++combiner->pairs.pairs[index].occurrences;
+        if(!is_new) continue;
+        if(sender->tail != PAIR_TABLE_END) combiner->pairs.pairs[sender->tail].next = index;
+        else sender->head = index;
+        sender->tail = index;
+    }
+    ++sender->mails;
+    return true;
+}
+
+/*!
+ * @brief step2_combiner_is_full tells if the records of a combiner must be written
+ * @param combiner the combiner
+ * @return true if it holds STEP2_COMBINER_PAIRS pairs or more
+ */
+bool step2_combiner_is_full(step2_combiner_t *combiner) {
+    return combiner != NULL && combiner->pairs.count >= STEP2_COMBINER_PAIRS;
+}
+
+/*!
+ * @brief step2_combiner_is_empty tells if a combiner holds no record
+ * @param combiner the combiner
+ * @return true if no e-mail was added since the last flush
+ */
+bool step2_combiner_is_empty(step2_combiner_t *combiner) {
+    return combiner == NULL || combiner->sender_ids_count == 0;
+}
+
+/*!
+ * @brief reserve_record makes room for the recipients of a combined record
+ * @param combiner the combiner
+ * @param count the count of recipients
+ * @return true on success, false if allocation failed
+ */
+static bool reserve_record(step2_combiner_t *combiner, uint32_t count) {
+    if(count <= combiner->recipients_capacity) return true;
+    uint32_t capacity = (combiner->recipients_capacity == 0) ? 64 : combiner->recipients_capacity;
+    while(capacity < count) capacity *= 2;
+    uint32_t *recipients = realloc(combiner->recipients, capacity * sizeof(uint32_t));
+    if(recipients == NULL) return false;
+    combiner->recipients = recipients;
+    uint32_t *occurrences = realloc(combiner->occurrences, capacity * sizeof(uint32_t));
+    if(occurrences == NULL) return false;
+    combiner->occurrences = occurrences;
+    combiner->recipients_capacity = capacity;
+    return true;
+}
+
+/*!
+ * @brief step2_combiner_flush writes the combined record of each sender of a combiner to a shard, in order of their
+ * first e-mail, then empties the combiner (keeping its memory for the next records)
+ * @param combiner the combiner
+ * @param shard the shard, opened for writing
+ * @param format the format of the shard
+ * @return true on success, false if a record could not be written
+ */
+bool step2_combiner_flush(step2_combiner_t *combiner, FILE *shard, step2_format_t format) {
+    if(combiner == NULL) return true;
+    bool is_written = true;
+    pair_t *pairs = combiner->pairs.pairs;
+    for(uint32_t i = 0; i < combiner->sender_ids_count; ++i){
+        uint32_t sender_id = combiner->sender_ids[i];
+        combined_sender_t *sender = &combiner->senders[sender_id];
+        uint32_t count = 0;
+        for(uint32_t index = sender->head; index != PAIR_TABLE_END && is_written; index = pairs[index].next){
+            if(pairs[index].occurrences <= 0) continue;
+            is_written = reserve_record(combiner, count + 1);
+            if(!is_written) break;
+            combiner->recipients[count] = pairs[index].recipient_id;
+            combiner->occurrences[count++] = pairs[index].occurrences;
+        }
+        // A sender whose only record could not be added has no e-mail
+        if(sender->mails > 0){
+            is_written = is_written && write_step2_combined_record(shard, format, sender_id, sender->mails,
+                                                                   combiner->recipients, combiner->occurrences,
+                                                                   count);
+        }
+        *sender = (combined_sender_t){0, PAIR_TABLE_END, PAIR_TABLE_END};
+    }
+    combiner->sender_ids_count = 0;
+    pair_table_clear(&combiner->pairs);
+    return is_written;
+}
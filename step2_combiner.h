@@ -0,0 +1,47 @@
+#ifndef A2022_STEP2_COMBINER_H
+#define A2022_STEP2_COMBINER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pair_table.h"
+#include "step2_format.h"
+
+/*
+ * Combiner of the records of a worker for one partition: instead of writing a record per e-mail, the worker counts the
+ * e-mails of each sender and the occurrences of each (sender, recipient) pair, and writes one combined record per
+ * sender (@see step2_format.h) when the combiner is full or flushed. On a corpus where the same senders write to the
+ * same recipients, the shards and the work of the reducers shrink by the ratio of e-mails to distinct pairs.
+ * IDs are those of the worker's dictionary of the partition, so that they index the senders directly.
+ */
+// Pairs of a combiner beyond which its records are written (memory of a combiner is about 32 bytes per pair)
+#define STEP2_COMBINER_PAIRS (8 * 1024)
+
+// E-mails of a sender since the last flush, with its pairs linked in order of appearance
+typedef struct {
+    uint32_t mails;
+    uint32_t head;              // Index of the first pair of its recipients, PAIR_TABLE_END if none
+    uint32_t tail;
+} combined_sender_t;
+
+typedef struct {
+    pair_table_t pairs;
+    combined_sender_t *senders; // Indexed by sender ID
+    uint32_t senders_capacity;
+    uint32_t *sender_ids;       // IDs of the senders with e-mails since the last flush, in order of their first e-mail
+    uint32_t sender_ids_count;
+    uint32_t *recipients;       // Recipients of the record being written, with their occurrences
+    uint32_t *occurrences;
+    uint32_t recipients_capacity;
+} step2_combiner_t;
+
+void step2_combiner_init(step2_combiner_t *combiner);
+void step2_combiner_free(step2_combiner_t *combiner);
+bool step2_combiner_add(step2_combiner_t *combiner, uint32_t sender_id, uint32_t *recipients,
+                        uint32_t recipients_count);
+bool step2_combiner_is_full(step2_combiner_t *combiner);
+bool step2_combiner_is_empty(step2_combiner_t *combiner);
+bool step2_combiner_flush(step2_combiner_t *combiner, FILE *shard, step2_format_t format);
+
+#endif //A2022_STEP2_COMBINER_H
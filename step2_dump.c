@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "step2_format.h"
+#include "address_dict.h"
+
+/*
+ * step2-dump prints a step2_output shard (binary or text) as text, one line per e-mail: the sender then the
+ * recipients. Combined shards have one line per sender, each address being followed by its count ("address*count").
+ * With the dictionary of the worker that wrote the shard (step2_dict.<worker>.<partition>), addresses are printed
+ * instead of IDs.
+ * Usage: step2-dump <shard> [<dictionary>]
+ */
+int main(int argc, char *argv[]) {
+    if(argc < 2 || argc > 3){
+        fprintf(stderr, "Usage: %s <step2 shard> [<step2 dictionary>]\n", argv[0]);
+        return 1;
+    }
+
+    address_dict_t addresses;
+    address_dict_init(&addresses);
+    uint32_t *ids = NULL;
+    uint32_t ids_count = 0;
+    if(argc == 3 && !address_dict_load(&addresses, argv[2], &ids, &ids_count)) return 1;
+
+    step2_reader_t reader;
+    if(!step2_reader_open(&reader, argv[1])){
+        free(ids);
+        address_dict_free(&addresses);
+        return 1;
+    }
+    fprintf(stderr, "%s: %s%s shard\n", argv[1], (reader.format == STEP2_FORMAT_BINARY) ? "binary" : "text",
+            reader.is_combined ? " combined" : "");
+
+    uint32_t sender_id;
+    uint32_t mails;
+    uint32_t *recipients;
+    uint32_t *occurrences;
+    uint32_t recipients_count;
+    while(step2_reader_next_combined(&reader, &sender_id, &mails, &recipients, &occurrences, &recipients_count)){
+        for(uint32_t i = 0; i <= recipients_count; ++i){
+            uint32_t id = (i == 0) ? sender_id : recipients[i - 1];
+            if(i > 0) putchar(' ');
+            if(argc == 3 && id < ids_count) fputs(address_dict_get(&addresses, ids[id]), stdout);
+            else printf("%u", id);
+            if(reader.is_combined) printf("*%u", (i == 0) ? mails : occurrences[i - 1]);
+        }
+        putchar('\n');
+    }
+
+    step2_reader_close(&reader);
+    free(ids);
+    address_dict_free(&addresses);
+    return 0;
+}
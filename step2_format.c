@@ -0,0 +1,363 @@
+#include "step2_format.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief step2_partition gives the partition of the records of a sender (FNV-1a hash of its address)
+ * @param sender the address of the sender (not necessarily null terminated)
+ * @param length the length of the address
+ * @return the partition, between 0 and STEP2_PARTITIONS_COUNT - 1
+ */
+uint32_t step2_partition(const char *sender, size_t length) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; ++i){
+        hash ^= (uint8_t)sender[i];
+        hash *= 16777619u;
+    }
+    return hash % STEP2_PARTITIONS_COUNT;
+}
+
+/*!
+ * @brief encode_varint encodes an integer as a varint
+ * @param value the integer to encode
+ * @param buffer the buffer receiving the varint (at least VARINT_MAX_SIZE bytes)
+ * @return the size of the varint
+ */
+size_t encode_varint(uint32_t value, uint8_t *buffer) {
+    size_t size = 0;
+    while(value >= 0x80){
+        buffer[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[size++] = (uint8_t)value;
+    return size;
+}
+
+/*!
+ * @brief decode_varint decodes a varint from a buffer
+ * @param buffer the buffer holding the varint
+ * @param length the length of the buffer
+ * @param cur a pointer to the offset of the varint in the buffer, moved after the varint
+ * @param value a pointer to the decoded integer
+ * @return true on success, false if the varint is truncated or too long
+ */
+bool decode_varint(const uint8_t *buffer, size_t length, size_t *cur, uint32_t *value) {
+    uint32_t result = 0;
+    for(size_t i = 0; i < VARINT_MAX_SIZE && *cur + i < length; ++i){
+        uint8_t byte = buffer[*cur + i];
+        result |= (uint32_t)(byte & 0x7F) << (7 * i);
+        if((byte & 0x80) == 0){
+            *cur += i + 1;
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief write_step2_header writes the header of a binary shard
+ * @param shard the shard, opened for writing
+ * @param is_combined true if the shard holds combined records
+ * @return true on success, false else
+ */
+bool write_step2_header(FILE *shard, bool is_combined) {
+    uint8_t header[STEP2_HEADER_SIZE] = {0};
+    memcpy(header, STEP2_MAGIC, STEP2_MAGIC_SIZE);
+    header[STEP2_MAGIC_SIZE] = is_combined ? STEP2_COMBINED_VERSION : STEP2_VERSION;
+    return fwrite(header, 1, STEP2_HEADER_SIZE, shard) == STEP2_HEADER_SIZE;
+}
+
+/*!
+ * @brief write_step2_record writes the record of an e-mail to a shard
+ * @param shard the shard, opened for writing
+ * @param format the format of the shard
+ * @param sender_id the ID of the sender
+ * @param recipients the IDs of the recipients
+ * @param recipients_count the count of recipients
+ * @return true on success, false else
+ */
+bool write_step2_record(FILE *shard, step2_format_t format, uint32_t sender_id, uint32_t *recipients,
+                        uint32_t recipients_count) {
+    if(format == STEP2_FORMAT_TEXT){
+        fprintf(shard, "%u", sender_id);
+        for(uint32_t i = 0; i < recipients_count; ++i) fprintf(shard, " %u", recipients[i]);
+        return fputc('\n', shard) != EOF;
+    }
+
+    // Varints are encoded by blocks, to write them with few calls
+    uint8_t block[64 * VARINT_MAX_SIZE];
+    size_t size = encode_varint(sender_id, block);
+    size += encode_varint(recipients_count, block + size);
+    for(uint32_t i = 0; i < recipients_count; ++i){
+        if(size + VARINT_MAX_SIZE > sizeof(block)){
+            if(fwrite(block, 1, size, shard) != size) return false;
+            size = 0;
+        }
+        size += encode_varint(recipients[i], block + size);
+    }
+    return fwrite(block, 1, size, shard) == size;
+}
+
+/*!
+ * @brief write_step2_combined_record writes the combined record of a sender to a shard
+ * @param shard the shard, opened for writing
+ * @param format the format of the shard
+ * @param sender_id the ID of the sender
+ * @param mails the count of e-mails of the sender
+ * @param recipients the IDs of the recipients
+ * @param occurrences the occurrences of each recipient, NULL if each one occurs once
+ * @param recipients_count the count of recipients
+ * @return true on success, false else
+ */
+bool write_step2_combined_record(FILE *shard, step2_format_t format, uint32_t sender_id, uint32_t mails,
+                                 uint32_t *recipients, uint32_t *occurrences, uint32_t recipients_count) {
+    if(format == STEP2_FORMAT_TEXT){
+        fprintf(shard, "%u*%u", sender_id, mails);
+        for(uint32_t i = 0; i < recipients_count; ++i){
+            fprintf(shard, " %u*%u", recipients[i], (occurrences == NULL) ? 1 : occurrences[i]);
+        }
+        return fputc('\n', shard) != EOF;
+    }
+
+    uint8_t block[64 * VARINT_MAX_SIZE];
+    size_t size = encode_varint(sender_id, block);
+    size += encode_varint(mails, block + size);
+    size += encode_varint(recipients_count, block + size);
+    for(uint32_t i = 0; i < recipients_count; ++i){
+        if(size + 2 * VARINT_MAX_SIZE > sizeof(block)){
+            if(fwrite(block, 1, size, shard) != size) return false;
+            size = 0;
+        }
+        size += encode_varint(recipients[i], block + size);
+        size += encode_varint((occurrences == NULL) ? 1 : occurrences[i], block + size);
+    }
+    return fwrite(block, 1, size, shard) == size;
+}
+
+/*!
+ * @brief step2_reader_open maps a shard in memory to read its records. The format is given by the header: files
+ * without the binary header are read as text shards (combined if their IDs are followed by counts).
+ * @param reader the reader to initialize
+ * @param path the path to the shard
+ * @return true on success, false on error (the reader is then empty)
+ */
+bool step2_reader_open(step2_reader_t *reader, char *path) {
+    memset(reader, 0, sizeof(step2_reader_t));
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "[ERROR] Could not open %s : %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat shard_stat;
+    if(fstat(fd, &shard_stat) != 0){
+        fprintf(stderr, "[ERROR] Could not stat %s : %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    reader->size = shard_stat.st_size;
+    if(reader->size > 0){
+        void *data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED){
+            fprintf(stderr, "[ERROR] Could not map %s : %s\n", path, strerror(errno));
+            close(fd);
+            reader->size = 0;
+            return false;
+        }
+        madvise(data, reader->size, MADV_SEQUENTIAL);
+        reader->data = data;
+        reader->is_mapped = true;
+    }
+    close(fd);
+
+    reader->format = STEP2_FORMAT_TEXT;
+    if(reader->size >= STEP2_HEADER_SIZE && memcmp(reader->data, STEP2_MAGIC, STEP2_MAGIC_SIZE) == 0){
+        uint8_t version = reader->data[STEP2_MAGIC_SIZE];
+        if(version != STEP2_VERSION && version != STEP2_COMBINED_VERSION){
+            fprintf(stderr, "[ERROR] Unsupported version %u of %s\n", version, path);
+            step2_reader_close(reader);
+            return false;
+        }
+        reader->format = STEP2_FORMAT_BINARY;
+        reader->is_combined = version == STEP2_COMBINED_VERSION;
+        reader->cur = STEP2_HEADER_SIZE;
+    }
+    return true;
+}
+
+/*!
+ * @brief step2_reader_open_buffer prepares a reader for binary records held in memory (without the shard header)
+ * @param reader the reader to initialize
+ * @param data the records
+ * @param size the size of the records
+ */
+void step2_reader_open_buffer(step2_reader_t *reader, const uint8_t *data, size_t size) {
+    memset(reader, 0, sizeof(step2_reader_t));
+    reader->format = STEP2_FORMAT_BINARY;
+    reader->data = data;
+    reader->size = size;
+}
+
+/*!
+ * @brief reserve_recipients makes room for the recipients of a record in a reader
+ * @param reader the reader
+ * @param count the count of recipients
+ * @return true on success, false if allocation failed
+ */
+static bool reserve_recipients(step2_reader_t *reader, uint32_t count) {
+    if(count <= reader->recipients_capacity) return true;
+    uint32_t capacity = (reader->recipients_capacity == 0) ? 64 : reader->recipients_capacity;
+    while(capacity < count) capacity *= 2;
+    uint32_t *recipients = realloc(reader->recipients, capacity * sizeof(uint32_t));
+    if(recipients == NULL) return false;
+    reader->recipients = recipients;
+    uint32_t *occurrences = realloc(reader->occurrences, capacity * sizeof(uint32_t));
+    if(occurrences == NULL) return false;
+    reader->occurrences = occurrences;
+    reader->recipients_capacity = capacity;
+    return true;
+}
+
+/*!
+ * @brief next_text_number reads a number of a text record
+ * @param reader the reader, on the first digit
+ * @return the number
+ */
+static uint32_t next_text_number(step2_reader_t *reader) {
+    uint32_t result = 0;
+    while(reader->cur < reader->size && reader->data[reader->cur] >= '0' && reader->data[reader->cur] <= '9'){
+        result = result * 10 + (reader->data[reader->cur++] - '0');
+    }
+    return result;
+}
+
+/*!
+ * @brief next_text_id reads the next ID of a text record, with its count if it is combined ("id*count")
+ * @param reader the reader
+ * @param value a pointer to the ID read
+ * @param count a pointer to the count of the ID (1 if it has none)
+ * @return true if an ID was read, false at the end of the line (the line break is skipped)
+ */
+static bool next_text_id(step2_reader_t *reader, uint32_t *value, uint32_t *count) {
+    while(reader->cur < reader->size && reader->data[reader->cur] == ' ') ++reader->cur;
+    if(reader->cur >= reader->size) return false;
+    if(reader->data[reader->cur] < '0' || reader->data[reader->cur] > '9'){
+        // Line break, or garbage skipped up to the end of the line
+        while(reader->cur < reader->size && reader->data[reader->cur++] != '\n');
+        return false;
+    }
+    *value = next_text_number(reader);
+    *count = 1;
+    if(reader->cur + 1 < reader->size && reader->data[reader->cur] == '*'){
+        ++reader->cur;
+        *count = next_text_number(reader);
+        reader->is_combined = true;
+    }
+    return true;
+}
+
+/*!
+ * @brief read_step2_record reads the next record of a shard into the recipients (and the occurrences, for combined
+ * records) of the reader
+ * @param reader the reader
+ * @param sender_id a pointer to the ID of the sender
+ * @param mails a pointer to the count of e-mails of the record (1 if it is not combined)
+ * @param recipients_count a pointer to the count of recipients
+ * @return true if a record was read, false at the end of the shard or if it is corrupted
+ */
+static bool read_step2_record(step2_reader_t *reader, uint32_t *sender_id, uint32_t *mails,
+                              uint32_t *recipients_count) {
+    if(reader->format == STEP2_FORMAT_TEXT){
+        // Empty lines are skipped
+        bool found = false;
+        while(reader->cur < reader->size && !(found = next_text_id(reader, sender_id, mails)));
+        if(!found) return false;
+        uint32_t count = 0;
+        uint32_t recipient_id, occurrences;
+        while(next_text_id(reader, &recipient_id, &occurrences)){
+            if(!reserve_recipients(reader, count + 1)) return false;
+            reader->recipients[count] = recipient_id;
+            reader->occurrences[count++] = occurrences;
+        }
+        *recipients_count = count;
+        return true;
+    }
+
+    if(reader->cur >= reader->size) return false;
+    uint32_t count;
+    *mails = 1;
+    if(!decode_varint(reader->data, reader->size, &reader->cur, sender_id) ||
+       (reader->is_combined && !decode_varint(reader->data, reader->size, &reader->cur, mails)) ||
+       !decode_varint(reader->data, reader->size, &reader->cur, &count) || count > reader->size - reader->cur){
+        fprintf(stderr, "[ERROR] Corrupted step2 record at offset %zu\n", reader->cur);
+        return false;
+    }
+    if(!reserve_recipients(reader, count)) return false;
+    for(uint32_t i = 0; i < count; ++i){
+        if(!decode_varint(reader->data, reader->size, &reader->cur, &reader->recipients[i]) ||
+           (reader->is_combined && !decode_varint(reader->data, reader->size, &reader->cur, &reader->occurrences[i]))){
+            fprintf(stderr, "[ERROR] Corrupted step2 record at offset %zu\n", reader->cur);
+            return false;
+        }
+    }
+    *recipients_count = count;
+    return true;
+}
+
+/*!
+ * @brief step2_reader_next reads the next record of a shard, which must not be combined
+ * @param reader the reader
+ * @param sender_id a pointer to the ID of the sender
+ * @param recipients a pointer to the IDs of the recipients (owned by the reader, valid until the next call)
+ * @param recipients_count a pointer to the count of recipients
+ * @return true if a record was read, false at the end of the shard or if it is corrupted
+ */
+bool step2_reader_next(step2_reader_t *reader, uint32_t *sender_id, uint32_t **recipients, uint32_t *recipients_count) {
+    uint32_t mails;
+    if(!read_step2_record(reader, sender_id, &mails, recipients_count)) return false;
+    if(reader->is_combined){
+        fprintf(stderr, "[ERROR] Combined step2 record at offset %zu\n", reader->cur);
+        return false;
+    }
+    *recipients = reader->recipients;
+    return true;
+}
+
+/*!
+ * @brief step2_reader_next_combined reads the next record of a shard, combined or not (a record that is not combined
+ * is one e-mail, each of its recipients occurring once)
+ * @param reader the reader
+ * @param sender_id a pointer to the ID of the sender
+ * @param mails a pointer to the count of e-mails of the sender
+ * @param recipients a pointer to the IDs of the recipients (owned by the reader, valid until the next call)
+ * @param occurrences a pointer to the occurrences of the recipients (owned by the reader, valid until the next call)
+ * @param recipients_count a pointer to the count of recipients
+ * @return true if a record was read, false at the end of the shard or if it is corrupted
+ */
+bool step2_reader_next_combined(step2_reader_t *reader, uint32_t *sender_id, uint32_t *mails, uint32_t **recipients,
+                                uint32_t **occurrences, uint32_t *recipients_count) {
+    if(!read_step2_record(reader, sender_id, mails, recipients_count)) return false;
+    if(reader->format == STEP2_FORMAT_BINARY && !reader->is_combined){
+        for(uint32_t i = 0; i < *recipients_count; ++i) reader->occurrences[i] = 1;
+    }
+    *recipients = reader->recipients;
+    *occurrences = reader->occurrences;
+    return true;
+}
+
+/*!
+ * @brief step2_reader_close unmaps a shard and frees the memory of its reader
+ * @param reader the reader
+ */
+void step2_reader_close(step2_reader_t *reader) {
+    if(reader->is_mapped) munmap((void *)reader->data, reader->size);
+    free(reader->recipients);
+    free(reader->occurrences);
+    memset(reader, 0, sizeof(step2_reader_t));
+}
@@ -0,0 +1,62 @@
+#ifndef A2022_STEP2_FORMAT_H
+#define A2022_STEP2_FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Binary step2 shards start with a header: the magic "LP2S", a version byte and 3 reserved bytes (zeros). It is
+ * followed by one record per e-mail: the sender ID, the count of recipients and the recipient IDs, all as varints
+ * (7 bits per byte, least significant first, the high bit set on all bytes but the last).
+ * Text shards (debug format) have no header, and one line per e-mail: "sender_id recipient_id ...".
+ *
+ * Shards of the workers combining their records (@see step2_combiner.h) have a header of version 2, and one record per
+ * sender instead: its ID, its count of e-mails and its count of recipients, then the ID and the occurrences of each
+ * recipient. As text, the counts follow the IDs: "sender_id*mails recipient_id*occurrences ...".
+ *
+ * Records are partitioned by the hash of their sender address: each worker writes one shard per partition, so that
+ * the partitions are reduced in parallel, each sender being found in a single partition.
+ */
+#define STEP2_MAGIC "LP2S"
+#define STEP2_MAGIC_SIZE 4
+#define STEP2_VERSION 1
+#define STEP2_COMBINED_VERSION 2
+#define STEP2_HEADER_SIZE 8
+#define VARINT_MAX_SIZE 5
+#define STEP2_PARTITIONS_COUNT 16
+
+typedef enum { STEP2_FORMAT_BINARY, STEP2_FORMAT_TEXT } step2_format_t;
+
+// Reads the records of a shard (in any format), mapped in memory
+typedef struct {
+    step2_format_t format;
+    const uint8_t *data;
+    size_t size;
+    size_t cur;
+    bool is_mapped;             // false when reading records of a buffer owned by the caller
+    bool is_combined;           // Records are combined (read with step2_reader_next_combined)
+    uint32_t *recipients;       // Recipients of the last record read
+    uint32_t *occurrences;      // Occurrences of the recipients of the last combined record
+    uint32_t recipients_capacity;
+} step2_reader_t;
+
+uint32_t step2_partition(const char *sender, size_t length);
+size_t encode_varint(uint32_t value, uint8_t *buffer);
+bool decode_varint(const uint8_t *buffer, size_t length, size_t *cur, uint32_t *value);
+
+bool write_step2_header(FILE *shard, bool is_combined);
+bool write_step2_record(FILE *shard, step2_format_t format, uint32_t sender_id, uint32_t *recipients,
+                        uint32_t recipients_count);
+bool write_step2_combined_record(FILE *shard, step2_format_t format, uint32_t sender_id, uint32_t mails,
+                                 uint32_t *recipients, uint32_t *occurrences, uint32_t recipients_count);
+
+bool step2_reader_open(step2_reader_t *reader, char *path);
+void step2_reader_open_buffer(step2_reader_t *reader, const uint8_t *data, size_t size);
+bool step2_reader_next(step2_reader_t *reader, uint32_t *sender_id, uint32_t **recipients, uint32_t *recipients_count);
+bool step2_reader_next_combined(step2_reader_t *reader, uint32_t *sender_id, uint32_t *mails, uint32_t **recipients,
+                                uint32_t **occurrences, uint32_t *recipients_count);
+void step2_reader_close(step2_reader_t *reader);
+
+#endif //A2022_STEP2_FORMAT_H
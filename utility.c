@@ -2,6 +2,9 @@
 // Created by flassabe on 26/10/22.
 //
 
+// For copy_file_range
+#define _GNU_SOURCE
+
 #include "utility.h"
 
 #include <string.h>
@@ -9,6 +12,9 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 
 #include <stdio.h> //Debug do not forget to remove
 
@@ -92,4 +98,87 @@ struct dirent *next_dir(struct dirent *entry, DIR *dir) {
         if(entry == NULL) return NULL;
     }while (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0);
     return entry;
-}
\ No newline at end of file
+}
+
+/*!
+ * @brief remove_files_with_prefix removes all files of a directory whose name starts with a prefix
+ * @param path the path to the directory
+ * @param prefix the prefix of the names of the files to remove
+ */
+void remove_files_with_prefix(char *path, char *prefix) {
+    DIR *dir = opendir(path);
+    if(dir == NULL){
+        fprintf(stderr, "[ERROR] Cannot open %s : %s\n", path, strerror(errno));
+        return;
+    }
+    size_t prefix_length = strlen(prefix);
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL){
+        if(strncmp(entry->d_name, prefix, prefix_length) != 0) continue;
+        if(unlinkat(dirfd(dir), entry->d_name, 0) == -1){
+            fprintf(stderr, "[ERROR] Cannot remove %s : %s\n", entry->d_name, strerror(errno));
+        }
+    }
+    closedir(dir);
+}
+
+/*!
+ * @brief is_copy_unsupported tells if a kernel copy failed because it is not supported for these files (the copy can
+ * then be done another way), rather than because of an I/O error
+ * @param error the errno of the copy
+ * @return true if the copy is not supported
+ */
+static bool is_copy_unsupported(int error) {
+    return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == EBADF;
+}
+
+/*!
+ * @brief copy_with_buffer copies bytes of a file to another one through a user-space buffer
+ * @param input_fd the file to copy, from its current offset
+ * @param output_fd the file to write to, at its current offset
+ * @param size the maximum number of bytes to copy
+ * @return the number of bytes copied (0 at the end of the input), -1 on error
+ */
+static ssize_t copy_with_buffer(int input_fd, int output_fd, size_t size) {
+    char buffer[FILE_COPY_BUFFER_SIZE];
+    ssize_t copied = read(input_fd, buffer, (size < sizeof(buffer)) ? size : sizeof(buffer));
+    for(ssize_t written = 0; copied > 0 && written < copied;){
+        ssize_t count = write(output_fd, buffer + written, copied - written);
+        if(count < 0 && errno != EINTR) return -1;
+        if(count > 0) written += count;
+    }
+    return copied;
+}
+
+/*!
+ * @brief append_file_contents appends the contents of a file to another one. The bytes are moved by the kernel with
+ * copy_file_range, falling back to sendfile, then to a user-space buffer if neither is supported for these files.
+ * @param input_fd the file to copy, from its current offset
+ * @param output_fd the file to append to, at its current offset
+ * @return true on success, false on error
+ */
+bool append_file_contents(int input_fd, int output_fd) {
+    struct stat input_stat;
+    if(fstat(input_fd, &input_stat) != 0) return false;
+    size_t remaining = input_stat.st_size;
+    bool is_range_copy = true;
+    bool is_sendfile = true;
+    while(remaining > 0){
+        ssize_t copied;
+        if(is_range_copy) copied = copy_file_range(input_fd, NULL, output_fd, NULL, remaining, 0);
+        else if(is_sendfile) copied = sendfile(output_fd, input_fd, NULL, remaining);
+        else copied = copy_with_buffer(input_fd, output_fd, remaining);
+        if(copied < 0){
+            if(errno == EINTR) continue;
+            // A call that is not supported copies nothing: the copy goes on the next way
+            if(is_range_copy && is_copy_unsupported(errno)) is_range_copy = false;
+            else if(!is_range_copy && is_sendfile && is_copy_unsupported(errno)) is_sendfile = false;
+            else return false;
+            continue;
+        }
+        // The file is shorter than when it was opened
+        if(copied == 0) break;
+        remaining -= copied;
+    }
+    return true;
+}
@@ -6,12 +6,19 @@
 #define A2022_UTILITY_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <dirent.h>
 
+// Buffer of the copies of files the kernel can not do by itself (@see append_file_contents)
+#define FILE_COPY_BUFFER_SIZE (64 * 1024)
+
 char *concat_path(char *prefix, char *suffix, char *full_path);
 bool directory_exists(char *path);
 bool path_to_file_exists(char *path);
 void sync_temporary_files(char *temp_dir);
 struct dirent *next_dir(struct dirent *entry, DIR *dir);
+void remove_files_with_prefix(char *path, char *prefix);
+bool append_file_contents(int input_fd, int output_fd);
 
 #endif //A2022_UTILITY_H